@@ -0,0 +1,336 @@
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <byteswap.h>
+#include <libgen.h>
+
+#include <libtwin/twin.h>
+#include <libtwin/twin_png.h>
+#include <libtwin/twin_jpeg.h>
+
+#include "artwork-bundle.h"
+
+/*
+ * Build the artwork bundle, at build time: decode each of the given
+ * images with libtwin, just as the GUI would, and write the pixels to a
+ * bundle that the GUI can map (see artwork-bundle.h).
+ *
+ * PNGs are stored as they are; X cursors (.gz) with their hotspot; JPEGs
+ * (the background) once for each screen size given with -r, scaled to
+ * fill it.
+ */
+
+#define MAX_IMAGES	64
+
+/* the cursor size that the GUI asks twin_load_X_cursor() for */
+#define CURSOR_SIZE	2
+
+struct image {
+	char		name[ARTWORK_BUNDLE_NAME_LEN];
+	twin_pixmap_t	*pixmap;
+	int		hot_x, hot_y;
+	uint32_t	offset;
+};
+
+static struct image images[MAX_IMAGES];
+static unsigned int n_images;
+
+static struct {
+	int	width, height;
+} sizes[MAX_IMAGES];
+static unsigned int n_sizes;
+
+static int swap;
+
+/* the largest bundle that we'll write, or 0 for no limit */
+static unsigned long max_size;
+
+static const char *suffix(const char *path)
+{
+	const char *dot = strrchr(path, '.');
+
+	return dot ? dot + 1 : "";
+}
+
+static struct image *new_image(const char *name)
+{
+	struct image *image;
+
+	if (n_images == MAX_IMAGES) {
+		fprintf(stderr, "too many images\n");
+		return NULL;
+	}
+
+	if (strlen(name) >= ARTWORK_BUNDLE_NAME_LEN) {
+		fprintf(stderr, "name too long: %s\n", name);
+		return NULL;
+	}
+
+	image = &images[n_images++];
+	strcpy(image->name, name);
+	return image;
+}
+
+/* scale @pic to @width x @height, as pboot_make_background() does */
+static twin_pixmap_t *scale(twin_pixmap_t *pic, int width, int height)
+{
+	twin_pixmap_t	*scaled;
+	twin_operand_t	srcop;
+	twin_fixed_t	sx, sy;
+
+	scaled = twin_pixmap_create(TWIN_ARGB32, width, height);
+	if (!scaled)
+		return NULL;
+
+	sx = twin_fixed_div(twin_int_to_fixed(pic->width),
+			twin_int_to_fixed(width));
+	sy = twin_fixed_div(twin_int_to_fixed(pic->height),
+			twin_int_to_fixed(height));
+
+	twin_matrix_scale(&pic->transform, sx, sy);
+	srcop.source_kind = TWIN_PIXMAP;
+	srcop.u.pixmap = pic;
+	twin_composite(scaled, 0, 0, &srcop, 0, 0, NULL, 0, 0, TWIN_SOURCE,
+			width, height);
+	twin_matrix_identity(&pic->transform);
+
+	return scaled;
+}
+
+static int add_file(const char *path)
+{
+	char *tmp, *base, name[ARTWORK_BUNDLE_NAME_LEN + 16];
+	const char *type = suffix(path);
+	twin_pixmap_t *pic;
+	struct image *image;
+	unsigned int i;
+	int rc = -1;
+
+	tmp = strdup(path);
+	if (!tmp)
+		return -1;
+	base = basename(tmp);
+
+	if (!strcmp(type, "png")) {
+		image = new_image(base);
+		if (!image)
+			goto out;
+		image->pixmap = twin_png_to_pixmap(path, TWIN_ARGB32);
+
+	} else if (!strcmp(type, "gz")) {
+		image = new_image(base);
+		if (!image)
+			goto out;
+		image->pixmap = twin_load_X_cursor(path, CURSOR_SIZE,
+				&image->hot_x, &image->hot_y);
+
+	} else if (!strcmp(type, "jpg")) {
+		pic = twin_jpeg_to_pixmap(path, TWIN_ARGB32);
+		if (!pic) {
+			fprintf(stderr, "can't load %s\n", path);
+			goto out;
+		}
+
+		for (i = 0; i < n_sizes; i++) {
+			snprintf(name, sizeof(name), "%s@%dx%d", base,
+					sizes[i].width, sizes[i].height);
+			image = new_image(name);
+			if (!image)
+				break;
+			image->pixmap = scale(pic, sizes[i].width,
+					sizes[i].height);
+			if (!image->pixmap) {
+				fprintf(stderr, "can't scale %s\n", path);
+				break;
+			}
+		}
+
+		twin_pixmap_destroy(pic);
+		rc = i == n_sizes ? 0 : -1;
+		goto out;
+
+	} else {
+		fprintf(stderr, "unknown image type: %s\n", path);
+		goto out;
+	}
+
+	if (!image->pixmap || image->pixmap->format != TWIN_ARGB32) {
+		fprintf(stderr, "can't load %s\n", path);
+		goto out;
+	}
+
+	rc = 0;
+out:
+	free(tmp);
+	return rc;
+}
+
+static uint32_t out32(uint32_t x)
+{
+	return swap ? bswap_32(x) : x;
+}
+
+static uint32_t align(uint32_t x)
+{
+	return (x + ARTWORK_BUNDLE_ALIGN - 1) & ~(ARTWORK_BUNDLE_ALIGN - 1);
+}
+
+static int write_bundle(const char *filename)
+{
+	static const char pad[ARTWORK_BUNDLE_ALIGN];
+	struct artwork_bundle_header hdr;
+	struct artwork_bundle_image ent;
+	uint32_t offset, *row;
+	twin_pixmap_t *pixmap;
+	unsigned int i;
+	int x, y, rc;
+	char *tmp;
+	FILE *fp;
+
+	/* the pixels follow the index, each image aligned */
+	offset = align(sizeof(hdr) + n_images * sizeof(ent));
+	for (i = 0; i < n_images; i++) {
+		pixmap = images[i].pixmap;
+		images[i].offset = offset;
+		offset = align(offset + pixmap->width * pixmap->height * 4);
+	}
+
+	if (max_size && offset > max_size) {
+		fprintf(stderr, "%s would be %u bytes, more than the maximum of "
+				"%lu: bundle fewer screen sizes\n",
+				filename, offset, max_size);
+		return -1;
+	}
+
+	if (asprintf(&tmp, "%s.tmp", filename) < 0)
+		return -1;
+
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		fprintf(stderr, "can't create %s\n", tmp);
+		free(tmp);
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, ARTWORK_BUNDLE_MAGIC, sizeof(ARTWORK_BUNDLE_MAGIC));
+	hdr.version = out32(ARTWORK_BUNDLE_VERSION);
+	hdr.byte_order = out32(ARTWORK_BUNDLE_BYTE_ORDER);
+	hdr.size = out32(offset);
+	hdr.n_images = out32(n_images);
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+
+	for (i = 0; i < n_images; i++) {
+		pixmap = images[i].pixmap;
+
+		memset(&ent, 0, sizeof(ent));
+		strcpy(ent.name, images[i].name);
+		ent.width = out32(pixmap->width);
+		ent.height = out32(pixmap->height);
+		ent.offset = out32(images[i].offset);
+		ent.hot_x = out32(images[i].hot_x);
+		ent.hot_y = out32(images[i].hot_y);
+		fwrite(&ent, sizeof(ent), 1, fp);
+	}
+
+	for (i = 0; i < n_images; i++) {
+		pixmap = images[i].pixmap;
+
+		fwrite(pad, 1, images[i].offset - ftell(fp), fp);
+
+		/* the pixmaps are ours, so swap them in place */
+		for (y = 0; y < pixmap->height; y++) {
+			row = (uint32_t *)(pixmap->p.a8 + y * pixmap->stride);
+			for (x = 0; swap && x < pixmap->width; x++)
+				row[x] = bswap_32(row[x]);
+			fwrite(row, 4, pixmap->width, fp);
+		}
+	}
+
+	fwrite(pad, 1, offset - ftell(fp), fp);
+
+	rc = ferror(fp);
+	if (fclose(fp) || rc || rename(tmp, filename)) {
+		fprintf(stderr, "can't write %s\n", filename);
+		unlink(tmp);
+		rc = -1;
+	}
+
+	free(tmp);
+	return rc;
+}
+
+static void usage(const char *progname)
+{
+	fprintf(stderr, "usage: %s [-e big|little] [-m <bytes>] "
+			"[-r <width>x<height>]... -o <output> <image>...\n"
+			"Decode the images into an artwork bundle\n"
+			"  -e  write the bundle for a machine of this byte order "
+			"(by default, this one's)\n"
+			"  -m  fail if the bundle would be larger than this\n"
+			"  -r  scale JPEGs to this screen size\n",
+			progname);
+}
+
+int main(int argc, char **argv)
+{
+	const union { uint32_t i; char c; } native = { 1 };
+	char *output = NULL;
+	unsigned int i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "e:m:r:o:")) != -1) {
+		switch (opt) {
+		case 'e':
+			if (!strcmp(optarg, "big"))
+				swap = native.c == 1;
+			else if (!strcmp(optarg, "little"))
+				swap = native.c != 1;
+			else {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'm':
+			max_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			if (n_sizes == MAX_IMAGES ||
+					sscanf(optarg, "%dx%d",
+						&sizes[n_sizes].width,
+						&sizes[n_sizes].height) != 2 ||
+					sizes[n_sizes].width <= 0 ||
+					sizes[n_sizes].height <= 0) {
+				fprintf(stderr, "invalid size: %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			n_sizes++;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!output || optind == argc) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	for (i = optind; i < argc; i++)
+		if (add_file(argv[i]))
+			return EXIT_FAILURE;
+
+	if (write_bundle(output))
+		return EXIT_FAILURE;
+
+	printf("%s: %u images\n", output, n_images);
+	return EXIT_SUCCESS;
+}
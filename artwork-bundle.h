@@ -0,0 +1,48 @@
+#ifndef _ARTWORK_BUNDLE_H
+#define _ARTWORK_BUNDLE_H
+
+#include <stdint.h>
+
+/*
+ * The artwork bundle: the default artwork, decoded at build time into
+ * ARGB32 images that the GUI draws straight from a read-only mapping of
+ * the file, so that it needs no image decoding to start up.
+ *
+ * The file is a header, then an index of images, then the pixel data of
+ * each image, every row packed (so the stride is width * 4), starting at
+ * a multiple of ARTWORK_BUNDLE_ALIGN. All fields and pixels are in the
+ * byte order of the machine that uses the bundle; byte_order is
+ * ARTWORK_BUNDLE_BYTE_ORDER in that order, so a bundle for a different
+ * machine can be recognised and ignored.
+ *
+ * Images are named after the file that they were decoded from. The
+ * background is stored at each of a set of screen sizes, pre-scaled, as
+ * "<file>@<width>x<height>".
+ */
+
+#define ARTWORK_BUNDLE_MAGIC		"pbart\n"
+#define ARTWORK_BUNDLE_VERSION		1
+#define ARTWORK_BUNDLE_BYTE_ORDER	0x01020304
+#define ARTWORK_BUNDLE_ALIGN		64
+
+#define ARTWORK_BUNDLE_FILE		"artwork.bin"
+#define ARTWORK_BUNDLE_NAME_LEN		32
+
+struct artwork_bundle_header {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	byte_order;
+	uint32_t	size;		/* of the whole file */
+	uint32_t	n_images;
+};
+
+struct artwork_bundle_image {
+	char		name[ARTWORK_BUNDLE_NAME_LEN];	/* nul-terminated */
+	uint32_t	width;
+	uint32_t	height;
+	uint32_t	offset;		/* of the pixels, from the file start */
+	int32_t		hot_x;		/* the hotspot, for a cursor */
+	int32_t		hot_y;
+};
+
+#endif /* _ARTWORK_BUNDLE_H */
@@ -0,0 +1,127 @@
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "petitboot.h"
+#include "petitboot-paths.h"
+#include "artwork.h"
+#include "artwork-bundle.h"
+
+static const struct artwork_bundle_header *bundle;
+
+static int check_bundle(const struct artwork_bundle_header *hdr, off_t size)
+{
+	const struct artwork_bundle_image *images;
+	uint64_t end;
+	uint32_t i;
+
+	if (size < sizeof(*hdr) ||
+			memcmp(hdr->magic, ARTWORK_BUNDLE_MAGIC,
+				sizeof(ARTWORK_BUNDLE_MAGIC)) ||
+			hdr->version != ARTWORK_BUNDLE_VERSION)
+		return -1;
+
+	/* built for a machine of the other byte order */
+	if (hdr->byte_order != ARTWORK_BUNDLE_BYTE_ORDER)
+		return -1;
+
+	if (hdr->size != size || hdr->n_images >
+			(size - sizeof(*hdr)) / sizeof(*images))
+		return -1;
+
+	images = (const void *)(hdr + 1);
+
+	for (i = 0; i < hdr->n_images; i++) {
+		const struct artwork_bundle_image *image = &images[i];
+
+		if (!memchr(image->name, '\0', sizeof(image->name)) ||
+				image->offset % ARTWORK_BUNDLE_ALIGN ||
+				image->width > INT16_MAX ||
+				image->height > INT16_MAX)
+			return -1;
+
+		end = (uint64_t)image->offset +
+			(uint64_t)image->width * image->height * 4;
+		if (end > size)
+			return -1;
+	}
+
+	return 0;
+}
+
+int artwork_load(void)
+{
+	const char *path = artwork_pathname(ARTWORK_BUNDLE_FILE);
+	struct stat statbuf;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		LOG("no artwork bundle %s\n", path);
+		return -1;
+	}
+
+	if (fstat(fd, &statbuf) || statbuf.st_size < sizeof(*bundle)) {
+		LOG("invalid artwork bundle %s\n", path);
+		close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		LOG("can't map artwork bundle %s: %s\n", path,
+				strerror(errno));
+		return -1;
+	}
+
+	if (check_bundle(map, statbuf.st_size)) {
+		LOG("invalid artwork bundle %s\n", path);
+		munmap(map, statbuf.st_size);
+		return -1;
+	}
+
+	bundle = map;
+	LOG("loaded artwork bundle %s: %u images\n", path, bundle->n_images);
+	return 0;
+}
+
+twin_pixmap_t *artwork_get(const char *name, int *hot_x, int *hot_y)
+{
+	const struct artwork_bundle_image *images;
+	twin_pointer_t pixels;
+	uint32_t i;
+
+	if (!bundle)
+		return NULL;
+
+	images = (const void *)(bundle + 1);
+
+	for (i = 0; i < bundle->n_images; i++) {
+		if (strcmp(images[i].name, name))
+			continue;
+
+		if (hot_x && hot_y) {
+			*hot_x = images[i].hot_x;
+			*hot_y = images[i].hot_y;
+		}
+
+		/* the mapping is never unmapped, so the pixmap can point
+		 * straight into it */
+		pixels.v = (char *)bundle + images[i].offset;
+		return twin_pixmap_create_const(TWIN_ARGB32, images[i].width,
+				images[i].height, images[i].width * 4, pixels);
+	}
+
+	return NULL;
+}
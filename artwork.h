@@ -0,0 +1,26 @@
+#ifndef _ARTWORK_H
+#define _ARTWORK_H
+
+#include <libtwin/twin.h>
+
+/*
+ * The default artwork, from the bundle that is built at install time (see
+ * artwork-bundle.h). The bundle is mapped once, and its images are drawn
+ * straight from the mapping, so they need no decoding; if there is no
+ * bundle, or it doesn't have an image, callers decode the image file as
+ * before.
+ */
+
+/**
+ * Map the bundle, if there is a usable one. Returns 0 on success.
+ */
+int artwork_load(void);
+
+/**
+ * Get a pixmap of the bundled image @name, and its hotspot if @hot_x and
+ * @hot_y aren't NULL, or NULL if it isn't in the bundle. The pixmap is
+ * read-only, and must be freed with twin_pixmap_destroy().
+ */
+twin_pixmap_t *artwork_get(const char *name, int *hot_x, int *hot_y);
+
+#endif /* _ARTWORK_H */
@@ -2,274 +2,631 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <sys/socket.h>
 #include <sys/un.h>
-#include <asm/byteorder.h>
 
-#include <libtwin/twin_png.h>
 #include "petitboot.h"
 #include "petitboot-paths.h"
+#include "icon-cache.h"
 #include "devices/message.h"
+#include "devices/shm-table.h"
 
 #define PBOOT_DEFAULT_ICON	"tux.png"
 
-static const char *default_icon = artwork_pathname(PBOOT_DEFAULT_ICON);
+/* how long to wait between attempts to reconnect to the discovery daemon,
+ * in ms */
+#define PBOOT_RECONNECT_DELAY	2000
 
-struct discovery_context {
-	/* nothing at present */
-	int pad;
-} _ctx;
+static const char *default_icon = artwork_pathname(PBOOT_DEFAULT_ICON);
 
 struct device_context {
-	struct discovery_context *discovery_ctx;
-	uint8_t action;
 	int device_idx;
 };
 
-static twin_pixmap_t *get_icon(const char *filename)
+static struct device_context _ctx = {
+	.device_idx = -1,
+};
+
+/* whether we subscribe to the shared device table */
+static int _use_shm;
+
+/* the shared device table, if the daemon has given us one. Options read
+ * from the table point into the mapping, rather than owning their strings */
+static struct {
+	const struct shm_table_header *hdr;
+	uint32_t pos;
+	uint32_t generation;
+	struct device_context ctx;
+
+	/* while reading a new region: the ids of the devices in it, which
+	 * point into the region, or NULL if we couldn't keep them */
+	const char **seen;
+	unsigned int n_seen;
+} _shm = {
+	.ctx = { .device_idx = -1 },
+};
+
+/* the data of every option that we give to the GUI: the option, and the
+ * shared table region that its strings point into, or NULL if it was read
+ * from the socket and owns them */
+struct gui_option {
+	struct boot_option opt;
+	const struct shm_table_header *region;
+};
+
+void pb_log(const char *fmt, ...)
 {
-	/* todo: cache */
-	twin_pixmap_t *icon;
+	va_list ap;
 
-	if (!filename)
-		filename = default_icon;
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+}
 
-retry:
-	LOG("loading icon %s ... ", filename);
-	icon = twin_png_to_pixmap(filename, TWIN_ARGB32);
-	LOG("%s\n", icon ? "ok" : "failed");
+/* get a reference to an icon, or to the default icon if the file isn't
+ * there. The reference must be dropped with icon_cache_put() */
+static struct icon *get_icon(const char *filename)
+{
+	struct icon *icon = NULL;
 
-	if (!icon && filename != default_icon) {
-		filename = default_icon;
-		LOG("reverting to default icon %s\n", filename);
-		goto retry;
+	if (filename)
+		icon = icon_cache_get(filename);
+
+	if (!icon) {
+		if (filename)
+			LOG("reverting to default icon for %s\n", filename);
+		icon = icon_cache_get(default_icon);
 	}
 
 	return icon;
 }
 
-#define MAX_LEN 4096
-static char *read_string(int fd)
+/* take an option read from the socket, which owns its strings */
+static struct boot_option *socket_option(struct boot_option *opt)
 {
-	int len;
-	uint32_t len_buf;
-	char *str, *pos;
+	struct gui_option *gopt;
 
-	if (read(fd, &len_buf, sizeof(len_buf)) != sizeof(len_buf)) {
-		perror("read");
+	gopt = malloc(sizeof(*gopt));
+	if (!gopt) {
+		free_boot_option(opt);
 		return NULL;
 	}
 
-	len = __be32_to_cpu(len_buf);
-	if (len + 1 > MAX_LEN) {
-		/* todo: truncate instead */
-		return NULL;
+	gopt->opt = *opt;
+	gopt->region = NULL;
+	free(opt);
+
+	return &gopt->opt;
+}
+
+static void put_boot_option(struct boot_option *opt)
+{
+	struct gui_option *gopt = (struct gui_option *)opt;
+
+	if (gopt->region)
+		free(gopt);
+	else
+		free_boot_option(&gopt->opt);
+}
+
+static int handle_device(struct device_context *dev_ctx,
+		const struct device *dev)
+{
+	struct icon *icon;
+	int index;
+
+	LOG("got device: '%s'\n", dev->name);
+
+	/* if we already have this device, any following option messages
+	 * are changes to it */
+	index = pboot_find_device(dev->id);
+	if (index == -1) {
+		icon = get_icon(dev->icon_file);
+		index = pboot_add_device(dev->id, dev->name, icon);
+		if (index == -1)
+			icon_cache_put(icon);
+		icon_cache_log_stats();
 	}
 
-	pos = str = malloc(len + 1);
+	dev_ctx->device_idx = index;
 
-	while (len) {
-		int rc = read(fd, pos, len);
-		if (rc <= 0) {
-			free(str);
-			LOG("read failed: %s\n", strerror(errno));
-			return NULL;
-		}
-		pos += rc;
-		len -= rc;
+	return index != -1;
+}
+
+/* what to show in place of a broken option's description */
+static const char *option_problem(const struct boot_option *opt)
+{
+	if (opt->flags & BOOT_OPTION_IMAGE_MISSING)
+		return "kernel image not found";
+	if (opt->flags & BOOT_OPTION_INITRD_MISSING)
+		return "initrd not found";
+	return opt->description;
+}
+
+/* Add a new option, or update the option with the same id. This takes
+ * ownership of @opt. */
+static int handle_option(struct device_context *dev_ctx,
+		struct boot_option *opt)
+{
+	struct icon *icon;
+	int index, broken;
+
+	if (dev_ctx->device_idx == -1) {
+		LOG("option, but no device has been sent?\n");
+		put_boot_option(opt);
+		return TWIN_FALSE;
+	}
+
+	LOG("got option: '%s'\n", opt->name);
+
+	/* discovery has already found which files are missing, so there's
+	 * no need to try opening an icon that isn't there. The icon is
+	 * loaded in the background; until then, the option is drawn with
+	 * the placeholder */
+	icon = get_icon(opt->flags & BOOT_OPTION_ICON_MISSING ?
+			NULL : opt->icon_file);
+
+	broken = (opt->flags & BOOT_OPTION_BROKEN) != 0;
+
+	index = pboot_find_option(dev_ctx->device_idx, opt->id);
+	if (index != -1) {
+		opt = pboot_update_option(dev_ctx->device_idx, index,
+					  opt->name, option_problem(opt),
+					  icon, broken, opt);
+		if (opt)
+			put_boot_option(opt);
+		return TWIN_TRUE;
+	}
+
+	index = pboot_add_option(dev_ctx->device_idx, opt->id,
+				 opt->name, option_problem(opt),
+				 icon, broken, opt);
+	if (index == -1) {
+		icon_cache_put(icon);
+		put_boot_option(opt);
+	}
+
+	return index != -1;
+}
+
+static int handle_remove_option(struct device_context *dev_ctx,
+		const char *opt_id)
+{
+	int index;
+
+	if (dev_ctx->device_idx == -1) {
+		LOG("option, but no device has been sent?\n");
+		return TWIN_FALSE;
 	}
-	*pos = '\0';
 
-	return str;
+	LOG("remove option %s\n", opt_id);
+
+	index = pboot_find_option(dev_ctx->device_idx, opt_id);
+	if (index != -1)
+		put_boot_option(pboot_remove_option(dev_ctx->device_idx,
+						    index));
+
+	return TWIN_TRUE;
+}
+
+static int handle_remove_device(struct device_context *dev_ctx,
+		const char *dev_id)
+{
+	int i, j;
+
+	LOG("remove device %s\n", dev_id);
+
+	/* take the options' data back before the device goes */
+	i = pboot_find_device(dev_id);
+	if (i != -1) {
+		for (j = pboot_option_count(i) - 1; j >= 0; j--)
+			put_boot_option(pboot_remove_option(i, j));
+		pboot_remove_device(dev_id);
+	}
+
+	/* device indices may have changed; a device will be re-sent before
+	 * any more option messages */
+	dev_ctx->device_idx = -1;
+
+	return TWIN_TRUE;
 }
 
-static int _read_strings(int fd, void *ptr, int n_strings)
+/* process any records that have been published since we last looked */
+static int read_shm_records(void)
 {
-	char **strings = ptr;
-	int i, ret = TWIN_TRUE;
+	struct msg_reader r;
+	struct device dev;
+	struct gui_option *opt;
+	enum device_action action;
+	const char **seen;
+	const char *id;
+	int rc;
+
+	r.data = shm_table_records(_shm.hdr);
+	r.len = shm_table_len(_shm.hdr);
+	r.pos = _shm.pos;
+
+	while (r.pos < r.len) {
+		if (msg_reader_action(&r, &action))
+			goto out_err;
 
-	for (i = 0; i < n_strings; i++) {
-		strings[i] = read_string(fd);
-		if (!strings[i]) {
-			ret = TWIN_FALSE;
+		switch (action) {
+		case DEV_ACTION_ADD_DEVICE:
+			rc = !msg_reader_device(&r, &dev) &&
+				handle_device(&_shm.ctx, &dev);
+			if (rc && _shm.seen) {
+				seen = realloc(_shm.seen, (_shm.n_seen + 1) *
+						sizeof(*seen));
+				if (seen)
+					seen[_shm.n_seen++] = dev.id;
+				else
+					free(_shm.seen);
+				_shm.seen = seen;
+			}
+			break;
+		case DEV_ACTION_ADD_OPTION:
+		case DEV_ACTION_UPDATE_OPTION:
+			opt = malloc(sizeof(*opt));
+			if (!opt)
+				goto out_err;
+			if (msg_reader_boot_option(&r, &opt->opt)) {
+				free(opt);
+				goto out_err;
+			}
+			opt->region = _shm.hdr;
+			rc = handle_option(&_shm.ctx, &opt->opt);
+			break;
+		case DEV_ACTION_REMOVE_OPTION:
+			id = msg_reader_string(&r);
+			rc = id && handle_remove_option(&_shm.ctx, id);
 			break;
+		case DEV_ACTION_REMOVE_DEVICE:
+			id = msg_reader_string(&r);
+			rc = id && handle_remove_device(&_shm.ctx, id);
+			break;
+		default:
+			LOG("unsupported action %d in shared table\n", action);
+			goto out_err;
 		}
+
+		if (!rc)
+			goto out_err;
+
+		_shm.pos = r.pos;
 	}
 
-	if (!ret)
-		while (i-- > 0) {
-			free(strings[i]);
-			strings[i] = NULL;
-		}
+	return TWIN_TRUE;
 
-	return ret;
+out_err:
+	LOG("invalid record in shared table\n");
+	return TWIN_FALSE;
 }
 
-static void _free_strings(void *ptr, int n_strings)
+static int shm_device_seen(const char *dev_id)
 {
-	char **strings = ptr;
-	int i;
+	unsigned int i;
 
-	for (i = 0; i < n_strings; i++)
-		free(strings[i]);
+	for (i = 0; i < _shm.n_seen; i++)
+		if (!strcmp(_shm.seen[i], dev_id))
+			return 1;
 
+	return 0;
 }
 
-#define n_strings(x) (sizeof((x)) / sizeof(char *))
-#define read_strings(f,x) _read_strings((f), &(x), n_strings(x))
-#define free_strings(x) _free_strings(&(x), n_strings(x))
-
-static int read_action(int fd, uint8_t *action)
+/*
+ * Once a new region has been read, drop every device and option that it
+ * doesn't have, which the daemon removed while we weren't reading the old
+ * region. Every option that it does have has been replaced with the one in
+ * the new region, so whatever still points into @old is gone. For the
+ * first region, @old is NULL, and that goes for the options that we read
+ * from the socket before it.
+ */
+static void sweep_shm_region(const struct shm_table_header *old)
 {
-	return read(fd, action, sizeof(*action)) != sizeof(*action);
+	const char *cur_id = NULL;
+	struct gui_option *opt;
+	const char *dev_id;
+	int i, j, keep;
+
+	if (_shm.ctx.device_idx != -1 && _shm.n_seen)
+		cur_id = _shm.seen[_shm.n_seen - 1];
+
+	for (i = pboot_device_count() - 1; i >= 0; i--) {
+		dev_id = pboot_device_id(i);
+
+		/* without the list of devices, we can only go by options */
+		keep = !_shm.seen || shm_device_seen(dev_id);
+
+		for (j = pboot_option_count(i) - 1; j >= 0; j--) {
+			opt = pboot_option_data(i, j);
+			if (!keep || opt->region == old)
+				put_boot_option(pboot_remove_option(i, j));
+		}
+
+		if (!keep || (!_shm.seen && !pboot_option_count(i))) {
+			LOG("device %s has gone\n", dev_id);
+			pboot_remove_device(dev_id);
+		}
+	}
+
+	/* records that follow may be for the last device, without sending
+	 * it again, and its index may have changed */
+	_shm.ctx.device_idx = cur_id ? pboot_find_device(cur_id) : -1;
 }
 
-static int read_device(int fd, struct device_context *dev_ctx)
+/* Start reading from a new region. The new region has the full table, so
+ * once we've read it and dropped whatever it doesn't have, nothing refers
+ * to the old one. */
+static int read_shm_region(int fd)
 {
-	/* name, description, icon_file */
-	struct device dev;
-	twin_pixmap_t *icon;
-	int index = -1;
+	const struct shm_table_header *old = _shm.hdr;
+	int rc;
+
+	_shm.hdr = shm_table_map(fd);
+	close(fd);
 
-	if (!read_strings(fd, dev))
+	if (!_shm.hdr) {
+		_shm.hdr = old;
 		return TWIN_FALSE;
+	}
 
-	LOG("got device: '%s'\n", dev.name);
+	LOG("using shared device table\n");
 
-	icon = get_icon(dev.icon_file);
+	_shm.pos = 0;
+	_shm.generation = 0;
+	_shm.ctx.device_idx = -1;
+	_shm.seen = malloc(sizeof(*_shm.seen));
+	_shm.n_seen = 0;
 
-	if (!icon)
-		goto out;
+	rc = read_shm_records();
 
-	index = dev_ctx->device_idx = pboot_add_device(dev.id, dev.name, icon);
+	sweep_shm_region(old);
+	if (old)
+		shm_table_unmap(old);
 
-out:
-	free_strings(dev);
+	free(_shm.seen);
+	_shm.seen = NULL;
+	_shm.n_seen = 0;
 
-	return index != -1;
+	return rc;
 }
 
-static int read_option(int fd, struct device_context *dev_ctx)
+static int read_shm_generation(int fd)
 {
-	struct boot_option *opt = malloc(sizeof(*opt));
-	twin_pixmap_t *icon;
-	int index = -1;
+	uint32_t generation;
 
-	if (!opt)
+	if (read_u32(fd, &generation) || !_shm.hdr)
 		return TWIN_FALSE;
 
-	if (!read_strings(fd, (*opt)))
-		return TWIN_FALSE;
+	if (generation == _shm.generation)
+		return TWIN_TRUE;
 
-	LOG("got option: '%s'\n", opt->name);
-	icon = get_icon(opt->icon_file);
-
-	if (icon)
-		index = pboot_add_option(dev_ctx->device_idx, opt->name,
-					 opt->description, icon, opt);
-
-	return index != -1;
+	_shm.generation = generation;
+	return read_shm_records();
 }
 
+static twin_time_t pboot_reconnect(twin_time_t now, void *closure);
+
 static twin_bool_t pboot_proc_client_sock(int sock, twin_file_op_t ops,
 		void *closure)
 {
 	struct device_context *dev_ctx = closure;
-	uint8_t action;
+	enum device_action action;
+	struct boot_option *opt;
+	struct device *dev;
+	char *id;
+	int rc, fd;
 
-	if (read_action(sock, &action))
+	if (read_action_fd(sock, &action, &fd))
 		goto out_err;
 
-	if (action == DEV_ACTION_ADD_DEVICE) {
-		if (!read_device(sock, dev_ctx))
-			goto out_err;
+	if (fd >= 0 && action != DEV_ACTION_SHM_REGION)
+		close(fd);
 
-	} else if (action == DEV_ACTION_ADD_OPTION) {
-		if (dev_ctx->device_idx == -1) {
-			LOG("option, but no device has been sent?\n");
+	switch (action) {
+	case DEV_ACTION_ADD_DEVICE:
+		dev = read_device(sock);
+		if (!dev)
 			goto out_err;
-		}
-
-		if (!read_option(sock, dev_ctx))
+		rc = handle_device(dev_ctx, dev);
+		free_device(dev);
+		break;
+
+	case DEV_ACTION_ADD_OPTION:
+	case DEV_ACTION_UPDATE_OPTION:
+		opt = read_boot_option(sock);
+		if (opt)
+			opt = socket_option(opt);
+		if (!opt)
 			goto out_err;
+		rc = handle_option(dev_ctx, opt);
+		break;
 
-	} else if (action == DEV_ACTION_REMOVE_DEVICE) {
-		char *dev_id = read_string(sock);
-		if (!dev_id)
+	case DEV_ACTION_REMOVE_OPTION:
+	case DEV_ACTION_REMOVE_DEVICE:
+		id = read_string(sock);
+		if (!id)
 			goto out_err;
-		
-		LOG("remove device %s\n", dev_id);
-		pboot_remove_device(dev_id);
+		if (action == DEV_ACTION_REMOVE_OPTION)
+			rc = handle_remove_option(dev_ctx, id);
+		else
+			rc = handle_remove_device(dev_ctx, id);
+		free(id);
+		break;
+
+	case DEV_ACTION_SHM_REGION:
+		if (fd < 0)
+			goto out_err;
+		rc = read_shm_region(fd);
+		break;
+
+	case DEV_ACTION_SHM_GENERATION:
+		rc = read_shm_generation(sock);
+		break;
 
-	} else {
+	default:
 		LOG("unsupported action %d\n", action);
 		goto out_err;
 	}
 
+	if (!rc)
+		goto out_err;
+
 	return TWIN_TRUE;
 
 out_err:
+	/* returning false removes the fd from twin's list. The daemon may
+	 * have restarted, or dropped us for not keeping up, so we keep
+	 * trying to get back */
+	LOG("lost connection to the discovery daemon\n");
 	close(sock);
+	dev_ctx->device_idx = -1;
+	twin_set_timeout(pboot_reconnect, PBOOT_RECONNECT_DELAY, NULL);
 	return TWIN_FALSE;
 }
 
-static twin_bool_t pboot_proc_server_sock(int sock, twin_file_op_t ops,
-		void *closure)
+static int connect_discovery_daemon(void)
 {
-	int fd;
-	struct discovery_context *disc_ctx = closure;
-	struct device_context *dev_ctx;
+	struct sockaddr_un addr;
+	int sock;
 
-	fd = accept(sock, NULL, 0);
-	if (fd < 0) {
-		LOG("accept failed: %s", strerror(errno));
-		return TWIN_FALSE;
+	sock = socket(PF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0) {
+		perror("socket");
+		return -1;
 	}
 
-	dev_ctx = malloc(sizeof(*dev_ctx));
-	dev_ctx->discovery_ctx = disc_ctx;
-	dev_ctx->device_idx = -1;
-	dev_ctx->action = 0xff;
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, PBOOT_DEVICE_SOCKET);
 
-	twin_set_file(pboot_proc_client_sock, fd, TWIN_READ, dev_ctx);
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+		close(sock);
+		return -1;
+	}
 
-	return TWIN_TRUE;
+	return sock;
 }
 
-int pboot_start_device_discovery(int udev_trigger)
+/* The daemon forks once its socket is ready, so we can connect as soon
+ * as the first process exits */
+static int start_discovery_daemon(void)
 {
-	int sock;
-	struct sockaddr_un addr;
+	int status;
+	pid_t pid;
 
-	unlink(PBOOT_DEVICE_SOCKET);
+	LOG("starting %s\n", PBOOT_DISCOVER_BIN);
 
-	sock = socket(PF_UNIX, SOCK_STREAM, 0);
-	if (sock < 0) {
-		perror("socket");
-		return TWIN_FALSE;
+	pid = fork();
+	if (pid == -1) {
+		LOG("fork failed: %s\n", strerror(errno));
+		return -1;
 	}
 
-	addr.sun_family = AF_UNIX;
-	strcpy(addr.sun_path, PBOOT_DEVICE_SOCKET);
+	if (pid == 0) {
+		execl(PBOOT_DISCOVER_BIN, PBOOT_DISCOVER_BIN, NULL);
+		exit(EXIT_FAILURE);
+	}
 
-	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr))) {
-		LOG("can't bind to %s: %s", addr.sun_path, strerror(errno));
-		return TWIN_FALSE;
+	if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) ||
+			WEXITSTATUS(status)) {
+		LOG("%s failed to start\n", PBOOT_DISCOVER_BIN);
+		return -1;
 	}
 
-	if (listen(sock, 1)) {
-		LOG("can't listen on socket %s: %s",
-				addr.sun_path, strerror(errno));
-		return TWIN_FALSE;
+	return 0;
+}
+
+/* the daemon replies with everything it has found so far, then any
+ * changes as they happen */
+static int subscribe(int sock)
+{
+	if (write_action(sock, _use_shm ? DEV_ACTION_SUBSCRIBE_SHM :
+				DEV_ACTION_SUBSCRIBE))
+		return -1;
+
+	LOG("subscribed to %s\n", PBOOT_DEVICE_SOCKET);
+
+	twin_set_file(pboot_proc_client_sock, sock, TWIN_READ, &_ctx);
+	return 0;
+}
+
+/* Forget every device, and the shared table, before subscribing again:
+ * the daemon will send us the whole table, without whatever was removed
+ * while we weren't connected */
+static void drop_devices(void)
+{
+	int i, j;
+
+	for (i = pboot_device_count() - 1; i >= 0; i--) {
+		for (j = pboot_option_count(i) - 1; j >= 0; j--)
+			put_boot_option(pboot_remove_option(i, j));
+		pboot_remove_device(pboot_device_id(i));
+	}
+
+	if (_shm.hdr)
+		shm_table_unmap(_shm.hdr);
+
+	_shm.hdr = NULL;
+	_shm.pos = 0;
+	_shm.generation = 0;
+	_shm.ctx.device_idx = -1;
+	_ctx.device_idx = -1;
+}
+
+static twin_time_t pboot_reconnect(twin_time_t now, void *closure)
+{
+	int sock;
+
+	sock = connect_discovery_daemon();
+	if (sock < 0 && !start_discovery_daemon())
+		sock = connect_discovery_daemon();
+	if (sock < 0)
+		return PBOOT_RECONNECT_DELAY;
+
+	LOG("reconnected to the discovery daemon\n");
+	drop_devices();
+
+	if (subscribe(sock)) {
+		close(sock);
+		return PBOOT_RECONNECT_DELAY;
 	}
 
-	LOG("listening on %s\n", addr.sun_path);
+	return -1;
+}
 
-	twin_set_file(pboot_proc_server_sock, sock, TWIN_READ, &_ctx);
+int pboot_start_device_discovery(int udev_trigger, int use_shm)
+{
+	int sock, started = 0;
+
+	icon_cache_init(default_icon, pboot_icon_ready);
+	_use_shm = use_shm;
+
+	sock = connect_discovery_daemon();
+	if (sock < 0) {
+		if (start_discovery_daemon())
+			return TWIN_FALSE;
+		started = 1;
+
+		sock = connect_discovery_daemon();
+		if (sock < 0) {
+			LOG("can't connect to %s: %s\n",
+					PBOOT_DEVICE_SOCKET, strerror(errno));
+			return TWIN_FALSE;
+		}
+	}
+
+	if (subscribe(sock)) {
+		close(sock);
+		return TWIN_FALSE;
+	}
 
-	if (udev_trigger) {
+	/* if the daemon was already running, the devices have already been
+	 * probed */
+	if (udev_trigger && started) {
 		int rc = system("udevtrigger");
 		if (rc)
 			LOG("udevtrigger failed, rc %d\n", rc);
@@ -0,0 +1,98 @@
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/* most parses fit in one chunk this size */
+#define ARENA_CHUNK_SIZE	4096
+#define ARENA_ALIGN		(sizeof(long double))
+
+struct arena_chunk {
+	struct arena_chunk	*next;
+	size_t			size;
+	size_t			used;
+	long double		data[];
+};
+
+void arena_init(struct arena *arena)
+{
+	memset(arena, 0, sizeof(*arena));
+}
+
+/* Large allocations get a chunk of their own, which goes behind the
+ * current chunk, so that the space left in that isn't wasted */
+static struct arena_chunk *arena_new_chunk(struct arena *arena, size_t size)
+{
+	struct arena_chunk *chunk, **link = &arena->chunks;
+
+	if (size > ARENA_CHUNK_SIZE / 4 && arena->chunks)
+		link = &arena->chunks->next;
+	else if (size < ARENA_CHUNK_SIZE)
+		size = ARENA_CHUNK_SIZE;
+
+	chunk = malloc(sizeof(*chunk) + size);
+	if (!chunk)
+		return NULL;
+
+	chunk->size = size;
+	chunk->used = 0;
+	chunk->next = *link;
+	*link = chunk;
+	arena->n_chunks++;
+
+	return chunk;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	struct arena_chunk *chunk = arena->chunks;
+	void *ptr;
+
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	if (!chunk || chunk->size - chunk->used < size) {
+		chunk = arena_new_chunk(arena, size);
+		if (!chunk)
+			return NULL;
+	}
+
+	ptr = (char *)chunk->data + chunk->used;
+	chunk->used += size;
+
+	arena->allocs++;
+	arena->bytes += size;
+
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+char *arena_strndup(struct arena *arena, const char *str, size_t len)
+{
+	char *ret;
+
+	if (!str)
+		return NULL;
+
+	ret = arena_alloc(arena, len + 1);
+	if (ret)
+		memcpy(ret, str, len);
+	return ret;
+}
+
+char *arena_strdup(struct arena *arena, const char *str)
+{
+	return str ? arena_strndup(arena, str, strlen(str)) : NULL;
+}
+
+void arena_release(struct arena *arena)
+{
+	struct arena_chunk *chunk, *next;
+
+	for (chunk = arena->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+
+	arena_init(arena);
+}
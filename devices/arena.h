@@ -0,0 +1,40 @@
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+
+/*
+ * A bump allocator. Allocations are carved from a list of chunks, and are
+ * never freed individually: everything allocated from an arena is freed at
+ * once, by arena_release(). An arena that has been zeroed (or initialised
+ * with arena_init()) is ready to use.
+ */
+struct arena_chunk;
+
+struct arena {
+	struct arena_chunk	*chunks;
+	unsigned long		allocs;		/* calls to arena_alloc() */
+	unsigned long		bytes;		/* bytes handed out */
+	unsigned int		n_chunks;	/* chunks from malloc() */
+};
+
+void arena_init(struct arena *arena);
+
+/**
+ * Allocate @size bytes from @arena, aligned for any type, and zeroed.
+ *
+ * Returns NULL if a new chunk can't be allocated.
+ */
+void *arena_alloc(struct arena *arena, size_t size);
+
+/* Copy a string into the arena; a NULL @str gives NULL. arena_strndup()
+ * copies exactly @len bytes, and adds a nul */
+char *arena_strdup(struct arena *arena, const char *str);
+char *arena_strndup(struct arena *arena, const char *str, size_t len);
+
+/**
+ * Free everything allocated from @arena, and leave it ready for reuse.
+ */
+void arena_release(struct arena *arena);
+
+#endif /* _ARENA_H */
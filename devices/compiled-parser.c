@@ -0,0 +1,251 @@
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <asm/byteorder.h>
+
+#include "parser.h"
+#include "paths.h"
+#include "menu-file.h"
+
+/*
+ * The compiled menu parser: loads a menu written by petitboot-compile, and
+ * adds its devices and options just as the text parsers did when it was
+ * compiled. Nothing is parsed: strings are used in place, from the mapped
+ * file, and only paths need any work, to resolve them against the device's
+ * mountpoint.
+ */
+
+static const char *const menu_filenames[] = {
+	MENU_FILE_NAME,
+	NULL,
+};
+
+/* the state of one load of a compiled menu */
+struct compiled_state {
+	struct parser_context	*ctx;
+	const char		*filepath;
+	const char		*strings;
+	uint32_t		strings_len;
+};
+
+static uint32_t get_u32(const uint32_t *val)
+{
+	return __be32_to_cpu(*val);
+}
+
+static int check_ref(const struct compiled_state *state, uint32_t ref)
+{
+	switch (MENU_REF_KIND(ref)) {
+	case MENU_REF_STRING:
+	case MENU_REF_PATH:
+		return MENU_REF_OFFSET(ref) < state->strings_len;
+	case MENU_REF_GENERIC_ICON:
+	case MENU_REF_DEVICE_PATH:
+	case MENU_REF_NULL:
+		return 1;
+	}
+	return 0;
+}
+
+static int check_refs(const struct compiled_state *state,
+		const uint32_t *refs, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (!check_ref(state, get_u32(&refs[i])))
+			return 0;
+	return 1;
+}
+
+static const char *get_string(struct compiled_state *state,
+		const uint32_t *field)
+{
+	struct parser_context *ctx = state->ctx;
+	uint32_t ref = get_u32(field);
+	const char *str = state->strings + MENU_REF_OFFSET(ref);
+
+	switch (MENU_REF_KIND(ref)) {
+	case MENU_REF_STRING:
+		return str;
+	case MENU_REF_PATH:
+		return resolve_path_arena(&ctx->arena, str, ctx->device_path);
+	case MENU_REF_GENERIC_ICON:
+		return generic_icon_file(guess_device_type());
+	case MENU_REF_DEVICE_PATH:
+		return ctx->device_path;
+	}
+	return NULL;
+}
+
+/* Check that the whole menu is valid, so that we never add part of one.
+ * Returns the number of devices, or -1 */
+static int check_menu(struct compiled_state *state,
+		const struct config_file *file)
+{
+	const struct menu_file_header *hdr = (const void *)file->buf;
+	const struct menu_file_device *dev;
+	uint32_t i, size, n_devices, n_options, records_len, total = 0;
+	uint64_t fingerprint;
+
+	if (file->len < sizeof(*hdr) ||
+			memcmp(hdr->magic, MENU_FILE_MAGIC, sizeof(hdr->magic))) {
+		pb_log("%s: not a compiled menu\n", state->filepath);
+		return -1;
+	}
+
+	if (get_u32(&hdr->version) != MENU_FILE_VERSION) {
+		pb_log("%s: unsupported version %u\n", state->filepath,
+				get_u32(&hdr->version));
+		return -1;
+	}
+
+	size = get_u32(&hdr->size);
+	n_devices = get_u32(&hdr->n_devices);
+	n_options = get_u32(&hdr->n_options);
+	state->strings_len = get_u32(&hdr->strings_len);
+
+	/* the counts are bounded by the file size, so this can't overflow */
+	records_len = n_devices * sizeof(*dev) +
+		n_options * sizeof(struct menu_file_option);
+
+	if (size != file->len || n_devices > size || n_options > size ||
+			state->strings_len > size ||
+			sizeof(*hdr) + records_len + state->strings_len != size) {
+		pb_log("%s: truncated or corrupt\n", state->filepath);
+		return -1;
+	}
+
+	if (menu_file_hash32(MENU_FILE_HASH32_INIT, hdr + 1,
+				size - sizeof(*hdr)) !=
+			get_u32(&hdr->checksum)) {
+		pb_log("%s: bad checksum\n", state->filepath);
+		return -1;
+	}
+
+	state->strings = file->buf + sizeof(*hdr) + records_len;
+	if (!state->strings_len ||
+			state->strings[state->strings_len - 1] != '\0') {
+		pb_log("%s: bad string table\n", state->filepath);
+		return -1;
+	}
+
+	dev = (const void *)(hdr + 1);
+	for (i = 0; i < n_devices; i++) {
+		const struct menu_file_option *opt = (const void *)(dev + 1);
+		uint32_t j, n = get_u32(&dev->n_options);
+
+		if (n > n_options - total ||
+				!check_refs(state, &dev->id, 4))
+			goto err_corrupt;
+
+		for (j = 0; j < n; j++)
+			if (!check_refs(state, &opt[j].id, 7))
+				goto err_corrupt;
+
+		total += n;
+		dev = (const void *)(opt + n);
+	}
+
+	if (total != n_options)
+		goto err_corrupt;
+
+	if ((get_u32(&hdr->flags) & MENU_FILE_MERGED) != !!state->ctx->merge) {
+		pb_log("%s: compiled %s merging configs, ignoring\n",
+				state->filepath,
+				state->ctx->merge ? "without" : "with");
+		return -1;
+	}
+
+	if (config_fingerprint(state->ctx, &fingerprint) ||
+			fingerprint != ((uint64_t)get_u32(&hdr->fingerprint[0])
+				<< 32 | get_u32(&hdr->fingerprint[1]))) {
+		pb_log("%s: configs have changed since it was compiled, "
+				"ignoring\n", state->filepath);
+		return -1;
+	}
+
+	return n_devices;
+
+err_corrupt:
+	pb_log("%s: corrupt device or option record\n", state->filepath);
+	return -1;
+}
+
+static void add_menu(struct compiled_state *state,
+		const struct config_file *file, int n_devices)
+{
+	const struct menu_file_device *rec;
+	struct device dev;
+	struct boot_option opt;
+	uint32_t i, n;
+
+	rec = (const void *)(file->buf + sizeof(struct menu_file_header));
+
+	for (; n_devices; n_devices--) {
+		const struct menu_file_option *opt_rec = (const void *)(rec + 1);
+
+		memset(&dev, 0, sizeof(dev));
+		dev.id = (char *)get_string(state, &rec->id);
+		dev.name = (char *)get_string(state, &rec->name);
+		dev.description = (char *)get_string(state, &rec->description);
+		dev.icon_file = (char *)get_string(state, &rec->icon_file);
+
+		add_device(state->ctx, &dev);
+
+		n = get_u32(&rec->n_options);
+		for (i = 0; i < n; i++) {
+			const struct menu_file_option *r = &opt_rec[i];
+
+			memset(&opt, 0, sizeof(opt));
+			opt.id = (char *)get_string(state, &r->id);
+			opt.name = (char *)get_string(state, &r->name);
+			opt.description = (char *)get_string(state,
+					&r->description);
+			opt.icon_file = (char *)get_string(state, &r->icon_file);
+			opt.boot_image_file = (char *)get_string(state,
+					&r->boot_image_file);
+			opt.initrd_file = (char *)get_string(state,
+					&r->initrd_file);
+			opt.boot_args = (char *)get_string(state, &r->boot_args);
+
+			add_boot_option(state->ctx, &opt);
+		}
+
+		rec = (const void *)(opt_rec + n);
+	}
+}
+
+static int parse(struct parser_context *ctx)
+{
+	struct compiled_state state;
+	struct config_file file;
+	int n_devices;
+
+	memset(&state, 0, sizeof(state));
+	state.ctx = ctx;
+	state.filepath = resolve_path_arena(&ctx->arena, ctx->filename,
+			ctx->device_path);
+
+	if (!state.filepath ||
+			load_config_file(ctx, state.filepath, 0, &file))
+		return 0;
+
+	n_devices = check_menu(&state, &file);
+	if (n_devices > 0)
+		add_menu(&state, &file, n_devices);
+
+	release_config_file(&file);
+
+	return n_devices > 0;
+}
+
+struct parser compiled_parser = {
+	.name		= "compiled menu parser",
+	.priority	= 200,
+	.filenames	= menu_filenames,
+	.compiled	= 1,
+	.parse		= parse,
+};
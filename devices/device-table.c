@@ -0,0 +1,368 @@
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "device-table.h"
+
+static char *strdup_safe(const char *str)
+{
+	return str ? strdup(str) : NULL;
+}
+
+/* we can't tell an empty string from NULL once it has been through the
+ * socket, so treat them as equal */
+static int strings_match(const char *a, const char *b)
+{
+	return !strcmp(a ? a : "", b ? b : "");
+}
+
+static int options_match(const struct boot_option *a,
+		const struct boot_option *b)
+{
+	return strings_match(a->name, b->name) &&
+		strings_match(a->description, b->description) &&
+		strings_match(a->icon_file, b->icon_file) &&
+		strings_match(a->boot_image_file, b->boot_image_file) &&
+		strings_match(a->initrd_file, b->initrd_file) &&
+		strings_match(a->boot_args, b->boot_args) &&
+		a->flags == b->flags &&
+		a->boot_image_size == b->boot_image_size &&
+		a->initrd_size == b->initrd_size;
+}
+
+static int find_option_index(const struct device_entry *entry,
+		const char *id)
+{
+	int i;
+
+	for (i = 0; i < entry->n_options; i++)
+		if (strings_match(entry->options[i]->id, id))
+			return i;
+
+	return -1;
+}
+
+static struct boot_option *find_option(const struct device_entry *entry,
+		const char *id)
+{
+	int i = find_option_index(entry, id);
+
+	return i == -1 ? NULL : entry->options[i];
+}
+
+static char *generate_option_id(const struct device_entry *entry,
+		const char *name)
+{
+	char *id;
+	int n;
+
+	asprintf(&id, "%s#%s", entry->dev->id, name ? name : "");
+
+	/* duplicate names get a numeric suffix */
+	for (n = 2; id && find_option(entry, id); n++) {
+		free(id);
+		asprintf(&id, "%s#%s#%d", entry->dev->id, name ? name : "", n);
+	}
+
+	return id;
+}
+
+struct device_entry *device_entry_create(const struct device *dev)
+{
+	struct device_entry *entry;
+
+	entry = malloc(sizeof(*entry));
+	if (!entry)
+		return NULL;
+	memset(entry, 0, sizeof(*entry));
+
+	entry->dev = malloc(sizeof(*entry->dev));
+	if (!entry->dev) {
+		free(entry);
+		return NULL;
+	}
+
+	entry->dev->id = strdup_safe(dev->id);
+	entry->dev->name = strdup_safe(dev->name);
+	entry->dev->description = strdup_safe(dev->description);
+	entry->dev->icon_file = strdup_safe(dev->icon_file);
+
+	return entry;
+}
+
+static struct boot_option *copy_option(const struct boot_option *opt,
+		char *id)
+{
+	struct boot_option *new_opt;
+
+	new_opt = malloc(sizeof(*new_opt));
+	if (!new_opt)
+		return NULL;
+
+	new_opt->id = id;
+	new_opt->name = strdup_safe(opt->name);
+	new_opt->description = strdup_safe(opt->description);
+	new_opt->icon_file = strdup_safe(opt->icon_file);
+	new_opt->boot_image_file = strdup_safe(opt->boot_image_file);
+	new_opt->initrd_file = strdup_safe(opt->initrd_file);
+	new_opt->boot_args = strdup_safe(opt->boot_args);
+	new_opt->flags = opt->flags;
+	new_opt->boot_image_size = opt->boot_image_size;
+	new_opt->initrd_size = opt->initrd_size;
+
+	return new_opt;
+}
+
+int device_entry_add_option(struct device_entry *entry,
+		const struct boot_option *opt)
+{
+	struct boot_option *new_opt, **options;
+
+	options = realloc(entry->options,
+			(entry->n_options + 1) * sizeof(*options));
+	if (!options)
+		return -1;
+	entry->options = options;
+
+	new_opt = copy_option(opt, opt->id ? strdup(opt->id) :
+			generate_option_id(entry, opt->name));
+	if (!new_opt)
+		return -1;
+
+	entry->options[entry->n_options++] = new_opt;
+	return 0;
+}
+
+const struct boot_option *device_entry_find_option(
+		const struct device_entry *entry, const char *id)
+{
+	return find_option(entry, id);
+}
+
+int device_entry_update_option(struct device_entry *entry,
+		const struct boot_option *opt)
+{
+	struct boot_option *new_opt;
+	int i;
+
+	i = find_option_index(entry, opt->id);
+	if (i == -1)
+		return device_entry_add_option(entry, opt) ? -1 : 1;
+
+	if (options_match(entry->options[i], opt))
+		return 0;
+
+	new_opt = copy_option(opt, strdup(opt->id));
+	if (!new_opt)
+		return -1;
+
+	free_boot_option(entry->options[i]);
+	entry->options[i] = new_opt;
+	return 1;
+}
+
+int device_entry_remove_option(struct device_entry *entry, const char *id)
+{
+	int i;
+
+	i = find_option_index(entry, id);
+	if (i == -1)
+		return -1;
+
+	free_boot_option(entry->options[i]);
+	memmove(entry->options + i, entry->options + i + 1,
+			(entry->n_options - i - 1) * sizeof(*entry->options));
+	entry->n_options--;
+
+	return 0;
+}
+
+void device_entry_free(struct device_entry *entry)
+{
+	int i;
+
+	if (!entry)
+		return;
+
+	for (i = 0; i < entry->n_options; i++)
+		free_boot_option(entry->options[i]);
+
+	free(entry->options);
+	free_device(entry->dev);
+	free(entry);
+}
+
+int msg_buf_add_device_entry(struct msg_buf *buf,
+		const struct device_entry *entry)
+{
+	int i;
+
+	if (msg_buf_add_device(buf, entry->dev))
+		return -1;
+
+	for (i = 0; i < entry->n_options; i++)
+		if (msg_buf_add_boot_option(buf, DEV_ACTION_ADD_OPTION,
+					entry->options[i]))
+			return -1;
+
+	return 0;
+}
+
+int device_entry_write(int fd, const struct device_entry *entry)
+{
+	struct msg_buf buf = MSG_BUF_INIT;
+	int rc;
+
+	rc = msg_buf_add_device_entry(&buf, entry) || msg_buf_write(fd, &buf);
+	msg_buf_free(&buf);
+	return rc;
+}
+
+struct device_entry *device_entry_read(int fd)
+{
+	struct device_entry *entry;
+	enum device_action action;
+	struct boot_option *opt;
+	struct device *dev;
+	int rc;
+
+	if (read_action(fd, &action) || action != DEV_ACTION_ADD_DEVICE)
+		return NULL;
+
+	dev = read_device(fd);
+	if (!dev)
+		return NULL;
+
+	entry = device_entry_create(dev);
+	free_device(dev);
+	if (!entry)
+		return NULL;
+
+	while (!read_action(fd, &action)) {
+		if (action != DEV_ACTION_ADD_OPTION)
+			break;
+
+		opt = read_boot_option(fd);
+		if (!opt)
+			break;
+
+		rc = device_entry_add_option(entry, opt);
+		free_boot_option(opt);
+		if (rc)
+			break;
+	}
+
+	return entry;
+}
+
+int msg_buf_add_device_entry_diff(struct msg_buf *buf,
+		const struct device_entry *old, const struct device_entry *new)
+{
+	const struct boot_option *opt, *old_opt;
+	int i, sent_device = 0;
+
+#define add_device() (!sent_device++ && msg_buf_add_device(buf, new->dev))
+
+	for (i = 0; i < old->n_options; i++) {
+		opt = old->options[i];
+		if (find_option(new, opt->id))
+			continue;
+
+		if (add_device() ||
+			msg_buf_add_action(buf, DEV_ACTION_REMOVE_OPTION) ||
+			msg_buf_add_string(buf, opt->id))
+			return -1;
+	}
+
+	for (i = 0; i < new->n_options; i++) {
+		opt = new->options[i];
+		old_opt = find_option(old, opt->id);
+
+		if (old_opt && options_match(old_opt, opt))
+			continue;
+
+		if (add_device() ||
+			msg_buf_add_boot_option(buf, old_opt ?
+					DEV_ACTION_UPDATE_OPTION :
+					DEV_ACTION_ADD_OPTION, opt))
+			return -1;
+	}
+
+#undef add_device
+
+	return 0;
+}
+
+int device_entry_write_diff(int fd, const struct device_entry *old,
+		const struct device_entry *new)
+{
+	struct msg_buf buf = MSG_BUF_INIT;
+	int rc;
+
+	rc = msg_buf_add_device_entry_diff(&buf, old, new) ||
+		msg_buf_write(fd, &buf);
+	msg_buf_free(&buf);
+	return rc;
+}
+
+struct device_entry *device_table_find(const struct device_table *table,
+		const char *id)
+{
+	int i;
+
+	for (i = 0; i < table->n_entries; i++)
+		if (!strcmp(table->entries[i]->dev->id, id))
+			return table->entries[i];
+
+	return NULL;
+}
+
+int device_table_add(struct device_table *table, struct device_entry *entry)
+{
+	struct device_entry **entries;
+
+	entries = realloc(table->entries,
+			(table->n_entries + 1) * sizeof(*entries));
+	if (!entries)
+		return -1;
+
+	table->entries = entries;
+	table->entries[table->n_entries++] = entry;
+	return 0;
+}
+
+struct device_entry *device_table_remove(struct device_table *table,
+		const char *id)
+{
+	struct device_entry *entry;
+	int i;
+
+	for (i = 0; i < table->n_entries; i++)
+		if (!strcmp(table->entries[i]->dev->id, id))
+			break;
+
+	if (i == table->n_entries)
+		return NULL;
+
+	entry = table->entries[i];
+	memmove(table->entries + i, table->entries + i + 1,
+			(table->n_entries - i - 1) * sizeof(*table->entries));
+	table->n_entries--;
+
+	return entry;
+}
+
+int msg_buf_add_device_table(struct msg_buf *buf,
+		const struct device_table *table)
+{
+	int i;
+
+	for (i = 0; i < table->n_entries; i++)
+		if (msg_buf_add_device_entry(buf, table->entries[i]))
+			return -1;
+
+	return 0;
+}
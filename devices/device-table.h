@@ -0,0 +1,106 @@
+#ifndef _DEVICE_TABLE_H
+#define _DEVICE_TABLE_H
+
+#include "message.h"
+
+/**
+ * A device, along with the full set of boot options discovered on it.
+ * Everything in an entry is owned by the entry.
+ */
+struct device_entry {
+	struct device		*dev;
+	struct boot_option	**options;
+	int			n_options;
+};
+
+/**
+ * Create a new entry, holding a copy of @dev and no options.
+ */
+struct device_entry *device_entry_create(const struct device *dev);
+
+/**
+ * Add a copy of @opt to the entry. If the option doesn't have an id, one
+ * is generated from the device id and the option name, so that the same
+ * option will get the same id when the config is re-parsed.
+ */
+int device_entry_add_option(struct device_entry *entry,
+		const struct boot_option *opt);
+
+void device_entry_free(struct device_entry *entry);
+
+const struct boot_option *device_entry_find_option(
+		const struct device_entry *entry, const char *id);
+
+/**
+ * Replace the option with the same id as @opt with a copy of @opt, or add
+ * it if there is no such option.
+ *
+ * Returns 1 if the entry changed, 0 if it already had an identical option,
+ * or -1 on error.
+ */
+int device_entry_update_option(struct device_entry *entry,
+		const struct boot_option *opt);
+
+/**
+ * Remove the option with id @id.
+ *
+ * Returns -1 if there is no such option.
+ */
+int device_entry_remove_option(struct device_entry *entry, const char *id);
+
+/**
+ * Write the full entry to @fd: the device, followed by each of its options.
+ */
+int device_entry_write(int fd, const struct device_entry *entry);
+int msg_buf_add_device_entry(struct msg_buf *buf,
+		const struct device_entry *entry);
+
+/**
+ * Read an entry written by device_entry_write() from @fd.
+ *
+ * Returns NULL if no device could be read.
+ */
+struct device_entry *device_entry_read(int fd);
+
+/**
+ * Write the changes needed to turn @old into @new to @fd, as a device
+ * message followed by option-level add, update and remove messages. Both
+ * entries must be for the same device. Unchanged options aren't sent, and
+ * if nothing has changed, nothing is written.
+ */
+int device_entry_write_diff(int fd, const struct device_entry *old,
+		const struct device_entry *new);
+int msg_buf_add_device_entry_diff(struct msg_buf *buf,
+		const struct device_entry *old, const struct device_entry *new);
+
+/**
+ * The set of all devices currently known, in the order they were added.
+ */
+struct device_table {
+	struct device_entry	**entries;
+	int			n_entries;
+};
+
+struct device_entry *device_table_find(const struct device_table *table,
+		const char *id);
+
+/**
+ * Add @entry to the table, which takes ownership of it.
+ */
+int device_table_add(struct device_table *table, struct device_entry *entry);
+
+/**
+ * Remove the entry for device @id from the table, and return it. The caller
+ * is responsible for freeing the entry.
+ */
+struct device_entry *device_table_remove(struct device_table *table,
+		const char *id);
+
+/**
+ * Add the full contents of the table to @buf, as a device message followed
+ * by option messages for each device.
+ */
+int msg_buf_add_device_table(struct msg_buf *buf,
+		const struct device_table *table);
+
+#endif /* _DEVICE_TABLE_H */
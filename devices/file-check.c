@@ -0,0 +1,179 @@
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "file-check.h"
+
+/* enough to keep several requests in flight on a slow device */
+#define FILE_CHECK_MAX_THREADS	8
+
+struct file_check {
+	const char	*path;
+	int		exists;
+	uint64_t	size;
+};
+
+/* the batch's checks are sorted by path, with no duplicates */
+struct file_check_batch {
+	struct file_check	*checks;
+	unsigned int		n_checks;
+	unsigned int		next;
+	pthread_mutex_t		lock;
+};
+
+static int file_check_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct file_check *)a)->path,
+			((const struct file_check *)b)->path);
+}
+
+static void add_path(struct file_check_batch *batch, const char *path)
+{
+	if (path && *path)
+		batch->checks[batch->n_checks++].path = path;
+}
+
+/* a kernel, initrd or icon must be a regular file */
+static void check_file(struct file_check *check)
+{
+	struct stat statbuf;
+
+	if (stat(check->path, &statbuf) || !S_ISREG(statbuf.st_mode))
+		return;
+
+	check->exists = 1;
+	check->size = statbuf.st_size;
+}
+
+static void *file_check_worker(void *arg)
+{
+	struct file_check_batch *batch = arg;
+	unsigned int i;
+
+	for (;;) {
+		pthread_mutex_lock(&batch->lock);
+		i = batch->next++;
+		pthread_mutex_unlock(&batch->lock);
+
+		if (i >= batch->n_checks)
+			break;
+
+		check_file(&batch->checks[i]);
+	}
+
+	return NULL;
+}
+
+/* run every check in the batch, and wait for them all to finish */
+static void run_batch(struct file_check_batch *batch)
+{
+	pthread_t threads[FILE_CHECK_MAX_THREADS - 1];
+	unsigned int i, n_threads;
+
+	n_threads = batch->n_checks < FILE_CHECK_MAX_THREADS ?
+		batch->n_checks : FILE_CHECK_MAX_THREADS;
+
+	/* this thread is one of the workers */
+	for (i = 0; i + 1 < n_threads; i++)
+		if (pthread_create(&threads[i], NULL, file_check_worker,
+					batch))
+			break;
+	n_threads = i;
+
+	file_check_worker(batch);
+
+	for (i = 0; i < n_threads; i++)
+		pthread_join(threads[i], NULL);
+}
+
+/* Look up @path's result; returns 0 if the file is missing. Options with
+ * no file of this type have nothing to check */
+static int file_exists(const struct file_check_batch *batch,
+		const char *path, uint64_t *size)
+{
+	const struct file_check *check;
+	struct file_check key;
+
+	key.path = path;
+	check = bsearch(&key, batch->checks, batch->n_checks,
+			sizeof(*batch->checks), file_check_cmp);
+
+	if (check && check->exists)
+		*size = check->size;
+
+	return check && check->exists;
+}
+
+int device_entry_check_files(struct device_entry *entry)
+{
+	struct file_check_batch batch;
+	struct boot_option *opt;
+	unsigned int i, j;
+	uint64_t size;
+
+	memset(&batch, 0, sizeof(batch));
+	pthread_mutex_init(&batch.lock, NULL);
+
+	batch.checks = calloc(entry->n_options * 3 + 1,
+			sizeof(*batch.checks));
+	if (!batch.checks)
+		return -1;
+
+	for (i = 0; i < entry->n_options; i++) {
+		opt = entry->options[i];
+		add_path(&batch, opt->boot_image_file);
+		add_path(&batch, opt->initrd_file);
+		add_path(&batch, opt->icon_file);
+	}
+
+	/* options often share files, which only need checking once */
+	qsort(batch.checks, batch.n_checks, sizeof(*batch.checks),
+			file_check_cmp);
+
+	for (i = j = 0; i < batch.n_checks; i++)
+		if (!j || strcmp(batch.checks[i].path,
+					batch.checks[j - 1].path))
+			batch.checks[j++] = batch.checks[i];
+	batch.n_checks = j;
+
+	run_batch(&batch);
+
+	for (i = 0; i < entry->n_options; i++) {
+		opt = entry->options[i];
+		opt->flags = 0;
+		opt->boot_image_size = opt->initrd_size = 0;
+
+		/* an option with no kernel can't be booted either */
+		if (!opt->boot_image_file || !*opt->boot_image_file ||
+				!file_exists(&batch, opt->boot_image_file,
+					&opt->boot_image_size))
+			opt->flags |= BOOT_OPTION_IMAGE_MISSING;
+
+		if (opt->initrd_file && *opt->initrd_file &&
+				!file_exists(&batch, opt->initrd_file,
+					&opt->initrd_size))
+			opt->flags |= BOOT_OPTION_INITRD_MISSING;
+
+		if (opt->icon_file && *opt->icon_file &&
+				!file_exists(&batch, opt->icon_file, &size))
+			opt->flags |= BOOT_OPTION_ICON_MISSING;
+
+		if (opt->flags)
+			pb_log("option %s: missing%s%s%s\n", opt->name,
+				opt->flags & BOOT_OPTION_IMAGE_MISSING ?
+					" kernel" : "",
+				opt->flags & BOOT_OPTION_INITRD_MISSING ?
+					" initrd" : "",
+				opt->flags & BOOT_OPTION_ICON_MISSING ?
+					" icon" : "");
+	}
+
+	free(batch.checks);
+	pthread_mutex_destroy(&batch.lock);
+	return 0;
+}
@@ -0,0 +1,18 @@
+#ifndef _FILE_CHECK_H
+#define _FILE_CHECK_H
+
+#include "device-table.h"
+
+/**
+ * Check that the files referenced by each of @entry's options exist: the
+ * kernel, initrd and icon of every option are stat()ed in one batch, spread
+ * over a pool of threads, so that a slow device is waited on once per batch
+ * rather than once per file. Each option's size fields and missing flags
+ * are set from the results.
+ *
+ * Returns -1 if the checks couldn't be run, in which case the options are
+ * left unchanged.
+ */
+int device_entry_check_files(struct device_entry *entry);
+
+#endif /* _FILE_CHECK_H */
@@ -0,0 +1,224 @@
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "keywords.h"
+
+/*
+ * Generate the keyword lookup tables for the parsers, at build time.
+ *
+ * The input is a list of keyword sets:
+ *
+ *	# comment
+ *	%set native
+ *	name
+ *	description
+ *	...
+ *
+ * For each set, we write an enum of the keywords (in the order given), the
+ * keyword strings, and an inline <set>_keyword(str, len) function, which
+ * returns the keyword's enum value or -1. The lookup uses a hash that is
+ * perfect over the set: we search for a seed that gives every keyword its
+ * own slot in the smallest power-of-two table we can.
+ */
+
+#define MAX_KEYWORDS	128
+#define MAX_SEEDS	(1 << 20)
+
+struct keyword_set {
+	char		*name;
+	char		*keywords[MAX_KEYWORDS];
+	unsigned int	n_keywords;
+	unsigned int	seed;
+	unsigned int	size;
+	signed char	*slots;
+};
+
+static const char *input_name;
+
+static void die(int line, const char *msg, const char *arg)
+{
+	fprintf(stderr, "%s:%d: %s%s\n", input_name, line, msg, arg);
+	exit(EXIT_FAILURE);
+}
+
+/* write @str as a C identifier, in upper case */
+static void print_ident(FILE *fp, const char *str)
+{
+	for (; *str; str++)
+		fputc(isalnum((unsigned char)*str) ?
+				toupper((unsigned char)*str) : '_', fp);
+}
+
+static int try_seed(struct keyword_set *set, unsigned int seed)
+{
+	unsigned int i, slot;
+
+	memset(set->slots, -1, set->size);
+
+	for (i = 0; i < set->n_keywords; i++) {
+		slot = keyword_hash(seed, set->keywords[i],
+				strlen(set->keywords[i])) & (set->size - 1);
+		if (set->slots[slot] >= 0)
+			return 0;
+		set->slots[slot] = i;
+	}
+
+	set->seed = seed;
+	return 1;
+}
+
+static void find_perfect_hash(struct keyword_set *set)
+{
+	unsigned int seed;
+
+	for (set->size = 1; set->size < set->n_keywords; set->size <<= 1)
+		;
+
+	for (;; set->size <<= 1) {
+		set->slots = realloc(set->slots, set->size);
+		if (!set->slots) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+
+		for (seed = 0; seed < MAX_SEEDS; seed++)
+			if (try_seed(set, seed * 2654435761u))
+				return;
+	}
+}
+
+/* what follows item @i of @n in an array initialiser, 16 to a line */
+static const char *separator(unsigned int i, unsigned int n)
+{
+	if (i + 1 == n)
+		return "\n";
+	return (i + 1) % 16 ? " " : "\n\t";
+}
+
+static void print_set(FILE *fp, struct keyword_set *set)
+{
+	unsigned int i;
+
+	fprintf(fp, "enum %s_keyword {\n", set->name);
+	for (i = 0; i < set->n_keywords; i++) {
+		fputc('\t', fp);
+		print_ident(fp, set->name);
+		fputc('_', fp);
+		print_ident(fp, set->keywords[i]);
+		fprintf(fp, ",\n");
+	}
+	fprintf(fp, "};\n\n");
+
+	fprintf(fp, "#define N_");
+	print_ident(fp, set->name);
+	fprintf(fp, "_KEYWORDS %u\n\n", set->n_keywords);
+
+	fprintf(fp, "static const char *const %s_keywords[] = {\n", set->name);
+	for (i = 0; i < set->n_keywords; i++)
+		fprintf(fp, "\t\"%s\",\n", set->keywords[i]);
+	fprintf(fp, "};\n\n");
+
+	fprintf(fp, "static const unsigned char %s_keyword_lens[] = {\n\t",
+			set->name);
+	for (i = 0; i < set->n_keywords; i++)
+		fprintf(fp, "%zu,%s", strlen(set->keywords[i]),
+				separator(i, set->n_keywords));
+	fprintf(fp, "};\n\n");
+
+	fprintf(fp, "static const signed char %s_keyword_slots[%u] = {\n\t",
+			set->name, set->size);
+	for (i = 0; i < set->size; i++)
+		fprintf(fp, "%d,%s", set->slots[i],
+				separator(i, set->size));
+	fprintf(fp, "};\n\n");
+
+	fprintf(fp, "/* returns the enum %s_keyword for @str, "
+			"or -1 if it isn't one */\n", set->name);
+	fprintf(fp, "static inline int %s_keyword(const char *str, "
+			"unsigned int len)\n{\n", set->name);
+	fprintf(fp, "\tint idx = %s_keyword_slots[\n"
+			"\t\tkeyword_hash(0x%08xu, str, len) & %u];\n\n",
+			set->name, set->seed, set->size - 1);
+	fprintf(fp, "\treturn keyword_match(%s_keywords,\n"
+			"\t\t\t%s_keyword_lens, idx, str, len) ? idx : -1;\n"
+			"}\n\n", set->name, set->name);
+}
+
+int main(int argc, char **argv)
+{
+	struct keyword_set sets[16], *set = NULL;
+	unsigned int i, n_sets = 0;
+	char *line = NULL, *str, *end;
+	size_t line_size = 0;
+	int line_num = 0;
+	FILE *fp;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s <keywords-file>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	input_name = argv[1];
+	fp = fopen(input_name, "r");
+	if (!fp) {
+		perror(input_name);
+		return EXIT_FAILURE;
+	}
+
+	memset(sets, 0, sizeof(sets));
+
+	while (getline(&line, &line_size, fp) >= 0) {
+		line_num++;
+
+		for (str = line; isspace((unsigned char)*str); str++)
+			;
+		for (end = str + strlen(str); end > str &&
+				isspace((unsigned char)end[-1]); end--)
+			;
+		*end = '\0';
+
+		if (!*str || *str == '#')
+			continue;
+
+		if (!strncmp(str, "%set ", 5)) {
+			if (n_sets == sizeof(sets) / sizeof(sets[0]))
+				die(line_num, "too many sets", "");
+			set = &sets[n_sets++];
+			set->name = strdup(str + 5);
+			continue;
+		}
+
+		if (!set)
+			die(line_num, "keyword before %set: ", str);
+		if (set->n_keywords == MAX_KEYWORDS)
+			die(line_num, "too many keywords in set ", set->name);
+		if (end - str > 255)
+			die(line_num, "keyword too long: ", str);
+
+		for (i = 0; i < set->n_keywords; i++)
+			if (!strcasecmp(set->keywords[i], str))
+				die(line_num, "duplicate keyword: ", str);
+
+		set->keywords[set->n_keywords++] = strdup(str);
+	}
+
+	fclose(fp);
+	free(line);
+
+	printf("/* generated by gen-keywords from %s, do not edit */\n\n",
+			input_name);
+	printf("#include \"keywords.h\"\n\n");
+
+	for (i = 0; i < n_sets; i++) {
+		find_perfect_hash(&sets[i]);
+		print_set(stdout, &sets[i]);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -4,285 +4,404 @@
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
-#include <unistd.h>
-
-#include <fcntl.h>
-#include <sys/types.h>
-#include <sys/stat.h>
 
 #include "parser.h"
 #include "params.h"
+#include "paths.h"
+#include "kboot-keywords.h"
 
-#define buf_size 1024
+/*
+ * A run of characters in the config file buffer. Slices aren't
+ * nul-terminated, so the lexer never needs to copy the buffer.
+ */
+struct slice {
+	char	*str;
+	int	len;
+};
+
+/* the enum kboot_keyword for a slice, or -1 */
+static int slice_keyword(const struct slice *s)
+{
+	return kboot_keyword(s->str, s->len);
+}
+
+/* nul-terminate a slice in place, once the lexer has finished with the
+ * byte that follows it */
+static char *slice_terminate(struct slice *s)
+{
+	s->str[s->len] = '\0';
+	return s->str;
+}
+
+static void slice_trim(struct slice *s)
+{
+	while (s->len && isspace(*s->str)) {
+		s->str++;
+		s->len--;
+	}
+	while (s->len && isspace(s->str[s->len - 1]))
+		s->len--;
+}
 
-static const char *devpath;
+static int param_is_ignored(int keyword)
+{
+	return keyword >= KBOOT_MESSAGE && keyword <= KBOOT_DEFAULT;
+}
 
-static int param_is_ignored(const char *param)
+/* root= and initrd= are taken out of the args, and added at the start */
+static int param_is_root_or_initrd(const struct slice *param)
 {
-	static const char *ignored_options[] =
-		{ "message", "timeout", "default", NULL };
-	const char **str;
-
-	for (str = ignored_options; *str; str++)
-		if (streq(*str, param))
-			return 1;
-	return 0;
+	int keyword = slice_keyword(param);
+
+	return keyword == KBOOT_ROOT || keyword == KBOOT_INITRD;
 }
 
 /**
- * Splits a name=value pair, with value terminated by @term (or nul). if there
- * is no '=', then only the value is populated, and *name is set to NULL. The
- * string is modified in place.
+ * Takes the next field from @rest, up to (but not including) @terminator,
+ * and advances @rest past it. A string with n terminators has n + 1
+ * fields, so repeated terminators give empty fields.
  *
- * Returns the next byte to process, or null if we've hit the end of the
- * string.
- *
- * */
-static char *get_param_pair(char *str, char **name_out, char **value_out,
+ * Returns 0 once there are no fields left.
+ */
+static int next_field(struct slice *rest, struct slice *field,
 		char terminator)
 {
-	char *sep, *tmp, *name, *value;
+	char *tmp;
 
-	/* terminate the value */
-	tmp = strchr(str, terminator);
-	if (tmp)
-		*tmp = 0;
-	else
-		tmp = NULL;
+	if (rest->len < 0)
+		return 0;
 
-	sep = strchr(str, '=');
-	if (!sep) {
-		*name_out = NULL;
-		*value_out = str;
-		return tmp ? tmp + 1 : NULL;
+	field->str = rest->str;
+	tmp = memchr(rest->str, terminator, rest->len);
+	if (!tmp) {
+		field->len = rest->len;
+		rest->len = -1;
+		return 1;
 	}
 
-	/* terminate the name */
-	*sep = 0;
+	field->len = tmp - rest->str;
+	rest->str = tmp + 1;
+	rest->len -= field->len + 1;
+	return 1;
+}
 
-	/* remove leading spaces */
-	for (name = str; isspace(*name); name++);
-	for (value = sep + 1; isspace(*value); value++);
+/**
+ * Splits a name=value field, with whitespace trimmed from around the name
+ * and the value. If there is no '=', then only the value is populated, with
+ * the whole (untrimmed) field.
+ *
+ * Returns 1 if the field is a name=value pair, 0 otherwise.
+ */
+static int split_pair(const struct slice *field, struct slice *name,
+		struct slice *value)
+{
+	char *sep;
 
-	/* .. and trailing ones.. */
-	for (sep--; isspace(*sep); sep--)
-		*sep = 0;
-	for (sep = value + strlen(value) - 1; isspace(*sep); sep--)
-		*sep = 0;
+	sep = memchr(field->str, '=', field->len);
+	if (!sep) {
+		*value = *field;
+		return 0;
+	}
 
-	*name_out = name;
-	*value_out = value;
+	name->str = field->str;
+	name->len = sep - field->str;
+	value->str = sep + 1;
+	value->len = field->len - name->len - 1;
 
-	return tmp ? tmp + 1 : NULL;
+	slice_trim(name);
+	slice_trim(value);
+	return 1;
 }
 
-struct global_option {
-	char *name;
-	char *value;
+/*
+ * An append-only string builder. The string is built twice: once with no
+ * buffer, which just counts its length, then again into a buffer of
+ * exactly that size.
+ */
+struct str_builder {
+	char	*buf;
+	int	len;
 };
 
+static void str_add(struct str_builder *b, const char *str, int len)
+{
+	if (b->buf)
+		memcpy(b->buf + b->len, str, len);
+	b->len += len;
+}
+
+#define str_add_const(b, str) str_add(b, str, sizeof(str) - 1)
+#define str_add_slice(b, s) str_add(b, (s)->str, (s)->len)
+
+static int str_alloc(struct arena *arena, struct str_builder *b)
+{
+	b->buf = arena_alloc(arena, b->len + 1);
+	b->len = 0;
+	return b->buf ? 0 : -1;
+}
+
+static char *str_finish(struct str_builder *b)
+{
+	b->buf[b->len] = '\0';
+	return b->buf;
+}
 
-static struct global_option global_options[] = {
-	{ .name = "root" },
-	{ .name = "initrd" },
-	{ .name = "video" },
-	{ .name = NULL }
+/* the global options are the keywords from KBOOT_ROOT on */
+#define N_GLOBAL_OPTIONS (N_KBOOT_KEYWORDS - KBOOT_ROOT)
+
+/* the state of one parse of a kboot.conf */
+struct kboot_state {
+	struct parser_context *ctx;
+	const char *devpath;
+	struct slice global_options[N_GLOBAL_OPTIONS];
 };
 
+static void init_global_options(struct kboot_state *state)
+{
+	int i;
+
+	for (i = 0; i < N_GLOBAL_OPTIONS; i++)
+		state->global_options[i].str = NULL;
+}
+
 /*
  * Check if an option (name=value) is a global option. If so, store it in
- * the global options table, and return 1. Otherwise, return 0.
+ * the global options table, and return 1. Otherwise, return 0. Unlike
+ * other keywords, global option names are case-sensitive.
  */
-static int check_for_global_option(const char *name, const char *value)
+static int check_for_global_option(struct kboot_state *state, int keyword,
+		const struct slice *name, const struct slice *value)
 {
-	int i;
+	if (keyword < KBOOT_ROOT ||
+			memcmp(name->str, kboot_keywords[keyword], name->len))
+		return 0;
 
-	for (i = 0; global_options[i].name ;i++) {
-		if (!strcmp(name, global_options[i].name)) {
-			global_options[i].value = strdup(value);
-			return 1;
-		}
-	}
-	return 0;
+	state->global_options[keyword - KBOOT_ROOT] = *value;
+	return 1;
 }
 
-static char *get_global_option(const char *name)
+static struct slice *get_global_option(struct kboot_state *state,
+		int keyword)
 {
-	int i;
+	struct slice *value = &state->global_options[keyword - KBOOT_ROOT];
+
+	return value->str ? value : NULL;
+}
+
+/*
+ * Add the kernel command line to @b: root= and initrd= first, then each of
+ * @args other than root and initrd, with a leading space.
+ */
+static void build_cmdline(struct str_builder *b, struct slice args,
+		const struct slice *root, const struct slice *initrd)
+{
+	struct slice field, name, value;
+
+	if (root) {
+		str_add_const(b, "root=");
+		str_add_slice(b, root);
+		str_add_const(b, " ");
+
+	} else if (initrd) {
+		/* if there's an initrd but no root, fake up /dev/ram0 */
+		str_add_const(b, "root=/dev/ram0 ");
+	}
 
-	for (i = 0; global_options[i].name ;i++)
-		if (!strcmp(name, global_options[i].name))
-			return global_options[i].value;
+	if (initrd) {
+		str_add_const(b, "initrd=");
+		str_add_slice(b, initrd);
+		str_add_const(b, " ");
+	}
 
-	return NULL;
+	while (next_field(&args, &field, ' ')) {
+		if (!split_pair(&field, &name, &value)) {
+			str_add_const(b, " ");
+			str_add_slice(b, &value);
+
+		} else if (!param_is_root_or_initrd(&name)) {
+			str_add_const(b, " ");
+			str_add_slice(b, &name);
+			str_add_const(b, "=");
+			str_add_slice(b, &value);
+		}
+	}
 }
 
-static int parse_option(struct boot_option *opt, char *config)
+static int parse_option(struct kboot_state *state, struct boot_option *opt,
+		struct slice *config)
 {
-	char *pos, *name, *value, *root, *initrd, *cmdline, *tmp;
+	const char *devpath = state->devpath;
+	struct arena *arena = &state->ctx->arena;
+	struct slice kernel, args, rest, field, name, value;
+	struct slice root_value, initrd_value, *root, *initrd;
+	struct str_builder cmdline, description;
+	int keyword;
+	char *sep;
 
-	root = initrd = cmdline = NULL;
+	root = initrd = NULL;
 
 	/* remove quotes around the value */
-	while (*config == '"' || *config == '\'')
-		config++;
+	while (config->len && (*config->str == '"' || *config->str == '\'')) {
+		config->str++;
+		config->len--;
+	}
 
-	pos = config + strlen(config) - 1;
-	while (*pos == '"' || *pos == '\'')
-		*(pos--) = 0;
+	while (config->len && (config->str[config->len - 1] == '"' ||
+				config->str[config->len - 1] == '\''))
+		config->len--;
 
-	if (!strlen(pos))
+	if (!config->len)
 		return 0;
 
-	pos = strchr(config, ' ');
+	sep = memchr(config->str, ' ', config->len);
 
 	/* if there's no space, it's only a kernel image with no params */
-	if (!pos) {
-		opt->boot_image_file = resolve_path(config, devpath);
-		opt->description = strdup(config);
+	if (!sep) {
+		slice_terminate(config);
+		opt->boot_image_file = resolve_path_arena(arena, config->str,
+				devpath);
+		opt->description = arena_strdup(arena, config->str);
 		return 1;
 	}
 
-	*pos = 0;
-	opt->boot_image_file = resolve_path(config, devpath);
-
-	cmdline = malloc(buf_size);
-	*cmdline = 0;
+	kernel.str = config->str;
+	kernel.len = sep - config->str;
+	args.str = sep + 1;
+	args.len = config->len - kernel.len - 1;
 
-	for (pos++; pos;) {
-		pos = get_param_pair(pos, &name, &value, ' ');
-
-		if (!name) {
-			strcat(cmdline, " ");
-			strcat(cmdline, value);
-
-		} else if (streq(name, "initrd")) {
-			initrd = value;
+	/* the option's own root and initrd override the global ones */
+	for (rest = args; next_field(&rest, &field, ' ');) {
+		if (!split_pair(&field, &name, &value))
+			continue;
 
-		} else if (streq(name, "root")) {
-			root = value;
+		keyword = slice_keyword(&name);
+		if (keyword == KBOOT_INITRD) {
+			initrd_value = value;
+			initrd = &initrd_value;
 
-		} else {
-			strcat(cmdline, " ");
-			*(value - 1) = '=';
-			strcat(cmdline, name);
+		} else if (keyword == KBOOT_ROOT) {
+			root_value = value;
+			root = &root_value;
 		}
 	}
 
 	if (!root)
-		root = get_global_option("root");
+		root = get_global_option(state, KBOOT_ROOT);
 	if (!initrd)
-		initrd = get_global_option("initrd");
+		initrd = get_global_option(state, KBOOT_INITRD);
 
-	if (initrd) {
-		asprintf(&tmp, "initrd=%s %s", initrd, cmdline);
-		free(cmdline);
-		cmdline = tmp;
-
-		opt->initrd_file = resolve_path(initrd, devpath);
-	}
-
-	if (root) {
-		asprintf(&tmp, "root=%s %s", root, cmdline);
-		free(cmdline);
-		cmdline = tmp;
+	memset(&cmdline, 0, sizeof(cmdline));
+	build_cmdline(&cmdline, args, root, initrd);
+	if (str_alloc(arena, &cmdline))
+		return 0;
+	build_cmdline(&cmdline, args, root, initrd);
+	str_finish(&cmdline);
 
-	} else if (initrd) {
-		/* if there's an initrd but no root, fake up /dev/ram0 */
-		asprintf(&tmp, "root=/dev/ram0 %s", cmdline);
-		free(cmdline);
-		cmdline = tmp;
-	}
+	memset(&description, 0, sizeof(description));
+	description.len = kernel.len + 1 + cmdline.len;
+	if (str_alloc(arena, &description))
+		return 0;
+	str_add_slice(&description, &kernel);
+	str_add_const(&description, " ");
+	str_add(&description, cmdline.buf, cmdline.len);
 
-	pb_log("kboot cmdline: %s\n", cmdline);
-	opt->boot_args = cmdline;
+	/* we're done with the args, so the slices can be terminated */
+	opt->boot_image_file = resolve_path_arena(arena,
+			slice_terminate(&kernel), devpath);
+	if (initrd)
+		opt->initrd_file = resolve_path_arena(arena,
+				slice_terminate(initrd), devpath);
 
-	asprintf(&opt->description, "%s %s",
-			config, opt->boot_args);
+	pb_log("kboot cmdline: %s\n", cmdline.buf);
+	opt->boot_args = cmdline.buf;
+	opt->description = str_finish(&description);
 
 	return 1;
 }
 
-static void parse_buf(struct device *dev, char *buf)
+static void parse_buf(struct kboot_state *state, struct device *dev,
+		char *buf, int len)
 {
-	char *pos, *name, *value;
-	int sent_device = 0;
+	struct slice rest, line, name, value;
+	int keyword, sent_device = 0;
 
-	for (pos = buf; pos;) {
+	rest.str = buf;
+	rest.len = len;
+
+	while (next_field(&rest, &line, '\n')) {
 		struct boot_option opt;
 
-		pos = get_param_pair(pos, &name, &value, '\n');
+		if (!split_pair(&line, &name, &value))
+			continue;
+
+		pb_log("kboot param: '%.*s' = '%.*s'\n", name.len, name.str,
+				value.len, value.str);
 
-		pb_log("kboot param: '%s' = '%s'\n", name, value);
+		keyword = slice_keyword(&name);
 
-		if (name == NULL || param_is_ignored(name))
+		if (param_is_ignored(keyword))
 			continue;
 
-		if (*name == '#')
+		if (name.len && *name.str == '#')
 			continue;
 
-		if (check_for_global_option(name, value))
+		if (check_for_global_option(state, keyword, &name, &value))
 			continue;
 
 		memset(&opt, 0, sizeof(opt));
-		opt.name = strdup(name);
+		opt.name = arena_strndup(&state->ctx->arena, name.str,
+				name.len);
 
-		if (parse_option(&opt, value))
+		if (parse_option(state, &opt, &value)) {
 			if (!sent_device++)
-				add_device(dev);
-			add_boot_option(&opt);
-
-		free(opt.name);
+				add_device(state->ctx, dev);
+			add_boot_option(state->ctx, &opt);
+		}
 	}
 }
 
-static int parse(const char *device)
+static int parse(struct parser_context *ctx)
 {
-	char *filepath, *buf;
-	int fd, len, rc = 0;
-	struct stat stat;
+	struct kboot_state state;
+	struct config_file file;
 	struct device *dev;
+	char *filepath;
 
-	devpath = device;
-
-	filepath = resolve_path("/etc/kboot.conf", devpath);
-
-	fd = open(filepath, O_RDONLY);
-	if (fd < 0)
-		goto out_free_path;
-
-	if (fstat(fd, &stat))
-		goto out_close;
-
-	buf = malloc(stat.st_size + 1);
-	if (!buf)
-		goto out_close;;
+	state.ctx = ctx;
+	state.devpath = ctx->device_path;
+	init_global_options(&state);
 
-	len = read(fd, buf, stat.st_size);
-	if (len < 0)
-		goto out_free_buf;
-	buf[len] = 0;
+	filepath = resolve_path_arena(&ctx->arena, ctx->filename,
+			state.devpath);
 
-	dev = malloc(sizeof(*dev));
-	memset(dev, 0, sizeof(*dev));
-	dev->id = strdup(device);
-	dev->icon_file = strdup(generic_icon_file(guess_device_type()));
+	/* the lexer nul-terminates slices in place */
+	if (!filepath || load_config_file(ctx, filepath,
+				CONFIG_FILE_WRITABLE, &file))
+		return 0;
 
-	parse_buf(dev, buf);
+	dev = arena_alloc(&ctx->arena, sizeof(*dev));
+	if (!dev) {
+		release_config_file(&file);
+		return 0;
+	}
+	dev->id = arena_strdup(&ctx->arena, ctx->device_path);
+	dev->icon_file = arena_strdup(&ctx->arena,
+			generic_icon_file(guess_device_type()));
 
-	rc = 1;
+	parse_buf(&state, dev, file.buf, file.len);
 
-out_free_buf:
-	free(buf);
-out_close:
-	close(fd);
-out_free_path:
-	free(filepath);
-	return rc;
+	release_config_file(&file);
+	return 1;
 }
 
+static const char *const kboot_conf_files[] = {
+	"/etc/kboot.conf",
+	NULL,
+};
+
 struct parser kboot_parser = {
 	.name = "kboot.conf parser",
 	.priority = 98,
+	.filenames = kboot_conf_files,
 	.parse	  = parse
 };
@@ -0,0 +1,98 @@
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "yaboot-keywords.h"
+
+/*
+ * Compare keyword dispatch with the generated perfect-hash tables against
+ * the chain of strcasecmp()s that it replaced, over the yaboot.conf image
+ * keywords. The input is a mix of keywords (in various cases) and unknown
+ * words, as a config file might have.
+ */
+
+static const char *words[] = {
+	"image", "label", "alias", "append", "initrd", "root", "read-only",
+	"Image", "LABEL", "Append", "InitRD", "sysmap", "novideo",
+	"literal", "initrd-size", "pause-message", "restricted",
+	"imagex", "labels", "kernel", "options", "title", "x", "",
+};
+
+#define N_WORDS (sizeof(words) / sizeof(words[0]))
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int lookup_chain(const char *str)
+{
+	int i;
+
+	for (i = 0; i < N_YABOOT_IMAGE_KEYWORDS; i++)
+		if (!strcasecmp(yaboot_image_keywords[i], str))
+			return i;
+	return -1;
+}
+
+static int lookup_hash(const char *str)
+{
+	return yaboot_image_keyword(str, strlen(str));
+}
+
+static void run(const char *name, int (*lookup)(const char *),
+		int iterations)
+{
+	uint64_t start, ns;
+	unsigned long sum = 0;
+	int i, j;
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++)
+		for (j = 0; j < N_WORDS; j++)
+			sum += lookup(words[j]) + 1;
+	ns = now_ns() - start;
+
+	printf("%-8s %6.1f ns/lookup  (checksum %lu)\n", name,
+			(double)ns / iterations / N_WORDS, sum);
+}
+
+int main(int argc, char **argv)
+{
+	int opt, i, iterations = 1000000;
+
+	while ((opt = getopt(argc, argv, "i:")) != -1) {
+		switch (opt) {
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-i iterations]\n",
+					argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	/* both lookups must agree before we time them */
+	for (i = 0; i < N_WORDS; i++) {
+		if (lookup_chain(words[i]) != lookup_hash(words[i])) {
+			fprintf(stderr, "lookups differ for '%s'\n", words[i]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	run("chain", lookup_chain, iterations);
+	run("hash", lookup_hash, iterations);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,38 @@
+#ifndef KEYWORDS_H
+#define KEYWORDS_H
+
+#include <string.h>
+
+/*
+ * Support for the keyword tables generated by gen-keywords: each
+ * devices/<name>.keywords file becomes a devices/<name>-keywords.h, with a
+ * perfect hash over the keyword set, so that a lookup is a single probe of
+ * the table and a single string compare.
+ *
+ * Keywords are case-insensitive. Only ASCII letters differ between cases,
+ * so hashing (c | 0x20) gives the same value for any spelling of a keyword.
+ */
+
+static inline unsigned int keyword_hash(unsigned int seed, const char *str,
+		unsigned int len)
+{
+	unsigned int i, hash = seed ^ len;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (unsigned char)str[i] | 0x20;
+		hash *= 16777619u;
+	}
+
+	return hash ^ (hash >> 15);
+}
+
+/* check that slot @idx's keyword matches @str */
+static inline int keyword_match(const char *const *names,
+		const unsigned char *lens, int idx,
+		const char *str, unsigned int len)
+{
+	return idx >= 0 && lens[idx] == len &&
+		!strncasecmp(names[idx], str, len);
+}
+
+#endif /* KEYWORDS_H */
@@ -0,0 +1,109 @@
+#ifndef _MENU_FILE_H
+#define _MENU_FILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Compiled menus, written by petitboot-compile and read by the compiled
+ * menu parser. A compiled menu records the devices and boot options that
+ * the text parsers found on a device, in the order they were added, so
+ * that they can be added again without parsing anything.
+ *
+ * The file is a header, then the device and option records (each device
+ * followed by its options), then a table of nul-terminated strings. Every
+ * field is a 32-bit big-endian value.
+ *
+ * The header has a fingerprint of the text configs that the menu was
+ * compiled from (see config_fingerprint()). If the configs have changed
+ * since, the menu is stale, and the text parsers are used instead.
+ */
+
+#define MENU_FILE_MAGIC		"pbmenu\n"
+#define MENU_FILE_VERSION	1
+
+/* where the compiled menu parser looks for a menu, on each device */
+#define MENU_FILE_NAME		"/boot/petitboot.bin"
+
+enum menu_file_flags {
+	/* compiled from every parser's configs, merged */
+	MENU_FILE_MERGED	= 0x1,
+};
+
+struct menu_file_header {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	flags;
+	uint32_t	size;		/* of the whole file */
+	uint32_t	checksum;	/* of everything after the header */
+	uint32_t	fingerprint[2];	/* high half first */
+	uint32_t	n_devices;
+	uint32_t	n_options;
+	uint32_t	strings_len;
+};
+
+struct menu_file_device {
+	uint32_t	n_options;
+	uint32_t	id;
+	uint32_t	name;
+	uint32_t	description;
+	uint32_t	icon_file;
+};
+
+struct menu_file_option {
+	uint32_t	id;
+	uint32_t	name;
+	uint32_t	description;
+	uint32_t	icon_file;
+	uint32_t	boot_image_file;
+	uint32_t	initrd_file;
+	uint32_t	boot_args;
+};
+
+/*
+ * String fields are references: the top four bits give the kind of
+ * reference, and the rest an offset into the string table. Paths on the
+ * device are stored as they would be written in a config file, so that
+ * they are resolved against wherever the device is mounted when the menu
+ * is loaded.
+ */
+enum menu_ref_kind {
+	MENU_REF_STRING		= 0x0,	/* the string itself */
+	MENU_REF_PATH		= 0x1,	/* a path, to resolve_path() */
+	MENU_REF_GENERIC_ICON	= 0xd,	/* the icon for the type of device */
+	MENU_REF_DEVICE_PATH	= 0xe,	/* the path of the device */
+	MENU_REF_NULL		= 0xf,	/* no string */
+};
+
+#define MENU_REF(kind, offset)	((uint32_t)(kind) << 28 | (offset))
+#define MENU_REF_KIND(ref)	((ref) >> 28)
+#define MENU_REF_OFFSET(ref)	((ref) & 0x0fffffff)
+#define MENU_REF_MAX_OFFSET	0x0fffffff
+
+/* FNV-1a, for the checksum and fingerprint */
+#define MENU_FILE_HASH32_INIT	2166136261u
+#define MENU_FILE_HASH64_INIT	14695981039346656037ull
+
+static inline uint32_t menu_file_hash32(uint32_t hash, const void *data,
+		size_t len)
+{
+	const unsigned char *c = data;
+
+	while (len--)
+		hash = (hash ^ *c++) * 16777619u;
+
+	return hash;
+}
+
+static inline uint64_t menu_file_hash64(uint64_t hash, const void *data,
+		size_t len)
+{
+	const unsigned char *c = data;
+
+	while (len--)
+		hash = (hash ^ *c++) * 1099511628211ull;
+
+	return hash;
+}
+
+#endif /* _MENU_FILE_H */
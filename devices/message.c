@@ -0,0 +1,582 @@
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <asm/byteorder.h>
+
+#include "message.h"
+
+void free_device(struct device *dev)
+{
+	if (!dev)
+		return;
+	if (dev->id)
+		free(dev->id);
+	if (dev->name)
+		free(dev->name);
+	if (dev->description)
+		free(dev->description);
+	if (dev->icon_file)
+		free(dev->icon_file);
+	free(dev);
+}
+
+void free_boot_option(struct boot_option *opt)
+{
+	if (!opt)
+		return;
+	if (opt->id)
+		free(opt->id);
+	if (opt->name)
+		free(opt->name);
+	if (opt->description)
+		free(opt->description);
+	if (opt->icon_file)
+		free(opt->icon_file);
+	if (opt->boot_image_file)
+		free(opt->boot_image_file);
+	if (opt->initrd_file)
+		free(opt->initrd_file);
+	if (opt->boot_args)
+		free(opt->boot_args);
+	free(opt);
+}
+
+/* make room for another @len bytes in @buf */
+int msg_buf_reserve(struct msg_buf *buf, unsigned int len)
+{
+	unsigned int size;
+	char *data;
+
+	if (buf->len + len <= buf->size)
+		return 0;
+
+	for (size = buf->size ? buf->size : 256; size < buf->len + len;)
+		size *= 2;
+
+	data = realloc(buf->data, size);
+	if (!data) {
+		pb_log("no memory for message buffer\n");
+		return -1;
+	}
+
+	buf->data = data;
+	buf->size = size;
+	return 0;
+}
+
+/* append raw data, such as messages that have already been built */
+int msg_buf_add_data(struct msg_buf *buf, const char *data, unsigned int len)
+{
+	if (msg_buf_reserve(buf, len))
+		return -1;
+
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+	return 0;
+}
+
+int msg_buf_add_action(struct msg_buf *buf, enum device_action action)
+{
+	if (msg_buf_reserve(buf, 1))
+		return -1;
+
+	buf->data[buf->len++] = action;
+	return 0;
+}
+
+int msg_buf_add_string(struct msg_buf *buf, const char *str)
+{
+	uint32_t len_buf;
+	int len;
+
+	len = str ? strlen(str) : 0;
+	if (len + 1 > MAX_STRING_LEN) {
+		pb_log("string too large\n");
+		return -1;
+	}
+
+	if (msg_buf_reserve(buf, sizeof(len_buf) + len + 1))
+		return -1;
+
+	len_buf = __cpu_to_be32(len);
+	memcpy(buf->data + buf->len, &len_buf, sizeof(len_buf));
+	if (len)
+		memcpy(buf->data + buf->len + sizeof(len_buf), str, len);
+	buf->len += sizeof(len_buf) + len;
+
+	if (buf->terminate)
+		buf->data[buf->len++] = '\0';
+
+	return 0;
+}
+
+int msg_buf_add_u32(struct msg_buf *buf, uint32_t val)
+{
+	uint32_t val_buf = __cpu_to_be32(val);
+
+	if (msg_buf_reserve(buf, sizeof(val_buf)))
+		return -1;
+
+	memcpy(buf->data + buf->len, &val_buf, sizeof(val_buf));
+	buf->len += sizeof(val_buf);
+	return 0;
+}
+
+int msg_buf_add_u64(struct msg_buf *buf, uint64_t val)
+{
+	return msg_buf_add_u32(buf, val >> 32) ||
+		msg_buf_add_u32(buf, val & 0xffffffff);
+}
+
+int msg_buf_add_device(struct msg_buf *buf, const struct device *dev)
+{
+	return msg_buf_add_action(buf, DEV_ACTION_ADD_DEVICE) ||
+		msg_buf_add_string(buf, dev->id) ||
+		msg_buf_add_string(buf, dev->name) ||
+		msg_buf_add_string(buf, dev->description) ||
+		msg_buf_add_string(buf, dev->icon_file);
+}
+
+int msg_buf_add_boot_option(struct msg_buf *buf, enum device_action action,
+		const struct boot_option *opt)
+{
+	return msg_buf_add_action(buf, action) ||
+		msg_buf_add_string(buf, opt->id) ||
+		msg_buf_add_string(buf, opt->name) ||
+		msg_buf_add_string(buf, opt->description) ||
+		msg_buf_add_string(buf, opt->icon_file) ||
+		msg_buf_add_string(buf, opt->boot_image_file) ||
+		msg_buf_add_string(buf, opt->initrd_file) ||
+		msg_buf_add_string(buf, opt->boot_args) ||
+		msg_buf_add_u32(buf, opt->flags) ||
+		msg_buf_add_u64(buf, opt->boot_image_size) ||
+		msg_buf_add_u64(buf, opt->initrd_size);
+}
+
+int msg_buf_write(int fd, const struct msg_buf *buf)
+{
+	unsigned int pos = 0;
+	int rc;
+
+	while (pos < buf->len) {
+		rc = write(fd, buf->data + pos, buf->len - pos);
+		if (rc <= 0) {
+			pb_log("write failed: %s\n", strerror(errno));
+			return -1;
+		}
+		pos += rc;
+	}
+
+	return 0;
+}
+
+void msg_buf_free(struct msg_buf *buf)
+{
+	free(buf->data);
+	buf->data = NULL;
+	buf->len = buf->size = 0;
+}
+
+/* Each of these sends a single message with one write() */
+int write_action(int fd, enum device_action action)
+{
+	struct msg_buf buf = MSG_BUF_INIT;
+	int rc;
+
+	rc = msg_buf_add_action(&buf, action) || msg_buf_write(fd, &buf);
+	msg_buf_free(&buf);
+	return rc;
+}
+
+int write_string(int fd, const char *str)
+{
+	struct msg_buf buf = MSG_BUF_INIT;
+	int rc;
+
+	rc = msg_buf_add_string(&buf, str) || msg_buf_write(fd, &buf);
+	msg_buf_free(&buf);
+	return rc;
+}
+
+int write_device(int fd, const struct device *dev)
+{
+	struct msg_buf buf = MSG_BUF_INIT;
+	int rc;
+
+	rc = msg_buf_add_device(&buf, dev) || msg_buf_write(fd, &buf);
+	msg_buf_free(&buf);
+	return rc;
+}
+
+int write_boot_option(int fd, enum device_action action,
+		const struct boot_option *opt)
+{
+	struct msg_buf buf = MSG_BUF_INIT;
+	int rc;
+
+	rc = msg_buf_add_boot_option(&buf, action, opt) ||
+		msg_buf_write(fd, &buf);
+	msg_buf_free(&buf);
+	return rc;
+}
+
+/* send a single action byte, with @fd attached */
+int write_action_fd(int sock, enum device_action action, int fd)
+{
+	char cbuf[CMSG_SPACE(sizeof(fd))];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	uint8_t action_buf = action;
+
+	iov.iov_base = &action_buf;
+	iov.iov_len = sizeof(action_buf);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fd));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(fd));
+
+	/* a full non-blocking socket is left for the caller to retry, with
+	 * errno intact */
+	if (sendmsg(sock, &msg, 0) != sizeof(action_buf)) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			pb_log("sendmsg failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+int read_action(int fd, enum device_action *action)
+{
+	uint8_t action_buf;
+
+	if (read(fd, &action_buf, sizeof(action_buf)) != sizeof(action_buf))
+		return -1;
+
+	*action = action_buf;
+	return 0;
+}
+
+/* like read_action, but also receive an fd if one was attached. *fd is
+ * set to -1 if there wasn't one */
+int read_action_fd(int sock, enum device_action *action, int *fd)
+{
+	char cbuf[CMSG_SPACE(sizeof(*fd))];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	uint8_t action_buf;
+
+	iov.iov_base = &action_buf;
+	iov.iov_len = sizeof(action_buf);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+
+	*fd = -1;
+
+	if (recvmsg(sock, &msg, 0) != sizeof(action_buf))
+		return -1;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+				cmsg->cmsg_type == SCM_RIGHTS)
+			memcpy(fd, CMSG_DATA(cmsg), sizeof(*fd));
+
+	*action = action_buf;
+	return 0;
+}
+
+/* read all of @len bytes; a message may arrive in any number of pieces */
+static int read_all(int fd, void *buf, unsigned int len)
+{
+	char *pos = buf;
+	int rc;
+
+	while (len) {
+		rc = read(fd, pos, len);
+		if (rc <= 0) {
+			if (rc < 0)
+				pb_log("read failed: %s\n", strerror(errno));
+			return -1;
+		}
+		pos += rc;
+		len -= rc;
+	}
+
+	return 0;
+}
+
+int read_u32(int fd, uint32_t *val)
+{
+	uint32_t val_buf;
+
+	if (read_all(fd, &val_buf, sizeof(val_buf)))
+		return -1;
+
+	*val = __be32_to_cpu(val_buf);
+	return 0;
+}
+
+int read_u64(int fd, uint64_t *val)
+{
+	uint32_t hi, lo;
+
+	if (read_u32(fd, &hi) || read_u32(fd, &lo))
+		return -1;
+
+	*val = (uint64_t)hi << 32 | lo;
+	return 0;
+}
+
+char *read_string(int fd)
+{
+	uint32_t len_buf;
+	unsigned int len;
+	char *str;
+
+	if (read_all(fd, &len_buf, sizeof(len_buf)))
+		return NULL;
+
+	len = __be32_to_cpu(len_buf);
+	if (len >= MAX_STRING_LEN) {
+		pb_log("string too large\n");
+		return NULL;
+	}
+
+	str = malloc(len + 1);
+	if (!str)
+		return NULL;
+
+	if (read_all(fd, str, len)) {
+		free(str);
+		return NULL;
+	}
+	str[len] = '\0';
+
+	return str;
+}
+
+struct device *read_device(int fd)
+{
+	struct device *dev;
+
+	dev = malloc(sizeof(*dev));
+	if (!dev)
+		return NULL;
+	memset(dev, 0, sizeof(*dev));
+
+	if (!(dev->id = read_string(fd)) ||
+			!(dev->name = read_string(fd)) ||
+			!(dev->description = read_string(fd)) ||
+			!(dev->icon_file = read_string(fd))) {
+		free_device(dev);
+		return NULL;
+	}
+
+	return dev;
+}
+
+struct boot_option *read_boot_option(int fd)
+{
+	struct boot_option *opt;
+
+	opt = malloc(sizeof(*opt));
+	if (!opt)
+		return NULL;
+	memset(opt, 0, sizeof(*opt));
+
+	if (!(opt->id = read_string(fd)) ||
+			!(opt->name = read_string(fd)) ||
+			!(opt->description = read_string(fd)) ||
+			!(opt->icon_file = read_string(fd)) ||
+			!(opt->boot_image_file = read_string(fd)) ||
+			!(opt->initrd_file = read_string(fd)) ||
+			!(opt->boot_args = read_string(fd)) ||
+			read_u32(fd, &opt->flags) ||
+			read_u64(fd, &opt->boot_image_size) ||
+			read_u64(fd, &opt->initrd_size)) {
+		free_boot_option(opt);
+		return NULL;
+	}
+
+	return opt;
+}
+
+int msg_reader_action(struct msg_reader *r, enum device_action *action)
+{
+	if (r->pos + 1 > r->len)
+		return -1;
+
+	*action = (uint8_t)r->data[r->pos++];
+	return 0;
+}
+
+const char *msg_reader_string(struct msg_reader *r)
+{
+	const char *str;
+	uint32_t len_buf;
+	unsigned int len;
+
+	if (r->pos + sizeof(len_buf) > r->len)
+		return NULL;
+
+	memcpy(&len_buf, r->data + r->pos, sizeof(len_buf));
+	len = __be32_to_cpu(len_buf);
+
+	if (len + 1 > MAX_STRING_LEN ||
+			r->pos + sizeof(len_buf) + len + 1 > r->len)
+		return NULL;
+
+	str = r->data + r->pos + sizeof(len_buf);
+	if (str[len] != '\0')
+		return NULL;
+
+	r->pos += sizeof(len_buf) + len + 1;
+	return str;
+}
+
+int msg_reader_u32(struct msg_reader *r, uint32_t *val)
+{
+	uint32_t val_buf;
+
+	if (r->pos + sizeof(val_buf) > r->len)
+		return -1;
+
+	memcpy(&val_buf, r->data + r->pos, sizeof(val_buf));
+	r->pos += sizeof(val_buf);
+
+	*val = __be32_to_cpu(val_buf);
+	return 0;
+}
+
+int msg_reader_u64(struct msg_reader *r, uint64_t *val)
+{
+	uint32_t hi, lo;
+
+	if (msg_reader_u32(r, &hi) || msg_reader_u32(r, &lo))
+		return -1;
+
+	*val = (uint64_t)hi << 32 | lo;
+	return 0;
+}
+
+/* the device and option fields are only valid while the reader's data is */
+int msg_reader_device(struct msg_reader *r, struct device *dev)
+{
+	if (!(dev->id = (char *)msg_reader_string(r)) ||
+			!(dev->name = (char *)msg_reader_string(r)) ||
+			!(dev->description = (char *)msg_reader_string(r)) ||
+			!(dev->icon_file = (char *)msg_reader_string(r)))
+		return -1;
+
+	return 0;
+}
+
+int msg_reader_boot_option(struct msg_reader *r, struct boot_option *opt)
+{
+	if (!(opt->id = (char *)msg_reader_string(r)) ||
+			!(opt->name = (char *)msg_reader_string(r)) ||
+			!(opt->description = (char *)msg_reader_string(r)) ||
+			!(opt->icon_file = (char *)msg_reader_string(r)) ||
+			!(opt->boot_image_file = (char *)msg_reader_string(r)) ||
+			!(opt->initrd_file = (char *)msg_reader_string(r)) ||
+			!(opt->boot_args = (char *)msg_reader_string(r)) ||
+			msg_reader_u32(r, &opt->flags) ||
+			msg_reader_u64(r, &opt->boot_image_size) ||
+			msg_reader_u64(r, &opt->initrd_size))
+		return -1;
+
+	return 0;
+}
+
+char *msg_reader_dup_string(struct msg_reader *r)
+{
+	uint32_t len_buf;
+	unsigned int len;
+	char *str;
+
+	if (r->pos + sizeof(len_buf) > r->len)
+		return NULL;
+
+	memcpy(&len_buf, r->data + r->pos, sizeof(len_buf));
+	len = __be32_to_cpu(len_buf);
+
+	if (len >= MAX_STRING_LEN ||
+			r->pos + sizeof(len_buf) + len > r->len)
+		return NULL;
+
+	str = malloc(len + 1);
+	if (!str)
+		return NULL;
+
+	memcpy(str, r->data + r->pos + sizeof(len_buf), len);
+	str[len] = '\0';
+
+	r->pos += sizeof(len_buf) + len;
+	return str;
+}
+
+struct device *msg_reader_dup_device(struct msg_reader *r)
+{
+	struct device *dev;
+
+	dev = malloc(sizeof(*dev));
+	if (!dev)
+		return NULL;
+	memset(dev, 0, sizeof(*dev));
+
+	if (!(dev->id = msg_reader_dup_string(r)) ||
+			!(dev->name = msg_reader_dup_string(r)) ||
+			!(dev->description = msg_reader_dup_string(r)) ||
+			!(dev->icon_file = msg_reader_dup_string(r))) {
+		free_device(dev);
+		return NULL;
+	}
+
+	return dev;
+}
+
+struct boot_option *msg_reader_dup_boot_option(struct msg_reader *r)
+{
+	struct boot_option *opt;
+
+	opt = malloc(sizeof(*opt));
+	if (!opt)
+		return NULL;
+	memset(opt, 0, sizeof(*opt));
+
+	if (!(opt->id = msg_reader_dup_string(r)) ||
+			!(opt->name = msg_reader_dup_string(r)) ||
+			!(opt->description = msg_reader_dup_string(r)) ||
+			!(opt->icon_file = msg_reader_dup_string(r)) ||
+			!(opt->boot_image_file = msg_reader_dup_string(r)) ||
+			!(opt->initrd_file = msg_reader_dup_string(r)) ||
+			!(opt->boot_args = msg_reader_dup_string(r)) ||
+			msg_reader_u32(r, &opt->flags) ||
+			msg_reader_u64(r, &opt->boot_image_size) ||
+			msg_reader_u64(r, &opt->initrd_size)) {
+		free_boot_option(opt);
+		return NULL;
+	}
+
+	return opt;
+}
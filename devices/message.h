@@ -2,11 +2,80 @@
 #ifndef _MESSAGE_H
 #define _MESSAGE_H
 
+#include <stdint.h>
+
+/*
+ * Each message on the device socket is a single action byte, followed by
+ * a number of strings and integers. Strings are sent as a 32-bit big-endian
+ * length, followed by the (non-terminated) string data. Integers are sent
+ * big-endian, 64-bit integers as two 32-bit halves, high half first.
+ *
+ *  DEV_ACTION_ADD_DEVICE:    id, name, description, icon_file
+ *  DEV_ACTION_ADD_OPTION:    a struct boot_option, in field order
+ *  DEV_ACTION_REMOVE_DEVICE: device id
+ *  DEV_ACTION_REMOVE_OPTION: option id
+ *  DEV_ACTION_UPDATE_OPTION: a struct boot_option, in field order
+ *  DEV_ACTION_SUBSCRIBE:     (no data)
+ *  DEV_ACTION_SUBSCRIBE_SHM: (no data)
+ *  DEV_ACTION_SHM_REGION:    (no data, carries an fd in SCM_RIGHTS)
+ *  DEV_ACTION_SHM_GENERATION: 32-bit big-endian generation number
+ *  DEV_ACTION_PARSE_DEVICE:  device path, 32-bit flags, 32-bit icon type
+ *  DEV_ACTION_PARSE_RESULT:  32-bit status, then the device and its options
+ *
+ * Option messages apply to the device most recently sent on the same
+ * connection. Sending ADD_DEVICE for a device id that the receiver
+ * already knows about just selects that device, so a sender can follow
+ * it with option-level changes rather than re-sending the whole device.
+ * Options are matched by their id.
+ *
+ * Helpers connect to the discovery daemon and send device and option
+ * messages. A frontend connects and sends DEV_ACTION_SUBSCRIBE; the daemon
+ * then sends it the complete current device table in a single write,
+ * followed by the messages for each change to the table as it happens.
+ *
+ * A frontend may instead send DEV_ACTION_SUBSCRIBE_SHM, to receive the table
+ * through shared memory (see shm-table.h). The daemon replies with
+ * DEV_ACTION_SHM_REGION, passing a read-only fd for the region, then sends
+ * DEV_ACTION_SHM_GENERATION whenever new records have been published. A
+ * new SHM_REGION message means that the region has been replaced, and the
+ * frontend should read the new one from the start. If the daemon can't
+ * create a region, it treats the frontend as a normal subscriber.
+ *
+ * A helper that has mounted a device sends DEV_ACTION_PARSE_DEVICE on a
+ * connection of its own, to have the device's configs parsed by the
+ * daemon's parser pool (see parser-pool.h). The icon type is the
+ * enum generic_icon_type for the device. The reply is a PARSE_RESULT; if
+ * its status is PARSE_STATUS_OK, it is followed by an ADD_DEVICE message
+ * and ADD_OPTION messages for what was found, if anything, and the
+ * connection is then closed. If the connection closes before the
+ * PARSE_RESULT, the parse failed. With PARSE_STATUS_UNAVAILABLE, the
+ * daemon has no parser pool, and with PARSE_STATUS_DENIED, the worker
+ * wasn't allowed to read a config file on the device; in either case,
+ * nothing follows, and the helper must parse the device itself.
+ */
 enum device_action {
 	DEV_ACTION_ADD_DEVICE = 0,
 	DEV_ACTION_ADD_OPTION = 1,
 	DEV_ACTION_REMOVE_DEVICE = 2,
-	DEV_ACTION_REMOVE_OPTION = 3
+	DEV_ACTION_REMOVE_OPTION = 3,
+	DEV_ACTION_UPDATE_OPTION = 4,
+	DEV_ACTION_SUBSCRIBE = 5,
+	DEV_ACTION_SUBSCRIBE_SHM = 6,
+	DEV_ACTION_SHM_REGION = 7,
+	DEV_ACTION_SHM_GENERATION = 8,
+	DEV_ACTION_PARSE_DEVICE = 9,
+	DEV_ACTION_PARSE_RESULT = 10
+};
+
+enum parse_flags {
+	/* merge the options of every parser, see struct parser_context */
+	PARSE_FLAG_MERGE	= 0x1,
+};
+
+enum parse_status {
+	PARSE_STATUS_OK		= 0,
+	PARSE_STATUS_UNAVAILABLE = 1,
+	PARSE_STATUS_DENIED	= 2,
 };
 
 struct device {
@@ -16,6 +85,18 @@ struct device {
 	char *icon_file;
 };
 
+/* what was found when an option's files were checked. Options that
+ * haven't been checked have no flags set */
+enum boot_option_flags {
+	BOOT_OPTION_IMAGE_MISSING	= 1 << 0,
+	BOOT_OPTION_INITRD_MISSING	= 1 << 1,
+	BOOT_OPTION_ICON_MISSING	= 1 << 2,
+};
+
+/* an option that can't be booted */
+#define BOOT_OPTION_BROKEN \
+	(BOOT_OPTION_IMAGE_MISSING | BOOT_OPTION_INITRD_MISSING)
+
 struct boot_option {
 	char *id;
 	char *name;
@@ -24,7 +105,90 @@ struct boot_option {
 	char *boot_image_file;
 	char *initrd_file;
 	char *boot_args;
+	uint32_t flags;
+	uint64_t boot_image_size;
+	uint64_t initrd_size;
 };
 
+void free_device(struct device *dev);
+void free_boot_option(struct boot_option *opt);
+
+/* the longest string that can be sent, including a terminating NUL */
+#define MAX_STRING_LEN 4096
+
+/* the longest message that can be sent: a boot option, with each of its
+ * strings as long as they can be */
+#define MAX_MESSAGE_LEN \
+	(1 + 7 * (sizeof(uint32_t) + MAX_STRING_LEN - 1) + \
+	 sizeof(uint32_t) + 2 * sizeof(uint64_t))
+
+/* socket protocol helpers, provided by message.c */
+
+/* a buffer of messages, to be sent with a single write. If terminate is
+ * set, each string is followed by a NUL (which isn't included in its
+ * length), so that the messages can be read in place by a msg_reader */
+struct msg_buf {
+	char		*data;
+	unsigned int	len;
+	unsigned int	size;
+	int		terminate;
+};
+
+#define MSG_BUF_INIT { NULL, 0, 0, 0 }
+#define MSG_BUF_INIT_TERMINATED { NULL, 0, 0, 1 }
+
+int msg_buf_reserve(struct msg_buf *buf, unsigned int len);
+int msg_buf_add_data(struct msg_buf *buf, const char *data, unsigned int len);
+int msg_buf_add_action(struct msg_buf *buf, enum device_action action);
+int msg_buf_add_string(struct msg_buf *buf, const char *str);
+int msg_buf_add_u32(struct msg_buf *buf, uint32_t val);
+int msg_buf_add_u64(struct msg_buf *buf, uint64_t val);
+int msg_buf_add_device(struct msg_buf *buf, const struct device *dev);
+int msg_buf_add_boot_option(struct msg_buf *buf, enum device_action action,
+		const struct boot_option *opt);
+int msg_buf_write(int fd, const struct msg_buf *buf);
+void msg_buf_free(struct msg_buf *buf);
+
+int write_action(int fd, enum device_action action);
+int write_string(int fd, const char *str);
+int write_device(int fd, const struct device *dev);
+int write_boot_option(int fd, enum device_action action,
+		const struct boot_option *opt);
+
+int write_action_fd(int sock, enum device_action action, int fd);
+
+int read_action(int fd, enum device_action *action);
+int read_action_fd(int sock, enum device_action *action, int *fd);
+int read_u32(int fd, uint32_t *val);
+int read_u64(int fd, uint64_t *val);
+char *read_string(int fd);
+struct device *read_device(int fd);
+struct boot_option *read_boot_option(int fd);
+
+/* reads messages in place from a terminated msg_buf's data. The strings
+ * returned point into the data, so nothing needs to be freed */
+struct msg_reader {
+	const char	*data;
+	unsigned int	len;
+	unsigned int	pos;
+};
+
+int msg_reader_action(struct msg_reader *r, enum device_action *action);
+const char *msg_reader_string(struct msg_reader *r);
+int msg_reader_u32(struct msg_reader *r, uint32_t *val);
+int msg_reader_u64(struct msg_reader *r, uint64_t *val);
+int msg_reader_device(struct msg_reader *r, struct device *dev);
+int msg_reader_boot_option(struct msg_reader *r, struct boot_option *opt);
+
+/* like the read_* functions, but for messages that have been received into
+ * a buffer, as they were sent (so the strings aren't terminated): each
+ * returns an allocated copy, or NULL if the message doesn't fit in the
+ * rest of the data */
+char *msg_reader_dup_string(struct msg_reader *r);
+struct device *msg_reader_dup_device(struct msg_reader *r);
+struct boot_option *msg_reader_dup_boot_option(struct msg_reader *r);
+
+/* provided by the user of message.c */
+void pb_log(const char *fmt, ...);
 
 #endif /* _MESSAGE_H */
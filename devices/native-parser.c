@@ -2,123 +2,156 @@
 #include "parser.h"
 #include "params.h"
 #include "paths.h"
+#include "native-keywords.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
-const char *conf_filename = "/boot/petitboot.conf";
+static const char *const conf_filenames[] = {
+	"/boot/petitboot.conf",
+	NULL,
+};
 
-static struct boot_option *cur_opt;
-static struct device *dev;
-static const char *devpath;
-int device_added;
+/* the state of one parse of a petitboot.conf */
+struct native_state {
+	struct parser_context *ctx;
+	struct boot_option *cur_opt;
+	struct device *dev;
+	int device_added;
+};
 
-int check_and_add_device(struct device *dev)
+static int check_and_add_device(struct parser_context *ctx,
+		struct device *dev)
 {
 	if (!dev->icon_file)
-		dev->icon_file = strdup(generic_icon_file(guess_device_type()));
+		dev->icon_file = arena_strdup(&ctx->arena,
+				generic_icon_file(guess_device_type()));
 
-	return !add_device(dev);
+	return !add_device(ctx, dev);
 }
 
-static int section(char *section_name)
+static int section(char *section_name, void *arg)
 {
-	if (!device_added++ && !check_and_add_device(dev))
+	struct native_state *state = arg;
+
+	if (!state->device_added++ &&
+			!check_and_add_device(state->ctx, state->dev))
 		return 0;
 
-	if (cur_opt) {
-		add_boot_option(cur_opt);
-		free_boot_option(cur_opt);
-	}
+	/* add_boot_option() takes a copy, so the option can be reused */
+	if (state->cur_opt)
+		add_boot_option(state->ctx, state->cur_opt);
+	else
+		state->cur_opt = arena_alloc(&state->ctx->arena,
+				sizeof(*state->cur_opt));
+
+	if (!state->cur_opt)
+		return 0;
 
-	cur_opt = malloc(sizeof(*cur_opt));
-	memset(cur_opt, 0, sizeof(*cur_opt));
+	memset(state->cur_opt, 0, sizeof(*state->cur_opt));
 	return 1;
 }
 
 
-static void set_boot_option_parameter(struct boot_option *opt,
-		const char *name, const char *value)
+static void set_boot_option_parameter(struct native_state *state,
+		struct boot_option *opt, const char *name, const char *value)
 {
-	if (streq(name, "name"))
-		opt->name = strdup(value);
-
-	else if (streq(name, "description"))
-		opt->description = strdup(value);
-
-	else if (streq(name, "image"))
-		opt->boot_image_file = resolve_path(value, devpath);
-
-	else if (streq(name, "icon"))
-		opt->icon_file = resolve_path(value, devpath);
-
-	else if (streq(name, "initrd"))
-		opt->initrd_file =resolve_path(value, devpath);
-
-	else if (streq(name, "args"))
-		opt->boot_args = strdup(value);
-
-	else
+	const char *devpath = state->ctx->device_path;
+	struct arena *arena = &state->ctx->arena;
+
+	switch (native_keyword(name, strlen(name))) {
+	case NATIVE_NAME:
+		opt->name = arena_strdup(arena, value);
+		break;
+	case NATIVE_DESCRIPTION:
+		opt->description = arena_strdup(arena, value);
+		break;
+	case NATIVE_IMAGE:
+		opt->boot_image_file = resolve_path_arena(arena, value, devpath);
+		break;
+	case NATIVE_ICON:
+		opt->icon_file = resolve_path_arena(arena, value, devpath);
+		break;
+	case NATIVE_INITRD:
+		opt->initrd_file = resolve_path_arena(arena, value, devpath);
+		break;
+	case NATIVE_ARGS:
+		opt->boot_args = arena_strdup(arena, value);
+		break;
+	default:
 		fprintf(stderr, "Unknown parameter %s\n", name);
+	}
 }
 
-static void set_device_parameter(struct device *dev,
-		const char *name, const char *value)
+static void set_device_parameter(struct native_state *state,
+		struct device *dev, const char *name, const char *value)
 {
-	if (streq(name, "name"))
-		dev->name = strdup(value);
-
-	else if (streq(name, "description"))
-		dev->description = strdup(value);
-
-	else if (streq(name, "icon"))
-		dev->icon_file = resolve_path(value, devpath);
+	struct arena *arena = &state->ctx->arena;
+
+	switch (native_keyword(name, strlen(name))) {
+	case NATIVE_NAME:
+		dev->name = arena_strdup(arena, value);
+		break;
+	case NATIVE_DESCRIPTION:
+		dev->description = arena_strdup(arena, value);
+		break;
+	case NATIVE_ICON:
+		dev->icon_file = resolve_path_arena(arena, value,
+				state->ctx->device_path);
+		break;
+	}
 }
 
-static int parameter(char *param_name, char *param_value)
+static int parameter(char *param_name, char *param_value, void *arg)
 {
-	if (cur_opt)
-		set_boot_option_parameter(cur_opt, param_name, param_value);
+	struct native_state *state = arg;
+
+	if (state->cur_opt)
+		set_boot_option_parameter(state, state->cur_opt,
+				param_name, param_value);
 	else
-		set_device_parameter(dev, param_name, param_value);
+		set_device_parameter(state, state->dev,
+				param_name, param_value);
 	return 1;
 }
 
 
-int parse(const char *device)
+static int parse(struct parser_context *ctx)
 {
+	struct native_state state;
+	struct config_file file;
 	char *filepath;
 	int rc;
 
-	filepath = resolve_path(conf_filename, device);
-
-	cur_opt = NULL;
-	dev = malloc(sizeof(*dev));
-	memset(dev, 0, sizeof(*dev));
-	dev->id = strdup(device);
+	filepath = resolve_path_arena(&ctx->arena, ctx->filename,
+			ctx->device_path);
 
-	rc = pm_process(filepath, section, parameter);
-	if (!rc)
+	if (!filepath || load_config_file(ctx, filepath, 0, &file))
 		return 0;
 
-	if (cur_opt) {
-		add_boot_option(cur_opt);
-		free_boot_option(cur_opt);
+	memset(&state, 0, sizeof(state));
+	state.ctx = ctx;
+	state.dev = arena_alloc(&ctx->arena, sizeof(*state.dev));
+	if (!state.dev) {
+		release_config_file(&file);
+		return 0;
 	}
+	state.dev->id = arena_strdup(&ctx->arena, ctx->device_path);
 
-	cur_opt = NULL;
+	rc = pm_process_buffer(file.buf, file.len, &state, section, parameter);
 
-	free(filepath);
+	if (rc && state.cur_opt)
+		add_boot_option(ctx, state.cur_opt);
 
-	return 1;
+	release_config_file(&file);
+
+	return rc ? 1 : 0;
 }
 
 struct parser native_parser = {
 	.name = "native petitboot parser",
 	.priority = 100,
+	.filenames = conf_filenames,
 	.parse	  = parse
 };
-
-
-
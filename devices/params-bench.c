@@ -0,0 +1,180 @@
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "params.h"
+
+/*
+ * Measure the throughput of the native config lexer, over a generated
+ * petitboot.conf or an existing file. Each file is parsed both from memory
+ * (pm_process_buffer) and from disk (pm_process), so that the cost of
+ * mapping the file can be seen separately.
+ */
+
+struct counts {
+	unsigned long	sections;
+	unsigned long	params;
+	unsigned long	bytes;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int section(char *name, void *arg)
+{
+	struct counts *counts = arg;
+
+	counts->sections++;
+	counts->bytes += strlen(name);
+	return 1;
+}
+
+static int parameter(char *name, char *value, void *arg)
+{
+	struct counts *counts = arg;
+
+	counts->params++;
+	counts->bytes += strlen(name) + strlen(value);
+	return 1;
+}
+
+/* write a config with @n_sections boot options, shaped like a real one */
+static int generate(FILE *fp, int n_sections)
+{
+	int i;
+
+	fprintf(fp, "# generated by params-bench\n"
+			"name = Generated device\n"
+			"description = %d boot options\n\n", n_sections);
+
+	for (i = 0; i < n_sections; i++) {
+		fprintf(fp, "[option %d]\n", i);
+		fprintf(fp, "name = option-%d\n", i);
+		fprintf(fp, "description = Linux 2.6.%d, with a longer "
+				"description than most\n", i);
+		fprintf(fp, "image = /boot/vmlinux-2.6.%d\n", i);
+		fprintf(fp, "initrd = /boot/initrd-2.6.%d.img\n", i);
+		fprintf(fp, "args = root=/dev/sda%d console=hvc0 quiet "
+				"video=ps3fb:mode:%d\n", i % 8, i % 14);
+		fprintf(fp, "\n");
+	}
+
+	return ferror(fp) ? -1 : 0;
+}
+
+static void report(const char *name, uint64_t ns, int iterations,
+		unsigned long len, const struct counts *counts)
+{
+	double secs = ns / 1e9;
+	unsigned long entries = counts->sections + counts->params;
+
+	printf("%-8s %8.1f MB/s  %8.1f ns/entry  (%lu sections, "
+			"%lu params)\n", name,
+			(double)len * iterations / secs / (1024 * 1024),
+			entries ? (double)ns / iterations / entries : 0,
+			counts->sections / iterations,
+			counts->params / iterations);
+}
+
+int main(int argc, char **argv)
+{
+	int opt, i, fd, n_sections = 10000, iterations = 20;
+	char tmpname[] = "/tmp/params-bench.XXXXXX";
+	char *filename, *buf = NULL;
+	struct counts counts;
+	struct stat statbuf;
+	uint64_t start;
+	FILE *fp;
+	int rc = EXIT_FAILURE;
+
+	while ((opt = getopt(argc, argv, "n:i:")) != -1) {
+		switch (opt) {
+		case 'n':
+			n_sections = atoi(optarg);
+			break;
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n sections] "
+					"[-i iterations] [file]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind < argc) {
+		filename = argv[optind];
+	} else {
+		filename = tmpname;
+		fd = mkstemp(tmpname);
+		if (fd < 0) {
+			fprintf(stderr, "can't create %s: %s\n", tmpname,
+					strerror(errno));
+			return EXIT_FAILURE;
+		}
+		fp = fdopen(fd, "w");
+		if (!fp || generate(fp, n_sections) || fclose(fp)) {
+			fprintf(stderr, "can't write %s\n", tmpname);
+			goto out_unlink;
+		}
+	}
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0 || fstat(fd, &statbuf)) {
+		fprintf(stderr, "can't open %s: %s\n", filename,
+				strerror(errno));
+		goto out_unlink;
+	}
+
+	buf = malloc(statbuf.st_size + 1);
+	if (!buf || read(fd, buf, statbuf.st_size) != statbuf.st_size) {
+		fprintf(stderr, "can't read %s\n", filename);
+		close(fd);
+		goto out_free;
+	}
+	close(fd);
+
+	printf("%s: %ld bytes, %d iterations\n", filename,
+			(long)statbuf.st_size, iterations);
+
+	memset(&counts, 0, sizeof(counts));
+	start = now_ns();
+	for (i = 0; i < iterations; i++)
+		if (!pm_process_buffer(buf, statbuf.st_size, &counts,
+					section, parameter))
+			goto out_free;
+	report("buffer", now_ns() - start, iterations, statbuf.st_size,
+			&counts);
+
+	memset(&counts, 0, sizeof(counts));
+	start = now_ns();
+	for (i = 0; i < iterations; i++)
+		if (!pm_process(filename, &counts, section, parameter))
+			goto out_free;
+	report("file", now_ns() - start, iterations, statbuf.st_size,
+			&counts);
+
+	rc = EXIT_SUCCESS;
+
+out_free:
+	free(buf);
+out_unlink:
+	if (filename == tmpname)
+		unlink(tmpname);
+	return rc;
+}
@@ -19,8 +19,13 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "params.h"
 
@@ -68,9 +73,10 @@ void *_realloc_array(void *ptr, unsigned int size, unsigned long num)
  *  internally.
  *
  *  The entry point to the module is function pm_process().  This
- *  function opens the source file, calls the Parse() function to parse
- *  the input, and then closes the file when either the EOF is reached
- *  or a fatal error is encountered.
+ *  function maps the source file into memory, calls the Parse() function
+ *  to parse the input, and then unmaps the file when either the EOF is
+ *  reached or a fatal error is encountered.  pm_process_buffer() parses
+ *  a file that is already in memory.
  *
  *  A sample parameter file might look like this:
  *
@@ -120,26 +126,79 @@ void *_realloc_array(void *ptr, unsigned int size, unsigned long num)
 
 
 /* -------------------------------------------------------------------------- **
- * Variables...
+ * Types...
  *
- *  bufr        - pointer to a global buffer.  This is probably a kludge,
- *                but it was the nicest kludge I could think of (for now).
- *  bSize       - The size of the global buffer <bufr>.
+ *  ParseState  - The state of a single call to pm_process(), so that
+ *                several files can be processed at once.
+ *
+ *    pos       - The next character of the input.
+ *    end       - The end of the input.
+ *    bufr      - pointer to the buffer used to collect names and values.
+ *    bSize     - The size of the buffer <bufr>.
+ *    arg       - Passed to the section and parameter functions.
  */
 
-static char *bufr  = NULL;
-static int   bSize = 0;
+typedef struct
+  {
+  const char *pos;
+  const char *end;
+  char *bufr;
+  int   bSize;
+  void *arg;
+  } ParseState;
 
 /* -------------------------------------------------------------------------- **
  * Functions...
  */
 
-static int EatWhitespace( FILE *InFile )
+static inline int NextChar( ParseState *st )
+  /* ------------------------------------------------------------------------ **
+   * Read the next character of the input, in the manner of getc().
+   *
+   *  Input:  st  - The state of this parse.
+   *
+   *  Output: The next character, as an unsigned char, or EOF at the end of
+   *          the input.
+   *
+   * ------------------------------------------------------------------------ **
+   */
+  {
+  return( (st->pos < st->end) ? *(const unsigned char *)st->pos++ : EOF );
+  } /* NextChar */
+
+static BOOL GrowBuffer( ParseState *st, int len, char *func )
+  /* ------------------------------------------------------------------------ **
+   * Make sure there is room for <len> bytes in bufr[].
+   *
+   *  Input:  st    - The state of this parse.
+   *          len   - The number of bytes needed.
+   *          func  - The caller, for error messages.
+   *
+   *  Output: True if there is enough room, False if the buffer could not be
+   *          grown.
+   *
+   * ------------------------------------------------------------------------ **
+   */
+  {
+  if( len <= st->bSize )
+    return( True );
+
+  st->bSize = ((len / BUFR_INC) + 1) * BUFR_INC;
+  st->bufr  = realloc_array( st->bufr, char, st->bSize );
+  if( NULL == st->bufr )
+    {
+    rprintf(FERROR, "%s Memory re-allocation failure.", func);
+    return( False );
+    }
+  return( True );
+  } /* GrowBuffer */
+
+static int EatWhitespace( ParseState *st )
   /* ------------------------------------------------------------------------ **
    * Scan past whitespace (see ctype(3C)) and return the first non-whitespace
    * character, or newline, or EOF.
    *
-   *  Input:  InFile  - Input source.
+   *  Input:  st  - The state of this parse.
    *
    *  Output: The next non-whitespace character in the input stream.
    *
@@ -154,16 +213,16 @@ static int EatWhitespace( FILE *InFile )
   {
   int c;
 
-  for( c = getc( InFile ); isspace( c ) && ('\n' != c); c = getc( InFile ) )
+  for( c = NextChar( st ); isspace( c ) && ('\n' != c); c = NextChar( st ) )
     ;
   return( c );
   } /* EatWhitespace */
 
-static int EatComment( FILE *InFile )
+static int EatComment( ParseState *st )
   /* ------------------------------------------------------------------------ **
    * Scan to the end of a comment.
    *
-   *  Input:  InFile  - Input source.
+   *  Input:  st  - The state of this parse.
    *
    *  Output: The character that marks the end of the comment.  Normally,
    *          this will be a newline, but it *might* be an EOF.
@@ -179,7 +238,7 @@ static int EatComment( FILE *InFile )
   {
   int c;
 
-  for( c = getc( InFile ); ('\n'!=c) && (EOF!=c) && (c>0); c = getc( InFile ) )
+  for( c = NextChar( st ); ('\n'!=c) && (EOF!=c) && (c>0); c = NextChar( st ) )
     ;
   return( c );
   } /* EatComment */
@@ -208,11 +267,11 @@ static int Continuation( char *line, int pos )
   } /* Continuation */
 
 
-static BOOL Section( FILE *InFile, BOOL (*sfunc)(char *) )
+static BOOL Section( ParseState *st, BOOL (*sfunc)(char *, void *) )
   /* ------------------------------------------------------------------------ **
    * Scan a section name, and pass the name to function sfunc().
    *
-   *  Input:  InFile  - Input source.
+   *  Input:  st      - The state of this parse.
    *          sfunc   - Pointer to the function to be called if the section
    *                    name is successfully read.
    *
@@ -234,78 +293,159 @@ static BOOL Section( FILE *InFile, BOOL (*sfunc)(char *) )
               /* character written to bufr[] is a space, then <end>     */
               /* will be one less than <i>.                             */
 
-  c = EatWhitespace( InFile );    /* We've already got the '['.  Scan */
+  c = EatWhitespace( st );        /* We've already got the '['.  Scan */
                                   /* past initial white space.        */
 
   while( (EOF != c) && (c > 0) )
     {
 
     /* Check that the buffer is big enough for the next character. */
-    if( i > (bSize - 2) )
-      {
-      bSize += BUFR_INC;
-      bufr   = realloc_array( bufr, char, bSize );
-      if( NULL == bufr )
-        {
-        rprintf(FERROR, "%s Memory re-allocation failure.", func);
-        return( False );
-        }
-      }
+    if( !GrowBuffer( st, i + 2, func ) )
+      return( False );
 
     /* Handle a single character. */
     switch( c )
       {
       case ']':                       /* Found the closing bracket.         */
-        bufr[end] = '\0';
+        st->bufr[end] = '\0';
         if( 0 == end )                  /* Don't allow an empty name.       */
           {
           rprintf(FERROR, "%s Empty section name in configuration file.\n", func );
           return( False );
           }
-        if( !sfunc( bufr ) )            /* Got a valid name.  Deal with it. */
+        if( !sfunc( st->bufr, st->arg ) )            /* Got a valid name.  Deal with it. */
           return( False );
-        (void)EatComment( InFile );     /* Finish off the line.             */
+        (void)EatComment( st );         /* Finish off the line.             */
         return( True );
 
       case '\n':                      /* Got newline before closing ']'.    */
-        i = Continuation( bufr, i );    /* Check for line continuation.     */
+        i = Continuation( st->bufr, i );    /* Check for line continuation.     */
         if( i < 0 )
           {
-          bufr[end] = '\0';
+          st->bufr[end] = '\0';
           rprintf(FERROR, "%s Badly formed line in configuration file: %s\n",
-                   func, bufr );
+                   func, st->bufr );
           return( False );
           }
-        end = ( (i > 0) && (' ' == bufr[i - 1]) ) ? (i - 1) : (i);
-        c = getc( InFile );             /* Continue with next line.         */
+        end = ( (i > 0) && (' ' == st->bufr[i - 1]) ) ? (i - 1) : (i);
+        c = NextChar( st );             /* Continue with next line.         */
         break;
 
       default:                        /* All else are a valid name chars.   */
         if( isspace( c ) )              /* One space per whitespace region. */
           {
-          bufr[end] = ' ';
+          st->bufr[end] = ' ';
           i = end + 1;
-          c = EatWhitespace( InFile );
+          c = EatWhitespace( st );
           }
         else                            /* All others copy verbatim.        */
           {
-          bufr[i++] = c;
+          st->bufr[i++] = c;
           end = i;
-          c = getc( InFile );
+          c = NextChar( st );
           }
       }
     }
 
   /* We arrive here if we've met the EOF before the closing bracket. */
-  rprintf(FERROR, "%s Unexpected EOF in the configuration file: %s\n", func, bufr );
+  st->bufr[end] = '\0';
+  rprintf(FERROR, "%s Unexpected EOF in the configuration file: %s\n", func, st->bufr );
   return( False );
   } /* Section */
 
-static BOOL Parameter( FILE *InFile, BOOL (*pfunc)(char *, char *), int c )
+static int QuickName( ParseState *st, int c, char *func )
+  /* ------------------------------------------------------------------------ **
+   * Copy a parameter name that is a single word, followed by optional
+   * whitespace and the equal sign, straight from the input into bufr[].
+   *
+   *  Input:  st    - The state of this parse.  <pos> must be just past <c>.
+   *          c     - The first character of the name.
+   *          func  - The caller, for error messages.
+   *
+   *  Output: The length of the name if it was copied, and the input
+   *          advanced past the equal sign.  -1 if the name needs the full
+   *          scan in Parameter(), in which case the input is left untouched.
+   *
+   * ------------------------------------------------------------------------ **
+   */
+  {
+  const unsigned char *start = (const unsigned char *)st->pos - 1;
+  const unsigned char *end   = (const unsigned char *)st->end;
+  const unsigned char *p;
+  int   len;
+
+  if( EOF == c || '=' == c )
+    return( -1 );
+
+  for( p = start; (p < end) && !isspace( *p ) && ('=' != *p) && (0 != *p); p++ )
+    ;
+  len = p - start;
+
+  while( (p < end) && isspace( *p ) && ('\n' != *p) )
+    p++;
+  if( (p >= end) || ('=' != *p) )
+    return( -1 );
+
+  if( !GrowBuffer( st, len + 2, func ) )
+    return( -1 );
+
+  memcpy( st->bufr, start, len );
+  st->bufr[len] = '\0';
+
+  st->pos = (const char *)p + 1;
+  return( len );
+  } /* QuickName */
+
+static BOOL QuickValue( ParseState *st, int i, char *func )
+  /* ------------------------------------------------------------------------ **
+   * Copy a parameter value that is contained on a single line straight
+   * from the input into bufr[], starting at offset <i>.
+   *
+   *  Input:  st    - The state of this parse.  <pos> must be at the first
+   *                  character of the value.
+   *          i     - The offset in bufr[] for the value.
+   *          func  - The caller, for error messages.
+   *
+   *  Output: True if the value was copied, and the input advanced past the
+   *          end of the line.  False if the value needs the full scan in
+   *          Parameter(), because it has a '\r' to strip, a nul, or a line
+   *          continuation.  In this case the input is left untouched.
+   *
+   * ------------------------------------------------------------------------ **
+   */
+  {
+  const char *eol;
+  int         len;
+
+  eol = memchr( st->pos, '\n', st->end - st->pos );
+  if( NULL == eol )
+    eol = st->end;
+  len = eol - st->pos;
+
+  if( memchr( st->pos, '\r', len ) || memchr( st->pos, '\0', len ) )
+    return( False );
+
+  while( (len > 0) && isspace(((const unsigned char *)st->pos)[len - 1]) )
+    len--;
+  if( (len > 0) && ('\\' == st->pos[len - 1]) )
+    return( False );
+
+  if( !GrowBuffer( st, i + len + 1, func ) )
+    return( False );
+
+  memcpy( &st->bufr[i], st->pos, len );
+  st->bufr[i + len] = '\0';
+
+  st->pos = (eol < st->end) ? eol + 1 : eol;
+  return( True );
+  } /* QuickValue */
+
+static BOOL Parameter( ParseState *st, BOOL (*pfunc)(char *, char *, void *),
+                       int c )
   /* ------------------------------------------------------------------------ **
    * Scan a parameter name and value, and pass these two fields to pfunc().
    *
-   *  Input:  InFile  - The input source.
+   *  Input:  st      - The state of this parse.
    *          pfunc   - A pointer to the function that will be called to
    *                    process the parameter, once it has been scanned.
    *          c       - The first character of the parameter name, which
@@ -322,29 +462,29 @@ static BOOL Parameter( FILE *InFile, BOOL (*pfunc)(char *, char *), int c )
    *          whitespace is discarded.  The second loop scans the parameter
    *          value.  When both have been successfully identified, they are
    *          passed to pfunc() for processing.
+   *        - A single-word name, and a value that fits on one line with no
+   *          '\r' to strip, are copied straight from the input rather than
+   *          scanned character by character.
    *
    * ------------------------------------------------------------------------ **
    */
   {
   int   i       = 0;    /* Position within bufr. */
-  int   end     = 0;    /* bufr[end] is current end-of-string. */
+  int   end     = 0;    /* st->bufr[end] is current end-of-string. */
   int   vstart  = 0;    /* Starting position of the parameter value. */
+  int   len;
   char *func    = "params.c:Parameter() -";
 
   /* Read the parameter name. */
+  len = QuickName( st, c, func );
+  if( len > 0 )
+    i = end = vstart = len + 1;
+
   while( 0 == vstart )  /* Loop until we've found the start of the value. */
     {
 
-    if( i > (bSize - 2) )       /* Ensure there's space for next char.    */
-      {
-      bSize += BUFR_INC;
-      bufr   = realloc_array( bufr, char, bSize );
-      if( NULL == bufr )
-        {
-        rprintf(FERROR, "%s Memory re-allocation failure.", func) ;
-        return( False );
-        }
-      }
+    if( !GrowBuffer( st, i + 2, func ) )  /* Ensure there's space for next char. */
+      return( False );
 
     switch( c )
       {
@@ -354,101 +494,101 @@ static BOOL Parameter( FILE *InFile, BOOL (*pfunc)(char *, char *), int c )
           rprintf(FERROR, "%s Invalid parameter name in config. file.\n", func );
           return( False );
           }
-        bufr[end++] = '\0';         /* Mark end of string & advance.   */
+        st->bufr[end++] = '\0';         /* Mark end of string & advance.   */
         i       = end;              /* New string starts here.         */
         vstart  = end;              /* New string is parameter value.  */
-        bufr[i] = '\0';             /* New string is nul, for now.     */
+        st->bufr[i] = '\0';             /* New string is nul, for now.     */
         break;
 
       case '\n':                /* Find continuation char, else error. */
-        i = Continuation( bufr, i );
+        i = Continuation( st->bufr, i );
         if( i < 0 )
           {
-          bufr[end] = '\0';
+          st->bufr[end] = '\0';
           rprintf(FERROR, "%s Ignoring badly formed line in configuration file: %s\n",
-                   func, bufr );
+                   func, st->bufr );
           return( True );
           }
-        end = ( (i > 0) && (' ' == bufr[i - 1]) ) ? (i - 1) : (i);
-        c = getc( InFile );       /* Read past eoln.                   */
+        end = ( (i > 0) && (' ' == st->bufr[i - 1]) ) ? (i - 1) : (i);
+        c = NextChar( st );       /* Read past eoln.                   */
         break;
 
       case '\0':                /* Shouldn't have EOF within param name. */
       case EOF:
-        bufr[i] = '\0';
-        rprintf(FERROR, "%s Unexpected end-of-file at: %s\n", func, bufr );
+        st->bufr[i] = '\0';
+        rprintf(FERROR, "%s Unexpected end-of-file at: %s\n", func, st->bufr );
         return( True );
 
       default:
         if( isspace( c ) )     /* One ' ' per whitespace region.       */
           {
-          bufr[end] = ' ';
+          st->bufr[end] = ' ';
           i = end + 1;
-          c = EatWhitespace( InFile );
+          c = EatWhitespace( st );
           }
         else                   /* All others verbatim.                 */
           {
-          bufr[i++] = c;
+          st->bufr[i++] = c;
           end = i;
-          c = getc( InFile );
+          c = NextChar( st );
           }
       }
     }
 
   /* Now parse the value. */
-  c = EatWhitespace( InFile );  /* Again, trim leading whitespace. */
+  c = EatWhitespace( st );      /* Again, trim leading whitespace. */
+  if( EOF != c )
+    {
+    st->pos--;                  /* Put it back, and try the fast path. */
+    if( QuickValue( st, i, func ) )
+      return( pfunc( st->bufr, &st->bufr[vstart], st->arg ) );
+    c = NextChar( st );
+    }
+
   while( (EOF !=c) && (c > 0) )
     {
 
-    if( i > (bSize - 2) )       /* Make sure there's enough room. */
-      {
-      bSize += BUFR_INC;
-      bufr   = realloc_array( bufr, char, bSize );
-      if( NULL == bufr )
-        {
-        rprintf(FERROR, "%s Memory re-allocation failure.", func) ;
-        return( False );
-        }
-      }
+    if( !GrowBuffer( st, i + 2, func ) )  /* Make sure there's enough room. */
+      return( False );
 
     switch( c )
       {
       case '\r':              /* Explicitly remove '\r' because the older */
-        c = getc( InFile );   /* version called fgets_slash() which also  */
+        c = NextChar( st );   /* version called fgets_slash() which also  */
         break;                /* removes them.                            */
 
       case '\n':              /* Marks end of value unless there's a '\'. */
-        i = Continuation( bufr, i );
+        i = Continuation( st->bufr, i );
         if( i < 0 )
           c = 0;
         else
           {
-          for( end = i; (end >= 0) && isspace(((unsigned char *) bufr)[end]); end-- )
+          for( end = i; (end >= 0) && isspace(((unsigned char *) st->bufr)[end]); end-- )
             ;
-          c = getc( InFile );
+          c = NextChar( st );
           }
         break;
 
       default:               /* All others verbatim.  Note that spaces do */
-        bufr[i++] = c;       /* not advance <end>.  This allows trimming  */
+        st->bufr[i++] = c;       /* not advance <end>.  This allows trimming  */
         if( !isspace( c ) )  /* of whitespace at the end of the line.     */
           end = i;
-        c = getc( InFile );
+        c = NextChar( st );
         break;
       }
     }
-  bufr[end] = '\0';          /* End of value. */
+  st->bufr[end] = '\0';          /* End of value. */
 
-  return( pfunc( bufr, &bufr[vstart] ) );   /* Pass name & value to pfunc().  */
+  return( pfunc( st->bufr, &st->bufr[vstart], st->arg ) );   /* Pass name & value to pfunc().  */
   } /* Parameter */
 
-static BOOL Parse( FILE *InFile,
-                   BOOL (*sfunc)(char *),
-                   BOOL (*pfunc)(char *, char *) )
+static BOOL Parse( ParseState *st,
+                   BOOL (*sfunc)(char *, void *),
+                   BOOL (*pfunc)(char *, char *, void *) )
   /* ------------------------------------------------------------------------ **
    * Scan & parse the input.
    *
-   *  Input:  InFile  - Input source.
+   *  Input:  st      - The state of this parse.
    *          sfunc   - Function to be called when a section name is scanned.
    *                    See Section().
    *          pfunc   - Function to be called when a parameter is scanned.
@@ -469,55 +609,59 @@ static BOOL Parse( FILE *InFile,
   {
   int    c;
 
-  c = EatWhitespace( InFile );
+  c = EatWhitespace( st );
   while( (EOF != c) && (c > 0) )
     {
     switch( c )
       {
       case '\n':                        /* Blank line. */
-        c = EatWhitespace( InFile );
+        c = EatWhitespace( st );
         break;
 
       case ';':                         /* Comment line. */
       case '#':
-        c = EatComment( InFile );
+        c = EatComment( st );
         break;
 
       case '[':                         /* Section Header. */
 	      if (!sfunc) return True;
-	      if( !Section( InFile, sfunc ) )
+	      if( !Section( st, sfunc ) )
 		      return( False );
-	      c = EatWhitespace( InFile );
+	      c = EatWhitespace( st );
 	      break;
 
       case '\\':                        /* Bogus backslash. */
-        c = EatWhitespace( InFile );
+        c = EatWhitespace( st );
         break;
 
       default:                          /* Parameter line. */
-        if( !Parameter( InFile, pfunc, c ) )
+        if( !Parameter( st, pfunc, c ) )
           return( False );
-        c = EatWhitespace( InFile );
+        c = EatWhitespace( st );
         break;
       }
     }
   return( True );
   } /* Parse */
 
-static FILE *OpenConfFile( char *FileName )
+static char *MapConfFile( char *FileName, size_t *Len )
   /* ------------------------------------------------------------------------ **
-   * Open a configuration file.
+   * Map a configuration file into memory.
    *
-   *  Input:  FileName  - The pathname of the config file to be opened.
+   *  Input:  FileName  - The pathname of the config file to be mapped.
+   *          Len       - Set to the length of the file.
    *
-   *  Output: A pointer of type (FILE *) to the opened file, or NULL if the
-   *          file could not be opened.
+   *  Output: A pointer to the (read-only) contents of the file, or NULL if
+   *          the file could not be mapped.  An empty file gives a pointer
+   *          to an empty string, and a <Len> of zero.
    *
    * ------------------------------------------------------------------------ **
    */
   {
-  FILE *OpenedFile;
-  char *func = "params.c:OpenConfFile() -";
+  struct stat statbuf;
+  char *MappedFile;
+  char *func = "params.c:MapConfFile() -";
+  int   fd;
 
   if( NULL == FileName || 0 == *FileName )
     {
@@ -525,62 +669,83 @@ static FILE *OpenConfFile( char *FileName )
     return( NULL );
     }
 
-  OpenedFile = fopen( FileName, "r" );
-  if( NULL == OpenedFile )
+  fd = open( FileName, O_RDONLY );
+  if( fd < 0 )
     {
     rsyserr(FERROR, errno, "unable to open configuration file \"%s\"",
 	    FileName);
+    return( NULL );
     }
 
-  return( OpenedFile );
-  } /* OpenConfFile */
+  if( fstat( fd, &statbuf ) )
+    {
+    rsyserr(FERROR, errno, "unable to stat configuration file \"%s\"",
+	    FileName);
+    close( fd );
+    return( NULL );
+    }
 
-BOOL pm_process( char *FileName,
-                 BOOL (*sfunc)(char *),
-                 BOOL (*pfunc)(char *, char *) )
+  *Len = statbuf.st_size;
+  if( 0 == *Len )
+    {
+    close( fd );
+    return( "" );
+    }
+
+  MappedFile = mmap( NULL, *Len, PROT_READ, MAP_PRIVATE, fd, 0 );
+  close( fd );
+  if( MAP_FAILED == MappedFile )
+    {
+    rsyserr(FERROR, errno, "unable to map configuration file \"%s\"",
+	    FileName);
+    return( NULL );
+    }
+
+  return( MappedFile );
+  } /* MapConfFile */
+
+BOOL pm_process_buffer( const char *Buffer,
+                        int Len,
+                        void *arg,
+                        BOOL (*sfunc)(char *, void *),
+                        BOOL (*pfunc)(char *, char *, void *) )
   /* ------------------------------------------------------------------------ **
-   * Process the named parameter file.
+   * Process a parameter file that is already in memory.
    *
-   *  Input:  FileName  - The pathname of the parameter file to be opened.
+   *  Input:  Buffer    - The contents of the parameter file.  This is not
+   *                      modified, and need not be nul-terminated.
+   *          Len       - The length of <Buffer>.
+   *          arg       - Passed as the last argument to sfunc and pfunc.
    *          sfunc     - A pointer to a function that will be called when
    *                      a section name is discovered.
    *          pfunc     - A pointer to a function that will be called when
    *                      a parameter name and value are discovered.
    *
-   *  Output: TRUE if the file was successfully parsed, else FALSE.
+   *  Output: TRUE if the buffer was successfully parsed, else FALSE.
+   *
+   *  Notes:  All of the parse state is local to this call, so it is safe
+   *          to process several files at once.
    *
    * ------------------------------------------------------------------------ **
    */
   {
   int   result;
-  FILE *InFile;
+  ParseState st;
   char *func = "params.c:pm_process() -";
 
-  InFile = OpenConfFile( FileName );          /* Open the config file. */
-  if( NULL == InFile )
+  st.pos   = Buffer;
+  st.end   = Buffer + Len;
+  st.arg   = arg;
+  st.bSize = BUFR_INC;
+  st.bufr  = new_array( char, st.bSize );
+  if( NULL == st.bufr )
+    {
+    rprintf(FERROR,"%s memory allocation failure.\n", func);
     return( False );
-
-  if( NULL != bufr )                          /* If we already have a buffer */
-    result = Parse( InFile, sfunc, pfunc );   /* (recursive call), then just */
-                                              /* use it.                     */
-
-  else                                        /* If we don't have a buffer   */
-    {                                         /* allocate one, then parse,   */
-    bSize = BUFR_INC;                         /* then free.                  */
-    bufr = new_array( char, bSize );
-    if( NULL == bufr )
-      {
-      rprintf(FERROR,"%s memory allocation failure.\n", func);
-      fclose(InFile);
-      return( False );
-      }
-    result = Parse( InFile, sfunc, pfunc );
-    free( bufr );
-    bufr  = NULL;
-    bSize = 0;
     }
 
-  fclose(InFile);
+  result = Parse( &st, sfunc, pfunc );
+  free( st.bufr );
 
   if( !result )                               /* Generic failure. */
     {
@@ -589,6 +754,41 @@ BOOL pm_process( char *FileName,
     }
 
   return( True );                             /* Generic success. */
+  } /* pm_process_buffer */
+
+BOOL pm_process( char *FileName,
+                 void *arg,
+                 BOOL (*sfunc)(char *, void *),
+                 BOOL (*pfunc)(char *, char *, void *) )
+  /* ------------------------------------------------------------------------ **
+   * Process the named parameter file.
+   *
+   *  Input:  FileName  - The pathname of the parameter file to be opened.
+   *          arg       - Passed as the last argument to sfunc and pfunc.
+   *          sfunc     - A pointer to a function that will be called when
+   *                      a section name is discovered.
+   *          pfunc     - A pointer to a function that will be called when
+   *                      a parameter name and value are discovered.
+   *
+   *  Output: TRUE if the file was successfully parsed, else FALSE.
+   *
+   * ------------------------------------------------------------------------ **
+   */
+  {
+  int     result;
+  char   *InBuf;
+  size_t  Len;
+
+  InBuf = MapConfFile( FileName, &Len );      /* Map the config file. */
+  if( NULL == InBuf )
+    return( False );
+
+  result = pm_process_buffer( InBuf, Len, arg, sfunc, pfunc );
+
+  if( Len )
+    munmap( InBuf, Len );
+
+  return( result );
   } /* pm_process */
 
 /* -------------------------------------------------------------------------- */
@@ -2,5 +2,12 @@
 #define BOOL int
 
 BOOL pm_process( char *FileName,
-                 BOOL (*sfunc)(char *),
-                 BOOL (*pfunc)(char *, char *) );
+                 void *arg,
+                 BOOL (*sfunc)(char *, void *),
+                 BOOL (*pfunc)(char *, char *, void *) );
+
+BOOL pm_process_buffer( const char *Buffer,
+                        int Len,
+                        void *arg,
+                        BOOL (*sfunc)(char *, void *),
+                        BOOL (*pfunc)(char *, char *, void *) );
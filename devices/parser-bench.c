@@ -0,0 +1,519 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <malloc.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "parser.h"
+#include "paths.h"
+
+/*
+ * Benchmark the parsers, in-process, over generated kboot.conf, yaboot.conf
+ * and petitboot.conf files of a range of sizes. For each file, we report
+ * the parse time and the number of heap allocations per boot option, and
+ * the peak heap use of the parse.
+ *
+ * The results can be checked against a stored baseline, so that a change
+ * that makes a parser slower, or makes it allocate more, fails the run.
+ * Allocation counts and memory use are deterministic, and are held to a
+ * tight tolerance; times depend on the machine, and are held to a loose
+ * one (see -t).
+ */
+
+/* heap accounting, by interposing the libc allocator */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+extern void __libc_free(void *ptr);
+
+static unsigned long heap_allocs;
+static long heap_live, heap_peak;
+
+static void *heap_account(void *ptr)
+{
+	if (ptr) {
+		heap_allocs++;
+		heap_live += malloc_usable_size(ptr);
+		if (heap_live > heap_peak)
+			heap_peak = heap_live;
+	}
+	return ptr;
+}
+
+void *malloc(size_t size)
+{
+	return heap_account(__libc_malloc(size));
+}
+
+void *calloc(size_t n, size_t size)
+{
+	return heap_account(__libc_calloc(n, size));
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	if (ptr)
+		heap_live -= malloc_usable_size(ptr);
+	ptr = __libc_realloc(ptr, size);
+	return heap_account(ptr);
+}
+
+void *memalign(size_t align, size_t size)
+{
+	return heap_account(__libc_memalign(align, size));
+}
+
+int posix_memalign(void **ptr, size_t align, size_t size)
+{
+	*ptr = heap_account(__libc_memalign(align, size));
+	return *ptr ? 0 : ENOMEM;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+	return heap_account(__libc_memalign(align, size));
+}
+
+void free(void *ptr)
+{
+	if (ptr)
+		heap_live -= malloc_usable_size(ptr);
+	__libc_free(ptr);
+}
+
+/* the parser callbacks; we only count the options */
+struct bench_output {
+	int	devices;
+	int	options;
+};
+
+void pb_log(const char *fmt, ...)
+{
+}
+
+int mount_device(const char *dev_path)
+{
+	return 0;
+}
+
+int add_device(struct parser_context *ctx, const struct device *dev)
+{
+	struct bench_output *out = ctx->data;
+
+	out->devices++;
+	return 0;
+}
+
+int add_boot_option(struct parser_context *ctx,
+		const struct boot_option *opt)
+{
+	struct bench_output *out = ctx->data;
+
+	out->options++;
+	return 0;
+}
+
+enum generic_icon_type guess_device_type(void)
+{
+	return ICON_TYPE_UNKNOWN;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* a kernel command line; one in eight is over 400 bytes long, as some
+ * distro configs have */
+static void print_args(FILE *fp, int i)
+{
+	int j;
+
+	fprintf(fp, "console=hvc0 quiet splash video=ps3fb:mode:%d", i % 14);
+	if (i % 8)
+		return;
+	for (j = 0; j < 24; j++)
+		fprintf(fp, " opt%d.param%d=value%d", j, i, j);
+}
+
+static void generate_kboot(FILE *fp, int n)
+{
+	int i;
+
+	fprintf(fp, "message=/etc/kboot.msg\ntimeout=100\ndefault=linux0\n");
+
+	for (i = 0; i < n; i++) {
+		/* restate the globals regularly, as kboot.conf allows */
+		if (i % 16 == 0)
+			fprintf(fp, "# globals\nroot=/dev/sda%d\n"
+					"initrd=/boot/initrd-%d.img\n"
+					"video=ps3fb:mode:%d\n",
+					i % 8 + 1, i, i % 14);
+
+		fprintf(fp, "linux%d='/boot/vmlinux-2.6.%d ", i, i);
+		if (i % 2)
+			fprintf(fp, "initrd=/boot/initrd-2.6.%d.img "
+					"root=/dev/sdb%d ", i, i % 8 + 1);
+		print_args(fp, i);
+		fprintf(fp, "'\n");
+	}
+}
+
+static void generate_yaboot(FILE *fp, int n)
+{
+	int i;
+
+	fprintf(fp, "init-message = \"Generated, %d images\"\n"
+			"timeout = 100\nroot = /dev/sda2\n"
+			"default = linux-%d\n\n", n, n - 1);
+
+	for (i = 0; i < n; i++) {
+		fprintf(fp, "image = /boot/vmlinux-2.6.%d\n", i);
+		fprintf(fp, "\tlabel = linux-%d\n", i);
+		fprintf(fp, "\talias = l%d\n", i);
+		fprintf(fp, "\tinitrd = /boot/initrd-2.6.%d.img\n", i);
+		fprintf(fp, "\tread-only\n");
+		fprintf(fp, "\tappend = \"");
+		print_args(fp, i);
+		fprintf(fp, "\"\n\n");
+	}
+}
+
+static void generate_native(FILE *fp, int n)
+{
+	int i;
+
+	fprintf(fp, "name = Generated device\n"
+			"description = %d boot options\n\n", n);
+
+	for (i = 0; i < n; i++) {
+		fprintf(fp, "[option %d]\n", i);
+		fprintf(fp, "name = option-%d\n", i);
+		fprintf(fp, "description = Linux 2.6.%d\n", i);
+		fprintf(fp, "image = /boot/vmlinux-2.6.%d\n", i);
+		fprintf(fp, "initrd = /boot/initrd-2.6.%d.img\n", i);
+		fprintf(fp, "args = ");
+		print_args(fp, i);
+		fprintf(fp, "\n\n");
+	}
+}
+
+static const struct bench_format {
+	const char	*name;
+	const char	*dir;
+	const char	*file;
+	void		(*generate)(FILE *fp, int n);
+} formats[] = {
+	{ "kboot",  "etc",  "etc/kboot.conf",       generate_kboot },
+	{ "yaboot", "etc",  "etc/yaboot.conf",      generate_yaboot },
+	{ "native", "boot", "boot/petitboot.conf",  generate_native },
+};
+
+#define N_FORMATS (sizeof(formats) / sizeof(formats[0]))
+
+/* the largest configs need to fit in CONFIG_FILE_MAX_SIZE */
+static const int sizes[] = { 4, 64, 1024, 16384 };
+
+#define N_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+struct bench_result {
+	char	format[16];
+	int	entries;
+	double	ns;		/* per entry */
+	double	allocs;		/* per entry */
+	long	peak_kb;
+};
+
+/* the directories and file that hold one generated config */
+struct bench_tree {
+	char	dev[64];
+	char	mnt[256];
+	char	subdir[256 + 32];
+	char	file[256 + 32];
+};
+
+static int write_config(const char *basedir, const struct bench_format *fmt,
+		int n, struct bench_tree *tree)
+{
+	FILE *fp;
+
+	snprintf(tree->dev, sizeof(tree->dev), "/dev/%s%d", fmt->name, n);
+	snprintf(tree->mnt, sizeof(tree->mnt), "%s/%s%d", basedir,
+			fmt->name, n);
+	snprintf(tree->subdir, sizeof(tree->subdir), "%s/%s", tree->mnt,
+			fmt->dir);
+	snprintf(tree->file, sizeof(tree->file), "%s/%s", tree->mnt,
+			fmt->file);
+
+	if (mkdir(tree->mnt, 0700) || mkdir(tree->subdir, 0700))
+		return -1;
+
+	fp = fopen(tree->file, "w");
+	if (!fp)
+		return -1;
+
+	fmt->generate(fp, n);
+
+	return fclose(fp) ? -1 : 0;
+}
+
+static void remove_config(const struct bench_tree *tree)
+{
+	unlink(tree->file);
+	rmdir(tree->subdir);
+	rmdir(tree->mnt);
+}
+
+static int parse_once(const char *dev, struct bench_output *out)
+{
+	struct parser_context ctx;
+
+	memset(&ctx, 0, sizeof(ctx));
+	memset(out, 0, sizeof(*out));
+	ctx.device_path = dev;
+	ctx.mountpoint = mountpoint_for_device(dev);
+	ctx.map_files = 1;
+	ctx.data = out;
+
+	return iterate_parsers(&ctx);
+}
+
+static int run_one(const char *basedir, const struct bench_format *fmt,
+		int n, struct bench_result *result)
+{
+	struct bench_output out;
+	struct bench_tree tree;
+	uint64_t start, ns, best = UINT64_MAX, total = 0;
+	unsigned long allocs;
+	long live;
+	int i, rc = -1;
+
+	if (write_config(basedir, fmt, n, &tree)) {
+		fprintf(stderr, "can't write %s: %s\n", tree.file,
+				strerror(errno));
+		remove_config(&tree);
+		return -1;
+	}
+
+	/* a first parse, to set up the mountpoint map */
+	parse_once(tree.dev, &out);
+
+	allocs = heap_allocs;
+	live = heap_live;
+	heap_peak = heap_live;
+
+	if (!parse_once(tree.dev, &out) || out.options != n) {
+		fprintf(stderr, "%s: parsed %d options, expected %d\n",
+				tree.file, out.options, n);
+		goto out;
+	}
+
+	memset(result, 0, sizeof(*result));
+	snprintf(result->format, sizeof(result->format), "%s", fmt->name);
+	result->entries = n;
+	result->allocs = (double)(heap_allocs - allocs) / n;
+	result->peak_kb = (heap_peak - live + 1023) / 1024;
+
+	/* take the best of several runs, of at least 200ms in total */
+	for (i = 0; i < 5 || total < 200000000ull; i++) {
+		start = now_ns();
+		parse_once(tree.dev, &out);
+		ns = now_ns() - start;
+		total += ns;
+		if (ns < best)
+			best = ns;
+	}
+
+	result->ns = (double)best / n;
+	rc = 0;
+
+out:
+	remove_config(&tree);
+	return rc;
+}
+
+static void print_result(FILE *fp, const struct bench_result *r)
+{
+	fprintf(fp, "%-8s %8d %12.1f %12.2f %10ld\n", r->format, r->entries,
+			r->ns, r->allocs, r->peak_kb);
+}
+
+static int read_baseline(const char *filename, struct bench_result *results,
+		int max)
+{
+	char line[256];
+	int n = 0;
+	FILE *fp;
+
+	fp = fopen(filename, "r");
+	if (!fp) {
+		fprintf(stderr, "can't open %s: %s\n", filename,
+				strerror(errno));
+		return -1;
+	}
+
+	while (n < max && fgets(line, sizeof(line), fp)) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, "%15s %d %lf %lf %ld", results[n].format,
+					&results[n].entries, &results[n].ns,
+					&results[n].allocs,
+					&results[n].peak_kb) == 5)
+			n++;
+	}
+
+	fclose(fp);
+	return n;
+}
+
+/* compare @r against the baseline, and return the number of regressions */
+static int check_result(const struct bench_result *r,
+		const struct bench_result *baseline, int n_baseline,
+		double time_factor)
+{
+	const struct bench_result *b = NULL;
+	int i, regressions = 0;
+
+	for (i = 0; i < n_baseline; i++)
+		if (!strcmp(baseline[i].format, r->format) &&
+				baseline[i].entries == r->entries)
+			b = &baseline[i];
+
+	if (!b) {
+		fprintf(stderr, "  no baseline for %s with %d entries\n",
+				r->format, r->entries);
+		return 0;
+	}
+
+	if (r->allocs > b->allocs * 1.1 + 0.05) {
+		fprintf(stderr, "  REGRESSION: %s, %d entries: %.2f "
+				"allocations per entry (baseline %.2f)\n",
+				r->format, r->entries, r->allocs, b->allocs);
+		regressions++;
+	}
+
+	if (r->peak_kb > b->peak_kb * 1.25 + 16) {
+		fprintf(stderr, "  REGRESSION: %s, %d entries: peak heap "
+				"%ld KB (baseline %ld KB)\n",
+				r->format, r->entries, r->peak_kb, b->peak_kb);
+		regressions++;
+	}
+
+	if (r->ns > b->ns * time_factor) {
+		fprintf(stderr, "  REGRESSION: %s, %d entries: %.1f ns "
+				"per entry (baseline %.1f ns)\n",
+				r->format, r->entries, r->ns, b->ns);
+		regressions++;
+	}
+
+	return regressions;
+}
+
+static void usage(const char *progname)
+{
+	fprintf(stderr, "usage: %s [-b baseline] [-w baseline] "
+			"[-t time-factor] [-m max-entries]\n", progname);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_result results[N_FORMATS * N_SIZES];
+	struct bench_result baseline[N_FORMATS * N_SIZES];
+	const char *baseline_file = NULL, *write_file = NULL;
+	char basedir[] = "/tmp/parser-bench.XXXXXX";
+	int opt, i, j, n_results = 0, n_baseline = 0, regressions = 0;
+	int max_entries = sizes[N_SIZES - 1];
+	double time_factor = 3.0;
+	FILE *fp;
+
+	while ((opt = getopt(argc, argv, "b:w:t:m:")) != -1) {
+		switch (opt) {
+		case 'b':
+			baseline_file = optarg;
+			break;
+		case 'w':
+			write_file = optarg;
+			break;
+		case 't':
+			time_factor = atof(optarg);
+			break;
+		case 'm':
+			max_entries = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (baseline_file) {
+		n_baseline = read_baseline(baseline_file, baseline,
+				N_FORMATS * N_SIZES);
+		if (n_baseline < 0)
+			return EXIT_FAILURE;
+	}
+
+	if (!mkdtemp(basedir)) {
+		perror("mkdtemp");
+		return EXIT_FAILURE;
+	}
+
+	set_mount_base(basedir);
+
+	printf("%-8s %8s %12s %12s %10s\n", "format", "entries",
+			"ns/entry", "allocs/entry", "peak KB");
+
+	for (i = 0; i < N_FORMATS; i++) {
+		for (j = 0; j < N_SIZES && sizes[j] <= max_entries; j++) {
+			struct bench_result *r = &results[n_results];
+
+			if (run_one(basedir, &formats[i], sizes[j], r)) {
+				regressions++;
+				continue;
+			}
+
+			print_result(stdout, r);
+			fflush(stdout);
+			n_results++;
+
+			if (baseline_file)
+				regressions += check_result(r, baseline,
+						n_baseline, time_factor);
+		}
+	}
+
+	rmdir(basedir);
+
+	if (write_file) {
+		fp = fopen(write_file, "w");
+		if (!fp) {
+			perror(write_file);
+			return EXIT_FAILURE;
+		}
+		fprintf(fp, "# parser-bench baseline: format, entries, "
+				"ns/entry, allocs/entry, peak KB\n"
+				"# from a build with the default CFLAGS; "
+				"regenerate with parser-bench -w\n");
+		for (i = 0; i < n_results; i++)
+			print_result(fp, &results[i]);
+		fclose(fp);
+	}
+
+	if (regressions) {
+		fprintf(stderr, "parser-bench: %d regressions\n", regressions);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
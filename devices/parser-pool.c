@@ -0,0 +1,498 @@
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <grp.h>
+#include <dirent.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "parser.h"
+#include "paths.h"
+#include "device-table.h"
+#include "parser-pool.h"
+
+/* how long a worker may spend on one device before it is killed */
+#define PARSER_TIMEOUT_MS		10000
+
+/* workers are replaced after this many devices, so that nothing that a
+ * parse leaves behind can build up */
+#define PARSER_WORKER_MAX_REQUESTS	256
+
+/* limits for each worker: parsers map config files of up to
+ * CONFIG_FILE_MAX_SIZE, and have one or two open at a time */
+#define PARSER_WORKER_MAX_MEM		(256 * 1024 * 1024)
+#define PARSER_WORKER_MAX_FILES		64
+
+/* how often to retry starting a worker that couldn't be started */
+#define PARSER_RESPAWN_MS		1000
+
+/*
+ * The parser callbacks. Only the workers parse anything, one device at a
+ * time, so the device type of the current request can be kept here.
+ */
+static enum generic_icon_type cur_icon_type = ICON_TYPE_UNKNOWN;
+
+int add_device(struct parser_context *ctx, const struct device *dev)
+{
+	struct device_entry **entry = ctx->data;
+
+	/* when merging, later parsers add the device again, along with
+	 * their own options */
+	if (*entry && ctx->merge && !strcmp((*entry)->dev->id, dev->id))
+		return 0;
+
+	if (*entry) {
+		pb_log("device %s already added, ignoring %s\n",
+				(*entry)->dev->id, dev->id);
+		return -1;
+	}
+
+	*entry = device_entry_create(dev);
+	return *entry ? 0 : -1;
+}
+
+int add_boot_option(struct parser_context *ctx,
+		const struct boot_option *opt)
+{
+	struct device_entry **entry = ctx->data;
+
+	if (!*entry) {
+		pb_log("option %s added before device\n", opt->name);
+		return -1;
+	}
+
+	return device_entry_add_option(*entry, opt);
+}
+
+/* the helper has already mounted the device, and workers can't mount
+ * anything else */
+int mount_device(const char *dev_path)
+{
+	return -1;
+}
+
+enum generic_icon_type guess_device_type(void)
+{
+	return cur_icon_type;
+}
+
+static long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* parse @dev_path, and send the result to the helper on @fd */
+static void worker_parse(int fd, const char *dev_path, uint32_t flags)
+{
+	struct msg_buf buf = MSG_BUF_INIT;
+	struct device_entry *entry = NULL;
+	struct parser_context ctx;
+	uint32_t status;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.device_path = dev_path;
+	ctx.mountpoint = mountpoint_for_device(dev_path);
+	ctx.merge = !!(flags & PARSE_FLAG_MERGE);
+	ctx.data = &entry;
+
+	/* if a mapped config goes away under us, we only lose this worker */
+	ctx.map_files = 1;
+
+	iterate_parsers(&ctx);
+
+	/* a config that only root can read would lose its options, so the
+	 * helper has to parse the device instead */
+	status = ctx.denied ? PARSE_STATUS_DENIED : PARSE_STATUS_OK;
+	if (ctx.denied)
+		pb_log("can't read the configs on %s, leaving it to the "
+				"helper\n", dev_path);
+
+	/* the whole result goes in one write, after the parse, so a crash
+	 * never leaves the helper with part of a device */
+	if (msg_buf_add_action(&buf, DEV_ACTION_PARSE_RESULT) ||
+			msg_buf_add_u32(&buf, status) ||
+			(status == PARSE_STATUS_OK && entry &&
+			 msg_buf_add_device_entry(&buf, entry)) ||
+			msg_buf_write(fd, &buf))
+		pb_log("can't send the options on %s\n", dev_path);
+
+	msg_buf_free(&buf);
+	device_entry_free(entry);
+}
+
+static void worker_run(int sock)
+{
+	enum device_action action;
+	uint32_t flags, icon_type;
+	char *dev_path;
+	int i, fd;
+
+	for (i = 0; i < PARSER_WORKER_MAX_REQUESTS; i++) {
+		if (read_action_fd(sock, &action, &fd))
+			break;
+
+		dev_path = read_string(sock);
+		if (action != DEV_ACTION_PARSE_DEVICE || fd < 0 || !dev_path ||
+				read_u32(sock, &flags) ||
+				read_u32(sock, &icon_type))
+			break;
+
+		cur_icon_type = icon_type <= ICON_TYPE_UNKNOWN ?
+			icon_type : ICON_TYPE_UNKNOWN;
+
+		worker_parse(fd, dev_path, flags);
+
+		close(fd);
+		free(dev_path);
+
+		if (write_action(sock, DEV_ACTION_PARSE_RESULT))
+			break;
+	}
+
+	exit(EXIT_SUCCESS);
+}
+
+/* close everything that we inherited from the daemon, apart from our
+ * socket and the log */
+static void close_inherited_fds(int sock, int log_fd)
+{
+	struct dirent *dirent;
+	int fd, max_fd;
+	DIR *dir;
+
+	dir = opendir("/proc/self/fd");
+	if (!dir) {
+		max_fd = sysconf(_SC_OPEN_MAX);
+		for (fd = STDERR_FILENO + 1; fd < max_fd; fd++)
+			if (fd != sock && fd != log_fd)
+				close(fd);
+		return;
+	}
+
+	while ((dirent = readdir(dir))) {
+		fd = atoi(dirent->d_name);
+		if (fd > STDERR_FILENO && fd != sock && fd != log_fd &&
+				fd != dirfd(dir))
+			close(fd);
+	}
+
+	closedir(dir);
+}
+
+static int drop_privileges(const struct parser_pool *pool)
+{
+	struct rlimit limit;
+
+	limit.rlim_cur = limit.rlim_max = 0;
+	setrlimit(RLIMIT_CORE, &limit);
+
+	limit.rlim_cur = limit.rlim_max = PARSER_WORKER_MAX_FILES;
+	setrlimit(RLIMIT_NOFILE, &limit);
+
+	limit.rlim_cur = limit.rlim_max = PARSER_WORKER_MAX_MEM;
+	setrlimit(RLIMIT_AS, &limit);
+
+	if (geteuid() == 0) {
+		if (setgroups(0, NULL) ||
+				setresgid(pool->gid, pool->gid, pool->gid) ||
+				setresuid(pool->uid, pool->uid, pool->uid)) {
+			pb_log("parser worker %d can't drop privileges: %s\n",
+					getpid(), strerror(errno));
+			return -1;
+		}
+
+		/* workers never need to start another process */
+		limit.rlim_cur = limit.rlim_max = 0;
+		setrlimit(RLIMIT_NPROC, &limit);
+	}
+
+	prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0);
+	prctl(PR_SET_DUMPABLE, 0, 0, 0, 0);
+
+	return 0;
+}
+
+static int spawn_worker(struct parser_pool *pool,
+		struct parser_worker *worker)
+{
+	int sv[2];
+	pid_t pid;
+
+	worker->pid = -1;
+	worker->fd = -1;
+	worker->dev_path = NULL;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv)) {
+		pb_log("can't create parser worker socket: %s\n",
+				strerror(errno));
+		return -1;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		pb_log("can't start parser worker: %s\n", strerror(errno));
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	}
+
+	if (pid == 0) {
+		close_inherited_fds(sv[1], pool->log_fd);
+		if (chdir("/") || drop_privileges(pool))
+			exit(EXIT_FAILURE);
+		worker_run(sv[1]);
+	}
+
+	close(sv[1]);
+	worker->pid = pid;
+	worker->fd = sv[0];
+
+	return 0;
+}
+
+/* reap a worker that has gone away, or that we've given up on, and start
+ * a new one */
+static void worker_exited(struct parser_pool *pool,
+		struct parser_worker *worker)
+{
+	int status;
+
+	kill(worker->pid, SIGKILL);
+	close(worker->fd);
+
+	if (waitpid(worker->pid, &status, 0) < 0)
+		status = 0;
+
+	if (worker->dev_path) {
+		if (WIFSIGNALED(status))
+			pb_log("parser worker %d killed by signal %d "
+					"while parsing %s\n", worker->pid,
+					WTERMSIG(status), worker->dev_path);
+		else
+			pb_log("parser worker %d exited while parsing %s\n",
+					worker->pid, worker->dev_path);
+	} else if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+		pb_log("parser worker %d failed\n", worker->pid);
+	}
+
+	free(worker->dev_path);
+	spawn_worker(pool, worker);
+}
+
+static void free_request(struct parser_request *req)
+{
+	free(req->dev_path);
+	free(req);
+}
+
+/* hand queued requests to idle workers */
+static void dispatch(struct parser_pool *pool)
+{
+	struct msg_buf buf = MSG_BUF_INIT;
+	struct parser_worker *worker;
+	struct parser_request *req;
+	int i, rc;
+
+	for (i = 0; i < pool->n_workers && pool->queue; i++) {
+		worker = &pool->workers[i];
+		if (worker->fd < 0 || worker->dev_path)
+			continue;
+
+		req = pool->queue;
+		pool->queue = req->next;
+		if (!pool->queue)
+			pool->queue_tail = &pool->queue;
+
+		buf.len = 0;
+		rc = write_action_fd(worker->fd, DEV_ACTION_PARSE_DEVICE,
+				req->fd) ||
+			msg_buf_add_string(&buf, req->dev_path) ||
+			msg_buf_add_u32(&buf, req->flags) ||
+			msg_buf_add_u32(&buf, req->icon_type) ||
+			msg_buf_write(worker->fd, &buf);
+
+		/* the worker has its own copy of the helper's connection; if
+		 * it didn't get the request, closing ours tells the helper
+		 * that the parse failed */
+		close(req->fd);
+
+		worker->dev_path = req->dev_path;
+		worker->deadline = now_ms() + PARSER_TIMEOUT_MS;
+		req->dev_path = NULL;
+		free_request(req);
+
+		if (rc)
+			worker_exited(pool, worker);
+	}
+
+	msg_buf_free(&buf);
+}
+
+struct parser_pool *parser_pool_create(int n_workers, uid_t uid, gid_t gid,
+		int log_fd)
+{
+	struct parser_pool *pool;
+	int i, n_started = 0;
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return NULL;
+
+	pool->workers = calloc(n_workers, sizeof(*pool->workers));
+	if (!pool->workers) {
+		free(pool);
+		return NULL;
+	}
+
+	pool->n_workers = n_workers;
+	pool->queue_tail = &pool->queue;
+	pool->uid = uid;
+	pool->gid = gid;
+	pool->log_fd = log_fd;
+
+	for (i = 0; i < n_workers; i++)
+		if (!spawn_worker(pool, &pool->workers[i]))
+			n_started++;
+
+	pb_log("started %d of %d parser workers\n", n_started, n_workers);
+
+	return pool;
+}
+
+int parser_pool_submit(struct parser_pool *pool, int fd,
+		const char *dev_path, uint32_t flags, uint32_t icon_type)
+{
+	struct parser_request *req;
+
+	req = calloc(1, sizeof(*req));
+	if (req)
+		req->dev_path = strdup(dev_path);
+
+	if (!req || !req->dev_path) {
+		free(req);
+		close(fd);
+		return -1;
+	}
+
+	req->fd = fd;
+	req->flags = flags;
+	req->icon_type = icon_type;
+
+	*pool->queue_tail = req;
+	pool->queue_tail = &req->next;
+
+	dispatch(pool);
+
+	return 0;
+}
+
+int parser_pool_poll_fds(struct parser_pool *pool, struct pollfd *pfds)
+{
+	int i;
+
+	/* poll() ignores the negative fds of workers that aren't running */
+	for (i = 0; i < pool->n_workers; i++) {
+		pfds[i].fd = pool->workers[i].fd;
+		pfds[i].events = POLLIN;
+		pfds[i].revents = 0;
+	}
+
+	return pool->n_workers;
+}
+
+void parser_pool_process(struct parser_pool *pool,
+		const struct pollfd *pfds)
+{
+	struct parser_request *req;
+	struct parser_worker *worker;
+	enum device_action action;
+	int i, n_running = 0;
+	long now;
+
+	for (i = 0; i < pool->n_workers; i++) {
+		worker = &pool->workers[i];
+
+		if (!pfds[i].revents || pfds[i].fd != worker->fd)
+			continue;
+
+		/* a worker sends a single byte when it's done with a
+		 * request; anything else means it has gone away */
+		if (!read_action(worker->fd, &action) &&
+				action == DEV_ACTION_PARSE_RESULT &&
+				worker->dev_path) {
+			free(worker->dev_path);
+			worker->dev_path = NULL;
+			continue;
+		}
+
+		if (worker->fd >= 0)
+			worker_exited(pool, worker);
+	}
+
+	now = now_ms();
+
+	for (i = 0; i < pool->n_workers; i++) {
+		worker = &pool->workers[i];
+
+		if (worker->dev_path && now >= worker->deadline) {
+			pb_log("parser worker %d timed out parsing %s\n",
+					worker->pid, worker->dev_path);
+			worker_exited(pool, worker);
+		}
+
+		if (worker->fd < 0)
+			spawn_worker(pool, worker);
+
+		if (worker->fd >= 0)
+			n_running++;
+	}
+
+	/* with no workers at all, fail the queued requests rather than
+	 * leave their helpers waiting */
+	while (!n_running && pool->queue) {
+		req = pool->queue;
+		pool->queue = req->next;
+		pool->queue_tail = &pool->queue;
+		pb_log("no parser workers, can't parse %s\n", req->dev_path);
+		close(req->fd);
+		free_request(req);
+	}
+
+	dispatch(pool);
+}
+
+int parser_pool_timeout(const struct parser_pool *pool)
+{
+	const struct parser_worker *worker;
+	long now = now_ms(), timeout = -1, left;
+	int i;
+
+	for (i = 0; i < pool->n_workers; i++) {
+		worker = &pool->workers[i];
+
+		if (worker->fd < 0)
+			left = PARSER_RESPAWN_MS;
+		else if (worker->dev_path)
+			left = worker->deadline > now ?
+				worker->deadline - now : 0;
+		else
+			continue;
+
+		if (timeout < 0 || left < timeout)
+			timeout = left;
+	}
+
+	return timeout;
+}
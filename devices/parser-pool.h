@@ -0,0 +1,89 @@
+#ifndef _PARSER_POOL_H
+#define _PARSER_POOL_H
+
+#include <stdint.h>
+#include <poll.h>
+#include <sys/types.h>
+
+/*
+ * A pool of pre-forked parser processes, run by the discovery daemon, so
+ * that the configs on a device are never parsed with the daemon's or the
+ * helpers' privileges.
+ *
+ * Each worker is forked when the pool is created, drops its privileges,
+ * and then parses one device at a time. A helper sends a
+ * DEV_ACTION_PARSE_DEVICE request to the daemon, which passes the
+ * connection to an idle worker; the worker sends the result straight back
+ * to the helper, and tells the daemon that it is ready for the next
+ * request. If a worker crashes or takes too long, only its current device
+ * is lost: the helper sees the connection close, and the daemon starts a
+ * new worker in its place.
+ */
+
+struct parser_worker {
+	pid_t		pid;
+	int		fd;		/* our end of the worker's socket */
+
+	/* the device that the worker is parsing, or NULL if it's idle */
+	char		*dev_path;
+	long		deadline;	/* in ms, see parser_pool_timeout() */
+};
+
+struct parser_request {
+	int			fd;	/* the helper's connection */
+	char			*dev_path;
+	uint32_t		flags;
+	uint32_t		icon_type;
+	struct parser_request	*next;
+};
+
+struct parser_pool {
+	struct parser_worker	*workers;
+	int			n_workers;
+
+	/* requests waiting for an idle worker, oldest first */
+	struct parser_request	*queue;
+	struct parser_request	**queue_tail;
+
+	/* who the workers run as, and an fd that they keep open, for
+	 * logging */
+	uid_t			uid;
+	gid_t			gid;
+	int			log_fd;
+};
+
+/**
+ * Start a pool of @n_workers workers, which run as @uid and @gid if the
+ * daemon is running as root.
+ */
+struct parser_pool *parser_pool_create(int n_workers, uid_t uid, gid_t gid,
+		int log_fd);
+
+/**
+ * Queue a request to parse @dev_path, and send the result to @fd. The
+ * pool takes ownership of @fd.
+ */
+int parser_pool_submit(struct parser_pool *pool, int fd,
+		const char *dev_path, uint32_t flags, uint32_t icon_type);
+
+/**
+ * Add the workers' fds to @pfds, which must have room for n_workers
+ * entries, and return the number added.
+ */
+int parser_pool_poll_fds(struct parser_pool *pool, struct pollfd *pfds);
+
+/**
+ * Handle the events that poll() returned for the fds added by
+ * parser_pool_poll_fds(), and kill any worker that has passed its
+ * deadline.
+ */
+void parser_pool_process(struct parser_pool *pool,
+		const struct pollfd *pfds);
+
+/**
+ * The poll() timeout until the next worker's deadline, or -1 if no worker
+ * is busy.
+ */
+int parser_pool_timeout(const struct parser_pool *pool);
+
+#endif /* _PARSER_POOL_H */
@@ -3,16 +3,26 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <string.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "parser.h"
 #include "paths.h"
 
+/* the test runner only reports failures, so doesn't log */
+static int log_enabled = 1;
+
 void pb_log(const char *fmt, ...)
 {
 	va_list ap;
 
+	if (!log_enabled)
+		return;
+
 	va_start(ap, fmt);
 	vfprintf(stderr, fmt, ap);
 	va_end(ap);
@@ -24,37 +34,56 @@ int mount_device(const char *dev_path)
 	return 0;
 }
 
-static int device_idx;
-static int option_idx;
+/* where a single parse writes its output */
+struct test_output {
+	FILE	*fp;
+	int	device_idx;
+	int	option_idx;
+};
 
-int add_device(const struct device *dev)
+int add_device(struct parser_context *ctx, const struct device *dev)
 {
-	printf("[dev %2d] id: %s\n", device_idx, dev->id);
-	printf("[dev %2d] name: %s\n", device_idx, dev->name);
-	printf("[dev %2d] description: %s\n", device_idx, dev->description);
-	printf("[dev %2d] boot_image: %s\n", device_idx, dev->icon_file);
+	struct test_output *out = ctx->data;
+
+	/* a later parser adding the same device just adds more options */
+	if (ctx->merge && out->device_idx)
+		return 0;
+
+	fprintf(out->fp, "[dev %2d] id: %s\n", out->device_idx, dev->id);
+	fprintf(out->fp, "[dev %2d] name: %s\n", out->device_idx, dev->name);
+	fprintf(out->fp, "[dev %2d] description: %s\n", out->device_idx,
+			dev->description);
+	fprintf(out->fp, "[dev %2d] boot_image: %s\n", out->device_idx,
+			dev->icon_file);
 
-	device_idx++;
-	option_idx = 0;
+	out->device_idx++;
+	out->option_idx = 0;
 	return 0;
 }
 
 
-int add_boot_option(const struct boot_option *opt)
+int add_boot_option(struct parser_context *ctx,
+		const struct boot_option *opt)
 {
-	if (!device_idx) {
+	struct test_output *out = ctx->data;
+
+	if (!out->device_idx) {
 		fprintf(stderr, "Option (%s) added before device\n",
 				opt->name);
 		exit(EXIT_FAILURE);
 	}
 
-	printf("[opt %2d] name: %s\n", option_idx, opt->name);
-	printf("[opt %2d] description: %s\n", option_idx, opt->description);
-	printf("[opt %2d] boot_image: %s\n", option_idx, opt->boot_image_file);
-	printf("[opt %2d] initrd: %s\n", option_idx, opt->initrd_file);
-	printf("[opt %2d] boot_args: %s\n", option_idx, opt->boot_args);
+	fprintf(out->fp, "[opt %2d] name: %s\n", out->option_idx, opt->name);
+	fprintf(out->fp, "[opt %2d] description: %s\n", out->option_idx,
+			opt->description);
+	fprintf(out->fp, "[opt %2d] boot_image: %s\n", out->option_idx,
+			opt->boot_image_file);
+	fprintf(out->fp, "[opt %2d] initrd: %s\n", out->option_idx,
+			opt->initrd_file);
+	fprintf(out->fp, "[opt %2d] boot_args: %s\n", out->option_idx,
+			opt->boot_args);
 
-	option_idx++;
+	out->option_idx++;
 
 	return 0;
 }
@@ -64,22 +93,446 @@ enum generic_icon_type guess_device_type(void)
 	return ICON_TYPE_UNKNOWN;
 }
 
+/* run the parsers over @dev, and return everything they output */
+static char *parse_to_string(const char *dev, int merge)
+{
+	struct test_output out;
+	struct parser_context ctx;
+	char *str = NULL;
+	size_t len;
+
+	memset(&out, 0, sizeof(out));
+	out.fp = open_memstream(&str, &len);
+	if (!out.fp)
+		return NULL;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.device_path = dev;
+	ctx.mountpoint = mountpoint_for_device(dev);
+	ctx.merge = merge;
+	ctx.map_files = 1;
+	ctx.data = &out;
+
+	iterate_parsers(&ctx);
+
+	fclose(out.fp);
+	return str;
+}
+
+struct stress_thread {
+	pthread_t	thread;
+	const char	*basedir;
+	const char	*dev;
+	int		merge;
+	const char	*expected;
+	int		iterations;
+	int		mismatches;
+};
+
+static void *stress_thread_fn(void *arg)
+{
+	struct stress_thread *t = arg;
+	char *output;
+	int i;
+
+	set_thread_mount_base(t->basedir);
+
+	for (i = 0; i < t->iterations; i++) {
+		output = parse_to_string(t->dev, t->merge);
+		if (!output || strcmp(output, t->expected))
+			t->mismatches++;
+		free(output);
+	}
+
+	return NULL;
+}
+
+/* parse the device from @n_threads threads at once, checking that every
+ * parse gives the same output as a single-threaded one. @basedir is the
+ * threads' mount base, or NULL for the global one */
+static int stress_test(const char *basedir, const char *dev, int merge,
+		int n_threads, int iterations)
+{
+	struct stress_thread *threads;
+	char *expected;
+	int i, mismatches = 0;
+
+	set_thread_mount_base(basedir);
+	expected = parse_to_string(dev, merge);
+	set_thread_mount_base(NULL);
+	if (!expected)
+		return EXIT_FAILURE;
+
+	threads = calloc(n_threads, sizeof(*threads));
+	if (!threads) {
+		free(expected);
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < n_threads; i++) {
+		threads[i].basedir = basedir;
+		threads[i].dev = dev;
+		threads[i].merge = merge;
+		threads[i].expected = expected;
+		threads[i].iterations = iterations;
+		if (pthread_create(&threads[i].thread, NULL,
+					stress_thread_fn, &threads[i])) {
+			fprintf(stderr, "can't create thread %d\n", i);
+			n_threads = i;
+			mismatches++;
+			break;
+		}
+	}
+
+	for (i = 0; i < n_threads; i++) {
+		pthread_join(threads[i].thread, NULL);
+		if (threads[i].mismatches)
+			fprintf(stderr, "thread %d: %d of %d parses differ\n",
+					i, threads[i].mismatches, iterations);
+		mismatches += threads[i].mismatches;
+	}
+
+	free(threads);
+	free(expected);
+
+	return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*
+ * The golden test runner: each directory under the test dir is a case,
+ * holding a tree of mounted devices, an expected-output file, and
+ * optionally a rootdev file naming the device to parse (ps3da1 if there
+ * is none), and an expected-output-merge file with the output of a merged
+ * parse. Cases are run in worker threads, each case under its own mount
+ * base, and the output is compared in memory.
+ *
+ * With a stress pass, each case is then parsed from many threads at once,
+ * with and without merging, to check that the parsers are reentrant.
+ */
+#define DEFAULT_ROOTDEV "ps3da1"
+
+struct test_case {
+	char		*name;
+	char		*dir;
+	char		*dev;
+	char		*expected;
+	char		*output;
+	char		*expected_merge;
+	char		*output_merge;
+	uint64_t	ns;
+	int		failed;
+};
+
+struct test_run {
+	struct test_case	*cases;
+	int			n_cases;
+	int			next;
+	pthread_mutex_t		lock;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* read all of @path into a new string, or return NULL */
+static char *read_file(const char *path)
+{
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *fp, *out;
+	char tmp[4096];
+	size_t n;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return NULL;
+
+	out = open_memstream(&buf, &len);
+	if (out) {
+		while ((n = fread(tmp, 1, sizeof(tmp), fp)) > 0)
+			fwrite(tmp, 1, n, out);
+		fclose(out);
+	}
+
+	fclose(fp);
+	return buf;
+}
+
+static int load_test_case(struct test_case *test, const char *testdir,
+		const char *name)
+{
+	char *path, *rootdev;
+
+	memset(test, 0, sizeof(*test));
+	test->name = strdup(name);
+	if (asprintf(&test->dir, "%s/%s", testdir, name) < 0)
+		return -1;
+
+	if (asprintf(&path, "%s/expected-output", test->dir) < 0)
+		return -1;
+	test->expected = read_file(path);
+	free(path);
+	if (!test->expected)
+		return -1;
+
+	/* the merged output is only checked if the case gives it */
+	if (asprintf(&path, "%s/expected-output-merge", test->dir) < 0)
+		return -1;
+	test->expected_merge = read_file(path);
+	free(path);
+
+	if (asprintf(&path, "%s/rootdev", test->dir) < 0)
+		return -1;
+	rootdev = read_file(path);
+	free(path);
+	if (rootdev)
+		rootdev[strcspn(rootdev, " \t\n")] = '\0';
+
+	if (asprintf(&test->dev, "/dev/%s",
+				rootdev && *rootdev ? rootdev : DEFAULT_ROOTDEV) < 0)
+		test->dev = NULL;
+	free(rootdev);
+
+	return test->dev ? 0 : -1;
+}
+
+static int filter_test_dir(const struct dirent *d)
+{
+	return d->d_name[0] != '.';
+}
+
+static void *test_worker(void *arg)
+{
+	struct test_run *run = arg;
+	struct test_case *test;
+	uint64_t start;
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&run->lock);
+		i = run->next++;
+		pthread_mutex_unlock(&run->lock);
+
+		if (i >= run->n_cases)
+			break;
+
+		test = &run->cases[i];
+		set_thread_mount_base(test->dir);
+
+		start = now_ns();
+		test->output = parse_to_string(test->dev, 0);
+		test->ns = now_ns() - start;
+
+		test->failed = !test->output ||
+			strcmp(test->output, test->expected);
+
+		if (test->expected_merge) {
+			test->output_merge = parse_to_string(test->dev, 1);
+			test->failed |= !test->output_merge ||
+				strcmp(test->output_merge,
+						test->expected_merge);
+		}
+	}
+
+	set_thread_mount_base(NULL);
+	return NULL;
+}
+
+/* print the lines where @output differs from @expected */
+static void print_diff(const char *expected, const char *output)
+{
+	int line = 1, elen, olen;
+
+	while (*expected || *output) {
+		elen = strcspn(expected, "\n");
+		olen = strcspn(output, "\n");
+
+		if (elen != olen || strncmp(expected, output, elen)) {
+			printf("    line %d:\n", line);
+			printf("    - %.*s\n", elen, expected);
+			printf("    + %.*s\n", olen, output);
+		}
+
+		expected += elen + (expected[elen] == '\n');
+		output += olen + (output[olen] == '\n');
+		line++;
+	}
+}
+
+static int run_tests(const char *testdir, int n_threads, int n_stress,
+		int iterations)
+{
+	struct dirent **names;
+	pthread_t *threads;
+	struct test_run run;
+	uint64_t start, ns;
+	int i, n, merge, failed = 0;
+
+	n = scandir(testdir, &names, filter_test_dir, alphasort);
+	if (n < 0) {
+		perror(testdir);
+		return EXIT_FAILURE;
+	}
+
+	memset(&run, 0, sizeof(run));
+	pthread_mutex_init(&run.lock, NULL);
+	run.cases = calloc(n, sizeof(*run.cases));
+	threads = calloc(n_threads, sizeof(*threads));
+	if (!run.cases || !threads)
+		return EXIT_FAILURE;
+
+	for (i = 0; i < n; i++) {
+		if (load_test_case(&run.cases[run.n_cases], testdir,
+					names[i]->d_name))
+			fprintf(stderr, "%s/%s: not a test case, skipping\n",
+					testdir, names[i]->d_name);
+		else
+			run.n_cases++;
+		free(names[i]);
+	}
+	free(names);
+
+	/* output is only logged on failure, so a run stays readable */
+	log_enabled = 0;
+
+	start = now_ns();
+
+	for (i = 0; i < n_threads; i++) {
+		if (pthread_create(&threads[i], NULL, test_worker, &run)) {
+			fprintf(stderr, "can't create thread %d\n", i);
+			n_threads = i;
+			break;
+		}
+	}
+
+	/* with no threads at all, run the tests here */
+	if (!n_threads)
+		test_worker(&run);
+
+	for (i = 0; i < n_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	ns = now_ns() - start;
+
+	for (i = 0; i < run.n_cases; i++) {
+		struct test_case *test = &run.cases[i];
+
+		printf("%-24s %8.3f ms  %s\n", test->name, test->ns / 1e6,
+				test->failed ? "FAIL" : "ok");
+		if (test->failed) {
+			failed++;
+			print_diff(test->expected,
+					test->output ? test->output : "");
+			if (test->expected_merge) {
+				printf("    merged:\n");
+				print_diff(test->expected_merge,
+						test->output_merge ?
+						test->output_merge : "");
+			}
+		}
+	}
+
+	for (i = 0; n_stress > 0 && i < run.n_cases; i++) {
+		struct test_case *test = &run.cases[i];
+
+		for (merge = 0; merge <= 1; merge++) {
+			if (test->failed || stress_test(test->dir, test->dev,
+						merge, n_stress, iterations) ==
+					EXIT_SUCCESS)
+				continue;
+
+			printf("%-24s %s stress FAIL\n", test->name,
+					merge ? "merged" : "single");
+			test->failed = 1;
+			failed++;
+		}
+	}
+
+	if (n_stress > 0)
+		printf("stress: %d threads, %d iterations per case\n",
+				n_stress, iterations);
+
+	printf("%d tests, %d failed, in %.3f ms with %d threads\n",
+			run.n_cases, failed, ns / 1e6, n_threads);
+
+	if (!failed)
+		printf("All tests passed\n");
+
+	return failed || !run.n_cases ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static void usage(const char *progname)
+{
+	fprintf(stderr, "usage: %s [-m] [-s threads] [-n iterations] "
+			"<basedir> <devname>\n"
+			"       %s -r <testdir> [-j threads] "
+			"[-s threads [-n iterations]]\n",
+			progname, progname);
+}
+
 int main(int argc, char **argv)
 {
-	char *mountpoint, *dev;
+	struct test_output out;
+	struct parser_context ctx;
+	char *basedir, *dev, *testdir = NULL;
+	int opt, merge = 0, n_threads = 0, iterations = 20;
+	int n_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((opt = getopt(argc, argv, "ms:n:r:j:")) != -1) {
+		switch (opt) {
+		case 'r':
+			testdir = optarg;
+			break;
+		case 'j':
+			n_jobs = atoi(optarg);
+			break;
+		case 'm':
+			merge = 1;
+			break;
+		case 's':
+			n_threads = atoi(optarg);
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
 
-	if (argc != 3) {
-		fprintf(stderr, "usage: %s <basedir> <devname>\n", argv[0]);
+	if (testdir)
+		return run_tests(testdir, n_jobs > 0 ? n_jobs : 1, n_threads,
+				iterations);
+
+	if (argc - optind != 2) {
+		usage(argv[0]);
 		return EXIT_FAILURE;
 	}
 
-	mountpoint = argv[1];
-	dev = argv[2];
+	basedir = argv[optind];
+	dev = argv[optind + 1];
+
+	set_mount_base(basedir);
+
+	if (n_threads > 0)
+		return stress_test(NULL, dev, merge, n_threads, iterations);
 
-	set_mount_base(mountpoint);
+	memset(&out, 0, sizeof(out));
+	out.fp = stdout;
 
-	iterate_parsers(dev, mountpoint);
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.device_path = dev;
+	ctx.mountpoint = mountpoint_for_device(dev);
+	ctx.merge = merge;
+	ctx.map_files = 1;
+	ctx.data = &out;
 
+	iterate_parsers(&ctx);
 
 	return EXIT_SUCCESS;
 }
@@ -2,69 +2,280 @@
 #include <petitboot-paths.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "parser.h"
+#include "menu-file.h"
 
+extern struct parser compiled_parser;
 extern struct parser native_parser;
 extern struct parser yaboot_parser;
 extern struct parser kboot_parser;
 
 /* array of parsers, ordered by priority */
 static struct parser *parsers[] = {
+	&compiled_parser,
 	&native_parser,
 	&yaboot_parser,
 	&kboot_parser,
 	NULL
 };
 
-void iterate_parsers(const char *devpath, const char *mountpoint)
+static uint64_t now_ns(void)
 {
-	int i;
+	struct timespec ts;
 
-	pb_log("trying parsers for %s\n", devpath);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* return the first of @parser's config files that exists under @root_fd */
+static const char *probe_parser(int root_fd, const struct parser *parser)
+{
+	const char *const *filename;
+	struct stat statbuf;
+
+	for (filename = parser->filenames; *filename; filename++) {
+		/* filenames are absolute within the device */
+		if (!fstatat(root_fd, *filename + 1, &statbuf, 0) &&
+				S_ISREG(statbuf.st_mode))
+			return *filename;
+	}
+
+	return NULL;
+}
+
+int iterate_parsers(struct parser_context *ctx)
+{
+	const char *filenames[sizeof(parsers) / sizeof(parsers[0])];
+	struct parser_stats *stats = &ctx->stats;
+	uint64_t start = now_ns();
+	int i, root_fd, rc = 0;
+
+	memset(stats, 0, sizeof(*stats));
+	arena_init(&ctx->arena);
+
+	pb_log("trying parsers for %s\n", ctx->device_path);
+
+	/* Look for every parser's config files in a single sweep of the
+	 * mounted filesystem, so that we only run the parsers that have
+	 * something to read */
+	root_fd = open(ctx->mountpoint, O_RDONLY | O_DIRECTORY);
+	if (root_fd < 0) {
+		pb_log("\tcan't open %s: %s\n", ctx->mountpoint,
+				strerror(errno));
+		goto out;
+	}
+
+	for (i = 0; parsers[i]; i++)
+		filenames[i] = parsers[i]->compiled && ctx->text_only ? NULL :
+			probe_parser(root_fd, parsers[i]);
+
+	close(root_fd);
 
 	for (i = 0; parsers[i]; i++) {
-		pb_log("\ttrying parser '%s'\n", parsers[i]->name);
-		/* just use a dummy device path for now */
-		if (parsers[i]->parse(devpath))
-			return;
+		if (!filenames[i])
+			continue;
+
+		pb_log("\ttrying parser '%s' with %s\n", parsers[i]->name,
+				filenames[i]);
+
+		ctx->filename = filenames[i];
+		if (parsers[i]->parse(ctx)) {
+			rc = 1;
+			if (!ctx->merge || parsers[i]->compiled)
+				break;
+		}
+	}
+	ctx->filename = NULL;
+
+out:
+	if (!rc)
+		pb_log("\tno boot_options found\n");
+
+	stats->parse_ns = now_ns() - start;
+	pb_log("\t%d config files (%lu bytes) loaded in %.3f ms, "
+			"parsed in %.3f ms\n", stats->files, stats->bytes,
+			stats->load_ns / 1e6, stats->parse_ns / 1e6);
+	pb_log("\t%lu allocations (%lu bytes) from %u chunks\n",
+			ctx->arena.allocs, ctx->arena.bytes,
+			ctx->arena.n_chunks);
+
+	arena_release(&ctx->arena);
+
+	return rc;
+}
+
+/* read up to *len bytes of @fd into a new buffer, coping with short reads,
+ * and set *len to the number of bytes read */
+static char *read_config_file(int fd, size_t *len)
+{
+	size_t pos = 0;
+	ssize_t rc;
+	char *buf;
+
+	buf = malloc(*len + 1);
+	if (!buf)
+		return NULL;
+
+	while (pos < *len) {
+		rc = read(fd, buf + pos, *len - pos);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc < 0) {
+			free(buf);
+			return NULL;
+		}
+		if (rc == 0)
+			break;
+		pos += rc;
+	}
+
+	buf[pos] = '\0';
+	*len = pos;
+	return buf;
+}
+
+int load_config_file(struct parser_context *ctx, const char *path,
+		int flags, struct config_file *file)
+{
+	uint64_t start = now_ns();
+	struct stat statbuf;
+	int fd, prot;
+
+	memset(file, 0, sizeof(*file));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		if (errno == EACCES || errno == EPERM)
+			ctx->denied = 1;
+		if (errno != ENOENT && errno != ENOTDIR)
+			pb_log("can't open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &statbuf)) {
+		pb_log("can't stat %s: %s\n", path, strerror(errno));
+		goto err_close;
+	}
+
+	if (!S_ISREG(statbuf.st_mode) ||
+			statbuf.st_size > CONFIG_FILE_MAX_SIZE) {
+		pb_log("ignoring %s: not a regular file, or too large\n",
+				path);
+		goto err_close;
+	}
+
+	file->len = statbuf.st_size;
+
+	/* The rest of the last page of a mapping is zeroed, which gives us
+	 * our nul. If the file fills the last page, read it instead */
+	if (ctx->map_files && file->len % sysconf(_SC_PAGESIZE)) {
+		prot = PROT_READ;
+		if (flags & CONFIG_FILE_WRITABLE)
+			prot |= PROT_WRITE;
+
+		file->buf = mmap(NULL, file->len, prot, MAP_PRIVATE, fd, 0);
+		if (file->buf == MAP_FAILED)
+			file->buf = NULL;
+		else
+			file->map_len = file->len;
+	}
+
+	if (!file->buf) {
+		file->buf = read_config_file(fd, &file->len);
+		if (!file->buf) {
+			pb_log("can't read %s\n", path);
+			goto err_close;
+		}
 	}
-	pb_log("\tno boot_options found\n");
+
+	close(fd);
+
+	ctx->stats.files++;
+	ctx->stats.bytes += file->len;
+	ctx->stats.load_ns += now_ns() - start;
+
+	pb_log("loaded %s: %zu bytes in %.3f ms\n", path, file->len,
+			(now_ns() - start) / 1e6);
+
+	return 0;
+
+err_close:
+	close(fd);
+	return -1;
+}
+
+void release_config_file(struct config_file *file)
+{
+	if (file->map_len)
+		munmap(file->buf, file->map_len);
+	else
+		free(file->buf);
+	file->buf = NULL;
 }
 
-/* convenience functions for parsers */
-void free_device(struct device *dev)
+/* add the name and contents of @filename under @root_fd to @hash, if it
+ * exists */
+static int fingerprint_file(int root_fd, const char *filename,
+		uint64_t *hash)
 {
-	if (!dev)
-		return;
-	if (dev->id)
-		free(dev->id);
-	if (dev->name)
-		free(dev->name);
-	if (dev->description)
-		free(dev->description);
-	if (dev->icon_file)
-		free(dev->icon_file);
-	free(dev);
+	struct stat statbuf;
+	char buf[4096];
+	ssize_t rc;
+	int fd;
+
+	fd = openat(root_fd, filename + 1, O_RDONLY);
+	if (fd < 0)
+		return errno == ENOENT || errno == ENOTDIR ? 0 : -1;
+
+	/* the parsers ignore anything but regular files */
+	if (fstat(fd, &statbuf) || !S_ISREG(statbuf.st_mode)) {
+		close(fd);
+		return 0;
+	}
+
+	*hash = menu_file_hash64(*hash, filename, strlen(filename) + 1);
+
+	while ((rc = read(fd, buf, sizeof(buf))) != 0) {
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc < 0)
+			break;
+		*hash = menu_file_hash64(*hash, buf, rc);
+	}
+
+	close(fd);
+	return rc ? -1 : 0;
 }
 
-void free_boot_option(struct boot_option *opt)
+int config_fingerprint(struct parser_context *ctx, uint64_t *fingerprint)
 {
-	if (!opt)
-		return;
-	if (opt->name)
-		free(opt->name);
-	if (opt->description)
-		free(opt->description);
-	if (opt->icon_file)
-		free(opt->icon_file);
-	if (opt->boot_image_file)
-		free(opt->boot_image_file);
-	if (opt->initrd_file)
-		free(opt->initrd_file);
-	if (opt->boot_args)
-		free(opt->boot_args);
-	free(opt);
+	const char *const *filename;
+	uint64_t hash = MENU_FILE_HASH64_INIT;
+	int i, root_fd, rc = 0;
+
+	root_fd = open(ctx->mountpoint, O_RDONLY | O_DIRECTORY);
+	if (root_fd < 0)
+		return -1;
+
+	for (i = 0; parsers[i] && !rc; i++) {
+		if (parsers[i]->compiled)
+			continue;
+		for (filename = parsers[i]->filenames; *filename && !rc;
+				filename++)
+			rc = fingerprint_file(root_fd, *filename, &hash);
+	}
+
+	close(root_fd);
+
+	*fingerprint = hash;
+	return rc;
 }
 
 const char *generic_icon_file(enum generic_icon_type type)
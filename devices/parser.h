@@ -3,12 +3,94 @@
 #define _PARSERS_H
 
 #include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
 #include "message.h"
+#include "arena.h"
+
+/* statistics for the discovery of one device */
+struct parser_stats {
+	int		files;		/* config files loaded */
+	unsigned long	bytes;		/* total size of those files */
+	uint64_t	load_ns;	/* time spent loading them */
+	uint64_t	parse_ns;	/* total time in iterate_parsers() */
+};
+
+/*
+ * The state for a single parse of a device. Parsers keep everything else
+ * they need on the stack, so that several devices can be parsed at once,
+ * each in their own thread with their own context.
+ */
+struct parser_context {
+	const char *device_path;
+	const char *mountpoint;
+
+	/* run every parser that has a config file on the device, merging
+	 * their options, rather than stopping at the first that succeeds */
+	int merge;
+
+	/* only run the text parsers, ignoring any compiled menu */
+	int text_only;
+
+	/* let load_config_file() map the config files, rather than read
+	 * them. A mapped file that shrinks, or whose media is pulled, while
+	 * it is parsed kills the process with SIGBUS, so this is only for
+	 * processes that can be lost: the parser pool's workers, and the
+	 * tests */
+	int map_files;
+
+	/* set by iterate_parsers(): the config file that the current parser
+	 * should use, from its list of filenames */
+	const char *filename;
+
+	/* for the add_device and add_boot_option implementation */
+	void *data;
+
+	/* set by load_config_file() if we weren't allowed to read a config
+	 * file, so its options are missing */
+	int denied;
+
+	/* Parsers allocate the devices and boot options that they add, and
+	 * their strings, from here. add_device() and add_boot_option() take
+	 * copies, so it is all released when iterate_parsers() returns. */
+	struct arena arena;
+
+	struct parser_stats stats;
+};
+
+/*
+ * A config file loaded by load_config_file(). The contents are always
+ * followed by a nul, so the buffer can be used as a string.
+ */
+struct config_file {
+	char	*buf;
+	size_t	len;
+
+	/* private: the length of the mapping, or zero if buf was malloc()ed */
+	size_t	map_len;
+};
+
+/* files larger than this are assumed not to be config files */
+#define CONFIG_FILE_MAX_SIZE	(4 * 1024 * 1024)
+
+enum config_file_flags {
+	/* give a private, copy-on-write view of the file, for parsers that
+	 * modify the buffer */
+	CONFIG_FILE_WRITABLE	= 0x1,
+};
 
 struct parser {
 	char *name;
 	int priority;
-	int (*parse)(const char *device);
+	/* the config files that this parser reads, as paths within the
+	 * device, in order of preference. The parser is only run if one of
+	 * them exists. */
+	const char *const *filenames;
+	/* set for a compiled menu, which holds everything the text parsers
+	 * would find: if it succeeds, no other parser is run, even when
+	 * merging */
+	int compiled;
+	int (*parse)(struct parser_context *ctx);
 	struct parser *next;
 };
 
@@ -23,10 +105,29 @@ enum generic_icon_type {
 #define streq(a,b) (!strcasecmp((a),(b)))
 
 /* general functions provided by parsers.c */
-void iterate_parsers(const char *devpath, const char *mountpoint);
+int iterate_parsers(struct parser_context *ctx);
+
+/**
+ * Load the file at @path (a path in the local filesystem) into @file, and
+ * add its size and load time to ctx->stats. Unless CONFIG_FILE_WRITABLE is
+ * given, the buffer is read-only. The file is only mapped if
+ * ctx->map_files is set.
+ *
+ * Returns 0 on success, or -1 if the file doesn't exist or can't be
+ * loaded. Only the latter is logged.
+ */
+int load_config_file(struct parser_context *ctx, const char *path,
+		int flags, struct config_file *file);
+void release_config_file(struct config_file *file);
 
-void free_device(struct device *dev);
-void free_boot_option(struct boot_option *opt);
+/**
+ * Fingerprint the text parsers' config files on the device: a hash of the
+ * name and contents of each that exists. A compiled menu is only used if
+ * it was compiled from configs with the same fingerprint.
+ *
+ * Returns 0 on success, or -1 if the files couldn't be read.
+ */
+int config_fingerprint(struct parser_context *ctx, uint64_t *fingerprint);
 
 const char *generic_icon_file(enum generic_icon_type type);
 
@@ -40,7 +141,9 @@ const char *mountpoint_for_device(const char *dev_path);
 
 enum generic_icon_type guess_device_type(void);
 
-int add_device(const struct device *dev);
-int add_boot_option(const struct boot_option *opt);
+/* these may be called from several parses at once */
+int add_device(struct parser_context *ctx, const struct device *dev);
+int add_boot_option(struct parser_context *ctx,
+		const struct boot_option *opt);
 
 #endif /* _PARSERS_H */
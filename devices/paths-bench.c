@@ -0,0 +1,261 @@
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+#include "paths.h"
+
+/*
+ * Compare the paths.c string utilities with the implementations that they
+ * replaced, kept here as a reference: first that both give the same result
+ * for a set of generated inputs, then their speed on short, long and deep
+ * paths and labels.
+ */
+
+static char *old_join_paths(const char *a, const char *b)
+{
+	char *full_path;
+
+	full_path = malloc(strlen(a) + strlen(b) + 2);
+	if (!full_path)
+		return NULL;
+
+	strcpy(full_path, a);
+	if (b[0] != '/' && a[strlen(a) - 1] != '/')
+		strcat(full_path, "/");
+	strcat(full_path, b);
+
+	return full_path;
+}
+
+static char *old_encode_label(const char *label)
+{
+	char *str, *c;
+	int i;
+
+	str = malloc(strlen(label) * 4 + 1);
+	c = str;
+
+	for (i = 0; i < strlen(label); i++) {
+
+		if (label[i] == '/' || label[i] == '\\') {
+			sprintf(c, "\\x%02x", label[i]);
+			c += 4;
+			continue;
+		}
+
+		*(c++) = label[i];
+	}
+
+	*c = '\0';
+
+	return str;
+}
+
+static char *old_parse_device_path(const char *dev_str, const char *cur_dev)
+{
+	char *dev, tmp[256], *enc;
+
+	if (!strncasecmp(dev_str, "uuid=", 5)) {
+		asprintf(&dev, "/dev/disk/by-uuid/%s", dev_str + 5);
+		return dev;
+	}
+
+	if (!strncasecmp(dev_str, "label=", 6)) {
+		enc = old_encode_label(dev_str + 6);
+		asprintf(&dev, "/dev/disk/by-label/%s", enc);
+		free(enc);
+		return dev;
+	}
+
+	if (!strncmp(dev_str, "/dev/", 5))
+		dev_str += 5;
+
+	if (cur_dev && !strncmp(cur_dev, "/dev/ps3d", 9)
+			&& !strncmp(dev_str, "sd", 2)) {
+		snprintf(tmp, 255, "ps3d%s", dev_str + 2);
+		dev_str = tmp;
+	}
+
+	return old_join_paths("/dev", dev_str);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* a path of @depth components, optionally with slashes at either end */
+static char *make_path(int depth, int leading, int trailing)
+{
+	char *buf, *c;
+	int i;
+
+	buf = malloc(depth * 16 + 3);
+	c = buf;
+	if (leading)
+		*(c++) = '/';
+	for (i = 0; i < depth; i++)
+		c += sprintf(c, "%sdir%d", i ? "/" : "", i);
+	if (trailing)
+		*(c++) = '/';
+	*c = '\0';
+
+	return buf;
+}
+
+/* a label of @len chars, with a slash or backslash every @every chars */
+static char *make_label(int len, int every)
+{
+	char *buf;
+	int i;
+
+	buf = malloc(len + 1);
+	for (i = 0; i < len; i++)
+		buf[i] = every && i % every == every - 1 ?
+			(i / every % 2 ? '\\' : '/') : 'a' + i % 26;
+	buf[len] = '\0';
+
+	return buf;
+}
+
+static int check(const char *what, const char *input, char *old, char *new)
+{
+	int rc = 0;
+
+	if (strcmp(old, new)) {
+		fprintf(stderr, "%s differs for '%s':\n  old '%s'\n  new '%s'\n",
+				what, input, old, new);
+		rc = -1;
+	}
+
+	free(old);
+	free(new);
+	return rc;
+}
+
+static int check_all(void)
+{
+	static const char *devs[] = {
+		"sda1", "/dev/sda1", "sdb", "/dev/sdc2", "ps3da1", "hda",
+		"uuid=B8E53381CA9EA0E3", "UUID=1234-5678", "label=boot",
+		"LABEL=my/disk\\label", "/dev/", "", "sd", "/dev/disk/x",
+	};
+	static const char *cur_devs[] = {
+		NULL, "/dev/sda1", "/dev/ps3da1", "/dev/ps3db",
+	};
+	int i, j, k, rc = 0;
+	char *a, *b, *label;
+
+	for (i = 0; i < sizeof(devs) / sizeof(devs[0]); i++)
+		for (j = 0; j < sizeof(cur_devs) / sizeof(cur_devs[0]); j++)
+			rc |= check("parse_device_path", devs[i],
+				old_parse_device_path(devs[i], cur_devs[j]),
+				parse_device_path(devs[i], cur_devs[j]));
+
+	for (i = 1; i < 8; i++) {
+		for (j = 0; j < 4; j++) {
+			for (k = 0; k < 4; k++) {
+				a = make_path(i, j & 1, j & 2);
+				b = make_path(i, k & 1, k & 2);
+				rc |= check("join_paths", a,
+						old_join_paths(a, b),
+						join_paths(a, b));
+				free(a);
+				free(b);
+			}
+		}
+	}
+
+	for (i = 0; i < 300; i += 7) {
+		for (j = 0; j < 5; j++) {
+			label = make_label(i, j);
+			rc |= check("encode_label", label,
+					old_encode_label(label),
+					encode_label(label));
+			free(label);
+		}
+	}
+
+	return rc;
+}
+
+#define run(name, expr, iterations) do {				\
+	uint64_t __start = now_ns();					\
+	int __i;							\
+	for (__i = 0; __i < (iterations); __i++)			\
+		free(expr);						\
+	printf("  %-6s %8.1f ns\n", name,				\
+			(double)(now_ns() - __start) / (iterations));	\
+} while (0)
+
+int main(int argc, char **argv)
+{
+	int opt, i, iterations = 200000;
+	static const int depths[] = { 2, 16, 64 };
+	static const int label_lens[] = { 8, 64, 512 };
+	char *a, *b, *label, *dev;
+
+	while ((opt = getopt(argc, argv, "i:")) != -1) {
+		switch (opt) {
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-i iterations]\n",
+					argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	/* both implementations must agree before we time them */
+	if (check_all())
+		return EXIT_FAILURE;
+
+	for (i = 0; i < sizeof(depths) / sizeof(depths[0]); i++) {
+		a = make_path(depths[i], 1, 0);
+		b = make_path(depths[i], 0, 0);
+		printf("join_paths, depth %d (%zu + %zu bytes):\n", depths[i],
+				strlen(a), strlen(b));
+		run("old", old_join_paths(a, b), iterations);
+		run("new", join_paths(a, b), iterations);
+		free(a);
+		free(b);
+	}
+
+	for (i = 0; i < sizeof(label_lens) / sizeof(label_lens[0]); i++) {
+		label = make_label(label_lens[i], 8);
+		printf("encode_label, %d bytes:\n", label_lens[i]);
+		run("old", old_encode_label(label), iterations);
+		run("new", encode_label(label), iterations);
+
+		asprintf(&dev, "label=%s", label);
+		printf("parse_device_path, %d byte label:\n", label_lens[i]);
+		run("old", old_parse_device_path(dev, NULL), iterations);
+		run("new", parse_device_path(dev, NULL), iterations);
+		free(dev);
+		free(label);
+	}
+
+	printf("parse_device_path, PS3 remap:\n");
+	run("old", old_parse_device_path("/dev/sda1", "/dev/ps3da1"),
+			iterations);
+	run("new", parse_device_path("/dev/sda1", "/dev/ps3da1"),
+			iterations);
+
+	printf("parse_device_path, uuid:\n");
+	run("old", old_parse_device_path("UUID=B8E53381CA9EA0E3", NULL),
+			iterations);
+	run("new", parse_device_path("UUID=B8E53381CA9EA0E3", NULL),
+			iterations);
+
+	return EXIT_SUCCESS;
+}
@@ -3,56 +3,254 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #include "paths.h"
+#include "arena.h"
 
 static char *mount_base;
 
-struct device_map {
-	char *dev, *mnt;
+/* a per-thread mount base, which overrides mount_base */
+static __thread const char *thread_mount_base;
+
+/*
+ * Mountpoints are found through two maps: device names (without /dev/)
+ * to mountpoints, and the "device:" prefixes seen in config files to
+ * mountpoints, so that a prefix is only parsed the first time it is seen.
+ * A prefix's device can depend on the current device (see the PS3 hack
+ * in parse_device_path), so that is part of its key. So is the mount base
+ * that the entry was created under.
+ */
+struct path_map_entry {
+	char		*key;
+	size_t		key_len;
+	const char	*base;
+	int		flags;
+	unsigned int	hash;
+	const char	*mnt;
+	size_t		mnt_len;
 };
 
-#define DEVICE_MAP_SIZE 32
-static struct device_map device_map[DEVICE_MAP_SIZE];
+/* open-addressed hash map, grown when it is half full */
+struct path_map {
+	struct path_map_entry	*entries;
+	unsigned int		size;	/* zero, or a power of two */
+	unsigned int		count;
+};
 
-char *encode_label(const char *label)
+/* prefix keys, for a current device that gets the PS3 remapping */
+#define PREFIX_FROM_PS3	0x1
+
+static struct path_map device_map;
+static struct path_map prefix_map;
+
+/* parsers may be resolving paths from several threads. Entries are never
+ * removed from the maps, and the strings they hold never move, so the
+ * returned mountpoints stay valid */
+static pthread_mutex_t device_map_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *current_mount_base(void)
+{
+	return thread_mount_base ? thread_mount_base : mount_base;
+}
+
+static unsigned int path_map_hash(const char *key, size_t len,
+		const char *base, int flags)
+{
+	unsigned int hash = 2166136261u ^ (uintptr_t)base ^ flags;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (unsigned char)key[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static struct path_map_entry *path_map_slot(struct path_map *map,
+		const char *key, size_t len, const char *base, int flags,
+		unsigned int hash)
+{
+	struct path_map_entry *entry;
+	unsigned int i;
+
+	for (i = hash & (map->size - 1);; i = (i + 1) & (map->size - 1)) {
+		entry = &map->entries[i];
+		if (!entry->key)
+			return entry;
+		if (entry->hash == hash && entry->key_len == len &&
+				entry->base == base && entry->flags == flags &&
+				!memcmp(entry->key, key, len))
+			return entry;
+	}
+}
+
+static struct path_map_entry *path_map_find(struct path_map *map,
+		const char *key, size_t len, const char *base, int flags)
+{
+	struct path_map_entry *entry;
+
+	if (!map->count)
+		return NULL;
+
+	entry = path_map_slot(map, key, len, base, flags,
+			path_map_hash(key, len, base, flags));
+	return entry->key ? entry : NULL;
+}
+
+static int path_map_grow(struct path_map *map)
+{
+	struct path_map old = *map;
+	struct path_map_entry *entry;
+	unsigned int i;
+
+	map->size = old.size ? old.size * 2 : 32;
+	map->entries = calloc(map->size, sizeof(*map->entries));
+	if (!map->entries) {
+		*map = old;
+		return -1;
+	}
+
+	for (i = 0; i < old.size; i++) {
+		entry = &old.entries[i];
+		if (entry->key)
+			*path_map_slot(map, entry->key, entry->key_len,
+					entry->base, entry->flags,
+					entry->hash) = *entry;
+	}
+
+	free(old.entries);
+	return 0;
+}
+
+/* add a new key to @map, which takes ownership of @mnt */
+static struct path_map_entry *path_map_insert(struct path_map *map,
+		const char *key, size_t len, const char *base, int flags,
+		const char *mnt)
 {
-	char *str, *c;
-	int i;
+	struct path_map_entry *entry;
+	unsigned int hash;
 
-	/* the label can be expanded by up to four times */
-	str = malloc(strlen(label) * 4 + 1);
-	c = str;
+	if ((map->count + 1) * 2 > map->size && path_map_grow(map))
+		return NULL;
+
+	hash = path_map_hash(key, len, base, flags);
+	entry = path_map_slot(map, key, len, base, flags, hash);
+
+	entry->key = strndup(key, len);
+	if (!entry->key)
+		return NULL;
+
+	entry->key_len = len;
+	entry->base = base;
+	entry->flags = flags;
+	entry->hash = hash;
+	entry->mnt = mnt;
+	entry->mnt_len = strlen(mnt);
+	map->count++;
+
+	return entry;
+}
+
+/* labels are used in symlink names, so slashes are written as "\xNN" */
+static int label_char_encoded(char c)
+{
+	return c == '/' || c == '\\';
+}
+
+static size_t encoded_label_len(const char *label, size_t len)
+{
+	size_t i, enc_len = len;
+
+	for (i = 0; i < len; i++)
+		if (label_char_encoded(label[i]))
+			enc_len += 3;
+
+	return enc_len;
+}
 
-	for (i = 0; i < strlen(label); i++) {
+/* write the encoded @label at @c, and return the end of it */
+static char *encode_label_at(char *c, const char *label, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	size_t i;
 
-		if (label[i] == '/' || label[i] == '\\') {
-			sprintf(c, "\\x%02x", label[i]);
-			c += 4;
+	for (i = 0; i < len; i++) {
+		if (!label_char_encoded(label[i])) {
+			*(c++) = label[i];
 			continue;
 		}
 
-		*(c++) = label[i];
+		*(c++) = '\\';
+		*(c++) = 'x';
+		*(c++) = hex[(unsigned char)label[i] >> 4];
+		*(c++) = hex[label[i] & 0xf];
 	}
 
-	*c = '\0';
+	return c;
+}
+
+char *encode_label(const char *label)
+{
+	size_t len = strlen(label);
+	char *str;
+
+	str = malloc(encoded_label_len(label, len) + 1);
+	if (!str)
+		return NULL;
+
+	*encode_label_at(str, label, len) = '\0';
 
 	return str;
 }
 
+/* join_paths(), for strings of known length. If @sep is zero, the
+ * strings are simply concatenated */
+static char *join_paths_len(const char *a, size_t a_len,
+		const char *b, size_t b_len, int sep)
+{
+	char *full_path, *c;
+
+	full_path = malloc(a_len + b_len + 2);
+	if (!full_path)
+		return NULL;
+
+	memcpy(full_path, a, a_len);
+	c = full_path + a_len;
+	if (sep && b[0] != '/' && (!a_len || a[a_len - 1] != '/'))
+		*(c++) = '/';
+	memcpy(c, b, b_len + 1);
+
+	return full_path;
+}
+
+#define DISK_BY_UUID	"/dev/disk/by-uuid/"
+#define DISK_BY_LABEL	"/dev/disk/by-label/"
+#define PS3_DEV_PREFIX	"/dev/ps3d"
+
 char *parse_device_path(const char *dev_str, const char *cur_dev)
 {
-	char *dev, tmp[256], *enc;
+	size_t len, prefix_len;
+	char *dev;
 
 	if (!strncasecmp(dev_str, "uuid=", 5)) {
-		asprintf(&dev, "/dev/disk/by-uuid/%s", dev_str + 5);
-		return dev;
+		dev_str += 5;
+		return join_paths_len(DISK_BY_UUID, strlen(DISK_BY_UUID),
+				dev_str, strlen(dev_str), 0);
 	}
 
 	if (!strncasecmp(dev_str, "label=", 6)) {
-		enc = encode_label(dev_str + 6);
-		asprintf(&dev, "/dev/disk/by-label/%s", enc);
-		free(enc);
+		dev_str += 6;
+		len = strlen(dev_str);
+		prefix_len = strlen(DISK_BY_LABEL);
+
+		dev = malloc(prefix_len + encoded_label_len(dev_str, len) + 1);
+		if (!dev)
+			return NULL;
+
+		memcpy(dev, DISK_BY_LABEL, prefix_len);
+		*encode_label_at(dev + prefix_len, dev_str, len) = '\0';
 		return dev;
 	}
 
@@ -66,76 +264,192 @@ char *parse_device_path(const char *dev_str, const char *cur_dev)
 	 * a sdx device, remap to ps3dx */
 	if (cur_dev && !strncmp(cur_dev, "/dev/ps3d", 9)
 			&& !strncmp(dev_str, "sd", 2)) {
-		snprintf(tmp, 255, "ps3d%s", dev_str + 2);
-		dev_str = tmp;
+		dev_str += 2;
+		return join_paths_len(PS3_DEV_PREFIX, strlen(PS3_DEV_PREFIX),
+				dev_str, strlen(dev_str), 0);
 	}
 
-	return join_paths("/dev", dev_str);
+	return join_paths_len("/dev", 4, dev_str, strlen(dev_str), 1);
 }
 
-const char *mountpoint_for_device(const char *dev)
+/* find (or create) the map entry for @dev; called with the lock held */
+static const struct path_map_entry *lookup_device(const char *dev)
 {
-	int i;
+	const char *base = current_mount_base();
+	struct path_map_entry *entry;
+	size_t len;
+	char *mnt;
 
 	if (!strncmp(dev, "/dev/", 5))
 		dev += 5;
 
-	/* check existing entries in the map */
-	for (i = 0; (i < DEVICE_MAP_SIZE) && device_map[i].dev; i++)
-		if (!strcmp(device_map[i].dev, dev))
-			return device_map[i].mnt;
+	len = strlen(dev);
+	entry = path_map_find(&device_map, dev, len, base, 0);
+	if (entry)
+		return entry;
 
-	if (i == DEVICE_MAP_SIZE)
+	mnt = join_paths(base, dev);
+	if (!mnt)
 		return NULL;
 
-	device_map[i].dev = strdup(dev);
-	device_map[i].mnt = join_paths(mount_base, dev);
-	return device_map[i].mnt;
+	entry = path_map_insert(&device_map, dev, len, base, 0, mnt);
+	if (!entry)
+		free(mnt);
+	return entry;
 }
 
-char *resolve_path(const char *path, const char *current_dev)
+/* find (or create) the map entry for the device named by the @len-byte
+ * @prefix, as seen on @cur_dev; called with the lock held */
+static const struct path_map_entry *lookup_prefix(const char *prefix,
+		size_t len, const char *cur_dev)
+{
+	const char *base = current_mount_base();
+	const struct path_map_entry *dev_entry;
+	struct path_map_entry *entry;
+	char *tmp, *dev;
+	int flags = 0;
+
+	if (cur_dev && !strncmp(cur_dev, "/dev/ps3d", 9))
+		flags |= PREFIX_FROM_PS3;
+
+	entry = path_map_find(&prefix_map, prefix, len, base, flags);
+	if (entry)
+		return entry;
+
+	tmp = strndup(prefix, len);
+	if (!tmp)
+		return NULL;
+
+	dev = parse_device_path(tmp, cur_dev);
+	free(tmp);
+	if (!dev)
+		return NULL;
+
+	/* the mountpoint string is shared with the device map */
+	dev_entry = lookup_device(dev);
+	free(dev);
+	if (!dev_entry)
+		return NULL;
+
+	return path_map_insert(&prefix_map, prefix, len, base, flags,
+			dev_entry->mnt);
+}
+
+const char *mountpoint_for_device(const char *dev)
 {
+	const struct path_map_entry *entry;
+	const char *mnt;
+
+	pthread_mutex_lock(&device_map_lock);
+	entry = lookup_device(dev);
+	mnt = entry ? entry->mnt : NULL;
+	pthread_mutex_unlock(&device_map_lock);
+
+	return mnt;
+}
+
+/* the mountpoint for @path (either device:path or a path on
+ * @current_dev) followed by the rest of @path, in a single allocation */
+static char *resolve_path_alloc(struct arena *arena, const char *path,
+		const char *current_dev)
+{
+	const struct path_map_entry *entry;
+	const char *mnt, *sep;
+	size_t mnt_len, len;
 	char *ret;
-	const char *devpath, *sep;
+
+	pthread_mutex_lock(&device_map_lock);
 
 	sep = strchr(path, ':');
 	if (!sep) {
-		devpath = mountpoint_for_device(current_dev);
-		ret = join_paths(devpath, path);
+		entry = lookup_device(current_dev);
 	} else {
-		/* parse just the device name into dev */
-		char *tmp, *dev;
-		tmp = strndup(path, sep - path);
-		dev = parse_device_path(tmp, current_dev);
+		entry = lookup_prefix(path, sep - path, current_dev);
+		path = sep + 1;
+	}
 
-		devpath = mountpoint_for_device(dev);
-		ret = join_paths(devpath, sep + 1);
+	/* the entry may move once we drop the lock, but its strings won't */
+	mnt = entry ? entry->mnt : NULL;
+	mnt_len = entry ? entry->mnt_len : 0;
 
-		free(dev);
-		free(tmp);
-	}
+	pthread_mutex_unlock(&device_map_lock);
+
+	if (!mnt)
+		return NULL;
+
+	len = strlen(path);
+
+	ret = arena ? arena_alloc(arena, mnt_len + len + 2) :
+		malloc(mnt_len + len + 2);
+	if (!ret)
+		return NULL;
+
+	memcpy(ret, mnt, mnt_len);
+	if (path[0] != '/' && (!mnt_len || mnt[mnt_len - 1] != '/'))
+		ret[mnt_len++] = '/';
+	memcpy(ret + mnt_len, path, len + 1);
 
 	return ret;
 }
 
-void set_mount_base(const char *path)
+char *resolve_path(const char *path, const char *current_dev)
 {
-	if (mount_base)
-		free(mount_base);
-	mount_base = strdup(path);
+	return resolve_path_alloc(NULL, path, current_dev);
 }
 
-char *join_paths(const char *a, const char *b)
+char *resolve_path_arena(struct arena *arena, const char *path,
+		const char *current_dev)
 {
-	char *full_path;
+	return resolve_path_alloc(arena, path, current_dev);
+}
 
-	full_path = malloc(strlen(a) + strlen(b) + 2);
+char *device_for_path(const char *path, const char **rest)
+{
+	const struct path_map_entry *entry, *best = NULL;
+	const char *base;
+	unsigned int i;
+	char *dev;
 
-	strcpy(full_path, a);
-	if (b[0] != '/' && a[strlen(a) - 1] != '/')
-		strcat(full_path, "/");
-	strcat(full_path, b);
+	pthread_mutex_lock(&device_map_lock);
 
-	return full_path;
+	base = current_mount_base();
+
+	/* mountpoints may be nested, so take the longest match */
+	for (i = 0; i < device_map.size; i++) {
+		entry = &device_map.entries[i];
+		if (!entry->key || entry->base != base ||
+				strncmp(path, entry->mnt, entry->mnt_len) ||
+				path[entry->mnt_len] != '/')
+			continue;
+		if (!best || entry->mnt_len > best->mnt_len)
+			best = entry;
+	}
+
+	dev = best ? join_paths("/dev", best->key) : NULL;
+	if (dev)
+		*rest = path + best->mnt_len;
+
+	pthread_mutex_unlock(&device_map_lock);
+
+	return dev;
+}
+
+/* The old base isn't freed: map entries refer to it, and a new base at
+ * the same address would make them match again */
+void set_mount_base(const char *path)
+{
+	pthread_mutex_lock(&device_map_lock);
+	mount_base = strdup(path);
+	pthread_mutex_unlock(&device_map_lock);
+}
+
+void set_thread_mount_base(const char *path)
+{
+	thread_mount_base = path;
+}
+
+char *join_paths(const char *a, const char *b)
+{
+	return join_paths_len(a, strlen(a), b, strlen(b), 1);
 }
 
@@ -31,12 +31,37 @@ const char *mountpoint_for_device(const char *dev);
  */
 char *resolve_path(const char *path, const char *current_device);
 
+struct arena;
+
+/**
+ * As resolve_path(), but the string is allocated from @arena.
+ */
+char *resolve_path_arena(struct arena *arena, const char *path,
+		const char *current_device);
+
+/**
+ * The reverse of resolve_path(): find the device whose mountpoint @path is
+ * under, and set *@rest to the rest of @path, starting with a '/'. Only
+ * devices that have already been looked up are found.
+ *
+ * Returns a newly-allocated device path (eg /dev/sda1), or NULL if @path
+ * isn't under any device's mountpoint.
+ */
+char *device_for_path(const char *path, const char **rest);
 
 /**
  * Set the base directory for newly-created mountpoints
  */
 void set_mount_base(const char *path);
 
+/**
+ * Set the base directory for mountpoints looked up by the calling thread,
+ * overriding set_mount_base(), or go back to the global base if @path is
+ * NULL. Devices have separate mountpoints under each base. @path must stay
+ * valid while it is set, and while mountpoints under it are in use.
+ */
+void set_thread_mount_base(const char *path);
+
 /**
  * Utility function for joining two paths. Adds a / between a and b if
  * required.
@@ -0,0 +1,361 @@
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <asm/byteorder.h>
+
+#include "parser.h"
+#include "paths.h"
+#include "menu-file.h"
+
+/*
+ * Compile the boot configs on a device into a menu file, which the
+ * compiled menu parser loads without parsing the configs again (see
+ * menu-file.h). The text parsers are run just as at boot, and every device
+ * and option they add is recorded.
+ */
+
+static int verbose;
+
+void pb_log(const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!verbose)
+		return;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+}
+
+int mount_device(const char *dev_path)
+{
+	return 0;
+}
+
+/* the device type is found again when the menu is loaded */
+enum generic_icon_type guess_device_type(void)
+{
+	return ICON_TYPE_UNKNOWN;
+}
+
+struct menu_builder {
+	const char	*dev_path;
+
+	FILE		*records;
+	char		*records_buf;
+	size_t		records_len;
+
+	FILE		*strings;
+	char		*strings_buf;
+	size_t		strings_len;
+
+	/* the offset of the current device's option count in the records */
+	long		device_pos;
+	uint32_t	device_options;
+
+	uint32_t	n_devices;
+	uint32_t	n_options;
+	int		error;
+};
+
+static void put_u32(FILE *fp, uint32_t val)
+{
+	uint32_t val_buf = __cpu_to_be32(val);
+
+	fwrite(&val_buf, sizeof(val_buf), 1, fp);
+}
+
+static uint32_t add_string(struct menu_builder *b, enum menu_ref_kind kind,
+		const char *str)
+{
+	long offset = ftell(b->strings);
+
+	if (offset < 0 || offset > MENU_REF_MAX_OFFSET) {
+		b->error = 1;
+		return MENU_REF(MENU_REF_NULL, 0);
+	}
+
+	fwrite(str, strlen(str) + 1, 1, b->strings);
+	return MENU_REF(kind, offset);
+}
+
+static uint32_t string_ref(struct menu_builder *b, const char *str)
+{
+	if (!str)
+		return MENU_REF(MENU_REF_NULL, 0);
+	return add_string(b, MENU_REF_STRING, str);
+}
+
+/* Store a path on a device as a config file would refer to it, so that it
+ * can be resolved against wherever the device is mounted at boot. Paths
+ * that aren't on a device are stored as they are */
+static uint32_t path_ref(struct menu_builder *b, const char *path)
+{
+	const char *rest;
+	char *dev, *cfg_path = NULL, *check;
+	uint32_t ref;
+
+	if (!path)
+		return MENU_REF(MENU_REF_NULL, 0);
+
+	dev = device_for_path(path, &rest);
+	if (!dev)
+		return string_ref(b, path);
+
+	if (!strcmp(dev, b->dev_path))
+		cfg_path = strdup(rest);
+	else if (asprintf(&cfg_path, "%s:%s", dev, rest) < 0)
+		cfg_path = NULL;
+	free(dev);
+
+	if (!cfg_path) {
+		b->error = 1;
+		return MENU_REF(MENU_REF_NULL, 0);
+	}
+
+	/* make sure that it will resolve back to the same path */
+	check = resolve_path(cfg_path, b->dev_path);
+	if (check && !strcmp(check, path)) {
+		ref = add_string(b, MENU_REF_PATH, cfg_path);
+	} else {
+		fprintf(stderr, "warning: can't store %s relative to its "
+				"device\n", path);
+		ref = string_ref(b, path);
+	}
+
+	free(check);
+	free(cfg_path);
+	return ref;
+}
+
+static uint32_t device_icon_ref(struct menu_builder *b, const char *icon)
+{
+	int type;
+
+	for (type = ICON_TYPE_DISK; icon && type <= ICON_TYPE_UNKNOWN; type++)
+		if (!strcmp(icon, generic_icon_file(type)))
+			return MENU_REF(MENU_REF_GENERIC_ICON, 0);
+
+	return path_ref(b, icon);
+}
+
+/* the previous device's option count wasn't known when it was written */
+static void finish_device(struct menu_builder *b)
+{
+	uint32_t val_buf = __cpu_to_be32(b->device_options);
+
+	if (b->device_pos < 0)
+		return;
+
+	fflush(b->records);
+	memcpy(b->records_buf + b->device_pos, &val_buf, sizeof(val_buf));
+	b->device_pos = -1;
+}
+
+int add_device(struct parser_context *ctx, const struct device *dev)
+{
+	struct menu_builder *b = ctx->data;
+
+	finish_device(b);
+
+	b->device_pos = ftell(b->records);
+	b->device_options = 0;
+	b->n_devices++;
+
+	put_u32(b->records, 0);
+	put_u32(b->records, dev->id && !strcmp(dev->id, ctx->device_path) ?
+			MENU_REF(MENU_REF_DEVICE_PATH, 0) :
+			string_ref(b, dev->id));
+	put_u32(b->records, string_ref(b, dev->name));
+	put_u32(b->records, string_ref(b, dev->description));
+	put_u32(b->records, device_icon_ref(b, dev->icon_file));
+
+	return 0;
+}
+
+int add_boot_option(struct parser_context *ctx,
+		const struct boot_option *opt)
+{
+	struct menu_builder *b = ctx->data;
+
+	if (b->device_pos < 0) {
+		fprintf(stderr, "option %s added before device\n", opt->name);
+		b->error = 1;
+		return -1;
+	}
+
+	b->device_options++;
+	b->n_options++;
+
+	put_u32(b->records, string_ref(b, opt->id));
+	put_u32(b->records, string_ref(b, opt->name));
+	put_u32(b->records, string_ref(b, opt->description));
+	put_u32(b->records, path_ref(b, opt->icon_file));
+	put_u32(b->records, path_ref(b, opt->boot_image_file));
+	put_u32(b->records, path_ref(b, opt->initrd_file));
+	put_u32(b->records, string_ref(b, opt->boot_args));
+
+	return 0;
+}
+
+static int write_menu(struct menu_builder *b, struct parser_context *ctx,
+		const char *filename)
+{
+	struct menu_file_header hdr;
+	uint64_t fingerprint;
+	uint32_t checksum;
+	char *tmp;
+	FILE *fp;
+	int rc;
+
+	if (config_fingerprint(ctx, &fingerprint)) {
+		fprintf(stderr, "can't read the configs on %s\n",
+				ctx->device_path);
+		return -1;
+	}
+
+	checksum = menu_file_hash32(MENU_FILE_HASH32_INIT, b->records_buf,
+			b->records_len);
+	checksum = menu_file_hash32(checksum, b->strings_buf,
+			b->strings_len);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, MENU_FILE_MAGIC, sizeof(hdr.magic));
+	hdr.version = __cpu_to_be32(MENU_FILE_VERSION);
+	hdr.flags = __cpu_to_be32(ctx->merge ? MENU_FILE_MERGED : 0);
+	hdr.size = __cpu_to_be32(sizeof(hdr) + b->records_len +
+			b->strings_len);
+	hdr.checksum = __cpu_to_be32(checksum);
+	hdr.fingerprint[0] = __cpu_to_be32(fingerprint >> 32);
+	hdr.fingerprint[1] = __cpu_to_be32(fingerprint & 0xffffffff);
+	hdr.n_devices = __cpu_to_be32(b->n_devices);
+	hdr.n_options = __cpu_to_be32(b->n_options);
+	hdr.strings_len = __cpu_to_be32(b->strings_len);
+
+	if (asprintf(&tmp, "%s.new", filename) < 0)
+		return -1;
+
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		fprintf(stderr, "can't create %s: %s\n", tmp, strerror(errno));
+		free(tmp);
+		return -1;
+	}
+
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+	fwrite(b->records_buf, 1, b->records_len, fp);
+	fwrite(b->strings_buf, 1, b->strings_len, fp);
+
+	rc = ferror(fp);
+	if (fclose(fp) || rc || rename(tmp, filename)) {
+		fprintf(stderr, "can't write %s\n", filename);
+		unlink(tmp);
+		rc = -1;
+	}
+
+	free(tmp);
+	return rc;
+}
+
+static void usage(const char *progname)
+{
+	fprintf(stderr, "usage: %s [-m] [-v] [-o <output>] "
+			"<basedir> <devname>\n"
+			"Compile the configs on <devname>, mounted at "
+			"<basedir>/<devname>, into a menu\n"
+			"file (by default, %s on the device)\n"
+			"  -m  merge the configs of every parser\n",
+			progname, MENU_FILE_NAME);
+}
+
+int main(int argc, char **argv)
+{
+	struct parser_context ctx;
+	struct menu_builder b;
+	char *output = NULL, *dev;
+	int opt, merge = 0, rc;
+
+	while ((opt = getopt(argc, argv, "mvo:")) != -1) {
+		switch (opt) {
+		case 'm':
+			merge = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (argc - optind != 2) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	set_mount_base(argv[optind]);
+
+	/* devices are always matched by their /dev path */
+	dev = parse_device_path(argv[optind + 1], NULL);
+	if (!dev)
+		return EXIT_FAILURE;
+
+	memset(&b, 0, sizeof(b));
+	b.dev_path = dev;
+	b.device_pos = -1;
+	b.records = open_memstream(&b.records_buf, &b.records_len);
+	b.strings = open_memstream(&b.strings_buf, &b.strings_len);
+	if (!b.records || !b.strings)
+		return EXIT_FAILURE;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.device_path = dev;
+	ctx.mountpoint = mountpoint_for_device(dev);
+	ctx.merge = merge;
+	ctx.text_only = 1;
+	ctx.data = &b;
+
+	iterate_parsers(&ctx);
+
+	finish_device(&b);
+	fclose(b.records);
+	fclose(b.strings);
+
+	if (b.error) {
+		fprintf(stderr, "error compiling the configs on %s\n", dev);
+		return EXIT_FAILURE;
+	}
+
+	if (!b.n_devices) {
+		fprintf(stderr, "no boot options found on %s\n", dev);
+		return EXIT_FAILURE;
+	}
+
+	if (!output)
+		output = resolve_path(MENU_FILE_NAME, dev);
+
+	rc = write_menu(&b, &ctx, output);
+	if (!rc)
+		printf("%s: %u devices, %u options, %zu bytes\n", output,
+				b.n_devices, b.n_options,
+				sizeof(struct menu_file_header) +
+				b.records_len + b.strings_len);
+
+	free(b.records_buf);
+	free(b.strings_buf);
+	free(dev);
+
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
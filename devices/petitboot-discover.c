@@ -0,0 +1,878 @@
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <pwd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "message.h"
+#include "device-table.h"
+#include "shm-table.h"
+#include "parser-pool.h"
+#include "paths.h"
+#include "petitboot-paths.h"
+
+/*
+ * The discovery daemon owns the device socket. The udev helpers connect to
+ * it and send the devices and boot options they find; we keep the
+ * authoritative table of everything that has been discovered, and send it
+ * to any frontend that subscribes. This means that a frontend can be
+ * restarted without having to re-probe any devices.
+ *
+ * The helpers mount the devices, but the configs on them are parsed here,
+ * by a pool of unprivileged worker processes (see parser-pool.h).
+ */
+
+/* default listen() backlog for the device socket. This needs to be large
+ * enough for all of the udev helpers started during a coldplug */
+#define DEFAULT_BACKLOG		128
+
+/* client contexts are allocated in chunks of this many */
+#define CLIENT_POOL_CHUNK	32
+
+/* how much we read from a client at a time */
+#define CLIENT_READ_SIZE	16384
+
+/* a subscriber that takes none of its waiting output for this long has
+ * stopped reading, and is dropped */
+#define CLIENT_WRITE_TIMEOUT_MS	5000
+
+/* default number of parser workers */
+#define DEFAULT_PARSER_WORKERS	2
+
+/* who the parser workers run as, if we can't look up PBOOT_PARSER_USER */
+#define PARSER_FALLBACK_ID	65534
+
+struct client {
+	int			fd;
+	int			subscriber;
+
+	/* the device that incoming option messages refer to */
+	struct device_entry	*cur;
+
+	/* for subscribers: the device that the last outgoing option message
+	 * referred to */
+	struct device_entry	*sent;
+
+	/* for shared table subscribers: the last region and generation that
+	 * we've told the client about. The epoch is 0 until we've sent the
+	 * first region */
+	int			shm_subscriber;
+	unsigned int		shm_epoch;
+	uint32_t		shm_generation;
+
+	/* the fd is non-blocking, so that a client that stops part-way
+	 * through a message, or stops reading, only holds itself up: @in has
+	 * the start of a message that hasn't all arrived yet, and @out what
+	 * is waiting to be sent */
+	struct msg_buf		in;
+	struct msg_buf		out;
+	long			write_deadline;	/* in ms, 0 if none */
+
+	struct client		*next;
+};
+
+static FILE *logf;
+static struct device_table table;
+static struct shm_table *shm;
+static struct parser_pool *pool;
+static struct client *clients;
+static struct client *free_clients;
+static int n_clients, n_pooled_clients;
+
+void pb_log(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(logf, fmt, ap);
+	va_end(ap);
+	fflush(logf);
+}
+
+static long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static struct client *get_client(int fd)
+{
+	struct client *client;
+	int i;
+
+	if (!free_clients) {
+		client = calloc(CLIENT_POOL_CHUNK, sizeof(*client));
+		if (!client)
+			return NULL;
+
+		for (i = 0; i < CLIENT_POOL_CHUNK; i++) {
+			client[i].next = free_clients;
+			free_clients = &client[i];
+		}
+
+		n_pooled_clients += CLIENT_POOL_CHUNK;
+		pb_log("client pool grown to %d\n", n_pooled_clients);
+	}
+
+	client = free_clients;
+	free_clients = client->next;
+
+	memset(client, 0, sizeof(*client));
+	client->fd = fd;
+	client->next = clients;
+	clients = client;
+	n_clients++;
+
+	return client;
+}
+
+/* stop handling @client's connection, and return its fd */
+static int detach_client(struct client *client)
+{
+	struct client **p;
+	int fd = client->fd;
+
+	for (p = &clients; *p; p = &(*p)->next) {
+		if (*p == client) {
+			*p = client->next;
+			break;
+		}
+	}
+
+	msg_buf_free(&client->in);
+	msg_buf_free(&client->out);
+
+	client->fd = -1;
+	client->next = free_clients;
+	free_clients = client;
+	n_clients--;
+
+	return fd;
+}
+
+static void put_client(struct client *client)
+{
+	close(detach_client(client));
+}
+
+/*
+ * Queue a message for all subscribers, to be sent by flush_clients(). If
+ * @entry is set, the message refers to that device, so make sure that it
+ * is the subscriber's current device first. @msg may be NULL, to just send
+ * the device. Subscribers that we can't queue the message for are dropped.
+ */
+static void broadcast(struct device_entry *entry, const struct msg_buf *msg)
+{
+	struct client *client, *next;
+	int rc;
+
+	for (client = clients; client; client = next) {
+		next = client->next;
+
+		if (!client->subscriber)
+			continue;
+
+		rc = 0;
+
+		if (entry && client->sent != entry) {
+			rc = msg_buf_add_device(&client->out, entry->dev);
+			client->sent = entry;
+		}
+
+		if (!rc && msg)
+			rc = msg_buf_add_data(&client->out, msg->data, msg->len);
+
+		if (rc) {
+			pb_log("dropping subscriber %d\n", client->fd);
+			put_client(client);
+		}
+	}
+}
+
+static int handle_add_device(struct client *client, struct msg_reader *r)
+{
+	struct device_entry *entry;
+	struct device *dev;
+
+	dev = msg_reader_dup_device(r);
+	if (!dev)
+		return 1;
+
+	entry = device_table_find(&table, dev->id);
+	if (!entry) {
+		entry = device_entry_create(dev);
+		if (!entry || device_table_add(&table, entry)) {
+			pb_log("can't add device %s\n", dev->id);
+			device_entry_free(entry);
+			free_device(dev);
+			return -1;
+		}
+
+		pb_log("added device %s\n", dev->id);
+		broadcast(entry, NULL);
+		if (shm)
+			shm_table_add_device(shm, entry);
+	}
+
+	free_device(dev);
+	client->cur = entry;
+
+	return 0;
+}
+
+static int handle_option(struct client *client, struct msg_reader *r,
+		enum device_action action)
+{
+	struct msg_buf buf = MSG_BUF_INIT;
+	struct boot_option *opt;
+	int rc, existed;
+
+	opt = msg_reader_dup_boot_option(r);
+	if (!opt)
+		return 1;
+
+	if (!client->cur) {
+		pb_log("option %s, but no device has been sent\n", opt->id);
+		free_boot_option(opt);
+		return -1;
+	}
+
+	/* adding an option that we already have is an update, so that
+	 * re-sending a whole device doesn't duplicate its options */
+	existed = device_entry_find_option(client->cur, opt->id) != NULL;
+
+	rc = device_entry_update_option(client->cur, opt);
+	if (rc == 1) {
+		action = existed ? DEV_ACTION_UPDATE_OPTION :
+			DEV_ACTION_ADD_OPTION;
+		if (!msg_buf_add_boot_option(&buf, action, opt))
+			broadcast(client->cur, &buf);
+		msg_buf_free(&buf);
+		if (shm)
+			shm_table_add_option(shm, client->cur, action, opt);
+	}
+
+	free_boot_option(opt);
+
+	return rc < 0 ? -1 : 0;
+}
+
+static int handle_remove_option(struct client *client, struct msg_reader *r)
+{
+	struct msg_buf buf = MSG_BUF_INIT;
+	char *id;
+
+	id = msg_reader_dup_string(r);
+	if (!id)
+		return 1;
+
+	if (!client->cur) {
+		pb_log("option %s, but no device has been sent\n", id);
+		free(id);
+		return -1;
+	}
+
+	if (!device_entry_remove_option(client->cur, id)) {
+		if (!msg_buf_add_action(&buf, DEV_ACTION_REMOVE_OPTION) &&
+				!msg_buf_add_string(&buf, id))
+			broadcast(client->cur, &buf);
+		msg_buf_free(&buf);
+		if (shm)
+			shm_table_remove_option(shm, client->cur, id);
+	}
+
+	free(id);
+	return 0;
+}
+
+static int handle_remove_device(struct client *client, struct msg_reader *r)
+{
+	struct msg_buf buf = MSG_BUF_INIT;
+	struct device_entry *entry;
+	struct client *c;
+	char *id;
+
+	id = msg_reader_dup_string(r);
+	if (!id)
+		return 1;
+
+	entry = device_table_remove(&table, id);
+	if (entry) {
+		pb_log("removed device %s\n", id);
+
+		/* removing a device changes the frontend's device indices,
+		 * so make sure we re-send the device for the next option
+		 * message */
+		for (c = clients; c; c = c->next) {
+			if (c->cur == entry)
+				c->cur = NULL;
+			c->sent = NULL;
+		}
+
+		if (!msg_buf_add_action(&buf, DEV_ACTION_REMOVE_DEVICE) &&
+				!msg_buf_add_string(&buf, id))
+			broadcast(NULL, &buf);
+		msg_buf_free(&buf);
+		if (shm)
+			shm_table_remove_device(shm, id);
+		device_entry_free(entry);
+	}
+
+	free(id);
+	return 0;
+}
+
+static int handle_subscribe(struct client *client)
+{
+	pb_log("new subscriber %d, sending %d devices\n",
+			client->fd, table.n_entries);
+
+	/* the whole table is queued at once, so it goes in as few writes as
+	 * the client allows */
+	if (msg_buf_add_device_table(&client->out, &table))
+		return -1;
+
+	client->subscriber = 1;
+	client->sent = table.n_entries ?
+		table.entries[table.n_entries - 1] : NULL;
+
+	return 0;
+}
+
+static int handle_subscribe_shm(struct client *client)
+{
+	if (!shm)
+		shm = shm_table_create(&table);
+
+	if (!shm) {
+		pb_log("no shared table, falling back to messages\n");
+		return handle_subscribe(client);
+	}
+
+	pb_log("new shared table subscriber %d\n", client->fd);
+
+	/* flush_clients() sends the region */
+	client->shm_subscriber = 1;
+	client->shm_epoch = 0;
+
+	return 0;
+}
+
+/* whether there is anything waiting to be sent to @client */
+static int client_has_output(const struct client *client)
+{
+	if (client->out.len)
+		return 1;
+
+	return client->shm_subscriber && shm &&
+		(client->shm_epoch != shm->epoch ||
+		 client->shm_generation != shm->hdr->generation);
+}
+
+/* write as much of @client's queued output as it will take */
+static int send_output(struct client *client)
+{
+	struct msg_buf *out = &client->out;
+	int rc;
+
+	if (!out->len)
+		return 0;
+
+	rc = write(client->fd, out->data, out->len);
+	if (rc < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return 0;
+		pb_log("write to %d failed: %s\n", client->fd, strerror(errno));
+		return -1;
+	}
+
+	/* it's still reading, so it gets a new deadline */
+	if (rc)
+		client->write_deadline = 0;
+
+	out->len -= rc;
+	memmove(out->data, out->data + rc, out->len);
+	return 0;
+}
+
+/*
+ * Send what we can of @client's output. Once its queue is empty, a shared
+ * table subscriber is told about anything that has been published since
+ * we last told it: a new region, which carries an fd, is sent on its own.
+ */
+static int flush_client(struct client *client)
+{
+	uint32_t generation;
+
+	if (send_output(client))
+		return -1;
+
+	if (!client->shm_subscriber || !shm || client->out.len)
+		return 0;
+
+	generation = shm->hdr->generation;
+
+	if (client->shm_epoch != shm->epoch) {
+		if (write_action_fd(client->fd, DEV_ACTION_SHM_REGION,
+					shm->ro_fd))
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+	} else if (client->shm_generation != generation) {
+		if (msg_buf_add_action(&client->out,
+					DEV_ACTION_SHM_GENERATION) ||
+				msg_buf_add_u32(&client->out, generation) ||
+				send_output(client))
+			return -1;
+	} else {
+		return 0;
+	}
+
+	client->shm_epoch = shm->epoch;
+	client->shm_generation = generation;
+	return 0;
+}
+
+/*
+ * Send what we can to every client that has output waiting. This is done
+ * once for each batch of incoming messages, rather than for every change.
+ * Subscribers that have gone away, or have stopped reading, are dropped.
+ */
+static void flush_clients(void)
+{
+	struct client *client, *next;
+	long now = now_ms();
+
+	for (client = clients; client; client = next) {
+		next = client->next;
+
+		if (!client_has_output(client))
+			continue;
+
+		if (flush_client(client)) {
+			pb_log("dropping subscriber %d\n", client->fd);
+			put_client(client);
+		} else if (!client_has_output(client)) {
+			client->write_deadline = 0;
+		} else if (!client->write_deadline) {
+			client->write_deadline = now + CLIENT_WRITE_TIMEOUT_MS;
+		} else if (now >= client->write_deadline) {
+			pb_log("subscriber %d isn't reading, dropping it\n",
+					client->fd);
+			put_client(client);
+		}
+	}
+}
+
+/* the poll() timeout until the next subscriber's write deadline, or -1 if
+ * no subscriber has one */
+static int clients_timeout(void)
+{
+	struct client *client;
+	long now = now_ms(), timeout = -1, left;
+
+	for (client = clients; client; client = client->next) {
+		if (!client->write_deadline)
+			continue;
+
+		left = client->write_deadline > now ?
+			client->write_deadline - now : 0;
+
+		if (timeout < 0 || left < timeout)
+			timeout = left;
+	}
+
+	return timeout;
+}
+
+/*
+ * Hand the client's connection to the parser pool, which sends the result
+ * of the parse on it. The connection is only used for this request.
+ */
+static int handle_parse_device(struct client *client, struct msg_reader *r)
+{
+	struct msg_buf buf = MSG_BUF_INIT;
+	uint32_t flags, icon_type;
+	char *dev_path;
+	int fd, rc;
+
+	dev_path = msg_reader_dup_string(r);
+	if (!dev_path || msg_reader_u32(r, &flags) ||
+			msg_reader_u32(r, &icon_type)) {
+		free(dev_path);
+		return 1;
+	}
+
+	pb_log("parsing %s\n", dev_path);
+	fd = detach_client(client);
+
+	/* the result is sent with blocking writes, by a worker that shares
+	 * the file's flags with us */
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+	if (pool) {
+		rc = parser_pool_submit(pool, fd, dev_path, flags, icon_type);
+	} else {
+		rc = msg_buf_add_action(&buf, DEV_ACTION_PARSE_RESULT) ||
+			msg_buf_add_u32(&buf, PARSE_STATUS_UNAVAILABLE) ||
+			msg_buf_write(fd, &buf);
+		msg_buf_free(&buf);
+		close(fd);
+	}
+
+	if (rc)
+		pb_log("can't parse %s\n", dev_path);
+
+	free(dev_path);
+	return 0;
+}
+
+/*
+ * Each handler returns 0 once it has handled its message, 1 if the rest of
+ * the message hasn't arrived yet, or -1 if the client should be dropped.
+ */
+static int handle_message(struct client *client, struct msg_reader *r,
+		enum device_action action)
+{
+	switch (action) {
+	case DEV_ACTION_ADD_DEVICE:
+		return handle_add_device(client, r);
+	case DEV_ACTION_ADD_OPTION:
+	case DEV_ACTION_UPDATE_OPTION:
+		return handle_option(client, r, action);
+	case DEV_ACTION_REMOVE_OPTION:
+		return handle_remove_option(client, r);
+	case DEV_ACTION_REMOVE_DEVICE:
+		return handle_remove_device(client, r);
+	case DEV_ACTION_SUBSCRIBE:
+		return handle_subscribe(client);
+	case DEV_ACTION_SUBSCRIBE_SHM:
+		return handle_subscribe_shm(client);
+	case DEV_ACTION_PARSE_DEVICE:
+		return handle_parse_device(client, r);
+	default:
+		break;
+	}
+
+	pb_log("unsupported action %d\n", action);
+	return -1;
+}
+
+/* read what has arrived from @client, and handle the messages that have
+ * arrived in full, keeping the start of any that hasn't */
+static int process_client(struct client *client)
+{
+	enum device_action action;
+	struct msg_reader r;
+	unsigned int start;
+	int fd = client->fd, rc;
+
+	if (msg_buf_reserve(&client->in, CLIENT_READ_SIZE))
+		return -1;
+
+	rc = read(fd, client->in.data + client->in.len,
+			client->in.size - client->in.len);
+	if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+				errno == EINTR))
+		return 0;
+	if (rc <= 0)
+		return -1;
+
+	client->in.len += rc;
+
+	r.data = client->in.data;
+	r.len = client->in.len;
+	r.pos = 0;
+
+	for (;;) {
+		start = r.pos;
+		if (msg_reader_action(&r, &action))
+			break;
+
+		rc = handle_message(client, &r, action);
+
+		/* the client may have been handed to the parser pool, or
+		 * dropped, along with its buffers */
+		if (client->fd != fd)
+			return 0;
+
+		if (rc < 0)
+			return -1;
+
+		if (rc) {
+			r.pos = start;
+			break;
+		}
+	}
+
+	client->in.len -= r.pos;
+	memmove(client->in.data, client->in.data + r.pos, client->in.len);
+
+	/* no message is longer than this, so what we have can't be one */
+	if (client->in.len >= MAX_MESSAGE_LEN) {
+		pb_log("invalid message from %d\n", fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void accept_clients(int sock)
+{
+	int fd;
+
+	/* the listening socket is non-blocking, so accept everything that
+	 * is pending in one go */
+	for (;;) {
+		fd = accept(sock, NULL, 0);
+		if (fd < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				pb_log("accept failed: %s\n", strerror(errno));
+			return;
+		}
+
+		if (fcntl(fd, F_SETFL, O_NONBLOCK)) {
+			pb_log("can't set client %d non-blocking: %s\n",
+					fd, strerror(errno));
+			close(fd);
+			continue;
+		}
+
+		if (!get_client(fd)) {
+			pb_log("no memory for client\n");
+			close(fd);
+			return;
+		}
+	}
+}
+
+static int create_socket(int backlog)
+{
+	struct sockaddr_un addr;
+	int sock;
+
+	unlink(PBOOT_DEVICE_SOCKET);
+
+	sock = socket(PF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0) {
+		pb_log("can't create socket: %s\n", strerror(errno));
+		return -1;
+	}
+
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, PBOOT_DEVICE_SOCKET);
+
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+		pb_log("can't bind to %s: %s\n",
+				addr.sun_path, strerror(errno));
+		goto err;
+	}
+
+	if (fcntl(sock, F_SETFL, O_NONBLOCK)) {
+		pb_log("can't set socket %s non-blocking: %s\n",
+				addr.sun_path, strerror(errno));
+		goto err;
+	}
+
+	if (listen(sock, backlog)) {
+		pb_log("can't listen on socket %s: %s\n",
+				addr.sun_path, strerror(errno));
+		goto err;
+	}
+
+	pb_log("listening on %s, backlog %d\n", addr.sun_path, backlog);
+	return sock;
+
+err:
+	close(sock);
+	return -1;
+}
+
+static void run(int sock)
+{
+	struct client **polled = NULL, *client;
+	struct pollfd *pfds = NULL;
+	int i, n, n_workers, timeout, left, size = 0;
+
+	n_workers = pool ? pool->n_workers : 0;
+
+	for (;;) {
+		if (n_clients + 1 + n_workers > size) {
+			size = n_clients + 1 + n_workers + CLIENT_POOL_CHUNK;
+			pfds = realloc(pfds, size * sizeof(*pfds));
+			polled = realloc(polled, size * sizeof(*polled));
+			if (!pfds || !polled) {
+				pb_log("no memory for poll set\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		n = 0;
+		for (client = clients; client; client = client->next) {
+			pfds[n].fd = client->fd;
+			pfds[n].events = POLLIN;
+			if (client_has_output(client))
+				pfds[n].events |= POLLOUT;
+			polled[n++] = client;
+		}
+		pfds[n].fd = sock;
+		pfds[n].events = POLLIN;
+
+		/* the parser workers' fds follow the listening socket */
+		if (pool)
+			parser_pool_poll_fds(pool, &pfds[n + 1]);
+
+		timeout = pool ? parser_pool_timeout(pool) : -1;
+		left = clients_timeout();
+		if (left >= 0 && (timeout < 0 || left < timeout))
+			timeout = left;
+
+		if (poll(pfds, n + 1 + n_workers, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			pb_log("poll failed: %s\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+
+		/* free up workers before handling new requests */
+		if (pool)
+			parser_pool_process(pool, &pfds[n + 1]);
+
+		/* output is sent by flush_clients(), once we've handled
+		 * what has arrived */
+		for (i = 0; i < n; i++) {
+			if (!(pfds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+
+			/* the client may have been dropped while handling an
+			 * earlier one; pooled clients are never freed, so we
+			 * can check that it is still the same connection */
+			client = polled[i];
+			if (client->fd != pfds[i].fd)
+				continue;
+
+			if (process_client(client) && client->fd == pfds[i].fd)
+				put_client(client);
+		}
+
+		flush_clients();
+
+		if (pfds[n].revents)
+			accept_clients(sock);
+	}
+}
+
+static void usage(const char *progname)
+{
+	fprintf(stderr, "Usage: %s [-f] [-b backlog] [-w workers] [-h]\n",
+			progname);
+}
+
+static struct parser_pool *create_parser_pool(int n_workers)
+{
+	uid_t uid = PARSER_FALLBACK_ID;
+	gid_t gid = PARSER_FALLBACK_ID;
+	struct passwd *pw;
+
+	pw = getpwnam(PBOOT_PARSER_USER);
+	if (pw) {
+		uid = pw->pw_uid;
+		gid = pw->pw_gid;
+	} else {
+		pb_log("no user %s, parsing as uid %d\n",
+				PBOOT_PARSER_USER, uid);
+	}
+
+	return parser_pool_create(n_workers, uid, gid, fileno(logf));
+}
+
+int main(int argc, char **argv)
+{
+	int c, sock, foreground = 0, backlog = DEFAULT_BACKLOG;
+	int n_workers = DEFAULT_PARSER_WORKERS;
+
+	for (;;) {
+		c = getopt(argc, argv, "fb:w:h");
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'f':
+			foreground = 1;
+			break;
+		case 'b':
+			backlog = atoi(optarg);
+			if (backlog <= 0) {
+				fprintf(stderr, "Invalid backlog '%s'\n",
+						optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'w':
+			n_workers = atoi(optarg);
+			if (n_workers < 0) {
+				fprintf(stderr, "Invalid number of workers "
+						"'%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'h':
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	logf = fopen("/var/log/petitboot-discover.log", "a");
+	if (!logf)
+		logf = stdout;
+	pb_log("%d started\n", getpid());
+
+	/* we'll see write errors for subscribers that have gone away */
+	signal(SIGPIPE, SIG_IGN);
+
+	sock = create_socket(backlog);
+	if (sock < 0)
+		return EXIT_FAILURE;
+
+	/* The socket is ready by the time our parent exits, so whoever
+	 * started us can connect straight away */
+	if (!foreground) {
+		switch (fork()) {
+		case -1:
+			pb_log("fork failed: %s\n", strerror(errno));
+			return EXIT_FAILURE;
+		case 0:
+			break;
+		default:
+			return EXIT_SUCCESS;
+		}
+		setsid();
+		chdir("/");
+	}
+
+	/* the workers are our children, so they're started after the fork.
+	 * Without any, the helpers parse devices themselves */
+	set_mount_base(TMP_DIR);
+	if (n_workers)
+		pool = create_parser_pool(n_workers);
+
+	run(sock);
+
+	return EXIT_SUCCESS;
+}
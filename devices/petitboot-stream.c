@@ -0,0 +1,1130 @@
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <asm/byteorder.h>
+
+#include "message.h"
+#include "petitboot-paths.h"
+
+/*
+ * Record, replay and generate device socket streams, for load-testing the
+ * discovery daemon and its subscribers, and check that the daemon gets
+ * everything from a storm of helpers connecting at once.
+ *
+ * A stream file is a magic number, followed by a sequence of chunks. Each
+ * chunk has a 64-bit big-endian timestamp (in nanoseconds since the start
+ * of the stream), a 32-bit big-endian length, and then that many bytes of
+ * socket data. A file without the magic number (for example, one written
+ * by the udev helper with USE_FAKE_SOCKET) is replayed as a single chunk.
+ *
+ * Generated streams stamp each option's description with "seq:N", where
+ * N is the index of the chunk that carries it, so that the measuring
+ * subscriber can work out how long each option took to arrive.
+ */
+
+#define STREAM_MAGIC		0x70627331	/* "pbs1" */
+
+/* how long we wait for the daemon to start listening, in 100ms tries */
+#define CONNECT_TRIES		50
+
+/* how long a storm round may take to reach the subscriber, in ms */
+#define STORM_TIMEOUT_MS	10000
+
+/* the marker device ids include our pid, so that markers in a recording
+ * of an earlier run are just normal devices */
+static char start_id[64], end_id[64];
+
+struct chunk {
+	uint64_t	time;
+	uint32_t	len;
+	char		*data;
+};
+
+struct stream {
+	struct chunk	*chunks;
+	int		n_chunks;
+};
+
+static volatile sig_atomic_t stop;
+
+void pb_log(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const char *pos = buf;
+	ssize_t rc;
+
+	while (len) {
+		rc = write(fd, pos, len);
+		if (rc <= 0) {
+			pb_log("write failed: %s\n", strerror(errno));
+			return -1;
+		}
+		pos += rc;
+		len -= rc;
+	}
+
+	return 0;
+}
+
+static int stream_add_chunk(struct stream *stream, uint64_t time,
+		const void *data, uint32_t len)
+{
+	struct chunk *chunks, *chunk;
+
+	chunks = realloc(stream->chunks,
+			(stream->n_chunks + 1) * sizeof(*chunks));
+	if (!chunks)
+		return -1;
+	stream->chunks = chunks;
+
+	chunk = &stream->chunks[stream->n_chunks];
+	chunk->data = malloc(len);
+	if (!chunk->data)
+		return -1;
+
+	memcpy(chunk->data, data, len);
+	chunk->time = time;
+	chunk->len = len;
+	stream->n_chunks++;
+
+	return 0;
+}
+
+static void stream_free(struct stream *stream)
+{
+	int i;
+
+	for (i = 0; i < stream->n_chunks; i++)
+		free(stream->chunks[i].data);
+	free(stream->chunks);
+}
+
+static int write_chunk(int fd, uint64_t time, const void *data, uint32_t len)
+{
+	uint64_t time_buf = __cpu_to_be64(time);
+	uint32_t len_buf = __cpu_to_be32(len);
+
+	return write_all(fd, &time_buf, sizeof(time_buf)) ||
+		write_all(fd, &len_buf, sizeof(len_buf)) ||
+		write_all(fd, data, len);
+}
+
+static int stream_save(const struct stream *stream, const char *filename)
+{
+	uint32_t magic = __cpu_to_be32(STREAM_MAGIC);
+	int fd, i, rc;
+
+	fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		pb_log("can't open %s: %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+	rc = write_all(fd, &magic, sizeof(magic));
+	for (i = 0; !rc && i < stream->n_chunks; i++)
+		rc = write_chunk(fd, stream->chunks[i].time,
+				stream->chunks[i].data, stream->chunks[i].len);
+
+	close(fd);
+	return rc;
+}
+
+static int stream_load(struct stream *stream, const char *filename)
+{
+	uint64_t time_buf;
+	uint32_t magic, len_buf;
+	char *buf, *pos, *end;
+	FILE *fp;
+	long size;
+
+	fp = fopen(filename, "r");
+	if (!fp) {
+		pb_log("can't open %s: %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+
+	buf = malloc(size ? size : 1);
+	if (!buf || fread(buf, 1, size, fp) != size) {
+		pb_log("can't read %s\n", filename);
+		fclose(fp);
+		free(buf);
+		return -1;
+	}
+	fclose(fp);
+
+	memset(stream, 0, sizeof(*stream));
+
+	if (size < sizeof(magic) ||
+			(memcpy(&magic, buf, sizeof(magic)),
+			 __be32_to_cpu(magic) != STREAM_MAGIC)) {
+		/* a raw dump of the socket data */
+		if (size && stream_add_chunk(stream, 0, buf, size))
+			goto err;
+		free(buf);
+		return 0;
+	}
+
+	pos = buf + sizeof(magic);
+	end = buf + size;
+
+	while (pos < end) {
+		if (end - pos < sizeof(time_buf) + sizeof(len_buf))
+			goto err_truncated;
+
+		memcpy(&time_buf, pos, sizeof(time_buf));
+		pos += sizeof(time_buf);
+		memcpy(&len_buf, pos, sizeof(len_buf));
+		pos += sizeof(len_buf);
+
+		if (end - pos < __be32_to_cpu(len_buf))
+			goto err_truncated;
+
+		if (stream_add_chunk(stream, __be64_to_cpu(time_buf), pos,
+					__be32_to_cpu(len_buf)))
+			goto err;
+
+		pos += __be32_to_cpu(len_buf);
+	}
+
+	free(buf);
+	return 0;
+
+err_truncated:
+	pb_log("%s is truncated\n", filename);
+err:
+	stream_free(stream);
+	free(buf);
+	return -1;
+}
+
+static int connect_daemon(void)
+{
+	struct sockaddr_un addr;
+	int sock, i;
+
+	sock = socket(PF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0) {
+		pb_log("can't create socket: %s\n", strerror(errno));
+		return -1;
+	}
+
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, PBOOT_DEVICE_SOCKET);
+
+	/* the daemon may still be starting up */
+	for (i = 0; i < CONNECT_TRIES; i++) {
+		if (!connect(sock, (struct sockaddr *)&addr, sizeof(addr)))
+			return sock;
+		if (errno != ENOENT && errno != ECONNREFUSED)
+			break;
+		usleep(100000);
+	}
+
+	pb_log("can't connect to %s: %s\n", addr.sun_path, strerror(errno));
+	close(sock);
+	return -1;
+}
+
+static void sigint(int sig)
+{
+	stop = 1;
+}
+
+/* subscribe to the daemon, and record everything it sends us */
+static int cmd_record(int argc, char **argv)
+{
+	struct sigaction sa;
+	struct stream stream;
+	uint64_t start;
+	char buf[4096];
+	int sock, rc;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s record <file>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	sock = connect_daemon();
+	if (sock < 0 || write_action(sock, DEV_ACTION_SUBSCRIBE))
+		return EXIT_FAILURE;
+
+	/* no SA_RESTART, so that the read is interrupted */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sigint;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	memset(&stream, 0, sizeof(stream));
+	start = now_ns();
+
+	while (!stop) {
+		rc = read(sock, buf, sizeof(buf));
+		if (rc <= 0)
+			break;
+
+		if (stream_add_chunk(&stream, now_ns() - start, buf, rc))
+			break;
+	}
+
+	close(sock);
+	pb_log("recorded %d chunks\n", stream.n_chunks);
+
+	rc = stream_save(&stream, argv[1]);
+	stream_free(&stream);
+
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int add_marker(struct msg_buf *buf, const char *id)
+{
+	struct device dev = {
+		.id		= (char *)id,
+		.name		= (char *)id,
+		.description	= NULL,
+		.icon_file	= NULL,
+	};
+
+	return msg_buf_add_device(buf, &dev);
+}
+
+static int remove_marker(struct msg_buf *buf, const char *id)
+{
+	return msg_buf_add_action(buf, DEV_ACTION_REMOVE_DEVICE) ||
+		msg_buf_add_string(buf, id);
+}
+
+/*
+ * Send the stream to the daemon, as a helper would, between a start and
+ * an end marker device. If @send_times is set, the send time of each chunk
+ * is stored there.
+ */
+static int send_stream(const struct stream *stream, int realtime,
+		uint64_t *send_times)
+{
+	struct msg_buf buf = MSG_BUF_INIT;
+	uint64_t start, t;
+	struct timespec ts;
+	int sock, i, rc;
+
+	sock = connect_daemon();
+	if (sock < 0)
+		return -1;
+
+	rc = add_marker(&buf, start_id) || msg_buf_write(sock, &buf);
+	msg_buf_free(&buf);
+
+	start = now_ns();
+
+	for (i = 0; !rc && i < stream->n_chunks; i++) {
+		if (realtime) {
+			t = now_ns() - start;
+			if (t < stream->chunks[i].time) {
+				t = stream->chunks[i].time - t;
+				ts.tv_sec = t / 1000000000ull;
+				ts.tv_nsec = t % 1000000000ull;
+				nanosleep(&ts, NULL);
+			}
+		}
+
+		if (send_times) {
+			send_times[i] = now_ns();
+			__sync_synchronize();
+		}
+
+		rc = write_all(sock, stream->chunks[i].data,
+				stream->chunks[i].len);
+	}
+
+	/* the end marker has to come before we remove the start marker, so
+	 * that the subscriber sees it */
+	buf = (struct msg_buf)MSG_BUF_INIT;
+	if (!rc)
+		rc = add_marker(&buf, end_id) ||
+			remove_marker(&buf, start_id) ||
+			remove_marker(&buf, end_id) ||
+			msg_buf_write(sock, &buf);
+	msg_buf_free(&buf);
+
+	close(sock);
+	return rc;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+struct measurement {
+	unsigned int	n_messages;
+	uint64_t	start;
+	uint64_t	end;
+	uint64_t	*latencies;
+	unsigned int	n_latencies;
+};
+
+/* read one message from the daemon, noting any latency sample and whether
+ * it was one of our markers */
+static int measure_message(int sock, const struct stream *stream,
+		const uint64_t *send_times, struct measurement *m,
+		int *started, int *done)
+{
+	enum device_action action;
+	struct boot_option *opt;
+	struct device *dev;
+	unsigned int seq;
+	char *id;
+
+	if (read_action(sock, &action))
+		return -1;
+
+	switch (action) {
+	case DEV_ACTION_ADD_DEVICE:
+		dev = read_device(sock);
+		if (!dev)
+			return -1;
+
+		if (!strcmp(dev->id, start_id)) {
+			*started = 1;
+			m->start = now_ns();
+		} else if (!strcmp(dev->id, end_id)) {
+			*done = 1;
+			m->end = now_ns();
+		} else if (*started) {
+			m->n_messages++;
+		}
+
+		free_device(dev);
+		return 0;
+
+	case DEV_ACTION_ADD_OPTION:
+	case DEV_ACTION_UPDATE_OPTION:
+		opt = read_boot_option(sock);
+		if (!opt)
+			return -1;
+
+		if (*started) {
+			m->n_messages++;
+
+			/* a recording of a generated stream will have
+			 * sequence numbers for some other stream */
+			if (sscanf(opt->description, "seq:%u", &seq) == 1 &&
+					seq < stream->n_chunks &&
+					send_times[seq] &&
+					memmem(stream->chunks[seq].data,
+						stream->chunks[seq].len,
+						opt->description,
+						strlen(opt->description))) {
+				__sync_synchronize();
+				m->latencies[m->n_latencies++] =
+					now_ns() - send_times[seq];
+			}
+		}
+
+		free_boot_option(opt);
+		return 0;
+
+	case DEV_ACTION_REMOVE_OPTION:
+	case DEV_ACTION_REMOVE_DEVICE:
+		id = read_string(sock);
+		if (!id)
+			return -1;
+		if (*started)
+			m->n_messages++;
+		free(id);
+		return 0;
+
+	default:
+		pb_log("unsupported action %d\n", action);
+		return -1;
+	}
+}
+
+/* print the results; returns non-zero if the rate is below @min_rate */
+static int report(const struct measurement *m, double min_rate)
+{
+	double secs = (m->end - m->start) / 1e9;
+	double rate = secs > 0 ? m->n_messages / secs : 0;
+
+	printf("messages: %u in %.3f s, %.0f msgs/sec\n",
+			m->n_messages, secs, rate);
+
+	if (m->n_latencies)
+		printf("latency: %u samples, p50 %.1f us, p99 %.1f us, "
+				"max %.1f us\n", m->n_latencies,
+				m->latencies[m->n_latencies / 2] / 1e3,
+				m->latencies[m->n_latencies * 99 / 100] / 1e3,
+				m->latencies[m->n_latencies - 1] / 1e3);
+
+	if (min_rate && rate < min_rate) {
+		printf("FAIL: below the minimum of %.0f msgs/sec\n", min_rate);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Subscribe to the daemon, then send the stream from a child process and
+ * time how long it takes to come back to us.
+ */
+static int measure_stream(const struct stream *stream, int realtime,
+		double min_rate)
+{
+	struct measurement m;
+	uint64_t *send_times;
+	int sock, status, started = 0, done = 0, rc = -1;
+	size_t size;
+	pid_t pid;
+
+	size = (stream->n_chunks ? stream->n_chunks : 1) * sizeof(*send_times);
+
+	/* shared with the sending child */
+	send_times = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (send_times == MAP_FAILED)
+		return -1;
+
+	memset(&m, 0, sizeof(m));
+	m.latencies = calloc(stream->n_chunks + 1, sizeof(*m.latencies));
+	if (!m.latencies)
+		goto out_unmap;
+
+	/* we need to be subscribed before the child starts sending */
+	sock = connect_daemon();
+	if (sock < 0 || write_action(sock, DEV_ACTION_SUBSCRIBE))
+		goto out_free;
+
+	pid = fork();
+	if (pid < 0) {
+		pb_log("fork failed: %s\n", strerror(errno));
+		goto out_close;
+	}
+
+	if (pid == 0) {
+		close(sock);
+		exit(send_stream(stream, realtime, send_times) ?
+				EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	while (!done)
+		if (measure_message(sock, stream, send_times,
+					&m, &started, &done))
+			break;
+
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+			WEXITSTATUS(status) || !done) {
+		pb_log("stream was not sent\n");
+		goto out_close;
+	}
+
+	qsort(m.latencies, m.n_latencies, sizeof(*m.latencies), compare_u64);
+	rc = report(&m, min_rate);
+
+out_close:
+	close(sock);
+out_free:
+	free(m.latencies);
+out_unmap:
+	munmap(send_times, size);
+	return rc;
+}
+
+static int cmd_replay(int argc, char **argv)
+{
+	struct stream stream;
+	double min_rate = 0;
+	int c, rc, realtime = 0, measure = 0;
+
+	for (;;) {
+		c = getopt(argc, argv, "rmt:");
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'r':
+			realtime = 1;
+			break;
+		case 'm':
+			measure = 1;
+			break;
+		case 't':
+			measure = 1;
+			min_rate = atof(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (optind != argc - 1)
+		goto usage;
+
+	if (stream_load(&stream, argv[optind]))
+		return EXIT_FAILURE;
+
+	if (measure)
+		rc = measure_stream(&stream, realtime, min_rate);
+	else
+		rc = send_stream(&stream, realtime, NULL);
+
+	stream_free(&stream);
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+
+usage:
+	fprintf(stderr, "usage: %s replay [-r] [-m] [-t msgs/sec] <file>\n",
+			argv[0]);
+	return EXIT_FAILURE;
+}
+
+/* fill @str with @len characters, starting with @prefix */
+static char *make_string(char *str, int len, const char *prefix)
+{
+	int n;
+
+	n = snprintf(str, len + 1, "%s", prefix);
+	if (n < len) {
+		memset(str + n, 'x', len - n);
+		str[len] = '\0';
+	}
+
+	return str;
+}
+
+static int add_generated_chunk(struct stream *stream, struct msg_buf *buf)
+{
+	int rc;
+
+	rc = stream_add_chunk(stream, 0, buf->data, buf->len);
+	msg_buf_free(buf);
+	return rc;
+}
+
+static int generate_option(struct stream *stream, int dev, int n,
+		int str_len)
+{
+	struct msg_buf buf = MSG_BUF_INIT;
+	struct boot_option opt;
+	char id[64], seq[32], *name, *desc, *args;
+	int rc;
+
+	name = malloc(str_len + 1);
+	desc = malloc(str_len + 32);
+	args = malloc(str_len + 1);
+	if (!name || !desc || !args) {
+		rc = -1;
+		goto out;
+	}
+
+	snprintf(id, sizeof(id), "gen%d#%d", dev, n);
+	snprintf(seq, sizeof(seq), "seq:%d ", stream->n_chunks);
+
+	memset(&opt, 0, sizeof(opt));
+	opt.id = id;
+	opt.name = make_string(name, str_len, id);
+	opt.description = make_string(desc, str_len > strlen(seq) ?
+			str_len : strlen(seq), seq);
+	opt.icon_file = NULL;
+	opt.boot_image_file = "/boot/vmlinux";
+	opt.initrd_file = "/boot/initrd.img";
+	opt.boot_args = make_string(args, str_len, "root=/dev/sda1 ");
+
+	rc = msg_buf_add_boot_option(&buf, DEV_ACTION_ADD_OPTION, &opt) ||
+		add_generated_chunk(stream, &buf);
+
+out:
+	free(name);
+	free(desc);
+	free(args);
+	return rc;
+}
+
+static int generate_device(struct stream *stream, int dev)
+{
+	struct msg_buf buf = MSG_BUF_INIT;
+	struct device device;
+	char id[32];
+
+	snprintf(id, sizeof(id), "gen%d", dev);
+
+	device.id = id;
+	device.name = id;
+	device.description = "generated device";
+	device.icon_file = NULL;
+
+	return msg_buf_add_device(&buf, &device) ||
+		add_generated_chunk(stream, &buf);
+}
+
+static int generate_remove_option(struct stream *stream, int dev, int n)
+{
+	struct msg_buf buf = MSG_BUF_INIT;
+	char id[64];
+
+	snprintf(id, sizeof(id), "gen%d#%d", dev, n);
+
+	return msg_buf_add_action(&buf, DEV_ACTION_REMOVE_OPTION) ||
+		msg_buf_add_string(&buf, id) ||
+		add_generated_chunk(stream, &buf);
+}
+
+/*
+ * Generate @n_devs devices with @n_opts options each, then @churn rounds
+ * of changes. Each round replaces the oldest option on every device with a
+ * new one. Apart from the device messages that select a device for the
+ * following changes, every message is a change to the table, so the daemon
+ * passes them all on.
+ */
+static int generate(struct stream *stream, int n_devs, int n_opts,
+		int str_len, int churn)
+{
+	int dev, opt, round;
+
+	for (dev = 0; dev < n_devs; dev++) {
+		if (generate_device(stream, dev))
+			return -1;
+
+		for (opt = 0; opt < n_opts; opt++)
+			if (generate_option(stream, dev, opt, str_len))
+				return -1;
+	}
+
+	for (round = 0; round < churn; round++) {
+		for (dev = 0; dev < n_devs; dev++) {
+			if (generate_device(stream, dev) ||
+				generate_remove_option(stream, dev, round) ||
+				generate_option(stream, dev, n_opts + round,
+					str_len))
+				return -1;
+		}
+	}
+
+	/* leave the daemon's table as we found it */
+	for (dev = 0; dev < n_devs; dev++) {
+		struct msg_buf buf = MSG_BUF_INIT;
+		char id[32];
+
+		snprintf(id, sizeof(id), "gen%d", dev);
+		if (msg_buf_add_action(&buf, DEV_ACTION_REMOVE_DEVICE) ||
+				msg_buf_add_string(&buf, id) ||
+				add_generated_chunk(stream, &buf))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int cmd_generate(int argc, char **argv)
+{
+	struct stream stream;
+	int c, rc, n_devs = 4, n_opts = 8, str_len = 32, churn = 0;
+
+	for (;;) {
+		c = getopt(argc, argv, "d:o:s:c:");
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'd':
+			n_devs = atoi(optarg);
+			break;
+		case 'o':
+			n_opts = atoi(optarg);
+			break;
+		case 's':
+			str_len = atoi(optarg);
+			break;
+		case 'c':
+			churn = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (optind != argc - 1 || n_devs < 0 || n_opts < 0 ||
+			str_len < 0 || churn < 0)
+		goto usage;
+
+	memset(&stream, 0, sizeof(stream));
+
+	rc = generate(&stream, n_devs, n_opts, str_len, churn) ||
+		stream_save(&stream, argv[optind]);
+
+	pb_log("generated %d messages\n", stream.n_chunks);
+	stream_free(&stream);
+
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+
+usage:
+	fprintf(stderr, "usage: %s generate [-d devices] [-o options] "
+			"[-s string-size] [-c churn-rounds] <file>\n",
+			argv[0]);
+	return EXIT_FAILURE;
+}
+
+/* the devices of a storm round are "<prefix><sender>", and each has
+ * options "<prefix><sender>#<n>" */
+struct storm {
+	char		prefix[64];
+	int		n_senders;
+	int		n_opts;
+	char		*seen_devs;
+	char		*seen_opts;
+	int		n_devs_seen;
+	int		n_opts_seen;
+};
+
+/* a storm sender: connect, wait for everyone else to, then send our device
+ * and its options, as a helper would */
+static int storm_send(const struct storm *storm, int sender, int barrier)
+{
+	struct msg_buf buf = MSG_BUF_INIT;
+	struct boot_option opt;
+	struct device dev;
+	char id[96], opt_id[112];
+	int sock, i, rc;
+	char c;
+
+	sock = connect_daemon();
+	if (sock < 0)
+		return -1;
+
+	/* the parent closes the pipe to start us all at once */
+	while (read(barrier, &c, 1) < 0 && errno == EINTR)
+		;
+
+	snprintf(id, sizeof(id), "%s%d", storm->prefix, sender);
+
+	dev.id = id;
+	dev.name = id;
+	dev.description = "storm device";
+	dev.icon_file = NULL;
+
+	memset(&opt, 0, sizeof(opt));
+	opt.id = opt_id;
+	opt.name = opt_id;
+	opt.boot_image_file = "/boot/vmlinux";
+
+	rc = msg_buf_add_device(&buf, &dev);
+	for (i = 0; !rc && i < storm->n_opts; i++) {
+		snprintf(opt_id, sizeof(opt_id), "%s#%d", id, i);
+		rc = msg_buf_add_boot_option(&buf, DEV_ACTION_ADD_OPTION, &opt);
+	}
+
+	if (!rc)
+		rc = msg_buf_write(sock, &buf);
+
+	msg_buf_free(&buf);
+	close(sock);
+	return rc;
+}
+
+/* note one of our round's devices or options, if @id is one */
+static void storm_seen(struct storm *storm, const char *id, int is_opt)
+{
+	int len = strlen(storm->prefix), sender, n, pos;
+
+	if (strncmp(id, storm->prefix, len))
+		return;
+
+	if (is_opt) {
+		if (sscanf(id + len, "%d#%d%n", &sender, &n, &pos) != 2 ||
+				id[len + pos] || sender < 0 ||
+				sender >= storm->n_senders || n < 0 ||
+				n >= storm->n_opts)
+			return;
+
+		n += sender * storm->n_opts;
+		if (!storm->seen_opts[n]) {
+			storm->seen_opts[n] = 1;
+			storm->n_opts_seen++;
+		}
+		return;
+	}
+
+	if (sscanf(id + len, "%d%n", &sender, &pos) != 1 || id[len + pos] ||
+			sender < 0 || sender >= storm->n_senders)
+		return;
+
+	if (!storm->seen_devs[sender]) {
+		storm->seen_devs[sender] = 1;
+		storm->n_devs_seen++;
+	}
+}
+
+/* read one message from the daemon, noting our devices and options */
+static int storm_read(int sock, struct storm *storm)
+{
+	enum device_action action;
+	struct boot_option *opt;
+	struct device *dev;
+	char *id;
+
+	if (read_action(sock, &action))
+		return -1;
+
+	switch (action) {
+	case DEV_ACTION_ADD_DEVICE:
+		dev = read_device(sock);
+		if (!dev)
+			return -1;
+		storm_seen(storm, dev->id, 0);
+		free_device(dev);
+		return 0;
+
+	case DEV_ACTION_ADD_OPTION:
+	case DEV_ACTION_UPDATE_OPTION:
+		opt = read_boot_option(sock);
+		if (!opt)
+			return -1;
+		storm_seen(storm, opt->id, 1);
+		free_boot_option(opt);
+		return 0;
+
+	case DEV_ACTION_REMOVE_OPTION:
+	case DEV_ACTION_REMOVE_DEVICE:
+		id = read_string(sock);
+		if (!id)
+			return -1;
+		free(id);
+		return 0;
+
+	default:
+		pb_log("unsupported action %d\n", action);
+		return -1;
+	}
+}
+
+/* remove the round's devices, to leave the daemon's table as we found it */
+static int storm_remove(const struct storm *storm)
+{
+	struct msg_buf buf = MSG_BUF_INIT;
+	char id[96];
+	int sock, i, rc = 0;
+
+	sock = connect_daemon();
+	if (sock < 0)
+		return -1;
+
+	for (i = 0; !rc && i < storm->n_senders; i++) {
+		snprintf(id, sizeof(id), "%s%d", storm->prefix, i);
+		rc = msg_buf_add_action(&buf, DEV_ACTION_REMOVE_DEVICE) ||
+			msg_buf_add_string(&buf, id);
+	}
+
+	if (!rc)
+		rc = msg_buf_write(sock, &buf);
+
+	msg_buf_free(&buf);
+	close(sock);
+	return rc;
+}
+
+/*
+ * One round of a storm: start @n_senders helpers at once, and check that
+ * every device and option that they send reaches our subscription on
+ * @sock.
+ */
+static int storm_round(int sock, struct storm *storm, int round)
+{
+	int i, status, barrier[2], n_failed = 0, rc = -1;
+	uint64_t start, elapsed = 0;
+	struct pollfd pfd;
+	pid_t pid;
+
+	snprintf(storm->prefix, sizeof(storm->prefix),
+			"petitboot-storm.%d.%d.", getpid(), round);
+	memset(storm->seen_devs, 0, storm->n_senders);
+	memset(storm->seen_opts, 0, storm->n_senders * storm->n_opts);
+	storm->n_devs_seen = storm->n_opts_seen = 0;
+
+	if (pipe(barrier)) {
+		pb_log("pipe failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	/* so that the senders don't print our earlier rounds again */
+	fflush(stdout);
+
+	for (i = 0; i < storm->n_senders; i++) {
+		pid = fork();
+		if (pid < 0) {
+			pb_log("fork failed: %s\n", strerror(errno));
+			n_failed += storm->n_senders - i;
+			break;
+		}
+
+		if (pid == 0) {
+			close(sock);
+			close(barrier[1]);
+			exit(storm_send(storm, i, barrier[0]) ?
+					EXIT_FAILURE : EXIT_SUCCESS);
+		}
+	}
+
+	close(barrier[0]);
+	close(barrier[1]);
+	start = now_ns();
+
+	pfd.fd = sock;
+	pfd.events = POLLIN;
+
+	while (storm->n_devs_seen < storm->n_senders ||
+			storm->n_opts_seen < storm->n_senders * storm->n_opts) {
+		elapsed = (now_ns() - start) / 1000000;
+		if (elapsed >= STORM_TIMEOUT_MS ||
+				poll(&pfd, 1, STORM_TIMEOUT_MS - elapsed) <= 0 ||
+				storm_read(sock, storm))
+			break;
+	}
+
+	elapsed = now_ns() - start;
+
+	while (wait(&status) > 0)
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			n_failed++;
+
+	printf("round %d: %d/%d devices, %d/%d options from %d senders "
+			"in %.1f ms\n", round,
+			storm->n_devs_seen, storm->n_senders,
+			storm->n_opts_seen, storm->n_senders * storm->n_opts,
+			storm->n_senders, elapsed / 1e6);
+
+	if (n_failed)
+		printf("FAIL: %d senders failed\n", n_failed);
+	else if (storm->n_devs_seen < storm->n_senders ||
+			storm->n_opts_seen < storm->n_senders * storm->n_opts)
+		printf("FAIL: not everything arrived\n");
+	else
+		rc = 0;
+
+	if (storm_remove(storm))
+		rc = -1;
+
+	return rc;
+}
+
+/*
+ * Check that the daemon gets everything from many helpers that connect
+ * and send at the same time, as they do during a coldplug.
+ */
+static int cmd_storm(int argc, char **argv)
+{
+	int c, i, sock, rc = 0, n_senders = 200, n_opts = 4, n_rounds = 3;
+	struct storm storm;
+
+	for (;;) {
+		c = getopt(argc, argv, "n:o:r:");
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'n':
+			n_senders = atoi(optarg);
+			break;
+		case 'o':
+			n_opts = atoi(optarg);
+			break;
+		case 'r':
+			n_rounds = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (optind != argc || n_senders <= 0 || n_opts < 0 || n_rounds <= 0)
+		goto usage;
+
+	memset(&storm, 0, sizeof(storm));
+	storm.n_senders = n_senders;
+	storm.n_opts = n_opts;
+	storm.seen_devs = malloc(n_senders);
+	storm.seen_opts = malloc(n_senders * n_opts + 1);
+	if (!storm.seen_devs || !storm.seen_opts)
+		return EXIT_FAILURE;
+
+	sock = connect_daemon();
+	if (sock < 0 || write_action(sock, DEV_ACTION_SUBSCRIBE))
+		return EXIT_FAILURE;
+
+	for (i = 0; i < n_rounds; i++)
+		if (storm_round(sock, &storm, i))
+			rc = -1;
+
+	close(sock);
+	free(storm.seen_devs);
+	free(storm.seen_opts);
+
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+
+usage:
+	fprintf(stderr, "usage: %s storm [-n senders] [-o options] "
+			"[-r rounds]\n", argv[0]);
+	return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+		goto usage;
+
+	snprintf(start_id, sizeof(start_id), "petitboot-stream-start.%d",
+			getpid());
+	snprintf(end_id, sizeof(end_id), "petitboot-stream-end.%d", getpid());
+
+	/* we'll get an error from write() instead */
+	signal(SIGPIPE, SIG_IGN);
+
+	if (!strcmp(argv[1], "record"))
+		return cmd_record(argc - 1, argv + 1);
+	if (!strcmp(argv[1], "replay"))
+		return cmd_replay(argc - 1, argv + 1);
+	if (!strcmp(argv[1], "generate"))
+		return cmd_generate(argc - 1, argv + 1);
+	if (!strcmp(argv[1], "storm"))
+		return cmd_storm(argc - 1, argv + 1);
+
+usage:
+	fprintf(stderr, "usage: %s record|replay|generate|storm ...\n",
+			argv[0]);
+	return EXIT_FAILURE;
+}
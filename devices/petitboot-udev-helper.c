@@ -14,12 +14,15 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
+#include <limits.h>
 #include <asm/byteorder.h>
 #include <linux/cdrom.h>
 #include <sys/ioctl.h>
 
 #include "parser.h"
 #include "paths.h"
+#include "device-table.h"
+#include "file-check.h"
 #include "petitboot-paths.h"
 
 /* Define below to operate without the frontend */
@@ -28,6 +31,10 @@
 /* Delay in seconds between polling of removable devices */
 #define REMOVABLE_SLEEP_DELAY	2
 
+/* the most mounts of a device that we'll try to unmount, in case umount
+ * keeps succeeding */
+#define MAX_UNMOUNTS		8
+
 static FILE *logf;
 static int sock;
 
@@ -58,89 +65,56 @@ static void print_device(const struct device *dev)
 	pb_log("\tboot_image: %s\n", dev->icon_file);
 }
 
-static int write_action(int fd, enum device_action action)
-{
-	uint8_t action_buf = action;
-	return write(fd, &action_buf, sizeof(action_buf)) != sizeof(action_buf);
-}
+/* the device (and its options) found by the current parse */
+static struct device_entry *new_entry;
 
-static int write_string(int fd, const char *str)
+/* the parser context's data is the entry to collect the parse into */
+int add_device(struct parser_context *ctx, const struct device *dev)
 {
-	int len, pos = 0;
-	uint32_t len_buf;
+	struct device_entry **entry = ctx->data;
 
-	if (!str) {
-		len_buf = 0;
-		if (write(fd, &len_buf, sizeof(len_buf)) != sizeof(len_buf)) {
-			pb_log("write failed: %s\n", strerror(errno));
-			return -1;
-		}
+	pb_log("device added:\n");
+	print_device(dev);
+
+	/* when merging, later parsers add the device again, along with
+	 * their own options */
+	if (*entry && ctx->merge && !strcmp((*entry)->dev->id, dev->id))
 		return 0;
-	}
 
-	len = strlen(str);
-	if (len > (1ull << (sizeof(len_buf) * 8 - 1))) {
-		pb_log("string too large\n");
+	if (*entry) {
+		pb_log("device %s already added, ignoring %s\n",
+				(*entry)->dev->id, dev->id);
 		return -1;
 	}
 
-	len_buf = __cpu_to_be32(len);
-	if (write(fd, &len_buf, sizeof(len_buf)) != sizeof(len_buf)) {
-		pb_log("write failed: %s\n", strerror(errno));
+	*entry = device_entry_create(dev);
+	if (!*entry) {
+		pb_log("error adding device %s\n", dev->id);
 		return -1;
 	}
 
-	while (pos < len) {
-		int rc = write(fd, str, len - pos);
-		if (rc <= 0) {
-			pb_log("write failed: %s\n", strerror(errno));
-			return -1;
-		}
-		pos += rc;
-		str += rc;
-	}
-
 	return 0;
 }
 
-int add_device(const struct device *dev)
-{
-	int rc;
-
-	pb_log("device added:\n");
-	print_device(dev);
-	rc = write_action(sock, DEV_ACTION_ADD_DEVICE) ||
-		write_string(sock, dev->id) ||
-		write_string(sock, dev->name) ||
-		write_string(sock, dev->description) ||
-		write_string(sock, dev->icon_file);
-
-	if (rc)
-		pb_log("error writing device %s to socket\n", dev->name);
-
-	return rc;
-}
-
-int add_boot_option(const struct boot_option *opt)
+int add_boot_option(struct parser_context *ctx,
+		const struct boot_option *opt)
 {
-	int rc;
+	struct device_entry **entry = ctx->data;
 
 	pb_log("boot option added:\n");
 	print_boot_option(opt);
 
-	rc = write_action(sock, DEV_ACTION_ADD_OPTION) ||
-		write_string(sock, opt->id) ||
-		write_string(sock, opt->name) ||
-		write_string(sock, opt->description) ||
-		write_string(sock, opt->icon_file) ||
-		write_string(sock, opt->boot_image_file) ||
-		write_string(sock, opt->initrd_file) ||
-		write_string(sock, opt->boot_args);
+	if (!*entry) {
+		pb_log("option %s added before device\n", opt->name);
+		return -1;
+	}
 
-	if (rc)
-		pb_log("error writing boot option %s to socket\n", opt->name);
+	if (device_entry_add_option(*entry, opt)) {
+		pb_log("error adding boot option %s\n", opt->name);
+		return -1;
+	}
 
-	return rc;
+	return 0;
 }
 
 int remove_device(const char *dev_path)
@@ -149,11 +123,10 @@ int remove_device(const char *dev_path)
 		write_string(sock, dev_path);
 }
 
-int connect_to_socket()
+static int open_device_socket(void)
 {
-#ifndef USE_FAKE_SOCKET
-	int fd;
 	struct sockaddr_un addr;
+	int fd;
 
 	fd = socket(PF_UNIX, SOCK_STREAM, 0);
 	if (fd == -1) {
@@ -167,11 +140,18 @@ int connect_to_socket()
 	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
 		pb_log("can't connect to %s: %s\n",
 				addr.sun_path, strerror(errno));
+		close(fd);
 		return -1;
 	}
-	sock = fd;
 
-	return 0;
+	return fd;
+}
+
+int connect_to_socket()
+{
+#ifndef USE_FAKE_SOCKET
+	sock = open_device_socket();
+	return sock < 0 ? -1 : 0;
 #else
 	int fd;
 	fd = open("./debug_socket", O_WRONLY | O_CREAT, 0640);
@@ -232,6 +212,124 @@ static int mkdir_recursive(const char *dir)
 	return 0;
 }
 
+/*
+ * We keep a copy of what we last sent for each device in a state file, so
+ * that when a device is re-parsed we only need to send what has changed.
+ */
+static char *state_file_path(const char *dev_path)
+{
+	char *name, *path;
+
+	name = encode_label(dev_path);
+	path = join_paths(PBOOT_STATE_DIR, name);
+	free(name);
+
+	return path;
+}
+
+static struct device_entry *load_state(const char *dev_path)
+{
+	struct device_entry *entry;
+	char *path;
+	int fd;
+
+	path = state_file_path(dev_path);
+	fd = open(path, O_RDONLY);
+	free(path);
+
+	if (fd < 0)
+		return NULL;
+
+	entry = device_entry_read(fd);
+	close(fd);
+
+	return entry;
+}
+
+static void remove_state(const char *dev_path)
+{
+	char *path;
+
+	path = state_file_path(dev_path);
+	unlink(path);
+	free(path);
+}
+
+static void save_state(const char *dev_path, const struct device_entry *entry)
+{
+	char *path, *tmp;
+	int fd, rc;
+
+	if (mkdir_recursive(PBOOT_STATE_DIR))
+		return;
+
+	path = state_file_path(dev_path);
+	asprintf(&tmp, "%s.new", path);
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		pb_log("can't create state file %s: %s\n",
+				tmp, strerror(errno));
+		goto out;
+	}
+
+	rc = device_entry_write(fd, entry);
+	close(fd);
+
+	if (rc || rename(tmp, path)) {
+		pb_log("can't write state file %s\n", path);
+		unlink(tmp);
+	}
+
+out:
+	free(tmp);
+	free(path);
+}
+
+/*
+ * Send the results of the current parse to the frontend. If @incremental is
+ * set and we've already sent this device, only send the option-level
+ * differences.
+ */
+static int send_new_entry(const char *dev_path, int incremental)
+{
+	struct device_entry *old_entry = NULL;
+	int rc;
+
+	if (incremental)
+		old_entry = load_state(dev_path);
+
+	if (!new_entry) {
+		rc = 0;
+		if (old_entry) {
+			pb_log("no boot options left on %s\n", dev_path);
+			rc = remove_device(old_entry->dev->id);
+			remove_state(dev_path);
+		}
+		goto out;
+	}
+
+	if (old_entry && !strcmp(old_entry->dev->id, new_entry->dev->id)) {
+		pb_log("sending changes to existing device %s\n", dev_path);
+		rc = device_entry_write_diff(sock, old_entry, new_entry);
+	} else {
+		if (old_entry)
+			remove_device(old_entry->dev->id);
+		rc = device_entry_write(sock, new_entry);
+	}
+
+	if (rc)
+		pb_log("error writing device %s to socket\n", dev_path);
+	else
+		save_state(dev_path, new_entry);
+
+out:
+	device_entry_free(old_entry);
+	device_entry_free(new_entry);
+	new_entry = NULL;
+	return rc;
+}
+
 static void setup_device_links(const char *device)
 {
 	struct link {
@@ -351,6 +449,16 @@ static int unmount_device(const char *dev_path)
 	return rc;
 }
 
+/* unmount @dev_path repeatedly, if needs be */
+static void unmount_all(const char *dev_path)
+{
+	int i;
+
+	for (i = 0; i < MAX_UNMOUNTS; i++)
+		if (unmount_device(dev_path))
+			break;
+}
+
 static const struct device fake_boot_devices[] =
 {
 	{
@@ -441,18 +549,91 @@ static int is_ignored_device(const char *devname)
 	return 0;
 }
 
-static int found_new_device(const char *dev_path)
+/*
+ * Have the discovery daemon's parser pool parse the device, so that its
+ * configs aren't parsed with our privileges. Returns 0 if it was parsed,
+ * with the result in new_entry, 1 if we need to parse it ourselves (there
+ * is no pool, or it can't read the configs), or -1 if the parse failed.
+ */
+static int parse_in_pool(const char *dev_path, int merge)
+{
+	struct msg_buf buf = MSG_BUF_INIT;
+	enum device_action action;
+	uint32_t status;
+	int fd, rc;
+
+	fd = open_device_socket();
+	if (fd < 0)
+		return -1;
+
+	rc = msg_buf_add_action(&buf, DEV_ACTION_PARSE_DEVICE) ||
+		msg_buf_add_string(&buf, dev_path) ||
+		msg_buf_add_u32(&buf, merge ? PARSE_FLAG_MERGE : 0) ||
+		msg_buf_add_u32(&buf, guess_device_type()) ||
+		msg_buf_write(fd, &buf);
+	msg_buf_free(&buf);
+
+	if (!rc)
+		rc = read_action(fd, &action) ||
+			action != DEV_ACTION_PARSE_RESULT ||
+			read_u32(fd, &status);
+
+	if (rc) {
+		pb_log("parse of %s failed\n", dev_path);
+		close(fd);
+		return -1;
+	}
+
+	/* the worker closes the connection after the options */
+	if (status == PARSE_STATUS_OK)
+		new_entry = device_entry_read(fd);
+	else if (status == PARSE_STATUS_DENIED)
+		pb_log("the parser pool can't read the configs on %s\n",
+				dev_path);
+
+	close(fd);
+	return status == PARSE_STATUS_OK ? 0 : 1;
+}
+
+static int found_new_device(const char *dev_path, int incremental)
 {
 	const char *mountpoint = mountpoint_for_device(dev_path);
+	struct parser_context ctx;
+	int merge, rc = 1;
 
 	if (mount_device(dev_path)) {
 		pb_log("failed to mount %s\n", dev_path);
+		if (incremental)
+			send_new_entry(dev_path, incremental);
 		return EXIT_FAILURE;
 	}
 
 	pb_log("mounted %s at %s\n", dev_path, mountpoint);
 
-	iterate_parsers(dev_path, mountpoint);
+	merge = getenv("PBOOT_MERGE_CONFIGS") != NULL;
+
+#ifndef USE_FAKE_SOCKET
+	rc = parse_in_pool(dev_path, merge);
+#endif
+
+	/* only parse here if the pool can't: if the pool failed, the
+	 * configs may well crash the parsers */
+	if (rc > 0) {
+		memset(&ctx, 0, sizeof(ctx));
+		ctx.device_path = dev_path;
+		ctx.mountpoint = mountpoint;
+		ctx.merge = merge;
+		ctx.data = &new_entry;
+
+		iterate_parsers(&ctx);
+	}
+
+	/* check the options' files while the device is mounted, so the
+	 * frontend knows which of them can't be booted */
+	if (new_entry && device_entry_check_files(new_entry))
+		pb_log("couldn't check the files on %s\n", dev_path);
+
+	send_new_entry(dev_path, incremental);
 
 	return EXIT_SUCCESS;
 }
@@ -553,16 +734,16 @@ static int poll_removable_device(const char *sysfs_path,
 		rc = poll_device_plug(dev_path, &optical);
 		if (rc == EXIT_FAILURE)
 			return rc;
-		rc = found_new_device(dev_path);
+		rc = found_new_device(dev_path, 0);
 		mounted = (rc == EXIT_SUCCESS);
 
 		poll_device_unplug(dev_path, optical);
 
 		remove_device(dev_path);
+		remove_state(dev_path);
 
-		/* Unmount it repeatedly, if needs be */
-		while (mounted && !unmount_device(dev_path))
-			;
+		if (mounted)
+			unmount_all(dev_path);
 		detach_and_sleep(1);
 	}
 }
@@ -591,14 +772,18 @@ int main(int argc, char **argv)
 		return EXIT_FAILURE;
 
 	if (streq(action, "fake")) {
+		struct parser_context ctx = { .data = &new_entry };
+
 		pb_log("fake mode");
 
-		add_device(&fake_boot_devices[0]);
-		add_boot_option(&fake_boot_options[0]);
-		add_boot_option(&fake_boot_options[1]);
-		add_boot_option(&fake_boot_options[2]);
-		add_device(&fake_boot_devices[1]);
-		add_boot_option(&fake_boot_options[3]);
+		add_device(&ctx, &fake_boot_devices[0]);
+		add_boot_option(&ctx, &fake_boot_options[0]);
+		add_boot_option(&ctx, &fake_boot_options[1]);
+		add_boot_option(&ctx, &fake_boot_options[2]);
+		send_new_entry(fake_boot_devices[0].id, 0);
+		add_device(&ctx, &fake_boot_devices[1]);
+		add_boot_option(&ctx, &fake_boot_options[3]);
+		send_new_entry(fake_boot_devices[1].id, 0);
 
 		return EXIT_SUCCESS;
 	}
@@ -617,15 +802,32 @@ int main(int argc, char **argv)
 		if (sysfs_path && is_removable_device(sysfs_path))
 			rc = poll_removable_device(sysfs_path, dev_path);
 		else
-			rc = found_new_device(dev_path);
+			rc = found_new_device(dev_path, 0);
+	} else if (streq(action, "change")) {
+		char *sysfs_path = getenv("DEVPATH");
+
+		/* removable devices belong to the helper that was started
+		 * for their add event, which already re-parses them when
+		 * their media changes. Optical drives send a change event
+		 * every time they are polled, so we mustn't race it */
+		if (sysfs_path && is_removable_device(sysfs_path)) {
+			pb_log("%s changed, leaving it to its poller\n",
+					dev_path);
+			return EXIT_SUCCESS;
+		}
+
+		pb_log("%s changed\n", dev_path);
+
+		/* the media may have changed, so remount and re-parse */
+		unmount_all(dev_path);
+		rc = found_new_device(dev_path, 1);
+
 	} else if (streq(action, "remove")) {
 		pb_log("%s removed\n", dev_path);
 
 		remove_device(dev_path);
-
-		/* Unmount it repeatedly, if needs be */
-		while (!unmount_device(dev_path))
-			;
+		remove_state(dev_path);
+		unmount_all(dev_path);
 
 	} else {
 		pb_log("invalid action '%s'\n", action);
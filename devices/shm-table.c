@@ -0,0 +1,325 @@
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shm-table.h"
+
+/* regions start at this size, and double as needed */
+#define SHM_TABLE_MIN_SIZE	(64 * 1024)
+
+static char *records(struct shm_table *shm)
+{
+	return (char *)(shm->hdr + 1);
+}
+
+static int region_create(struct shm_table *shm)
+{
+	char path[64];
+
+	shm->fd = memfd_create("petitboot-table",
+			MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (shm->fd < 0) {
+		pb_log("memfd_create failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	/* frontends rely on the region never shrinking under them */
+	if (ftruncate(shm->fd, SHM_TABLE_MIN_SIZE) ||
+			fcntl(shm->fd, F_ADD_SEALS,
+				F_SEAL_SHRINK | F_SEAL_SEAL)) {
+		pb_log("can't set up shared table: %s\n", strerror(errno));
+		goto err_close;
+	}
+
+	shm->hdr = mmap(NULL, SHM_TABLE_MAX_SIZE, PROT_READ | PROT_WRITE,
+			MAP_SHARED, shm->fd, 0);
+	if (shm->hdr == MAP_FAILED) {
+		pb_log("can't map shared table: %s\n", strerror(errno));
+		goto err_close;
+	}
+
+	/* the fd we hand out can't be used to write to the region */
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", shm->fd);
+	shm->ro_fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (shm->ro_fd < 0) {
+		pb_log("can't open %s: %s\n", path, strerror(errno));
+		munmap(shm->hdr, SHM_TABLE_MAX_SIZE);
+		goto err_close;
+	}
+
+	shm->size = SHM_TABLE_MIN_SIZE;
+	shm->hdr->magic = SHM_TABLE_MAGIC;
+	shm->hdr->version = SHM_TABLE_VERSION;
+	shm->hdr->generation = 0;
+	shm->hdr->len = 0;
+
+	return 0;
+
+err_close:
+	close(shm->fd);
+	return -1;
+}
+
+static void region_destroy(struct shm_table *shm)
+{
+	munmap(shm->hdr, SHM_TABLE_MAX_SIZE);
+	close(shm->ro_fd);
+	close(shm->fd);
+}
+
+static int region_grow(struct shm_table *shm, unsigned int need)
+{
+	unsigned int size;
+
+	for (size = shm->size; size < need; size *= 2)
+		;
+
+	if (size > SHM_TABLE_MAX_SIZE)
+		return -1;
+
+	if (ftruncate(shm->fd, size)) {
+		pb_log("can't grow shared table: %s\n", strerror(errno));
+		return -1;
+	}
+
+	shm->size = size;
+	return 0;
+}
+
+static int append(struct shm_table *shm, const struct msg_buf *buf)
+{
+	struct shm_table_header *hdr = shm->hdr;
+
+	if (sizeof(*hdr) + hdr->len + buf->len > shm->size &&
+			region_grow(shm, sizeof(*hdr) + hdr->len + buf->len))
+		return -1;
+
+	memcpy(records(shm) + hdr->len, buf->data, buf->len);
+
+	/* the records have to be visible before the new length is */
+	__sync_synchronize();
+	hdr->len += buf->len;
+	hdr->generation++;
+
+	return 0;
+}
+
+/* start a new region, holding just the current table */
+static int replace(struct shm_table *shm)
+{
+	struct msg_buf buf = MSG_BUF_INIT_TERMINATED;
+	struct shm_table new = *shm;
+	int n = shm->table->n_entries;
+
+	if (msg_buf_add_device_table(&buf, shm->table) ||
+			region_create(&new) || append(&new, &buf)) {
+		msg_buf_free(&buf);
+		return -1;
+	}
+
+	msg_buf_free(&buf);
+	if (shm->hdr)
+		region_destroy(shm);
+
+	*shm = new;
+	shm->epoch++;
+	shm->sent = n ? shm->table->entries[n - 1] : NULL;
+
+	pb_log("new shared table, %d bytes\n", shm->hdr->len);
+	return 0;
+}
+
+/*
+ * Publish @buf. If the region is full, we start a new one instead, if
+ * that would free up at least half of the records. The table has already
+ * been updated, so in that case the new region includes the records in
+ * @buf.
+ *
+ * Returns 1 if the region was replaced, 0 if @buf was appended, or -1 on
+ * error.
+ */
+static int publish(struct shm_table *shm, const struct msg_buf *buf)
+{
+	struct msg_buf snapshot = MSG_BUF_INIT_TERMINATED;
+	unsigned int need;
+	int rc;
+
+	need = sizeof(*shm->hdr) + shm->hdr->len + buf->len;
+	if (need <= shm->size)
+		return append(shm, buf);
+
+	rc = msg_buf_add_device_table(&snapshot, shm->table);
+	need = snapshot.len;
+	msg_buf_free(&snapshot);
+	if (rc)
+		return -1;
+
+	if (need * 2 <= shm->hdr->len || append(shm, buf))
+		return replace(shm) ? -1 : 1;
+
+	return 0;
+}
+
+/* publish @buf, which has records for @entry */
+static int publish_entry(struct shm_table *shm, struct device_entry *entry,
+		struct msg_buf *buf)
+{
+	int rc;
+
+	rc = publish(shm, buf);
+	msg_buf_free(buf);
+
+	if (rc < 0) {
+		pb_log("can't publish to shared table\n");
+		return -1;
+	}
+
+	if (rc == 0)
+		shm->sent = entry;
+
+	return 0;
+}
+
+/* add a device record to @buf, if the next option record would refer to
+ * some other device */
+static int add_device(struct shm_table *shm, struct device_entry *entry,
+		struct msg_buf *buf)
+{
+	if (shm->sent == entry)
+		return 0;
+
+	return msg_buf_add_device(buf, entry->dev);
+}
+
+struct shm_table *shm_table_create(const struct device_table *table)
+{
+	struct shm_table *shm;
+
+	shm = malloc(sizeof(*shm));
+	if (!shm)
+		return NULL;
+
+	memset(shm, 0, sizeof(*shm));
+	shm->table = table;
+
+	if (replace(shm)) {
+		free(shm);
+		return NULL;
+	}
+
+	return shm;
+}
+
+void shm_table_free(struct shm_table *shm)
+{
+	if (!shm)
+		return;
+
+	region_destroy(shm);
+	free(shm);
+}
+
+int shm_table_add_device(struct shm_table *shm, struct device_entry *entry)
+{
+	struct msg_buf buf = MSG_BUF_INIT_TERMINATED;
+
+	if (add_device(shm, entry, &buf)) {
+		msg_buf_free(&buf);
+		return -1;
+	}
+
+	return publish_entry(shm, entry, &buf);
+}
+
+int shm_table_add_option(struct shm_table *shm, struct device_entry *entry,
+		enum device_action action, const struct boot_option *opt)
+{
+	struct msg_buf buf = MSG_BUF_INIT_TERMINATED;
+
+	if (add_device(shm, entry, &buf) ||
+			msg_buf_add_boot_option(&buf, action, opt)) {
+		msg_buf_free(&buf);
+		return -1;
+	}
+
+	return publish_entry(shm, entry, &buf);
+}
+
+int shm_table_remove_option(struct shm_table *shm,
+		struct device_entry *entry, const char *id)
+{
+	struct msg_buf buf = MSG_BUF_INIT_TERMINATED;
+
+	if (add_device(shm, entry, &buf) ||
+			msg_buf_add_action(&buf, DEV_ACTION_REMOVE_OPTION) ||
+			msg_buf_add_string(&buf, id)) {
+		msg_buf_free(&buf);
+		return -1;
+	}
+
+	return publish_entry(shm, entry, &buf);
+}
+
+int shm_table_remove_device(struct shm_table *shm, const char *id)
+{
+	struct msg_buf buf = MSG_BUF_INIT_TERMINATED;
+
+	/* the entry is about to be freed, and the frontends' device indices
+	 * change, so the next option record needs a device record first */
+	shm->sent = NULL;
+
+	if (msg_buf_add_action(&buf, DEV_ACTION_REMOVE_DEVICE) ||
+			msg_buf_add_string(&buf, id)) {
+		msg_buf_free(&buf);
+		return -1;
+	}
+
+	return publish_entry(shm, NULL, &buf);
+}
+
+const struct shm_table_header *shm_table_map(int fd)
+{
+	struct shm_table_header *hdr;
+	struct stat statbuf;
+
+	if (fstat(fd, &statbuf) || statbuf.st_size < sizeof(*hdr)) {
+		pb_log("invalid shared table\n");
+		return NULL;
+	}
+
+	hdr = mmap(NULL, SHM_TABLE_MAX_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED) {
+		pb_log("can't map shared table: %s\n", strerror(errno));
+		return NULL;
+	}
+
+	if (hdr->magic != SHM_TABLE_MAGIC || hdr->version != SHM_TABLE_VERSION) {
+		pb_log("unsupported shared table version %d\n", hdr->version);
+		munmap(hdr, SHM_TABLE_MAX_SIZE);
+		return NULL;
+	}
+
+	return hdr;
+}
+
+void shm_table_unmap(const struct shm_table_header *hdr)
+{
+	munmap((void *)hdr, SHM_TABLE_MAX_SIZE);
+}
+
+uint32_t shm_table_len(const struct shm_table_header *hdr)
+{
+	uint32_t len = *(volatile const uint32_t *)&hdr->len;
+
+	/* pairs with the barrier in append() */
+	__sync_synchronize();
+	return len;
+}
@@ -0,0 +1,92 @@
+#ifndef _SHM_TABLE_H
+#define _SHM_TABLE_H
+
+#include <stdint.h>
+
+#include "message.h"
+#include "device-table.h"
+
+/*
+ * The shared device table is a memfd-backed region, published by the
+ * discovery daemon and mapped read-only by frontends.
+ *
+ * The region starts with a struct shm_table_header, followed by a log of
+ * records in the socket message format (see message.h), except that each
+ * string is NUL-terminated so that frontends can use the strings in place.
+ * The region is append-only: the daemon writes new records after the
+ * current end, and then publishes them by updating len and generation.
+ * Records that have been published are never changed.
+ *
+ * The region never moves or shrinks, so a frontend can map the maximum
+ * size once, and keep pointers into the records for as long as it has the
+ * region mapped. When a region is full, the daemon starts a new one,
+ * containing just the current state of the device table.
+ */
+
+#define SHM_TABLE_MAGIC		0x70627462	/* "pbtb" */
+#define SHM_TABLE_VERSION	1
+
+/* the largest a region may grow to; frontends map this much */
+#define SHM_TABLE_MAX_SIZE	(16 * 1024 * 1024)
+
+struct shm_table_header {
+	uint32_t	magic;
+	uint32_t	version;
+
+	/* bumped each time new records are published */
+	uint32_t	generation;
+
+	/* length of the published records, following the header */
+	uint32_t	len;
+};
+
+/* the daemon's side of the region */
+struct shm_table {
+	int			fd;
+	int			ro_fd;
+	struct shm_table_header	*hdr;
+	unsigned int		size;
+
+	/* bumped whenever the region is replaced */
+	unsigned int		epoch;
+
+	/* the device that the last option record referred to */
+	struct device_entry	*sent;
+
+	const struct device_table *table;
+};
+
+/**
+ * Create a region, holding the current contents of @table. Later changes
+ * to the table need to be published with the shm_table_* calls below.
+ */
+struct shm_table *shm_table_create(const struct device_table *table);
+void shm_table_free(struct shm_table *shm);
+
+int shm_table_add_device(struct shm_table *shm, struct device_entry *entry);
+int shm_table_add_option(struct shm_table *shm, struct device_entry *entry,
+		enum device_action action, const struct boot_option *opt);
+int shm_table_remove_option(struct shm_table *shm,
+		struct device_entry *entry, const char *id);
+int shm_table_remove_device(struct shm_table *shm, const char *id);
+
+/**
+ * Map a region read-only, from an fd received in DEV_ACTION_SHM_REGION.
+ *
+ * Returns NULL if @fd isn't a valid region.
+ */
+const struct shm_table_header *shm_table_map(int fd);
+void shm_table_unmap(const struct shm_table_header *hdr);
+
+/**
+ * The published length of a mapped region. After this returns, records up
+ * to that length can be read.
+ */
+uint32_t shm_table_len(const struct shm_table_header *hdr);
+
+static inline const char *shm_table_records(const struct shm_table_header *hdr)
+{
+	return (const char *)(hdr + 1);
+}
+
+#endif /* _SHM_TABLE_H */
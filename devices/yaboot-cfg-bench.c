@@ -0,0 +1,129 @@
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+#include "yaboot-cfg.h"
+
+/*
+ * Measure the yaboot.conf engine over generated configs with many images:
+ * the time to parse the file, then to walk the images and look up each of
+ * the keywords that the yaboot parser uses to build an option.
+ */
+
+static char *lookup_items[] = {
+	"image", "initrd", "literal", "root", "read-only", "read-write",
+	"ramdisk", "initrd-size", "novideo", "append", NULL,
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static char *generate(int n_images, size_t *len)
+{
+	char *buf;
+	FILE *fp;
+	int i;
+
+	fp = open_memstream(&buf, len);
+	if (!fp)
+		return NULL;
+
+	fprintf(fp, "# generated by yaboot-cfg-bench\n"
+			"init-message = \"%d images\"\n"
+			"timeout = 100\n"
+			"root = /dev/sda2\n"
+			"default = linux-%d\n\n", n_images, n_images - 1);
+
+	for (i = 0; i < n_images; i++) {
+		fprintf(fp, "image = /boot/vmlinux-2.6.%d\n", i);
+		fprintf(fp, "\tlabel = linux-%d\n", i);
+		fprintf(fp, "\talias = l%d\n", i);
+		fprintf(fp, "\tinitrd = /boot/initrd-2.6.%d.img\n", i);
+		fprintf(fp, "\tread-only\n");
+		fprintf(fp, "\tappend = \"console=hvc0 quiet video=%d\"\n\n",
+				i % 14);
+	}
+
+	fclose(fp);
+	return buf;
+}
+
+int main(int argc, char **argv)
+{
+	int opt, i, n, n_images = 5000, iterations = 5;
+	uint64_t start, parse_ns = 0, lookup_ns = 0;
+	unsigned long found = 0;
+	struct cfg_context *cfg;
+	char *conf, *label, **item;
+	size_t len;
+
+	while ((opt = getopt(argc, argv, "n:i:")) != -1) {
+		switch (opt) {
+		case 'n':
+			n_images = atoi(optarg);
+			break;
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n images] "
+					"[-i iterations]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	conf = generate(n_images, &len);
+	if (!conf)
+		return EXIT_FAILURE;
+
+	for (i = 0; i < iterations; i++) {
+		start = now_ns();
+
+		cfg = cfg_context_create();
+		if (!cfg || cfg_parse(cfg, "yaboot.conf", conf, len)) {
+			fprintf(stderr, "parse failed\n");
+			return EXIT_FAILURE;
+		}
+
+		parse_ns += now_ns() - start;
+		start = now_ns();
+
+		n = 0;
+		for (label = cfg_next_image(cfg, NULL); label;
+				label = cfg_next_image(cfg, label)) {
+			for (item = lookup_items; *item; item++)
+				found += !!cfg_get_strg(cfg, label, *item);
+			n++;
+		}
+
+		lookup_ns += now_ns() - start;
+		cfg_context_free(cfg);
+
+		if (n != n_images) {
+			fprintf(stderr, "found %d images, expected %d\n",
+					n, n_images);
+			return EXIT_FAILURE;
+		}
+	}
+
+	printf("%d images, %zd bytes: parse %.2f ms, lookups %.2f ms "
+			"(%.0f ns/image, %lu found)\n", n_images, len,
+			parse_ns / 1e6 / iterations,
+			lookup_ns / 1e6 / iterations,
+			(double)(parse_ns + lookup_ns) / iterations / n_images,
+			found / iterations);
+
+	free(conf);
+	return EXIT_SUCCESS;
+}
@@ -19,12 +19,15 @@
  *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
  */
 
-#include <setjmp.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <ctype.h>
+
+#include "yaboot-cfg.h"
+#include "yaboot-keywords.h"
 
 #define prom_printf printf
 #define prom_putchar putchar
@@ -43,76 +46,230 @@ typedef struct {
      void *data;
 } CONFIG;
 
-#define MAX_TOKEN 200
-#define MAX_VAR_NAME MAX_TOKEN
-char *cfg_get_default (void);
-
-CONFIG cf_options[] =
-{
-     {cft_strg, "device", NULL},
-     {cft_strg, "partition", NULL},
-     {cft_strg, "default", NULL},
-     {cft_strg, "timeout", NULL},
-     {cft_strg, "password", NULL},
-     {cft_flag, "restricted", NULL},
-     {cft_strg, "message", NULL},
-     {cft_strg, "root", NULL},
-     {cft_strg, "ramdisk", NULL},
-     {cft_flag, "read-only", NULL},
-     {cft_flag, "read-write", NULL},
-     {cft_strg, "append", NULL},
-     {cft_strg, "initrd", NULL},
-     {cft_flag, "initrd-prompt", NULL},
-     {cft_strg, "initrd-size", NULL},
-     {cft_flag, "pause-after", NULL},
-     {cft_strg, "pause-message", NULL},
-     {cft_strg, "init-code", NULL},
-     {cft_strg, "init-message", NULL},
-     {cft_strg, "fgcolor", NULL},
-     {cft_strg, "bgcolor", NULL},
-     {cft_strg, "ptypewarning", NULL},
-     {cft_end, NULL, NULL}};
-
-CONFIG cf_image[] =
-{
-     {cft_strg, "image", NULL},
-     {cft_strg, "label", NULL},
-     {cft_strg, "alias", NULL},
-     {cft_flag, "single-key", NULL},
-     {cft_flag, "restricted", NULL},
-     {cft_strg, "device", NULL},
-     {cft_strg, "partition", NULL},
-     {cft_strg, "root", NULL},
-     {cft_strg, "ramdisk", NULL},
-     {cft_flag, "read-only", NULL},
-     {cft_flag, "read-write", NULL},
-     {cft_strg, "append", NULL},
-     {cft_strg, "literal", NULL},
-     {cft_strg, "initrd", NULL},
-     {cft_flag, "initrd-prompt", NULL},
-     {cft_strg, "initrd-size", NULL},
-     {cft_flag, "pause-after", NULL},
-     {cft_strg, "pause-message", NULL},
-     {cft_flag, "novideo", NULL},
-     {cft_strg, "sysmap", NULL},
-     {cft_end, NULL, NULL}};
+#define MAX_TOKEN 200		/* initial size of the token buffer */
+
+/* the keyword templates, copied into each context and image. Each entry
+ * is at its keyword's index in yaboot.keywords, which is what the
+ * generated lookup functions return */
+static const CONFIG cf_options[] =
+{
+     [YABOOT_OPTION_DEVICE] = {cft_strg, "device", NULL},
+     [YABOOT_OPTION_PARTITION] = {cft_strg, "partition", NULL},
+     [YABOOT_OPTION_DEFAULT] = {cft_strg, "default", NULL},
+     [YABOOT_OPTION_TIMEOUT] = {cft_strg, "timeout", NULL},
+     [YABOOT_OPTION_PASSWORD] = {cft_strg, "password", NULL},
+     [YABOOT_OPTION_RESTRICTED] = {cft_flag, "restricted", NULL},
+     [YABOOT_OPTION_MESSAGE] = {cft_strg, "message", NULL},
+     [YABOOT_OPTION_ROOT] = {cft_strg, "root", NULL},
+     [YABOOT_OPTION_RAMDISK] = {cft_strg, "ramdisk", NULL},
+     [YABOOT_OPTION_READ_ONLY] = {cft_flag, "read-only", NULL},
+     [YABOOT_OPTION_READ_WRITE] = {cft_flag, "read-write", NULL},
+     [YABOOT_OPTION_APPEND] = {cft_strg, "append", NULL},
+     [YABOOT_OPTION_INITRD] = {cft_strg, "initrd", NULL},
+     [YABOOT_OPTION_INITRD_PROMPT] = {cft_flag, "initrd-prompt", NULL},
+     [YABOOT_OPTION_INITRD_SIZE] = {cft_strg, "initrd-size", NULL},
+     [YABOOT_OPTION_PAUSE_AFTER] = {cft_flag, "pause-after", NULL},
+     [YABOOT_OPTION_PAUSE_MESSAGE] = {cft_strg, "pause-message", NULL},
+     [YABOOT_OPTION_INIT_CODE] = {cft_strg, "init-code", NULL},
+     [YABOOT_OPTION_INIT_MESSAGE] = {cft_strg, "init-message", NULL},
+     [YABOOT_OPTION_FGCOLOR] = {cft_strg, "fgcolor", NULL},
+     [YABOOT_OPTION_BGCOLOR] = {cft_strg, "bgcolor", NULL},
+     [YABOOT_OPTION_PTYPEWARNING] = {cft_strg, "ptypewarning", NULL},
+     [N_YABOOT_OPTION_KEYWORDS] = {cft_end, NULL, NULL}};
+
+static const CONFIG cf_image[] =
+{
+     [YABOOT_IMAGE_IMAGE] = {cft_strg, "image", NULL},
+     [YABOOT_IMAGE_LABEL] = {cft_strg, "label", NULL},
+     [YABOOT_IMAGE_ALIAS] = {cft_strg, "alias", NULL},
+     [YABOOT_IMAGE_SINGLE_KEY] = {cft_flag, "single-key", NULL},
+     [YABOOT_IMAGE_RESTRICTED] = {cft_flag, "restricted", NULL},
+     [YABOOT_IMAGE_DEVICE] = {cft_strg, "device", NULL},
+     [YABOOT_IMAGE_PARTITION] = {cft_strg, "partition", NULL},
+     [YABOOT_IMAGE_ROOT] = {cft_strg, "root", NULL},
+     [YABOOT_IMAGE_RAMDISK] = {cft_strg, "ramdisk", NULL},
+     [YABOOT_IMAGE_READ_ONLY] = {cft_flag, "read-only", NULL},
+     [YABOOT_IMAGE_READ_WRITE] = {cft_flag, "read-write", NULL},
+     [YABOOT_IMAGE_APPEND] = {cft_strg, "append", NULL},
+     [YABOOT_IMAGE_LITERAL] = {cft_strg, "literal", NULL},
+     [YABOOT_IMAGE_INITRD] = {cft_strg, "initrd", NULL},
+     [YABOOT_IMAGE_INITRD_PROMPT] = {cft_flag, "initrd-prompt", NULL},
+     [YABOOT_IMAGE_INITRD_SIZE] = {cft_strg, "initrd-size", NULL},
+     [YABOOT_IMAGE_PAUSE_AFTER] = {cft_flag, "pause-after", NULL},
+     [YABOOT_IMAGE_PAUSE_MESSAGE] = {cft_strg, "pause-message", NULL},
+     [YABOOT_IMAGE_NOVIDEO] = {cft_flag, "novideo", NULL},
+     [YABOOT_IMAGE_SYSMAP] = {cft_strg, "sysmap", NULL},
+     [N_YABOOT_IMAGE_KEYWORDS] = {cft_end, NULL, NULL}};
 
 static char flag_set;
-static char *last_token = NULL, *last_item = NULL, *last_value = NULL;
-static int line_num;
-static int back = 0;		/* can go back by one char */
-static char *currp = NULL;
-static char *endp = NULL;
-static char *file_name = NULL;
-static CONFIG *curr_table = cf_options;
-static jmp_buf env;
-
-static struct IMAGES {
+
+/* Each image has its own copy of cf_image, so a keyword's slot in an
+ * image table is its index in cf_image */
+struct IMAGES {
      CONFIG table[sizeof (cf_image) / sizeof (cf_image[0])];
+     char *label;		/* label, or the basename of the image */
      struct IMAGES *next;
-} *images = NULL;
+};
+
+/* open-addressed hash table, for the label index */
+struct cfg_hash_entry {
+     const char *key;
+     void *value;
+};
+
+struct cfg_hash {
+     struct cfg_hash_entry *entries;
+     unsigned int size;		/* zero, or a power of two */
+     unsigned int count;
+};
+
+/* everything for one parse of a config file */
+struct cfg_context {
+     char *last_token, *last_item, *last_value;
+     int line_num;
+     int back;			/* can go back by one char */
+     char *currp;
+     char *endp;
+     char *file_name;
+     CONFIG *curr_table;
+     int error;			/* set by cfg_error() */
+     char *token;		/* buffer for cfg_get_token() */
+     int token_size;
+     CONFIG options[sizeof (cf_options) / sizeof (cf_options[0])];
+     struct IMAGES *images, **images_tail;
+     struct IMAGES *last_next_image;	/* for cfg_next_image() */
+     struct cfg_hash labels;		/* label or alias -> image */
+     int printl_count;
+};
+
+static unsigned int cfg_hash_string (const char *str)
+{
+     unsigned int hash = 2166136261u;
+
+     for (; *str; str++) {
+	  hash ^= (unsigned char)*str;
+	  hash *= 16777619u;
+     }
+     return hash;
+}
+
+static struct cfg_hash_entry *cfg_hash_slot (struct cfg_hash *h,
+					     const char *key)
+{
+     unsigned int i;
+
+     i = cfg_hash_string (key) & (h->size - 1);
+     while (h->entries[i].key && strcmp (h->entries[i].key, key))
+	  i = (i + 1) & (h->size - 1);
+     return &h->entries[i];
+}
+
+static int cfg_hash_grow (struct cfg_hash *h)
+{
+     struct cfg_hash old = *h;
+     unsigned int i;
+
+     h->size = old.size ? old.size * 2 : 64;
+     h->entries = calloc (h->size, sizeof (*h->entries));
+     if (!h->entries) {
+	  *h = old;
+	  return -1;
+     }
+     for (i = 0; i < old.size; i++)
+	  if (old.entries[i].key)
+	       *cfg_hash_slot (h, old.entries[i].key) = old.entries[i];
+     free (old.entries);
+     return 0;
+}
+
+/* add @key, unless it's already there; the first value added wins */
+static int cfg_hash_insert (struct cfg_hash *h, const char *key, void *value)
+{
+     struct cfg_hash_entry *entry;
+
+     if ((h->count + 1) * 2 > h->size && cfg_hash_grow (h))
+	  return -1;
+     entry = cfg_hash_slot (h, key);
+     if (entry->key)
+	  return 0;
+     entry->key = key;
+     entry->value = value;
+     h->count++;
+     return 0;
+}
+
+static void *cfg_hash_find (struct cfg_hash *h, const char *key)
+{
+     if (!h->count)
+	  return NULL;
+     return cfg_hash_slot (h, key)->value;
+}
+
+static void cfg_hash_free (struct cfg_hash *h)
+{
+     free (h->entries);
+     h->entries = NULL;
+     h->size = h->count = 0;
+}
+
+/* find @item's entry in @table, which is either ctx->options or an image
+ * table, or NULL if there is no such keyword */
+static CONFIG *cfg_lookup (struct cfg_context *ctx, CONFIG *table, char *item)
+{
+     int idx;
+
+     if (table == ctx->options)
+	  idx = yaboot_option_keyword (item, strlen (item));
+     else
+	  idx = yaboot_image_keyword (item, strlen (item));
+     return idx < 0 ? NULL : table + idx;
+}
+
+struct cfg_context *cfg_context_create (void)
+{
+     struct cfg_context *ctx;
+
+     ctx = malloc (sizeof (*ctx));
+     if (!ctx)
+	  return NULL;
+
+     memset (ctx, 0, sizeof (*ctx));
+     memcpy (ctx->options, cf_options, sizeof (cf_options));
+     ctx->curr_table = ctx->options;
+     ctx->images_tail = &ctx->images;
+
+     return ctx;
+}
+
+static void cfg_free_table (CONFIG *table)
+{
+     CONFIG *walk;
+
+     for (walk = table; walk->type != cft_end; walk++)
+	  if (walk->type == cft_strg)
+	       free (walk->data);
+}
+
+void cfg_context_free (struct cfg_context *ctx)
+{
+     struct IMAGES *p, *next;
+
+     if (!ctx)
+	  return;
 
-void cfg_error (char *msg,...)
+     for (p = ctx->images; p; p = next) {
+	  next = p->next;
+	  cfg_free_table (p->table);
+	  free (p);
+     }
+     cfg_free_table (ctx->options);
+     cfg_hash_free (&ctx->labels);
+     free (ctx->last_token);
+     free (ctx->token);
+     free (ctx);
+}
+
+static void cfg_error (struct cfg_context *ctx, char *msg,...)
 {
      va_list ap;
 
@@ -120,11 +277,11 @@ void cfg_error (char *msg,...)
      prom_printf ("Config file error: ");
      prom_vprintf (msg, ap);
      va_end (ap);
-     prom_printf (" near line %d in file %s\n", line_num, file_name);
-     longjmp (env, 1);
+     prom_printf (" near line %d in file %s\n", ctx->line_num, ctx->file_name);
+     ctx->error = 1;
 }
 
-void cfg_warn (char *msg,...)
+static void cfg_warn (struct cfg_context *ctx, char *msg,...)
 {
      va_list ap;
 
@@ -132,356 +289,411 @@ void cfg_warn (char *msg,...)
      prom_printf ("Config file warning: ");
      prom_vprintf (msg, ap);
      va_end (ap);
-     prom_printf (" near line %d in file %s\n", line_num, file_name);
+     prom_printf (" near line %d in file %s\n", ctx->line_num, ctx->file_name);
 }
 
-inline int cfg_getc ()
+static inline int cfg_getc (struct cfg_context *ctx)
 {
-     if (currp == endp)
+     if (ctx->currp == ctx->endp)
 	  return EOF;
-     return *currp++;
+     return *ctx->currp++;
 }
 
 #define next_raw next
-static int next (void)
+static int next (struct cfg_context *ctx)
 {
      int ch;
 
-     if (!back)
-	  return cfg_getc ();
-     ch = back;
-     back = 0;
+     if (!ctx->back)
+	  return cfg_getc (ctx);
+     ch = ctx->back;
+     ctx->back = 0;
      return ch;
 }
 
-static void again (int ch)
+static void again (struct cfg_context *ctx, int ch)
+{
+     ctx->back = ch;
+}
+
+/* add @ch to the token being read, growing the buffer as needed */
+static int token_putc (struct cfg_context *ctx, int *len, int ch)
+{
+     char *token;
+     int size;
+
+     if (*len >= ctx->token_size) {
+	  size = ctx->token_size ? ctx->token_size * 2 : MAX_TOKEN;
+	  token = realloc (ctx->token, size);
+	  if (!token) {
+	       cfg_error (ctx, "Token is too long");
+	       return -1;
+	  }
+	  ctx->token = token;
+	  ctx->token_size = size;
+     }
+     ctx->token[(*len)++] = ch;
+     return 0;
+}
+
+static char *token_finish (struct cfg_context *ctx, int len)
 {
-     back = ch;
+     return len ? strndup (ctx->token, len) : strdup ("");
 }
 
-static char *cfg_get_token (void)
+/* returns the next token, or NULL at EOF or on error (when ctx->error is
+ * set) */
+static char *cfg_get_token (struct cfg_context *ctx)
 {
-     char buf[MAX_TOKEN + 1];
      char *here;
-     int ch, escaped;
+     int ch, escaped, len = 0;
 
-     if (last_token) {
-	  here = last_token;
-	  last_token = NULL;
+     if (ctx->last_token) {
+	  here = ctx->last_token;
+	  ctx->last_token = NULL;
 	  return here;
      }
      while (1) {
-	  while (ch = next (), ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r')
+	  while (ch = next (ctx), ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r')
 	       if (ch == '\n' || ch == '\r')
-		    line_num++;
+		    ctx->line_num++;
 	  if (ch == EOF || ch == (int)NULL)
 	       return NULL;
 	  if (ch != '#')
 	       break;
-	  while (ch = next_raw (), (ch != '\n' && ch != '\r'))
+	  while (ch = next_raw (ctx), (ch != '\n' && ch != '\r'))
 	       if (ch == EOF)
 		    return NULL;
-	  line_num++;
+	  ctx->line_num++;
      }
      if (ch == '=')
 	  return strdup ("=");
      if (ch == '"') {
-	  here = buf;
-	  while (here - buf < MAX_TOKEN) {
-	       if ((ch = next ()) == EOF)
-		    cfg_error ("EOF in quoted string");
-	       if (ch == '"') {
-		    *here = 0;
-		    return strdup (buf);
+	  while (1) {
+	       if ((ch = next (ctx)) == EOF) {
+		    cfg_error (ctx, "EOF in quoted string");
+		    return NULL;
 	       }
+	       if (ch == '"')
+		    return token_finish (ctx, len);
 	       if (ch == '\\') {
-		    ch = next ();
+		    ch = next (ctx);
 		    switch (ch) {
 		    case '"':
 		    case '\\':
 			 break;
 		    case '\n':
 		    case '\r':
-			 while ((ch = next ()), ch == ' ' || ch == '\t');
+			 while ((ch = next (ctx)), ch == ' ' || ch == '\t');
 			 if (!ch)
 			      continue;
-			 again (ch);
+			 again (ctx, ch);
 			 ch = ' ';
 			 break;
 		    case 'n':
 			 ch = '\n';
 			 break;
 		    default:
-			 cfg_error ("Bad use of \\ in quoted string");
+			 cfg_error (ctx, "Bad use of \\ in quoted string");
+			 return NULL;
 		    }
-	       } else if ((ch == '\n') || (ch == '\r'))
-		    cfg_error ("newline is not allowed in quoted strings");
-	       *here++ = ch;
+	       } else if ((ch == '\n') || (ch == '\r')) {
+		    cfg_error (ctx, "newline is not allowed in quoted strings");
+		    return NULL;
+	       }
+	       if (token_putc (ctx, &len, ch))
+		    return NULL;
 	  }
-	  cfg_error ("Quoted string is too long");
-	  return 0;		/* not reached */
      }
-     here = buf;
      escaped = 0;
-     while (here - buf < MAX_TOKEN) {
+     while (1) {
 	  if (escaped) {
-	       if (ch == EOF)
-		    cfg_error ("\\ precedes EOF");
+	       if (ch == EOF) {
+		    cfg_error (ctx, "\\ precedes EOF");
+		    return NULL;
+	       }
 	       if (ch == '\n')
-		    line_num++;
-	       else
-		    *here++ = ch == '\t' ? ' ' : ch;
+		    ctx->line_num++;
+	       else if (token_putc (ctx, &len, ch == '\t' ? ' ' : ch))
+		    return NULL;
 	       escaped = 0;
 	  } else {
 	       if (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == '#' ||
 		   ch == '=' || ch == EOF) {
-		    again (ch);
-		    *here = 0;
-		    return strdup (buf);
+		    again (ctx, ch);
+		    return token_finish (ctx, len);
 	       }
-	       if (!(escaped = (ch == '\\')))
-		    *here++ = ch;
+	       if (!(escaped = (ch == '\\')) && token_putc (ctx, &len, ch))
+		    return NULL;
 	  }
-	  ch = next ();
+	  ch = next (ctx);
      }
-     cfg_error ("Token is too long");
-     return 0;			/* not reached */
 }
 
-static void cfg_return_token (char *token)
+static void cfg_return_token (struct cfg_context *ctx, char *token)
 {
-     last_token = token;
+     ctx->last_token = token;
 }
 
-static int cfg_next (char **item, char **value)
+/* returns 1 if an item was read, 0 at EOF, or -1 on error */
+static int cfg_next (struct cfg_context *ctx, char **item, char **value)
 {
      char *this;
 
-     if (last_item) {
-	  *item = last_item;
-	  *value = last_value;
-	  last_item = NULL;
+     if (ctx->last_item) {
+	  *item = ctx->last_item;
+	  *value = ctx->last_value;
+	  ctx->last_item = NULL;
 	  return 1;
      }
      *value = NULL;
-     if (!(*item = cfg_get_token ()))
-	  return 0;
-     if (!strcmp (*item, "="))
-	  cfg_error ("Syntax error");
-     if (!(this = cfg_get_token ()))
+     if (!(*item = cfg_get_token (ctx)))
+	  return ctx->error ? -1 : 0;
+     if (!strcmp (*item, "=")) {
+	  cfg_error (ctx, "Syntax error");
+	  goto err;
+     }
+     if (!(this = cfg_get_token (ctx))) {
+	  if (ctx->error)
+	       goto err;
 	  return 1;
+     }
      if (strcmp (this, "=")) {
-	  cfg_return_token (this);
+	  cfg_return_token (ctx, this);
 	  return 1;
      }
-     if (!(*value = cfg_get_token ()))
-	  cfg_error ("Value expected at EOF");
-     if (!strcmp (*value, "="))
-	  cfg_error ("Syntax error after %s", *item);
+     free (this);
+     if (!(*value = cfg_get_token (ctx))) {
+	  if (!ctx->error)
+	       cfg_error (ctx, "Value expected at EOF");
+	  goto err;
+     }
+     if (!strcmp (*value, "=")) {
+	  cfg_error (ctx, "Syntax error after %s", *item);
+	  free (*value);
+	  goto err;
+     }
      return 1;
+
+err:
+     free (*item);
+     return -1;
 }
 
 #if 0
 // The one and only call to this procedure is commented out
 // below, so we don't need this unless we decide to use it again.
-static void cfg_return (char *item, char *value)
+static void cfg_return (struct cfg_context *ctx, char *item, char *value)
 {
-     last_item = item;
-     last_value = value;
+     ctx->last_item = item;
+     ctx->last_value = value;
 }
 #endif
 
-static int cfg_set (char *item, char *value)
+static int cfg_set (struct cfg_context *ctx, char *item, char *value)
 {
      CONFIG *walk;
 
-     if (!strcasecmp (item, "image")) {
-	  struct IMAGES **p = &images;
+     if (yaboot_image_keyword (item, strlen (item)) == YABOOT_IMAGE_IMAGE) {
+	  struct IMAGES *p;
 
-	  while (*p)
-	       p = &((*p)->next);
-	  *p = (struct IMAGES *)malloc (sizeof (struct IMAGES));
-	  if (*p == NULL) {
+	  p = (struct IMAGES *)malloc (sizeof (struct IMAGES));
+	  if (p == NULL) {
 	       prom_printf("malloc error in cfg_set\n");
 	       return -1;
 	  }
-	  (*p)->next = 0;
-	  curr_table = ((*p)->table);
-	  memcpy (curr_table, cf_image, sizeof (cf_image));
+	  p->label = NULL;
+	  p->next = 0;
+	  *ctx->images_tail = p;
+	  ctx->images_tail = &p->next;
+	  ctx->curr_table = p->table;
+	  memcpy (ctx->curr_table, cf_image, sizeof (cf_image));
      }
-     for (walk = curr_table; walk->type != cft_end; walk++) {
-	  if (walk->name && !strcasecmp (walk->name, item)) {
-	       if (value && walk->type != cft_strg)
-		    cfg_warn ("'%s' doesn't have a value", walk->name);
-	       else if (!value && walk->type == cft_strg)
-		    cfg_warn ("Value expected for '%s'", walk->name);
-	       else {
-		    if (walk->data)
-			 cfg_warn ("Duplicate entry '%s'", walk->name);
-		    if (walk->type == cft_flag)
-			 walk->data = &flag_set;
-		    else if (walk->type == cft_strg)
-			 walk->data = value;
-	       }
-	       break;
+     walk = cfg_lookup (ctx, ctx->curr_table, item);
+     if (!walk)
+	  return 0;
+     if (value && walk->type != cft_strg) {
+	  cfg_warn (ctx, "'%s' doesn't have a value", walk->name);
+	  free (value);
+     }
+     else if (!value && walk->type == cft_strg)
+	  cfg_warn (ctx, "Value expected for '%s'", walk->name);
+     else {
+	  if (walk->data) {
+	       cfg_warn (ctx, "Duplicate entry '%s'", walk->name);
+	       if (walk->type == cft_strg)
+		    free (walk->data);
 	  }
+	  if (walk->type == cft_flag)
+	       walk->data = &flag_set;
+	  else if (walk->type == cft_strg)
+	       walk->data = value;
      }
-     if (walk->type != cft_end)
-	  return 1;
-//    cfg_return (item, value);
-     return 0;
+     return 1;
 }
 
-int cfg_parse (char *cfg_file, char *buff, int len)
+static int cfg_index_images (struct cfg_context *ctx);
+
+int cfg_parse (struct cfg_context *ctx, char *cfg_file, char *buff, int len)
 {
      char *item, *value;
+     int rc;
 
-     file_name = cfg_file;
-     currp = buff;
-     endp = currp + len;
+     ctx->file_name = cfg_file;
+     ctx->currp = buff;
+     ctx->endp = ctx->currp + len;
+     ctx->error = 0;
 
-     if (setjmp (env))
-	  return -1;
-     while (1) {
-	  if (!cfg_next (&item, &value))
-	       return 0;
-	  if (!cfg_set (item, value)) {
+     while ((rc = cfg_next (ctx, &item, &value)) > 0) {
+	  rc = cfg_set (ctx, item, value);
+	  if (rc <= 0) {
 #if DEBUG
-	       prom_printf("Can't set item %s to value %s\n", item, value);
+	       if (!rc)
+		    prom_printf("Can't set item %s to value %s\n", item, value);
 #endif	    
+	       free (value);
 	  }
 	  free (item);
+	  if (rc < 0)
+	       break;
      }
+
+     if (cfg_index_images (ctx) || rc < 0)
+	  return -1;
+     return 0;
 }
 
-static char *cfg_get_strg_i (CONFIG * table, char *item)
+static char *cfg_get_strg_i (struct cfg_context *ctx, CONFIG * table, char *item)
 {
-     CONFIG *walk;
+     CONFIG *walk = cfg_lookup (ctx, table, item);
 
-     for (walk = table; walk->type != cft_end; walk++)
-	  if (walk->name && !strcasecmp (walk->name, item))
-	       return walk->data;
-     return 0;
+     return walk ? walk->data : 0;
 }
 
-char *cfg_get_strg (char *image, char *item)
+/* Build the label index, once the whole file has been parsed. Each image
+ * is found by its label (or the basename of its image) and its alias; if
+ * several images have the same name, the first one wins. */
+static int cfg_index_images (struct cfg_context *ctx)
 {
      struct IMAGES *p;
      char *label, *alias;
-     char *ret;
 
-     if (!image)
-	  return cfg_get_strg_i (cf_options, item);
-     for (p = images; p; p = p->next) {
-	  label = cfg_get_strg_i (p->table, "label");
+     cfg_hash_free (&ctx->labels);
+     ctx->last_next_image = NULL;
+
+     for (p = ctx->images; p; p = p->next) {
+	  label = cfg_get_strg_i (ctx, p->table, "label");
 	  if (!label) {
-	       label = cfg_get_strg_i (p->table, "image");
-	       alias = strrchr (label, '/');
+	       label = cfg_get_strg_i (ctx, p->table, "image");
+	       alias = label ? strrchr (label, '/') : NULL;
 	       if (alias)
 		    label = alias + 1;
 	  }
-	  alias = cfg_get_strg_i (p->table, "alias");
-	  if (!strcmp (label, image) || (alias && !strcmp (alias, image))) {
-	       ret = cfg_get_strg_i (p->table, item);
-	       if (!ret)
-		    ret = cfg_get_strg_i (cf_options, item);
-	       return ret;
-	  }
+	  p->label = label;
+	  if (label && cfg_hash_insert (&ctx->labels, label, p))
+	       return -1;
+
+	  alias = cfg_get_strg_i (ctx, p->table, "alias");
+	  if (alias && cfg_hash_insert (&ctx->labels, alias, p))
+	       return -1;
      }
      return 0;
 }
 
-int cfg_get_flag (char *image, char *item)
+char *cfg_get_strg (struct cfg_context *ctx, char *image, char *item)
+{
+     struct IMAGES *p;
+     char *ret;
+
+     if (!image)
+	  return cfg_get_strg_i (ctx, ctx->options, item);
+     p = cfg_hash_find (&ctx->labels, image);
+     if (!p)
+	  return 0;
+     ret = cfg_get_strg_i (ctx, p->table, item);
+     if (!ret)
+	  ret = cfg_get_strg_i (ctx, ctx->options, item);
+     return ret;
+}
+
+int cfg_get_flag (struct cfg_context *ctx, char *image, char *item)
 {
-     return !!cfg_get_strg (image, item);
+     return !!cfg_get_strg (ctx, image, item);
 }
 
-static int printl_count = 0;
-static void printlabel (char *label, int defflag)
+static void printlabel (struct cfg_context *ctx, char *label, int defflag)
 {
      int len = strlen (label);
 
-     if (!printl_count)
+     if (!ctx->printl_count)
 	  prom_printf ("\n");
      prom_printf ("%s %s",defflag?"*":" ", label);
      while (len++ < 25)
 	  prom_putchar (' ');
-     printl_count++;
-     if (printl_count == 3)
-	  printl_count = 0;
+     ctx->printl_count++;
+     if (ctx->printl_count == 3)
+	  ctx->printl_count = 0;
 }
 
-void cfg_print_images (void)
+void cfg_print_images (struct cfg_context *ctx)
 {
      struct IMAGES *p;
      char *label, *alias;
 
-     char *ret = cfg_get_default();//strg_i (cf_options, "default");
+     char *ret = cfg_get_default(ctx);//strg_i (cf_options, "default");
      int defflag=0;
 
-     printl_count = 0;
-     for (p = images; p; p = p->next) {
-	  label = cfg_get_strg_i (p->table, "label");
-	  if (!label) {
-	       label = cfg_get_strg_i (p->table, "image");
-	       alias = strrchr (label, '/');
-	       if (alias)
-		    label = alias + 1;
-	  }
+     ctx->printl_count = 0;
+     for (p = ctx->images; p; p = p->next) {
+	  label = p->label;
+	  if (!label)
+	       continue;
 	  if(!strcmp(ret,label))
 	       defflag=1;
 	  else
 	       defflag=0;
-	  alias = cfg_get_strg_i (p->table, "alias");
-	  printlabel (label, defflag);
+	  alias = cfg_get_strg_i (ctx, p->table, "alias");
+	  printlabel (ctx, label, defflag);
 	  if (alias)
-	       printlabel (alias, 0);
+	       printlabel (ctx, alias, 0);
      }
      prom_printf("\n");
 }
 
-char *cfg_get_default (void)
+char *cfg_get_default (struct cfg_context *ctx)
 {
-     char *label;
-     char *ret = cfg_get_strg_i (cf_options, "default");
+     char *ret = cfg_get_strg_i (ctx, ctx->options, "default");
 
      if (ret)
 	  return ret;
-     if (!images)
+     if (!ctx->images)
 	  return 0;
-     ret = cfg_get_strg_i (images->table, "label");
-     if (!ret) {
-	  ret = cfg_get_strg_i (images->table, "image");
-	  label = strrchr (ret, '/');
-	  if (label)
-	       ret = label + 1;
-     }
-     return ret;
+     return ctx->images->label;
 }
 
-char *cfg_next_image(char *prev)
+char *cfg_next_image(struct cfg_context *ctx, char *prev)
 {
      struct IMAGES *p;
-     char *label, *alias;
-     int wantnext = 0;
 
      if (!prev)
-	  wantnext = 1;
-
-     for (p = images; p; p = p->next) {
-	  label = cfg_get_strg_i (p->table, "label");
-	  if (!label) {
-	       label = cfg_get_strg_i (p->table, "image");
-	       alias = strrchr (label, '/');
-	       if (alias)
-		    label = alias + 1;
-	  }
-	  if (wantnext)
-	       return label;
-	  if (!strcmp(prev, label))
-	       wantnext = 1;
+	  p = ctx->images;
+     else if (ctx->last_next_image && ctx->last_next_image->label == prev)
+	  /* the usual case, of walking through the images in order */
+	  p = ctx->last_next_image->next;
+     else {
+	  for (p = ctx->images; p; p = p->next)
+	       if (p->label && !strcmp(prev, p->label))
+		    break;
+	  if (p)
+	       p = p->next;
      }
-     return NULL;
+
+     /* skip any images without a name */
+     while (p && !p->label)
+	  p = p->next;
+
+     ctx->last_next_image = p;
+     return p ? p->label : NULL;
 }
 /* 
  * Local variables:
@@ -21,10 +21,18 @@
 #ifndef CFG_H
 #define CFG_H
 
-extern int	cfg_parse(char *cfg_file, char *buff, int len);
-extern char*	cfg_get_strg(char *image, char *item);
-extern int	cfg_get_flag(char *image, char *item);
-extern void	cfg_print_images(void);
-extern char*	cfg_get_default(void);
-extern char*	cfg_next_image(char *);
+/* the state of one parse; the strings returned by the cfg_get_* functions
+ * belong to the context */
+struct cfg_context;
+
+extern struct cfg_context *cfg_context_create(void);
+extern void	cfg_context_free(struct cfg_context *ctx);
+
+extern int	cfg_parse(struct cfg_context *ctx, char *cfg_file, char *buff,
+			int len);
+extern char*	cfg_get_strg(struct cfg_context *ctx, char *image, char *item);
+extern int	cfg_get_flag(struct cfg_context *ctx, char *image, char *item);
+extern void	cfg_print_images(struct cfg_context *ctx);
+extern char*	cfg_get_default(struct cfg_context *ctx);
+extern char*	cfg_next_image(struct cfg_context *ctx, char *);
 #endif
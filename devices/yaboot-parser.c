@@ -7,229 +7,249 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <unistd.h>
-#include <fcntl.h>
 #include <ctype.h>
 #include <sys/param.h>
 
-static struct device *dev;
-static char *devpath;
-static char *defimage;
+/* the state of one parse of a yaboot.conf */
+struct yaboot_state {
+	struct parser_context *ctx;
+	struct cfg_context *cfg;
+	struct device *dev;
+	const char *devpath;
+	char *defimage;
+};
+
+/* one "prefix" "value" part of a kernel command line */
+struct param_part {
+	const char *prefix;
+	const char *value;
+};
 
-char *
-make_params(char *label, char *params)
+/* join @parts into a new string, each followed by a space, then @params */
+static char *join_params(struct arena *arena, const struct param_part *parts,
+		int n_parts, const char *params)
 {
-     char *p, *q;
-     static char buffer[2048];
+	char *buffer, *q;
+	size_t len = 1;
+	int i;
+
+	for (i = 0; i < n_parts; i++)
+		len += strlen(parts[i].prefix) + strlen(parts[i].value) + 1;
+	if (params)
+		len += strlen(params);
+
+	q = buffer = arena_alloc(arena, len);
+	if (!buffer)
+		return NULL;
+
+	for (i = 0; i < n_parts; i++) {
+		q = stpcpy(q, parts[i].prefix);
+		q = stpcpy(q, parts[i].value);
+		*q++ = ' ';
+	}
+	*q = 0;
+	if (params)
+		strcpy(q, params);
 
-     q = buffer;
-     *q = 0;
+	return buffer;
+}
 
-     p = cfg_get_strg(label, "literal");
+/* build the kernel command line for @label, in the parse's arena */
+static char *
+make_params(struct yaboot_state *state, char *label, char *params)
+{
+     struct arena *arena = &state->ctx->arena;
+     struct cfg_context *cfg = state->cfg;
+     struct param_part parts[7];
+     int n = 0;
+     char *p;
+
+     p = cfg_get_strg(cfg, label, "literal");
      if (p) {
-          strcpy(q, p);
-          q = strchr(q, 0);
-          if (params) {
-               if (*p)
-                    *q++ = ' ';
-               strcpy(q, params);
-          }
-          return buffer;
+          parts[0].prefix = "";
+          parts[0].value = p;
+          if (!params)
+               return arena_strdup(arena, p);
+          if (!*p)
+               return arena_strdup(arena, params);
+          /* the separating space comes from join_params */
+          return join_params(arena, parts, 1, params);
      }
 
-     p = cfg_get_strg(label, "root");
+     p = cfg_get_strg(cfg, label, "root");
      if (p) {
-          strcpy (q, "root=");
-          strcpy (q + 5, p);
-          q = strchr (q, 0);
-          *q++ = ' ';
+          parts[n].prefix = "root=";
+          parts[n++].value = p;
      }
-     if (cfg_get_flag(label, "read-only")) {
-          strcpy (q, "ro ");
-          q += 3;
+     if (cfg_get_flag(cfg, label, "read-only")) {
+          parts[n].prefix = "ro";
+          parts[n++].value = "";
      }
-     if (cfg_get_flag(label, "read-write")) {
-          strcpy (q, "rw ");
-          q += 3;
+     if (cfg_get_flag(cfg, label, "read-write")) {
+          parts[n].prefix = "rw";
+          parts[n++].value = "";
      }
-     p = cfg_get_strg(label, "ramdisk");
+     p = cfg_get_strg(cfg, label, "ramdisk");
      if (p) {
-          strcpy (q, "ramdisk=");
-          strcpy (q + 8, p);
-          q = strchr (q, 0);
-          *q++ = ' ';
+          parts[n].prefix = "ramdisk=";
+          parts[n++].value = p;
      }
-     p = cfg_get_strg(label, "initrd-size");
+     p = cfg_get_strg(cfg, label, "initrd-size");
      if (p) {
-          strcpy (q, "ramdisk_size=");
-          strcpy (q + 13, p);
-          q = strchr (q, 0);
-          *q++ = ' ';
+          parts[n].prefix = "ramdisk_size=";
+          parts[n++].value = p;
      }
-     if (cfg_get_flag(label, "novideo")) {
-          strcpy (q, "video=ofonly");
-          q = strchr (q, 0);
-          *q++ = ' ';
+     if (cfg_get_flag(cfg, label, "novideo")) {
+          parts[n].prefix = "video=ofonly";
+          parts[n++].value = "";
      }
-     p = cfg_get_strg (label, "append");
+     p = cfg_get_strg (cfg, label, "append");
      if (p) {
-          strcpy (q, p);
-          q = strchr (q, 0);
-          *q++ = ' ';
+          parts[n].prefix = "";
+          parts[n++].value = p;
      }
-     *q = 0;
-     if (params)
-          strcpy(q, params);
 
-     return buffer;
+     return join_params(arena, parts, n, params);
 }
 
-static int check_and_add_device(struct device *dev)
+static int check_and_add_device(struct parser_context *ctx,
+		struct device *dev)
 {
 	if (!dev->icon_file)
-		dev->icon_file = strdup(generic_icon_file(guess_device_type()));
+		dev->icon_file = arena_strdup(&ctx->arena,
+				generic_icon_file(guess_device_type()));
 
-	return !add_device(dev);
+	return !add_device(ctx, dev);
 }
 
-void process_image(char *label)
+static void process_image(struct yaboot_state *state, char *label)
 {
+	struct arena *arena = &state->ctx->arena;
 	struct boot_option opt;
 	char *cfgopt;
 
 	memset(&opt, 0, sizeof(opt));
 
 	opt.name = label;
-	cfgopt = cfg_get_strg(label, "image");
-	opt.boot_image_file = resolve_path(cfgopt, devpath);
-	if (cfgopt == defimage)
+	cfgopt = cfg_get_strg(state->cfg, label, "image");
+	opt.boot_image_file = resolve_path_arena(arena, cfgopt,
+			state->devpath);
+	if (cfgopt == state->defimage)
 		pb_log("This one is default. What do we do about it?\n");
 
-	cfgopt = cfg_get_strg(label, "initrd");
+	cfgopt = cfg_get_strg(state->cfg, label, "initrd");
 	if (cfgopt)
-		opt.initrd_file = resolve_path(cfgopt, devpath);
-
-	opt.boot_args = make_params(label, NULL);
+		opt.initrd_file = resolve_path_arena(arena, cfgopt,
+				state->devpath);
 
-	add_boot_option(&opt);
+	opt.boot_args = make_params(state, label, NULL);
 
-	if (opt.initrd_file)
-		free(opt.initrd_file);
+	add_boot_option(state->ctx, &opt);
 }
 
-static int yaboot_parse(const char *device)
+static int yaboot_parse(struct parser_context *ctx)
 {
+	struct arena *arena = &ctx->arena;
+	struct yaboot_state state;
+	struct config_file file;
 	char *filepath;
-	char *conf_file;
 	char *tmpstr;
-	ssize_t conf_len;
-	int fd;
-	struct stat st;
+	int rc = 0;
 	char *label;
 
-	devpath = strdup(device);
+	memset(&state, 0, sizeof(state));
+	state.ctx = ctx;
+	state.devpath = ctx->device_path;
 
-	filepath = resolve_path("/etc/yaboot.conf", devpath);
+	filepath = resolve_path_arena(arena, ctx->filename, state.devpath);
 
-	fd = open(filepath, O_RDONLY);
-	if (fd < 0) {
-		free(filepath);
-		filepath = resolve_path("/yaboot.conf", devpath);
-		fd = open(filepath, O_RDONLY);
-		
-		if (fd < 0)
-			return 0;
-	}
-
-	if (fstat(fd, &st)) {
-		close(fd);
+	if (!filepath || load_config_file(ctx, filepath, 0, &file))
 		return 0;
-	}
 
-	conf_file = malloc(st.st_size+1);
-	if (!conf_file) {
-		close(fd);
-		return 0;
-	}
-	
-	conf_len = read(fd, conf_file, st.st_size);
-	if (conf_len < 0) {
-		close(fd);
-		return 0;
-	}
-	conf_file[conf_len] = 0;
+	state.cfg = cfg_context_create();
+	if (!state.cfg)
+		goto out_free_conf;
 
-	close(fd);
-	
-	if (cfg_parse(filepath, conf_file, conf_len)) {
+	if (cfg_parse(state.cfg, filepath, file.buf, file.len)) {
 		pb_log("Error parsing yaboot.conf\n");
-		return 0;
+		goto out_free_conf;
 	}
 
-	free(filepath);
-
-	dev = malloc(sizeof(*dev));
-	memset(dev, 0, sizeof(*dev));
-	dev->id = strdup(devpath);
-	if (cfg_get_strg(0, "init-message")) {
+	state.dev = arena_alloc(arena, sizeof(*state.dev));
+	if (!state.dev)
+		goto out_free_conf;
+	state.dev->id = arena_strdup(arena, state.devpath);
+	if (cfg_get_strg(state.cfg, 0, "init-message")) {
 		char *newline;
-		dev->description = strdup(cfg_get_strg(0, "init-message"));
-		newline = strchr(dev->description, '\n');
+		state.dev->description = arena_strdup(arena,
+				cfg_get_strg(state.cfg, 0, "init-message"));
+		newline = strchr(state.dev->description, '\n');
 		if (newline)
 			*newline = 0;
 	}
-	dev->icon_file = strdup(generic_icon_file(guess_device_type()));
+	state.dev->icon_file = arena_strdup(arena,
+			generic_icon_file(guess_device_type()));
 
 	/* If we have a 'partiton=' directive, update the default devpath
 	 * to use that instead of the current device */
-	tmpstr = cfg_get_strg(0, "partition");
+	tmpstr = cfg_get_strg(state.cfg, 0, "partition");
 	if (tmpstr) {
 		char *endp;
 		int partnr = strtol(tmpstr, &endp, 10);
 		if (endp != tmpstr && !*endp) {
 			char *new_dev, *tmp;
 
-			new_dev = malloc(strlen(devpath) + strlen(tmpstr) + 1);
+			new_dev = arena_alloc(arena, strlen(state.devpath) +
+					strlen(tmpstr) + 1);
 			if (!new_dev)
-				return 0;
+				goto out_free_conf;
 
-			strcpy(new_dev, devpath);
+			strcpy(new_dev, state.devpath);
 
 			/* Strip digits (partition number) from string */
-			endp = new_dev + strlen(devpath) - 1;
+			endp = new_dev + strlen(state.devpath) - 1;
 			while (isdigit(*endp))
 				*(endp--) = 0;
 
 			/* and add our own... */
 			sprintf(endp + 1, "%d", partnr);
 
-			tmp = devpath;
-			devpath = parse_device_path(new_dev, devpath);
+			tmp = parse_device_path(new_dev, state.devpath);
+			state.devpath = arena_strdup(arena, tmp);
 			free(tmp);
-			free(new_dev);
 		}
 	}
 
-	defimage = cfg_get_default();
-	if (!defimage)
-		return 0;
-	defimage = cfg_get_strg(defimage, "image");
+	state.defimage = cfg_get_default(state.cfg);
+	if (!state.defimage)
+		goto out_free_conf;
+	state.defimage = cfg_get_strg(state.cfg, state.defimage, "image");
 
-	label = cfg_next_image(NULL);
-	if (!label || !check_and_add_device(dev))
-		return 0;
+	label = cfg_next_image(state.cfg, NULL);
+	if (!label || !check_and_add_device(ctx, state.dev))
+		goto out_free_conf;
 
 	do {
-		process_image(label);
-	} while ((label = cfg_next_image(label)));
+		process_image(&state, label);
+	} while ((label = cfg_next_image(state.cfg, label)));
+
+	rc = 1;
 
-	return 1;
+out_free_conf:
+	cfg_context_free(state.cfg);
+	release_config_file(&file);
+	return rc;
 }
 
+static const char *const yaboot_conf_files[] = {
+	"/etc/yaboot.conf",
+	"/yaboot.conf",
+	NULL,
+};
+
 struct parser yaboot_parser = {
 	.name = "yaboot.conf parser",
 	.priority = 99,
+	.filenames = yaboot_conf_files,
 	.parse	  = yaboot_parse
 };
@@ -0,0 +1,421 @@
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <libtwin/twin_png.h>
+#include "petitboot.h"
+#include "petitboot-paths.h"
+#include "icon-cache.h"
+#include "artwork.h"
+
+/* icons with no users are kept, for devices and options that come back,
+ * up to this many bytes; the least recently used go first */
+#define ICON_CACHE_MAX_UNUSED	(1024 * 1024)
+
+enum icon_state {
+	ICON_PENDING,	/* queued for, or being decoded by, the worker */
+	ICON_READY,
+	ICON_FAILED,	/* couldn't be decoded; not retried until it changes */
+};
+
+struct icon {
+	/* the file's identity */
+	dev_t		dev;
+	ino_t		ino;
+	off_t		size;
+	time_t		mtime;
+
+	/* the path that it was first loaded from */
+	char		*path;
+
+	enum icon_state	state;
+	twin_pixmap_t	*pixmap;
+	unsigned long	bytes;
+
+	unsigned int	refs;
+	unsigned long	last_used;
+
+	struct icon	*next;
+
+	/* for the worker: the next icon in the decode or done queue */
+	struct icon	*next_job;
+};
+
+static struct icon *icons;
+static struct icon *placeholder;
+static void (*ready_cb)(struct icon *icon);
+
+/*
+ * The worker takes icons from the decode queue, and puts them on the done
+ * queue once they are decoded, with a byte written to done_pipe to wake
+ * up the dispatch loop. Only the queues are shared with the worker: it
+ * doesn't touch anything else in a queued icon but the path, which never
+ * changes, and the pixmap, which nothing else looks at until the icon is
+ * done. Pending icons are never freed.
+ */
+static struct {
+	pthread_t	thread;
+	int		started;	/* 1 if running, -1 if it failed */
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	struct icon	*decode, **decode_tail;
+	struct icon	*done;
+	int		done_pipe[2];
+} worker = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.decode_tail = &worker.decode,
+	.done_pipe = { -1, -1 },
+};
+
+static struct {
+	unsigned long	lookups;
+	unsigned long	hits;
+	unsigned long	decodes;
+	unsigned int	n_icons;
+	unsigned long	bytes;
+	unsigned long	unused_bytes;
+	unsigned long	clock;
+} stats;
+
+static struct icon *find_icon(const struct stat *statbuf)
+{
+	struct icon *icon;
+
+	for (icon = icons; icon; icon = icon->next)
+		if (icon->dev == statbuf->st_dev &&
+				icon->ino == statbuf->st_ino &&
+				icon->size == statbuf->st_size &&
+				icon->mtime == statbuf->st_mtime)
+			return icon;
+
+	return NULL;
+}
+
+static void free_icon(struct icon *icon)
+{
+	struct icon **p;
+
+	for (p = &icons; *p; p = &(*p)->next) {
+		if (*p == icon) {
+			*p = icon->next;
+			break;
+		}
+	}
+
+	stats.n_icons--;
+	stats.bytes -= icon->bytes;
+	stats.unused_bytes -= icon->bytes;
+
+	if (icon->pixmap)
+		twin_pixmap_destroy(icon->pixmap);
+	free(icon->path);
+	free(icon);
+}
+
+/* drop unused icons until we're within ICON_CACHE_MAX_UNUSED */
+static void evict(void)
+{
+	struct icon *icon, *lru;
+
+	while (stats.unused_bytes > ICON_CACHE_MAX_UNUSED) {
+		lru = NULL;
+		for (icon = icons; icon; icon = icon->next)
+			if (!icon->refs && icon->bytes &&
+					(!lru || icon->last_used <
+						lru->last_used))
+				lru = icon;
+
+		if (!lru)
+			break;
+
+		LOG("dropping icon %s\n", lru->path);
+		free_icon(lru);
+	}
+}
+
+/* decode an icon that isn't shared with the worker */
+static void decode_icon(struct icon *icon)
+{
+	icon->pixmap = twin_png_to_pixmap(icon->path, TWIN_ARGB32);
+}
+
+/* the default icons are in the artwork bundle, already decoded. They
+ * take no memory of ours, so they are never evicted */
+static int bundled_icon(struct icon *icon)
+{
+	static const char dir[] = artwork_pathname("");
+
+	if (strncmp(icon->path, dir, sizeof(dir) - 1))
+		return 0;
+
+	icon->pixmap = artwork_get(icon->path + sizeof(dir) - 1, NULL, NULL);
+	if (!icon->pixmap)
+		return 0;
+
+	LOG("using bundled icon %s\n", icon->path);
+	icon->state = ICON_READY;
+	return 1;
+}
+
+/* account for an icon that has been decoded */
+static void finish_icon(struct icon *icon)
+{
+	LOG("loaded icon %s: %s\n", icon->path,
+			icon->pixmap ? "ok" : "failed");
+
+	stats.decodes++;
+
+	if (!icon->pixmap) {
+		icon->state = ICON_FAILED;
+		return;
+	}
+
+	icon->state = ICON_READY;
+	icon->bytes = (unsigned long)icon->pixmap->stride *
+		icon->pixmap->height;
+	stats.bytes += icon->bytes;
+	if (!icon->refs)
+		stats.unused_bytes += icon->bytes;
+}
+
+static void *worker_thread(void *arg)
+{
+	struct icon *icon;
+	char c = 0;
+
+	pthread_mutex_lock(&worker.lock);
+
+	for (;;) {
+		while (!worker.decode)
+			pthread_cond_wait(&worker.cond, &worker.lock);
+
+		icon = worker.decode;
+		worker.decode = icon->next_job;
+		if (!worker.decode)
+			worker.decode_tail = &worker.decode;
+
+		pthread_mutex_unlock(&worker.lock);
+		decode_icon(icon);
+		pthread_mutex_lock(&worker.lock);
+
+		icon->next_job = worker.done;
+		worker.done = icon;
+
+		/* the dispatch loop drains the pipe, so this won't block
+		 * for long; if the pipe is full, it's already awake */
+		if (write(worker.done_pipe[1], &c, 1) < 0 && errno != EAGAIN)
+			LOG("can't wake up the icon loader: %s\n",
+					strerror(errno));
+	}
+
+	return NULL;
+}
+
+/* called from the dispatch loop when the worker has finished icons */
+static twin_bool_t icons_done(int fd, twin_file_op_t ops, void *closure)
+{
+	struct icon *icon, *done;
+	char buf[64];
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+
+	pthread_mutex_lock(&worker.lock);
+	done = worker.done;
+	worker.done = NULL;
+	pthread_mutex_unlock(&worker.lock);
+
+	while (done) {
+		icon = done;
+		done = icon->next_job;
+
+		finish_icon(icon);
+
+		/* nobody needs to redraw an icon that they don't use, or
+		 * one that still looks like the placeholder */
+		if (icon->refs && icon->state == ICON_READY && ready_cb)
+			ready_cb(icon);
+	}
+
+	evict();
+	icon_cache_log_stats();
+
+	return TWIN_TRUE;
+}
+
+static int start_worker(void)
+{
+	if (pipe2(worker.done_pipe, O_NONBLOCK | O_CLOEXEC)) {
+		LOG("can't create icon loader pipe: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (pthread_create(&worker.thread, NULL, worker_thread, NULL)) {
+		LOG("can't start icon loader thread\n");
+		close(worker.done_pipe[0]);
+		close(worker.done_pipe[1]);
+		return -1;
+	}
+
+	twin_set_file(icons_done, worker.done_pipe[0], TWIN_READ, NULL);
+	return 0;
+}
+
+static struct icon *new_icon(const char *path, const struct stat *statbuf)
+{
+	struct icon *icon;
+
+	icon = calloc(1, sizeof(*icon));
+	if (!icon)
+		return NULL;
+
+	icon->path = strdup(path);
+	if (!icon->path) {
+		free(icon);
+		return NULL;
+	}
+
+	icon->dev = statbuf->st_dev;
+	icon->ino = statbuf->st_ino;
+	icon->size = statbuf->st_size;
+	icon->mtime = statbuf->st_mtime;
+	icon->state = ICON_PENDING;
+
+	icon->next = icons;
+	icons = icon;
+	stats.n_icons++;
+
+	if (bundled_icon(icon))
+		return icon;
+
+	/* without a worker, decode it here */
+	if (!worker.started)
+		worker.started = start_worker() ? -1 : 1;
+
+	if (worker.started < 0) {
+		decode_icon(icon);
+		finish_icon(icon);
+		return icon;
+	}
+
+	pthread_mutex_lock(&worker.lock);
+	*worker.decode_tail = icon;
+	worker.decode_tail = &icon->next_job;
+	pthread_cond_signal(&worker.cond);
+	pthread_mutex_unlock(&worker.lock);
+
+	return icon;
+}
+
+struct icon *icon_cache_get(const char *path)
+{
+	struct stat statbuf;
+	struct icon *icon;
+
+	stats.lookups++;
+
+	if (stat(path, &statbuf) || !S_ISREG(statbuf.st_mode))
+		return NULL;
+
+	icon = find_icon(&statbuf);
+	if (icon)
+		stats.hits++;
+	else
+		icon = new_icon(path, &statbuf);
+
+	if (!icon)
+		return NULL;
+
+	if (!icon->refs++)
+		stats.unused_bytes -= icon->bytes;
+
+	return icon;
+}
+
+void icon_cache_put(struct icon *icon)
+{
+	if (!icon)
+		return;
+
+	if (!icon->refs) {
+		LOG("icon_cache_put: %s has no references\n", icon->path);
+		return;
+	}
+
+	if (--icon->refs)
+		return;
+
+	icon->last_used = ++stats.clock;
+	stats.unused_bytes += icon->bytes;
+	evict();
+}
+
+twin_pixmap_t *icon_cache_pixmap(const struct icon *icon)
+{
+	if (icon && icon->state == ICON_READY)
+		return icon->pixmap;
+
+	return placeholder && placeholder->state == ICON_READY ?
+		placeholder->pixmap : NULL;
+}
+
+void icon_cache_init(const char *placeholder_path,
+		void (*ready)(struct icon *icon))
+{
+	struct stat statbuf;
+
+	ready_cb = ready;
+
+	/* the placeholder is needed straight away, so it's the one icon
+	 * that we decode here. We keep a reference to it for good */
+	if (stat(placeholder_path, &statbuf)) {
+		LOG("no placeholder icon %s\n", placeholder_path);
+		return;
+	}
+
+	placeholder = calloc(1, sizeof(*placeholder));
+	if (!placeholder)
+		return;
+
+	placeholder->path = strdup(placeholder_path);
+	if (!placeholder->path) {
+		free(placeholder);
+		placeholder = NULL;
+		return;
+	}
+
+	placeholder->dev = statbuf.st_dev;
+	placeholder->ino = statbuf.st_ino;
+	placeholder->size = statbuf.st_size;
+	placeholder->mtime = statbuf.st_mtime;
+	placeholder->refs = 1;
+
+	if (!bundled_icon(placeholder)) {
+		decode_icon(placeholder);
+		finish_icon(placeholder);
+	}
+
+	placeholder->next = icons;
+	icons = placeholder;
+	stats.n_icons++;
+}
+
+void icon_cache_log_stats(void)
+{
+	LOG("icon cache: %u icons, %lu KiB (%lu KiB unused), "
+			"%lu of %lu lookups hit (%lu%%), %lu decodes\n",
+			stats.n_icons, stats.bytes / 1024,
+			stats.unused_bytes / 1024, stats.hits, stats.lookups,
+			stats.lookups ? stats.hits * 100 / stats.lookups : 0,
+			stats.decodes);
+}
@@ -0,0 +1,55 @@
+#ifndef _ICON_CACHE_H
+#define _ICON_CACHE_H
+
+#include <libtwin/twin.h>
+
+/*
+ * Decoded icons, shared between every device and option that uses the
+ * same file. Icons are found by file identity (device, inode, size and
+ * mtime), so each distinct file is only decoded once, whatever path it is
+ * reached by, and an icon that is replaced on disk is decoded again.
+ *
+ * Icons are decoded on a worker thread, so that a large icon doesn't hold
+ * up the UI. Until an icon has been decoded, or if it can't be, it is
+ * drawn with the placeholder given to icon_cache_init(); once it has, the
+ * ready callback is called from the twin dispatch loop, so the GUI can
+ * redraw whatever uses it. The default icons, in the artwork directory,
+ * come already decoded from the artwork bundle, if it has them.
+ *
+ * Each icon_cache_get() takes a reference to the icon, which must be
+ * dropped with icon_cache_put() once it is no longer drawn. The pixmaps
+ * are shared, so they must never be drawn into.
+ */
+
+struct icon;
+
+/**
+ * Set up the cache. The icon at @placeholder_path is decoded straight
+ * away, to stand in for the others until they are ready.
+ */
+void icon_cache_init(const char *placeholder_path,
+		void (*ready)(struct icon *icon));
+
+/**
+ * Get the icon for the PNG at @path, starting to decode it if it isn't
+ * already. Returns NULL if the file doesn't exist.
+ */
+struct icon *icon_cache_get(const char *path);
+
+/**
+ * Drop a reference taken by icon_cache_get(). @icon may be NULL.
+ */
+void icon_cache_put(struct icon *icon);
+
+/**
+ * The pixmap to draw for @icon: its own once it has been decoded, and the
+ * placeholder until then. May return NULL if there is no placeholder.
+ */
+twin_pixmap_t *icon_cache_pixmap(const struct icon *icon);
+
+/**
+ * Log the number of icons held, their memory use, and the hit rate.
+ */
+void icon_cache_log_stats(void);
+
+#endif /* _ICON_CACHE_H */
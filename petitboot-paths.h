@@ -14,6 +14,9 @@
 #endif
 
 #define PBOOT_DEVICE_SOCKET "/var/tmp/petitboot-dev"
+#define PBOOT_STATE_DIR "/var/tmp/petitboot-state/"
+#define PBOOT_PARSER_USER "nobody"
+#define PBOOT_DISCOVER_BIN PREFIX "/sbin/petitboot-discover"
 #define MOUNT_BIN "/bin/mount"
 #define UMOUNT_BIN "/bin/umount"
 #define BOOT_GAMEOS_BIN "/usr/bin/ps3-boot-game-os"
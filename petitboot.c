@@ -23,6 +23,8 @@
 
 #include "petitboot.h"
 #include "petitboot-paths.h"
+#include "icon-cache.h"
+#include "artwork.h"
 
 #ifdef _USE_X11
 #include <libtwin/twin_x11.h>
@@ -77,9 +79,16 @@ static twin_screen_t *pboot_screen;
 
 #define PBOOT_RIGHT_TITLE_COLOR		0xff000000
 #define PBOOT_RIGHT_SUBTITLE_COLOR	0xff400000
+#define PBOOT_RIGHT_BROKEN_COLOR	0xff808080
+#define PBOOT_RIGHT_BROKEN_ALPHA	0x60
 
 #define PBOOT_FOCUS_COLOR		0x10404040
 
+/* the focus box takes the same time to reach its target, however far it
+ * is, and is redrawn at most once a frame on the way */
+#define PBOOT_FOCUS_MOVE_TIME		150	/* ms */
+#define PBOOT_FRAME_TIME		16	/* ms */
+
 #define PBOOT_STATUS_PANE_COLOR		0x60606060
 #define PBOOT_STATUS_PANE_HEIGHT	20
 #define PBOOT_STATUS_PANE_XYMARGIN	20
@@ -92,18 +101,20 @@ typedef struct _pboot_device pboot_device_t;
 
 struct _pboot_option
 {
+	char		*id;
 	char		*title;
 	char		*subtitle;
-	twin_pixmap_t	*badge;
+	struct icon	*badge;
 	twin_pixmap_t	*cache;
 	twin_rect_t	box;
+	twin_bool_t	broken;
 	void		*data;
 };
 
 struct _pboot_device
 {
 	char			*id;
-	twin_pixmap_t		*badge;
+	struct icon		*badge;
 	twin_rect_t		box;
 	int			option_count;
 	pboot_option_t		options[PBOOT_MAX_OPTION];
@@ -123,6 +134,8 @@ typedef struct _pboot_lpane {
 	twin_rect_t	focus_box;
 	int		focus_start;
 	int		focus_target;
+	twin_time_t	focus_time;	/* when it left focus_start */
+	int		focus_moving;
 	int		focus_curindex;
 	int		mouse_target;
 } pboot_lpane_t;
@@ -132,6 +145,8 @@ typedef struct _pboot_rpane {
 	twin_rect_t	focus_box;
 	int		focus_start;
 	int		focus_target;
+	twin_time_t	focus_time;	/* when it left focus_start */
+	int		focus_moving;
 	int		focus_curindex;
 	int		mouse_target;
 } pboot_rpane_t;
@@ -184,9 +199,19 @@ static inline twin_bool_t twin_rect_intersect(twin_rect_t r1,
 static void pboot_draw_option_cache(pboot_device_t *dev, pboot_option_t *opt,
 				    int index)
 {
-	twin_pixmap_t	*px;
+	twin_pixmap_t	*px, *badge;
 	twin_path_t	*path;
 	twin_fixed_t	tx, ty;
+	twin_argb32_t	title_color, subtitle_color;
+
+	/* options that can't be booted are greyed out */
+	if (opt->broken) {
+		title_color = PBOOT_RIGHT_BROKEN_COLOR;
+		subtitle_color = PBOOT_RIGHT_BROKEN_COLOR;
+	} else {
+		title_color = PBOOT_RIGHT_TITLE_COLOR;
+		subtitle_color = PBOOT_RIGHT_SUBTITLE_COLOR;
+	}
 
 	/* Create pixmap */
 	px = twin_pixmap_create(TWIN_ARGB32, opt->box.right - opt->box.left,
@@ -219,7 +244,7 @@ static void pboot_draw_option_cache(pboot_device_t *dev, pboot_option_t *opt,
 	ty = twin_int_to_fixed(PBOOT_RIGHT_TITLE_YOFFSET);
 	twin_path_move (path, tx, ty);
 	twin_path_utf8 (path, opt->title);
-	twin_paint_path (px, PBOOT_RIGHT_TITLE_COLOR, path);
+	twin_paint_path (px, title_color, path);
 	twin_path_empty (path);
 
 	if (opt->subtitle) {
@@ -229,20 +254,23 @@ static void pboot_draw_option_cache(pboot_device_t *dev, pboot_option_t *opt,
 		ty = twin_int_to_fixed(PBOOT_RIGHT_SUBTITLE_YOFFSET);
 		twin_path_move (path, tx, ty);
 		twin_path_utf8 (path, opt->subtitle);
-		twin_paint_path (px, PBOOT_RIGHT_SUBTITLE_COLOR, path);
+		twin_paint_path (px, subtitle_color, path);
 		twin_path_empty (path);
 	}
 
-	if (opt->badge) {
-		twin_operand_t	src;
+	badge = icon_cache_pixmap(opt->badge);
+	if (badge) {
+		twin_operand_t	src, msk;
 
 		src.source_kind = TWIN_PIXMAP;
-		src.u.pixmap = opt->badge;
+		src.u.pixmap = badge;
+		msk.source_kind = TWIN_SOLID;
+		msk.u.argb = PBOOT_RIGHT_BROKEN_ALPHA << 24;
 
 		twin_composite(px, PBOOT_RIGHT_BADGE_XOFFSET,
 			       PBOOT_RIGHT_BADGE_YOFFSET,
-			       &src, 0, 0, NULL, 0, 0, TWIN_OVER,
-			       opt->badge->width, opt->badge->height);
+			       &src, 0, 0, opt->broken ? &msk : NULL, 0, 0,
+			       TWIN_OVER, badge->width, badge->height);
 	}
 
 
@@ -315,39 +343,110 @@ static void pboot_rpane_draw(twin_window_t *window)
 	twin_path_destroy(path);
 }
 
-static twin_time_t pboot_rfocus_timeout (twin_time_t now, void *closure)
+static void pboot_set_device_select(int sel, int force)
+{
+	LOG("%s: %d -> %d\n", __FUNCTION__, pboot_dev_sel, sel);
+	if (!force && sel == pboot_dev_sel)
+		return;
+	if (sel >= pboot_dev_count)
+		return;
+	pboot_dev_sel = sel;
+	if (force) {
+		pboot_lpane->focus_curindex = sel;
+		if (sel < 0)
+			pboot_lpane->focus_target = 0 - PBOOT_LEFT_FOCUS_HEIGHT;
+		else
+			pboot_lpane->focus_target = PBOOT_LEFT_FOCUS_YOFF +
+				PBOOT_LEFT_ICON_STRIDE * sel;
+		pboot_rpane->focus_box.bottom = pboot_lpane->focus_target;
+		pboot_rpane->focus_box.bottom = pboot_rpane->focus_box.top +
+			PBOOT_RIGHT_FOCUS_HEIGHT;
+		twin_window_damage(pboot_lpane->window,
+				   0, 0,
+				   pboot_lpane->window->pixmap->width,
+				   pboot_lpane->window->pixmap->height);
+		twin_window_queue_paint(pboot_lpane->window);
+	}
+	pboot_rpane->focus_curindex = -1;
+	pboot_rpane->focus_moving = 0;
+	pboot_rpane->mouse_target = -1;
+	pboot_rpane->focus_box.top = -2*PBOOT_RIGHT_FOCUS_HEIGHT;
+	pboot_rpane->focus_box.bottom = pboot_rpane->focus_box.top +
+		PBOOT_RIGHT_FOCUS_HEIGHT;
+	twin_window_damage(pboot_rpane->window, 0, 0,
+			   pboot_rpane->window->pixmap->width,
+			   pboot_rpane->window->pixmap->height);
+	twin_window_queue_paint(pboot_rpane->window);
+}
+
+/*
+ * Move a focus box to where it should be @elapsed ms after it left @start
+ * for @target, and damage the old and new positions as one rectangle.
+ * Returns whether it has yet to arrive.
+ */
+static int pboot_move_focus(twin_window_t *window, twin_rect_t *box,
+			    int start, int target, twin_time_t elapsed)
 {
-	int dir = 1, dist, pos;
-	const int accel[11] = { 7, 4, 2, 1, 1, 1, 1, 1, 2, 2, 3 };
+	twin_coord_t	top, height;
+	long long	t;
 
-	dist = abs(pboot_rpane->focus_target - pboot_rpane->focus_start);
-	dir = dist > 5 ? 5 : dist;
-	pos = pboot_rpane->focus_target - (int)pboot_rpane->focus_box.top;
-	if (pos == 0) {
-		return -1;
+	if (elapsed >= PBOOT_FOCUS_MOVE_TIME)
+		top = target;
+	else {
+		/* ease in and out, much as the old per-pixel delays did */
+		t = elapsed * 1024 / PBOOT_FOCUS_MOVE_TIME;
+		t = t * t * (3 * 1024 - 2 * t) / (1024 * 1024);
+		top = start + (target - start) * t / 1024;
 	}
-	if (pos < 0) {
-		dir = -dir;
-		pos = -pos;
+
+	if (top == box->top)
+		return top != target;
+
+	height = box->bottom - box->top;
+	twin_window_damage(window, box->left,
+			   top < box->top ? top : box->top,
+			   box->right,
+			   (top > box->top ? top : box->top) + height);
+	twin_window_queue_paint(window);
+
+	box->top = top;
+	box->bottom = top + height;
+
+	return top != target;
+}
+
+static twin_timeout_t	*pboot_frame_clock;
+
+/* one frame of every focus animation; the clock stops once none are left */
+static twin_time_t pboot_frame(twin_time_t now, void *closure)
+{
+	if (pboot_lpane->focus_moving &&
+	    !pboot_move_focus(pboot_lpane->window, &pboot_lpane->focus_box,
+			      pboot_lpane->focus_start,
+			      pboot_lpane->focus_target,
+			      now - pboot_lpane->focus_time)) {
+		pboot_lpane->focus_moving = 0;
+		pboot_set_device_select(pboot_lpane->focus_curindex, 0);
 	}
-	twin_window_damage(pboot_rpane->window,
-			   pboot_rpane->focus_box.left,
-			   pboot_rpane->focus_box.top,
-			   pboot_rpane->focus_box.right,
-			   pboot_rpane->focus_box.bottom);
 
-	pboot_rpane->focus_box.top += dir;
-	pboot_rpane->focus_box.bottom += dir;
+	if (pboot_rpane->focus_moving &&
+	    !pboot_move_focus(pboot_rpane->window, &pboot_rpane->focus_box,
+			      pboot_rpane->focus_start,
+			      pboot_rpane->focus_target,
+			      now - pboot_rpane->focus_time))
+		pboot_rpane->focus_moving = 0;
 
-	twin_window_damage(pboot_rpane->window,
-			   pboot_rpane->focus_box.left,
-			   pboot_rpane->focus_box.top,
-			   pboot_rpane->focus_box.right,
-			   pboot_rpane->focus_box.bottom);
+	if (pboot_lpane->focus_moving || pboot_rpane->focus_moving)
+		return PBOOT_FRAME_TIME;
 
-	twin_window_queue_paint(pboot_rpane->window);
+	pboot_frame_clock = NULL;
+	return -1;
+}
 
-	return accel[(pos * 10) / dist];
+static void pboot_start_frame_clock(void)
+{
+	if (pboot_frame_clock == NULL)
+		pboot_frame_clock = twin_set_timeout(pboot_frame, 0, NULL);
 }
 
 static void pboot_set_rfocus(int index)
@@ -363,9 +462,11 @@ static void pboot_set_rfocus(int index)
 	pboot_rpane->focus_start = pboot_rpane->focus_box.top;
 	pboot_rpane->focus_target = PBOOT_RIGHT_FOCUS_YOFF +
 		PBOOT_RIGHT_OPTION_STRIDE * index;
+	pboot_rpane->focus_time = twin_now();
+	pboot_rpane->focus_moving = 1;
 	pboot_rpane->focus_curindex = index;
 
-	twin_set_timeout(pboot_rfocus_timeout, 0, NULL);
+	pboot_start_frame_clock();
 }
 
 static void pboot_select_rpane(void)
@@ -460,6 +561,14 @@ static void pboot_choose_option(void)
 	pboot_option_t *opt = &dev->options[pboot_rpane->focus_curindex];
 
 	LOG("Selected device %s\n", opt->title);
+
+	/* don't let a missing kernel or initrd cost a failed boot */
+	if (opt->broken) {
+		pboot_message("can't boot %s: %s", opt->title,
+			      opt->subtitle ? opt->subtitle : "files missing");
+		return;
+	}
+
 	pboot_message("booting %s...", opt->title);
 
 	/* Give user feedback, make sure errors and panics will be seen */
@@ -507,12 +616,26 @@ static twin_bool_t pboot_rpane_event (twin_window_t	    *window,
 }
 
 
-int pboot_add_option(int devindex, const char *title,
-		     const char *subtitle, twin_pixmap_t *badge, void *data)
+static void pboot_set_option_box(pboot_option_t *opt, int index)
+{
+	twin_coord_t	width;
+
+	width = pboot_rpane->window->pixmap->width -
+		(PBOOT_RIGHT_OPTION_LMARGIN + PBOOT_RIGHT_OPTION_RMARGIN);
+
+	opt->box.left = PBOOT_RIGHT_OPTION_LMARGIN;
+	opt->box.right = opt->box.left + width;
+	opt->box.top = PBOOT_RIGHT_OPTION_TMARGIN +
+		index * PBOOT_RIGHT_OPTION_STRIDE;
+	opt->box.bottom = opt->box.top + PBOOT_RIGHT_OPTION_HEIGHT;
+}
+
+int pboot_add_option(int devindex, const char *id, const char *title,
+		     const char *subtitle, struct icon *badge, int broken,
+		     void *data)
 {
 	pboot_device_t	*dev;
 	pboot_option_t	*opt;
-	twin_coord_t	width;
 	int		index;
 
 	if (devindex < 0 || devindex >= pboot_dev_count)
@@ -524,6 +647,9 @@ int pboot_add_option(int devindex, const char *title,
 	index = dev->option_count++;
 	opt = &dev->options[index];
 
+	opt->id = malloc(strlen(id) + 1);
+	strcpy(opt->id, id);
+
 	opt->title = malloc(strlen(title) + 1);
 	strcpy(opt->title, title);
 
@@ -535,54 +661,151 @@ int pboot_add_option(int devindex, const char *title,
 
 	opt->badge = badge;
 	opt->cache = NULL;
+	opt->broken = broken;
 
-	width = pboot_rpane->window->pixmap->width -
-		(PBOOT_RIGHT_OPTION_LMARGIN + PBOOT_RIGHT_OPTION_RMARGIN);
-
-	opt->box.left = PBOOT_RIGHT_OPTION_LMARGIN;
-	opt->box.right = opt->box.left + width;
-	opt->box.top = PBOOT_RIGHT_OPTION_TMARGIN +
-		index * PBOOT_RIGHT_OPTION_STRIDE;
-	opt->box.bottom = opt->box.top + PBOOT_RIGHT_OPTION_HEIGHT;
+	pboot_set_option_box(opt, index);
 
 	opt->data = data;
+
+	if (devindex == pboot_dev_sel) {
+		twin_window_damage(pboot_rpane->window,
+				   opt->box.left, opt->box.top,
+				   opt->box.right, opt->box.bottom);
+		twin_window_queue_paint(pboot_rpane->window);
+	}
+
 	return index;
 }
 
+int pboot_find_option(int devindex, const char *id)
+{
+	pboot_device_t	*dev;
+	int		i;
 
-static void pboot_set_device_select(int sel, int force)
+	if (devindex < 0 || devindex >= pboot_dev_count)
+		return -1;
+	dev = pboot_devices[devindex];
+
+	for (i = 0; i < dev->option_count; i++)
+		if (!strcmp(dev->options[i].id, id))
+			return i;
+
+	return -1;
+}
+
+void *pboot_update_option(int devindex, int index, const char *title,
+			  const char *subtitle, struct icon *badge,
+			  int broken, void *data)
 {
-	LOG("%s: %d -> %d\n", __FUNCTION__, pboot_dev_sel, sel);
-	if (!force && sel == pboot_dev_sel)
-		return;
-	if (sel >= pboot_dev_count)
-		return;
-	pboot_dev_sel = sel;
-	if (force) {
-		pboot_lpane->focus_curindex = sel;
-		if (sel < 0)
-			pboot_lpane->focus_target = 0 - PBOOT_LEFT_FOCUS_HEIGHT;
-		else
-			pboot_lpane->focus_target = PBOOT_LEFT_FOCUS_YOFF +
-				PBOOT_LEFT_ICON_STRIDE * sel;
-		pboot_rpane->focus_box.bottom = pboot_lpane->focus_target;
-		pboot_rpane->focus_box.bottom = pboot_rpane->focus_box.top +
-			PBOOT_RIGHT_FOCUS_HEIGHT;
-		twin_window_damage(pboot_lpane->window,
-				   0, 0,
-				   pboot_lpane->window->pixmap->width,
-				   pboot_lpane->window->pixmap->height);
-		twin_window_queue_paint(pboot_lpane->window);
+	pboot_device_t	*dev;
+	pboot_option_t	*opt;
+	void		*old_data;
+
+	if (devindex < 0 || devindex >= pboot_dev_count)
+		return NULL;
+	dev = pboot_devices[devindex];
+
+	if (index < 0 || index >= dev->option_count)
+		return NULL;
+	opt = &dev->options[index];
+
+	free(opt->title);
+	opt->title = malloc(strlen(title) + 1);
+	strcpy(opt->title, title);
+
+	free(opt->subtitle);
+	if (subtitle) {
+		opt->subtitle = malloc(strlen(subtitle) + 1);
+		strcpy(opt->subtitle, subtitle);
+	} else
+		opt->subtitle = NULL;
+
+	icon_cache_put(opt->badge);
+	opt->badge = badge;
+	opt->broken = broken;
+
+	/* only this option's cache needs to be redrawn */
+	if (opt->cache) {
+		twin_pixmap_destroy(opt->cache);
+		opt->cache = NULL;
 	}
-	pboot_rpane->focus_curindex = -1;
-	pboot_rpane->mouse_target = -1;
-	pboot_rpane->focus_box.top = -2*PBOOT_RIGHT_FOCUS_HEIGHT;
-	pboot_rpane->focus_box.bottom = pboot_rpane->focus_box.top +
-		PBOOT_RIGHT_FOCUS_HEIGHT;
-	twin_window_damage(pboot_rpane->window, 0, 0,
-			   pboot_rpane->window->pixmap->width,
-			   pboot_rpane->window->pixmap->height);
+
+	old_data = opt->data;
+	opt->data = data;
+
+	if (devindex == pboot_dev_sel) {
+		twin_window_damage(pboot_rpane->window,
+				   opt->box.left, opt->box.top,
+				   opt->box.right, opt->box.bottom);
+		twin_window_queue_paint(pboot_rpane->window);
+	}
+
+	return old_data;
+}
+
+void *pboot_remove_option(int devindex, int index)
+{
+	pboot_device_t	*dev;
+	pboot_option_t	*opt;
+	twin_coord_t	left, right, top, bottom;
+	void		*old_data;
+	int		i;
+
+	if (devindex < 0 || devindex >= pboot_dev_count)
+		return NULL;
+	dev = pboot_devices[devindex];
+
+	if (index < 0 || index >= dev->option_count)
+		return NULL;
+	opt = &dev->options[index];
+
+	/* opt is reused by the options that move up, so keep its box */
+	old_data = opt->data;
+	left = opt->box.left;
+	right = opt->box.right;
+	top = opt->box.top;
+	bottom = dev->options[dev->option_count - 1].box.bottom;
+
+	free(opt->id);
+	free(opt->title);
+	free(opt->subtitle);
+	icon_cache_put(opt->badge);
+	if (opt->cache)
+		twin_pixmap_destroy(opt->cache);
+
+	/* the following options move up a slot; their caches don't depend on
+	 * their position, so we can keep them */
+	memmove(dev->options + index, dev->options + index + 1,
+		sizeof(*dev->options) * (dev->option_count - index - 1));
+	dev->option_count--;
+	memset(&dev->options[dev->option_count], 0, sizeof(*dev->options));
+
+	for (i = index; i < dev->option_count; i++)
+		pboot_set_option_box(&dev->options[i], i);
+
+	if (devindex != pboot_dev_sel)
+		return old_data;
+
+	twin_window_damage(pboot_rpane->window, left, top, right, bottom);
 	twin_window_queue_paint(pboot_rpane->window);
+
+	/* keep the focus on the option that it was on, which moved up */
+	if (index < pboot_rpane->focus_curindex) {
+		pboot_set_rfocus(pboot_rpane->focus_curindex - 1);
+		return old_data;
+	}
+
+	if (pboot_rpane->focus_curindex < dev->option_count)
+		return old_data;
+
+	if (dev->option_count) {
+		pboot_set_rfocus(dev->option_count - 1);
+	} else {
+		pboot_rpane->focus_curindex = -1;
+		pboot_select_lpane();
+	}
+
+	return old_data;
 }
 
 static void pboot_create_rpane(void)
@@ -615,42 +838,6 @@ static void pboot_create_rpane(void)
 }
 
 
-static twin_time_t pboot_lfocus_timeout (twin_time_t now, void *closure)
-{
-	int dir = 1, dist, pos;
-	const int accel[11] = { 7, 4, 2, 1, 1, 1, 1, 1, 2, 2, 3 };
-
-	dist = abs(pboot_lpane->focus_target - pboot_lpane->focus_start);
-	dir = dist > 2 ? 2 : dist;
-	pos = pboot_lpane->focus_target - (int)pboot_lpane->focus_box.top;
-	if (pos == 0) {
-		pboot_set_device_select(pboot_lpane->focus_curindex, 0);
-		return -1;
-	}
-	if (pos < 0) {
-		dir = -1;
-		pos = -pos;
-	}
-	twin_window_damage(pboot_lpane->window,
-			   pboot_lpane->focus_box.left,
-			   pboot_lpane->focus_box.top,
-			   pboot_lpane->focus_box.right,
-			   pboot_lpane->focus_box.bottom);
-
-	pboot_lpane->focus_box.top += dir;
-	pboot_lpane->focus_box.bottom += dir;
-
-	twin_window_damage(pboot_lpane->window,
-			   pboot_lpane->focus_box.left,
-			   pboot_lpane->focus_box.top,
-			   pboot_lpane->focus_box.right,
-			   pboot_lpane->focus_box.bottom);
-
-	twin_window_queue_paint(pboot_lpane->window);
-
-	return accel[(pos * 10) / dist];
-}
-
 static void pboot_set_lfocus(int index)
 {
 	if (index >= pboot_dev_count)
@@ -664,9 +851,11 @@ static void pboot_set_lfocus(int index)
 		pboot_lpane->focus_target = PBOOT_LEFT_FOCUS_YOFF +
 			PBOOT_LEFT_ICON_STRIDE * index;
 
+	pboot_lpane->focus_time = twin_now();
+	pboot_lpane->focus_moving = 1;
 	pboot_lpane->focus_curindex = index;
 
-	twin_set_timeout(pboot_lfocus_timeout, 0, NULL);
+	pboot_start_frame_clock();
 }
 
 static void pboot_lpane_mousetrack(twin_coord_t x, twin_coord_t y)
@@ -860,7 +1049,9 @@ static void pboot_lpane_draw(twin_window_t *window)
 			continue;
 
 		src.source_kind = TWIN_PIXMAP;
-		src.u.pixmap = dev->badge;
+		src.u.pixmap = icon_cache_pixmap(dev->badge);
+		if (!src.u.pixmap)
+			continue;
 
 		twin_composite(px, dev->box.left, dev->box.top,
 			       &src, 0, 0, NULL, 0, 0, TWIN_OVER,
@@ -968,8 +1159,17 @@ static void pboot_create_spane(void)
 	twin_window_queue_paint(pboot_spane->window);
 }
 
+static void pboot_set_device_box(pboot_device_t *dev, int index)
+{
+	dev->box.left = PBOOT_LEFT_ICON_XOFF;
+	dev->box.right = dev->box.left + PBOOT_LEFT_ICON_WIDTH;
+	dev->box.top = PBOOT_LEFT_ICON_YOFF +
+		PBOOT_LEFT_ICON_STRIDE * index;
+	dev->box.bottom = dev->box.top + PBOOT_LEFT_ICON_HEIGHT;
+}
+
 int pboot_add_device(const char *dev_id, const char *name,
-		twin_pixmap_t *pixmap)
+		struct icon *badge)
 {
 	int		index;
 	pboot_device_t	*dev;
@@ -983,12 +1183,8 @@ int pboot_add_device(const char *dev_id, const char *name,
 	memset(dev, 0, sizeof(*dev));
 	dev->id = malloc(strlen(dev_id) + 1);
 	strcpy(dev->id, dev_id);
-	dev->badge = pixmap;
-	dev->box.left = PBOOT_LEFT_ICON_XOFF;
-	dev->box.right = dev->box.left + PBOOT_LEFT_ICON_WIDTH;
-	dev->box.top = PBOOT_LEFT_ICON_YOFF +
-		PBOOT_LEFT_ICON_STRIDE * index;
-	dev->box.bottom = dev->box.top + PBOOT_LEFT_ICON_HEIGHT;
+	dev->badge = badge;
+	pboot_set_device_box(dev, index);
 
 	pboot_devices[index] = dev;
 
@@ -1000,26 +1196,63 @@ int pboot_add_device(const char *dev_id, const char *name,
 	return index;
 }
 
+int pboot_find_device(const char *dev_id)
+{
+	int		i;
+
+	for (i = 0; i < pboot_dev_count; i++)
+		if (!strcmp(pboot_devices[i]->id, dev_id))
+			return i;
+
+	return -1;
+}
+
+int pboot_device_count(void)
+{
+	return pboot_dev_count;
+}
+
+const char *pboot_device_id(int devindex)
+{
+	if (devindex < 0 || devindex >= pboot_dev_count)
+		return NULL;
+	return pboot_devices[devindex]->id;
+}
+
+int pboot_option_count(int devindex)
+{
+	if (devindex < 0 || devindex >= pboot_dev_count)
+		return 0;
+	return pboot_devices[devindex]->option_count;
+}
+
+void *pboot_option_data(int devindex, int index)
+{
+	if (index < 0 || index >= pboot_option_count(devindex))
+		return NULL;
+	return pboot_devices[devindex]->options[index].data;
+}
+
 int pboot_remove_device(const char *dev_id)
 {
-	pboot_device_t	*dev = NULL;
-	int		i, newsel = pboot_dev_sel;
+	pboot_device_t	*dev;
+	int		i, j, newsel = pboot_dev_sel;
 
 	/* find the matching device */
-	for (i = 0; i < pboot_dev_count; i++) {
-		if (!strcmp(pboot_devices[i]->id, dev_id)) {
-			dev = pboot_devices[i];
-			break;
-		}
-	}
-
-	if (!dev)
+	i = pboot_find_device(dev_id);
+	if (i == -1)
 		return TWIN_FALSE;
+	dev = pboot_devices[i];
 
 	memmove(pboot_devices + i, pboot_devices + i + 1,
-			sizeof(*pboot_devices) * (pboot_dev_count + i - 1));
+			sizeof(*pboot_devices) * (pboot_dev_count - i - 1));
 	pboot_devices[--pboot_dev_count] = NULL;
 
+	/* the following devices move up a slot; the whole left pane is
+	 * redrawn below */
+	for (j = i; j < pboot_dev_count; j++)
+		pboot_set_device_box(pboot_devices[j], j);
+
 	/* select the newly-focussed device */
 	if (pboot_dev_sel > i)
 		newsel = pboot_dev_sel - 1;
@@ -1027,15 +1260,82 @@ int pboot_remove_device(const char *dev_id)
 			newsel = pboot_dev_count - 1;
 	pboot_set_device_select(newsel, 1);
 
-	/* todo: free device & options */
+	/* the badges are shared, so they go back to the icon cache. Any
+	 * option data belongs to the caller, which should have taken it
+	 * back with pboot_remove_option() first */
+	icon_cache_put(dev->badge);
+	for (j = 0; j < dev->option_count; j++) {
+		pboot_option_t *opt = &dev->options[j];
+
+		free(opt->id);
+		free(opt->title);
+		free(opt->subtitle);
+		icon_cache_put(opt->badge);
+		if (opt->cache)
+			twin_pixmap_destroy(opt->cache);
+	}
+
+	free(dev->id);
+	free(dev);
 
 	return TWIN_TRUE;
 }
 
+void pboot_icon_ready(struct icon *icon)
+{
+	pboot_device_t	*dev;
+	pboot_option_t	*opt;
+	int		i, j;
+
+	/* the placeholder was drawn in its place, so only the boxes of the
+	 * devices and options that use it need to be redrawn */
+	for (i = 0; i < pboot_dev_count; i++) {
+		dev = pboot_devices[i];
+
+		if (dev->badge == icon) {
+			twin_window_damage(pboot_lpane->window,
+					   dev->box.left, dev->box.top,
+					   dev->box.right, dev->box.bottom);
+			twin_window_queue_paint(pboot_lpane->window);
+		}
+
+		for (j = 0; j < dev->option_count; j++) {
+			opt = &dev->options[j];
+			if (opt->badge != icon)
+				continue;
+
+			if (opt->cache) {
+				twin_pixmap_destroy(opt->cache);
+				opt->cache = NULL;
+			}
+
+			if (i != pboot_dev_sel)
+				continue;
+
+			twin_window_damage(pboot_rpane->window,
+					   opt->box.left, opt->box.top,
+					   opt->box.right, opt->box.bottom);
+			twin_window_queue_paint(pboot_rpane->window);
+		}
+	}
+}
+
 static void pboot_make_background(void)
 {
 	twin_pixmap_t	*filepic, *scaledpic;
 	const char	*background_path;
+	char		name[64];
+
+	/* Use the bundled background for this screen size, if there is one:
+	 * it's already decoded and scaled */
+	snprintf(name, sizeof(name), "background.jpg@%dx%d",
+		 pboot_screen->width, pboot_screen->height);
+	scaledpic = artwork_get(name, NULL, NULL);
+	if (scaledpic != NULL) {
+		LOG("using bundled background %s\n", name);
+		twin_screen_set_background(pboot_screen, scaledpic);
+		return;
+	}
 
 	/* Set background pixmap */
 	LOG("loading background...");
@@ -1104,16 +1404,17 @@ static void sigint(int sig)
 
 static void usage(const char *progname)
 {
-	fprintf(stderr, "Usage: %s [-u] [-h]\n", progname);
+	fprintf(stderr, "Usage: %s [-u] [-s] [-h]\n", progname);
 }
 
 int main(int argc, char **argv)
 {
 	int c;
 	int udev_trigger = 0;
+	int use_shm = 0;
 
 	for (;;) {
-		c = getopt(argc, argv, "u::h");
+		c = getopt(argc, argv, "u::sh");
 		if (c == -1)
 			break;
 
@@ -1121,6 +1422,9 @@ int main(int argc, char **argv)
 		case 'u':
 			udev_trigger = 1;
 			break;
+		case 's':
+			use_shm = 1;
+			break;
 		case 'h':
 			usage(argv[0]);
 			return EXIT_SUCCESS;
@@ -1134,6 +1438,9 @@ int main(int argc, char **argv)
 	atexit(exitfunc);
 	signal(SIGINT, sigint);
 
+	/* Map the pre-decoded artwork */
+	artwork_load();
+
 #ifdef _USE_X11
 	pboot_x11 = twin_x11_create(XOpenDisplay(0), 1024, 768);
 	if (pboot_x11 == NULL) {
@@ -1154,9 +1461,12 @@ int main(int argc, char **argv)
 
 	if (pboot_fbdev != NULL) {
 		char *cursor_path = artwork_pathname("cursor.gz");
-		pboot_cursor = twin_load_X_cursor(cursor_path, 2,
-						  &pboot_cursor_hx,
-						  &pboot_cursor_hy);
+		pboot_cursor = artwork_get("cursor.gz", &pboot_cursor_hx,
+					   &pboot_cursor_hy);
+		if (pboot_cursor == NULL)
+			pboot_cursor = twin_load_X_cursor(cursor_path, 2,
+							  &pboot_cursor_hx,
+							  &pboot_cursor_hy);
 		if (pboot_cursor == NULL)
 			pboot_cursor =
 				twin_get_default_cursor(&pboot_cursor_hx,
@@ -1172,7 +1482,7 @@ int main(int argc, char **argv)
 	pboot_create_rpane();
 	pboot_create_spane();
 
-	if (!pboot_start_device_discovery(udev_trigger)) {
+	if (!pboot_start_device_discovery(udev_trigger, use_shm)) {
 		LOG("Couldn't start device discovery!\n");
 		return 1;
 	}
@@ -2,17 +2,37 @@
 #include <libtwin/twin.h>
 #include <stdarg.h>
 
+struct icon;
+
 #define LOG(fmt...)	printf(fmt)
 
 #define PBOOT_MAX_DEV		16
 #define PBOOT_MAX_OPTION	16
 
+/* the device and option badges are references from the icon cache, which
+ * these take over, and drop when the badge is replaced or removed */
 int pboot_add_device(const char *dev_id, const char *name,
-		twin_pixmap_t *pixmap);
-int pboot_add_option(int devindex, const char *title,
-		     const char *subtitle, twin_pixmap_t *badge, void *data);
+		struct icon *badge);
+int pboot_add_option(int devindex, const char *id, const char *title,
+		     const char *subtitle, struct icon *badge, int broken,
+		     void *data);
+int pboot_find_device(const char *dev_id);
+int pboot_find_option(int devindex, const char *id);
+void *pboot_update_option(int devindex, int index, const char *title,
+			  const char *subtitle, struct icon *badge,
+			  int broken, void *data);
+void *pboot_remove_option(int devindex, int index);
 int pboot_remove_device(const char *dev_id);
 
-int pboot_start_device_discovery(int udev_trigger);
+/* to walk the devices and options, by index */
+int pboot_device_count(void);
+const char *pboot_device_id(int devindex);
+int pboot_option_count(int devindex);
+void *pboot_option_data(int devindex, int index);
+
+/* redraw whatever uses @icon, which has just been loaded */
+void pboot_icon_ready(struct icon *icon);
+
+int pboot_start_device_discovery(int udev_trigger, int use_shm);
 void pboot_exec_option(void *data);
 void pboot_message(const char *fmt, ...);